@@ -0,0 +1,342 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas-allocator.h"
+
+/* Shelf heights are rounded up to this, so that rectangles of nearly the
+ * same height share shelves. */
+#define SHELF_ALIGN 8
+
+/* A rectangle only goes on a shelf up to this many times its own
+ * (aligned) height, so that small ones do not fill tall shelves. */
+#define SHELF_MAX_WASTE 2
+
+void
+atlas_allocator_init(struct atlas_allocator *a, int width, int height)
+{
+	memset(a, 0, sizeof *a);
+	a->width = width;
+	a->height = height;
+}
+
+void
+atlas_allocator_fini(struct atlas_allocator *a)
+{
+	int i;
+
+	for (i = 0; i < a->num_shelves; i++)
+		free(a->shelves[i].free);
+	free(a->shelves);
+	memset(a, 0, sizeof *a);
+}
+
+static int
+shelf_reserve_spans(struct atlas_shelf *shelf, int n)
+{
+	struct atlas_span *spans;
+	int size;
+
+	if (n <= shelf->free_size)
+		return 0;
+
+	size = shelf->free_size ? shelf->free_size * 2 : 4;
+	while (size < n)
+		size *= 2;
+
+	spans = realloc(shelf->free, size * sizeof *spans);
+	if (spans == NULL)
+		return -1;
+
+	shelf->free = spans;
+	shelf->free_size = size;
+
+	return 0;
+}
+
+/* Insert an empty shelf at the given index. */
+static struct atlas_shelf *
+insert_shelf(struct atlas_allocator *a, int index, int y, int height)
+{
+	struct atlas_shelf *shelves, *shelf;
+	int size;
+
+	if (a->num_shelves == a->shelves_size) {
+		size = a->shelves_size ? a->shelves_size * 2 : 8;
+		shelves = realloc(a->shelves, size * sizeof *shelves);
+		if (shelves == NULL)
+			return NULL;
+		a->shelves = shelves;
+		a->shelves_size = size;
+	}
+
+	memmove(&a->shelves[index + 1], &a->shelves[index],
+		(a->num_shelves - index) * sizeof *a->shelves);
+	a->num_shelves++;
+
+	shelf = &a->shelves[index];
+	memset(shelf, 0, sizeof *shelf);
+	shelf->y = y;
+	shelf->height = height;
+
+	if (shelf_reserve_spans(shelf, 1) < 0) {
+		memmove(&a->shelves[index], &a->shelves[index + 1],
+			(a->num_shelves - index - 1) * sizeof *a->shelves);
+		a->num_shelves--;
+		return NULL;
+	}
+
+	shelf->free[0].x = 0;
+	shelf->free[0].width = a->width;
+	shelf->num_free = 1;
+
+	return shelf;
+}
+
+static void
+remove_shelf(struct atlas_allocator *a, int index)
+{
+	free(a->shelves[index].free);
+	memmove(&a->shelves[index], &a->shelves[index + 1],
+		(a->num_shelves - index - 1) * sizeof *a->shelves);
+	a->num_shelves--;
+}
+
+static int
+shelf_find_span(struct atlas_shelf *shelf, int width)
+{
+	int i;
+
+	for (i = 0; i < shelf->num_free; i++)
+		if (shelf->free[i].width >= width)
+			return i;
+
+	return -1;
+}
+
+static void
+shelf_take(struct atlas_shelf *shelf, int span, int width,
+	   struct atlas_rect *rect, int height)
+{
+	struct atlas_span *s = &shelf->free[span];
+
+	rect->x = s->x;
+	rect->y = shelf->y;
+	rect->width = width;
+	rect->height = height;
+
+	s->x += width;
+	s->width -= width;
+	if (s->width == 0) {
+		memmove(s, s + 1,
+			(shelf->num_free - span - 1) * sizeof *s);
+		shelf->num_free--;
+	}
+
+	shelf->count++;
+}
+
+/** Find room for a rectangle
+ *
+ * \param a The allocator.
+ * \param width Width of the rectangle.
+ * \param height Height of the rectangle.
+ * \param rect Set to where the rectangle goes.
+ * \return 0 on success, -1 if there is no room left or on allocation
+ * failure.
+ */
+int
+atlas_allocator_alloc(struct atlas_allocator *a, int width, int height,
+		      struct atlas_rect *rect)
+{
+	struct atlas_shelf *shelf;
+	int aligned, i, span;
+	int best = -1, best_span = -1, best_empty = -1;
+
+	if (width <= 0 || height <= 0 ||
+	    width > a->width || height > a->height)
+		return -1;
+
+	aligned = (height + SHELF_ALIGN - 1) / SHELF_ALIGN * SHELF_ALIGN;
+	if (aligned > a->height)
+		aligned = height;
+
+	/* the lowest used shelf that fits, or else the lowest empty one */
+	for (i = 0; i < a->num_shelves; i++) {
+		shelf = &a->shelves[i];
+
+		if (shelf->height < aligned)
+			continue;
+
+		if (shelf->count == 0) {
+			if (best_empty < 0 ||
+			    shelf->height < a->shelves[best_empty].height)
+				best_empty = i;
+			continue;
+		}
+
+		if (shelf->height > aligned * SHELF_MAX_WASTE)
+			continue;
+		if (best >= 0 && shelf->height >= a->shelves[best].height)
+			continue;
+
+		span = shelf_find_span(shelf, width);
+		if (span < 0)
+			continue;
+
+		/* Freeing may split the spans once more per rectangle;
+		 * make room now so that freeing cannot fail. */
+		if (shelf_reserve_spans(shelf, shelf->count + 2) < 0)
+			continue;
+
+		best = i;
+		best_span = span;
+	}
+
+	if (best >= 0) {
+		shelf_take(&a->shelves[best], best_span, width, rect, height);
+		a->count++;
+		return 0;
+	}
+
+	if (best_empty >= 0) {
+		shelf = &a->shelves[best_empty];
+
+		/* cut the empty shelf down, keeping the rest as another */
+		if (shelf->height > aligned) {
+			if (insert_shelf(a, best_empty + 1,
+					 shelf->y + aligned,
+					 shelf->height - aligned) == NULL)
+				return -1;
+			shelf = &a->shelves[best_empty];
+			shelf->height = aligned;
+		}
+	} else {
+		if (a->top + aligned > a->height)
+			return -1;
+
+		shelf = insert_shelf(a, a->num_shelves, a->top, aligned);
+		if (shelf == NULL)
+			return -1;
+		a->top += aligned;
+	}
+
+	if (shelf_reserve_spans(shelf, 2) < 0)
+		return -1;
+
+	shelf_take(shelf, 0, width, rect, height);
+	a->count++;
+
+	return 0;
+}
+
+/* Merge an empty shelf into empty neighbours, and give the space of the
+ * last one back to the area below the shelves. */
+static void
+shelf_release(struct atlas_allocator *a, int index)
+{
+	struct atlas_shelf *shelf;
+
+	if (index + 1 < a->num_shelves && a->shelves[index + 1].count == 0) {
+		a->shelves[index].height += a->shelves[index + 1].height;
+		remove_shelf(a, index + 1);
+	}
+
+	if (index > 0 && a->shelves[index - 1].count == 0) {
+		a->shelves[index - 1].height += a->shelves[index].height;
+		remove_shelf(a, index);
+		index--;
+	}
+
+	if (index == a->num_shelves - 1) {
+		shelf = &a->shelves[index];
+		a->top = shelf->y;
+		remove_shelf(a, index);
+	}
+}
+
+void
+atlas_allocator_free(struct atlas_allocator *a,
+		     const struct atlas_rect *rect)
+{
+	struct atlas_shelf *shelf = NULL;
+	struct atlas_span *s;
+	int i, lo, hi;
+
+	/* binary search for the shelf */
+	lo = 0;
+	hi = a->num_shelves - 1;
+	while (lo <= hi) {
+		i = (lo + hi) / 2;
+		if (a->shelves[i].y == rect->y) {
+			shelf = &a->shelves[i];
+			break;
+		}
+		if (a->shelves[i].y < rect->y)
+			lo = i + 1;
+		else
+			hi = i - 1;
+	}
+
+	assert(shelf && shelf->count > 0);
+	if (shelf == NULL)
+		return;
+
+	for (i = 0; i < shelf->num_free; i++)
+		if (shelf->free[i].x > rect->x)
+			break;
+
+	/* coalesce with the spans before and after */
+	if (i > 0 && shelf->free[i - 1].x + shelf->free[i - 1].width ==
+		     rect->x) {
+		s = &shelf->free[i - 1];
+		s->width += rect->width;
+		if (i < shelf->num_free && s->x + s->width ==
+					   shelf->free[i].x) {
+			s->width += shelf->free[i].width;
+			memmove(&shelf->free[i], &shelf->free[i + 1],
+				(shelf->num_free - i - 1) * sizeof *s);
+			shelf->num_free--;
+		}
+	} else if (i < shelf->num_free &&
+		   rect->x + rect->width == shelf->free[i].x) {
+		shelf->free[i].x = rect->x;
+		shelf->free[i].width += rect->width;
+	} else {
+		/* room was reserved by atlas_allocator_alloc() */
+		assert(shelf->num_free < shelf->free_size);
+		memmove(&shelf->free[i + 1], &shelf->free[i],
+			(shelf->num_free - i) * sizeof *s);
+		shelf->free[i].x = rect->x;
+		shelf->free[i].width = rect->width;
+		shelf->num_free++;
+	}
+
+	shelf->count--;
+	a->count--;
+
+	if (shelf->count == 0)
+		shelf_release(a, shelf - a->shelves);
+}
@@ -0,0 +1,78 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_ATLAS_ALLOCATOR_H
+#define _WESTON_ATLAS_ALLOCATOR_H
+
+/*
+ * Packs rectangles into a fixed size area, like small surfaces into a
+ * shared texture.
+ *
+ * The area is cut into horizontal shelves from the top down. A shelf is
+ * as tall as the first rectangle put on it, rounded up, and takes
+ * rectangles of up to that height side by side. Freed space in a shelf
+ * is reused by later rectangles of fitting height; shelves that become
+ * empty are merged with empty neighbours and can be cut again to another
+ * height. This suits many small rectangles that rarely change size.
+ */
+
+struct atlas_rect {
+	int x, y;
+	int width, height;
+};
+
+struct atlas_span {
+	int x, width;
+};
+
+struct atlas_shelf {
+	int y, height;
+	int count;			/* rectangles on the shelf */
+	struct atlas_span *free;	/* sorted by x, not touching */
+	int num_free;
+	int free_size;
+};
+
+struct atlas_allocator {
+	int width, height;
+	int top;			/* below the last shelf */
+	struct atlas_shelf *shelves;	/* sorted by y, no gaps */
+	int num_shelves;
+	int shelves_size;
+	int count;			/* rectangles allocated */
+};
+
+void
+atlas_allocator_init(struct atlas_allocator *a, int width, int height);
+
+void
+atlas_allocator_fini(struct atlas_allocator *a);
+
+int
+atlas_allocator_alloc(struct atlas_allocator *a, int width, int height,
+		      struct atlas_rect *rect);
+
+void
+atlas_allocator_free(struct atlas_allocator *a,
+		     const struct atlas_rect *rect);
+
+#endif
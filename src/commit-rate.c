@@ -0,0 +1,77 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <wayland-util.h>
+
+#include "commit-rate.h"
+
+/* Fastest rate a single commit interval can account for, so that two
+ * commits in quick succession do not look like a flood */
+#define MAX_RATE 1000.0f
+
+/* Weight of the newest interval in the smoothed rate */
+#define RATE_SMOOTHING 0.25f
+
+static double
+timespec_sub_sec(const struct timespec *a, const struct timespec *b)
+{
+	return (double)(a->tv_sec - b->tv_sec) +
+	       (a->tv_nsec - b->tv_nsec) * 1e-9;
+}
+
+WL_EXPORT float
+commit_rate_update(float rate, const struct timespec *last,
+		   const struct timespec *now)
+{
+	double dt;
+	float instant;
+
+	if (last->tv_sec == 0 && last->tv_nsec == 0)
+		return rate;
+
+	dt = timespec_sub_sec(now, last);
+	if (dt <= 0)
+		return rate;
+
+	instant = dt < 1.0 / MAX_RATE ? MAX_RATE : 1.0 / dt;
+
+	return rate + RATE_SMOOTHING * (instant - rate);
+}
+
+WL_EXPORT float
+commit_rate_current(float rate, const struct timespec *last,
+		    const struct timespec *now)
+{
+	double dt;
+
+	if (last->tv_sec == 0 && last->tv_nsec == 0)
+		return 0.0f;
+
+	dt = timespec_sub_sec(now, last);
+	if (dt > 0 && rate > 1.0 / dt)
+		return 1.0 / dt;
+
+	return rate;
+}
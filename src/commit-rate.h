@@ -0,0 +1,47 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WESTON_COMMIT_RATE_H
+#define _WESTON_COMMIT_RATE_H
+
+#include <time.h>
+
+/*
+ * How often a surface commits a new buffer, in commits per second,
+ * smoothed over the last few commits. Backends use it to pick the
+ * views that are worth a plane of their own.
+ */
+
+/* Updates the smoothed commit rate of a surface that committed a
+ * buffer at now, having last done so at last. */
+float
+commit_rate_update(float rate, const struct timespec *last,
+		   const struct timespec *now);
+
+/* The commit rate as of now: a surface that stopped committing cannot
+ * be updating faster than once since its last commit. */
+float
+commit_rate_current(float rate, const struct timespec *last,
+		    const struct timespec *now);
+
+#endif
@@ -28,6 +28,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <ctype.h>
 #include <string.h>
 #include <fcntl.h>
@@ -36,8 +37,10 @@
 #include <linux/vt.h>
 #include <assert.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <dlfcn.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -54,6 +57,8 @@
 #include "libinput-seat.h"
 #include "launcher-util.h"
 #include "vaapi-recorder.h"
+#include "commit-rate.h"
+#include "plane-planner.h"
 #include "presentation_timing-server-protocol.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
@@ -83,26 +88,41 @@ enum output_config {
 	OUTPUT_CONFIG_MODELINE
 };
 
+/*
+ * A KMS device. The backend renders with its primary device, in
+ * drm_backend::drm. Outputs on secondary devices get a copy of what was
+ * rendered for them, or are rendered right into their dumb buffers with
+ * the pixman renderer.
+ */
+struct drm_device {
+	struct drm_backend *backend;
+	struct wl_list link;	/* drm_backend::secondary_devices */
+
+	int id;
+	int fd;
+	char *filename;
+	struct udev_device *udev_device;
+
+	uint32_t crtc_allocator;
+	uint32_t connector_allocator;
+
+	struct wl_event_source *source;
+};
+
 struct drm_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
 
 	struct udev *udev;
-	struct wl_event_source *drm_source;
 
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_drm_source;
 
-	struct {
-		int id;
-		int fd;
-		char *filename;
-	} drm;
+	struct drm_device drm;
+	struct wl_list secondary_devices;
 	struct gbm_device *gbm;
 	uint32_t *crtcs;
 	int num_crtcs;
-	uint32_t crtc_allocator;
-	uint32_t connector_allocator;
 	struct wl_listener session_listener;
 	uint32_t format;
 
@@ -121,6 +141,8 @@ struct drm_backend {
 	int cursors_are_broken;
 
 	int use_pixman;
+	int render_threads;
+	int num_dumb;
 
 	uint32_t prev_state;
 
@@ -128,11 +150,19 @@ struct drm_backend {
 
 	uint32_t cursor_width;
 	uint32_t cursor_height;
+
+	/* drm_cursor_image::link, most recently used first */
+	struct wl_list cursor_cache;
+	int cursor_cache_size;
+	uint32_t *cursor_buf;
+
+	int atomic_modeset;
 };
 
 struct drm_mode {
 	struct weston_mode base;
 	drmModeModeInfo mode_info;
+	uint32_t blob_id;
 };
 
 struct drm_output;
@@ -158,9 +188,13 @@ struct drm_edid {
 	char serial_number[13];
 };
 
+/* Outputs rendered into dumb buffers can use up to this many */
+#define DRM_OUTPUT_MAX_DUMB 4
+
 struct drm_output {
 	struct weston_output   base;
 
+	struct drm_device *dev;
 	uint32_t crtc_id;
 	int pipe;
 	uint32_t connector_id;
@@ -174,26 +208,82 @@ struct drm_output {
 	int destroy_pending;
 
 	struct gbm_surface *surface;
-	struct gbm_bo *cursor_bo[2];
 	struct weston_plane cursor_plane;
 	struct weston_plane fb_plane;
 	struct weston_view *cursor_view;
-	int current_cursor;
+	struct drm_cursor_image *cursor_image;
+	/* Still shown until the commit that replaced it completes */
+	struct drm_cursor_image *prev_cursor_image;
+	int cursor_image_pending;
 	struct drm_fb *current, *next;
 	struct backlight *backlight;
 
-	struct drm_fb *dumb[2];
-	pixman_image_t *image[2];
+	/* The dumb buffers are shown in turn. Each one accumulates the
+	 * damage of the frames drawn since it was last drawn to, in global
+	 * coordinates, so only that has to be redrawn into it. */
+	struct drm_fb *dumb[DRM_OUTPUT_MAX_DUMB];
+	pixman_image_t *image[DRM_OUTPUT_MAX_DUMB];
+	pixman_region32_t dumb_damage[DRM_OUTPUT_MAX_DUMB];
+	int num_dumb;
 	int current_image;
-	pixman_region32_t previous_damage;
+
+	/* What was written into the dumb buffers */
+	struct {
+		uint64_t bytes_copied;		/* in the last frame */
+		uint64_t total_bytes_copied;
+		uint32_t frames;
+	} copy_stats;
+
+	/* Used by outputs on secondary devices with the GL renderer */
+	uint32_t *copy_buf;
+	pixman_region32_t copy_damage;
+	struct wl_listener copy_frame_listener;
+
+	/* With pixman, each output renders on a thread of its own. The
+	 * repaint is recorded on the main thread, and the page flip is
+	 * queued from the main loop once the thread is done. */
+	pthread_t render_thread;
+	pthread_mutex_t render_lock;
+	pthread_cond_t render_cond;
+	int render_thread_running;
+	struct pixman_renderer_job *render_queued; /* taken by the thread */
+	struct pixman_renderer_job *render_job;	   /* until finished */
+	int render_fd;
+	struct wl_event_source *render_source;
+	int render_wake_failed;	/* logged by the main thread */
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+
+	struct plane_planner_view *plan;
+	int plan_size;
+
+	/* Used with atomic modesetting */
+	struct drm_sprite *primary_sprite, *cursor_sprite;
+	uint32_t crtc_prop_mode_id, crtc_prop_active;
+	uint32_t connector_prop_crtc_id;
+};
+
+/* Values of the KMS plane "type" property */
+enum drm_sprite_type {
+	DRM_SPRITE_OVERLAY = 0,
+	DRM_SPRITE_PRIMARY = 1,
+	DRM_SPRITE_CURSOR = 2,
+};
+
+struct drm_plane_props {
+	uint32_t fb_id, crtc_id;
+	uint32_t src_x, src_y, src_w, src_h;
+	uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
 };
 
 /*
  * An output has a primary display plane plus zero or more sprites for
  * blending display contents.
+ *
+ * With atomic modesetting, the primary and cursor planes of each CRTC
+ * show up here as well. They are claimed by their output at creation,
+ * and only the overlay planes are used as sprites.
  */
 struct drm_sprite {
 	struct wl_list link;
@@ -204,6 +294,9 @@ struct drm_sprite {
 	struct drm_output *output;
 	struct drm_backend *backend;
 
+	enum drm_sprite_type type;
+	struct drm_plane_props props;
+
 	uint32_t possible_crtcs;
 	uint32_t plane_id;
 	uint32_t count_formats;
@@ -216,11 +309,30 @@ struct drm_sprite {
 	uint32_t formats[];
 };
 
+/*
+ * A cursor image uploaded to a cursor bo. Images are cached by their
+ * content, so that animated cursors cycle through bos that are already
+ * uploaded, and outputs showing the same image share its bo.
+ */
+struct drm_cursor_image {
+	struct wl_list link;
+	struct gbm_bo *bo;
+	uint32_t hash;
+	int32_t width, height;	/* 0x0 if the bo holds no valid image */
+	uint32_t *pixels;	/* to tell hash collisions apart */
+	int outputs;		/* number of outputs showing it */
+};
+
+/* Enough for the frames of the usual animated cursors */
+#define DRM_CURSOR_CACHE_SIZE 16
+
 struct drm_parameters {
 	int connector;
 	int tty;
 	int use_pixman;
+	int dumb_buffers;
 	const char *seat_id;
+	const char *additional_devices;
 };
 
 static struct gl_renderer_interface *gl_renderer;
@@ -229,6 +341,13 @@ static const char default_seat[] = "seat0";
 
 static void
 drm_output_set_cursor(struct drm_output *output);
+static struct drm_cursor_image *
+drm_output_get_cursor_image(struct drm_output *output, struct weston_view *ev);
+static void
+drm_output_set_cursor_image(struct drm_output *output,
+			    struct drm_cursor_image *image);
+static void
+drm_output_release_cursor_image(struct drm_output *output, int flipped);
 
 static int
 drm_sprite_crtc_supported(struct drm_output *output, uint32_t supported)
@@ -263,7 +382,7 @@ drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
 }
 
 static struct drm_fb *
-drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
+drm_fb_create_dumb(struct drm_device *dev, unsigned width, unsigned height)
 {
 	struct drm_fb *fb;
 	int ret;
@@ -281,16 +400,16 @@ drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
 	create_arg.width = width;
 	create_arg.height = height;
 
-	ret = drmIoctl(b->drm.fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
+	ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
 	if (ret)
 		goto err_fb;
 
 	fb->handle = create_arg.handle;
 	fb->stride = create_arg.pitch;
 	fb->size = create_arg.size;
-	fb->fd = b->drm.fd;
+	fb->fd = dev->fd;
 
-	ret = drmModeAddFB(b->drm.fd, width, height, 24, 32,
+	ret = drmModeAddFB(dev->fd, width, height, 24, 32,
 			   fb->stride, fb->handle, &fb->fb_id);
 	if (ret)
 		goto err_bo;
@@ -302,18 +421,18 @@ drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
 		goto err_add_fb;
 
 	fb->map = mmap(0, fb->size, PROT_WRITE,
-		       MAP_SHARED, b->drm.fd, map_arg.offset);
+		       MAP_SHARED, dev->fd, map_arg.offset);
 	if (fb->map == MAP_FAILED)
 		goto err_add_fb;
 
 	return fb;
 
 err_add_fb:
-	drmModeRmFB(b->drm.fd, fb->fb_id);
+	drmModeRmFB(dev->fd, fb->fb_id);
 err_bo:
 	memset(&destroy_arg, 0, sizeof(destroy_arg));
 	destroy_arg.handle = create_arg.handle;
-	drmIoctl(b->drm.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
+	drmIoctl(dev->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
 err_fb:
 	free(fb);
 	return NULL;
@@ -418,14 +537,25 @@ drm_fb_set_buffer(struct drm_fb *fb, struct weston_buffer *buffer)
 	weston_buffer_reference(&fb->buffer_ref, buffer);
 }
 
+static int
+drm_output_is_dumb(struct drm_output *output, struct drm_fb *fb)
+{
+	int i;
+
+	for (i = 0; i < output->num_dumb; i++)
+		if (fb == output->dumb[i])
+			return 1;
+
+	return 0;
+}
+
 static void
 drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
 {
 	if (!fb)
 		return;
 
-	if (fb->map &&
-            (fb != output->dumb[0] && fb != output->dumb[1])) {
+	if (fb->map && !drm_output_is_dumb(output, fb)) {
 		drm_fb_destroy_dumb(fb);
 	} else if (fb->bo) {
 		if (fb->is_client_buffer)
@@ -436,6 +566,237 @@ drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
 	}
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static int
+drm_sprite_add_atomic(drmModeAtomicReq *req, struct drm_sprite *s,
+		      uint32_t crtc_id, struct drm_fb *fb)
+{
+	const struct drm_plane_props *p = &s->props;
+	int ret = 0;
+
+	if (fb == NULL) {
+		ret |= drmModeAtomicAddProperty(req, s->plane_id,
+						p->fb_id, 0) < 0;
+		ret |= drmModeAtomicAddProperty(req, s->plane_id,
+						p->crtc_id, 0) < 0;
+		return ret ? -1 : 0;
+	}
+
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->fb_id, fb->fb_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_id, crtc_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_x, s->src_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_y, s->src_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_w, s->src_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_h, s->src_h) < 0;
+	/* CRTC_X and CRTC_Y are signed, a cursor can hang off the
+	 * top left edge */
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_x, (int32_t) s->dest_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_y, (int32_t) s->dest_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_w, s->dest_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_h, s->dest_h) < 0;
+
+	return ret ? -1 : 0;
+}
+
+/* Adds the primary plane showing primary_fb and all overlay planes of
+ * the output to the request. Overlays get their next buffer, or are
+ * turned off if they have none. The cursor plane is left alone. */
+static int
+drm_output_add_atomic_planes(struct drm_output *output,
+			     drmModeAtomicReq *req, struct drm_fb *primary_fb)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s = output->primary_sprite;
+	struct drm_fb *fb;
+	int ret = 0;
+
+	s->src_x = 0;
+	s->src_y = 0;
+	s->src_w = output->base.current_mode->width << 16;
+	s->src_h = output->base.current_mode->height << 16;
+	s->dest_x = 0;
+	s->dest_y = 0;
+	s->dest_w = output->base.current_mode->width;
+	s->dest_h = output->base.current_mode->height;
+	ret |= drm_sprite_add_atomic(req, s, output->crtc_id, primary_fb);
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY || s->output != output)
+			continue;
+
+		fb = b->sprites_hidden ? NULL : s->next;
+		ret |= drm_sprite_add_atomic(req, s, output->crtc_id, fb);
+	}
+
+	return ret;
+}
+
+/* Checks with the kernel whether the output's plane configuration, as
+ * assigned so far, can be shown together with primary_fb. */
+static int
+drm_output_test_atomic(struct drm_output *output, struct drm_fb *primary_fb)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	drmModeAtomicReq *req;
+	int ret;
+
+	/* The first frame after a modeset never uses planes */
+	if (!output->current)
+		return -1;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_output_add_atomic_planes(output, req, primary_fb);
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req,
+					  DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+static int
+drm_output_add_atomic_cursor(struct drm_output *output,
+			     drmModeAtomicReq *req)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_view *ev = output->cursor_view;
+	struct drm_sprite *s = output->cursor_sprite;
+	struct drm_cursor_image *image = NULL;
+	struct drm_fb *fb = NULL;
+
+	output->cursor_view = NULL;
+	if (s == NULL)
+		return 0;
+
+	if (ev) {
+		image = drm_output_get_cursor_image(output, ev);
+		if (image)
+			fb = drm_fb_get_from_bo(image->bo, b,
+						GBM_FORMAT_ARGB8888);
+		if (fb == NULL)
+			b->cursors_are_broken = 1;
+	}
+
+	drm_output_set_cursor_image(output, fb ? image : NULL);
+
+	if (fb) {
+		output->cursor_plane.x = (ev->geometry.x - output->base.x) *
+					 output->base.current_scale;
+		output->cursor_plane.y = (ev->geometry.y - output->base.y) *
+					 output->base.current_scale;
+
+		s->src_x = 0;
+		s->src_y = 0;
+		s->src_w = b->cursor_width << 16;
+		s->src_h = b->cursor_height << 16;
+		s->dest_x = output->cursor_plane.x;
+		s->dest_y = output->cursor_plane.y;
+		s->dest_w = b->cursor_width;
+		s->dest_h = b->cursor_height;
+	}
+
+	return drm_sprite_add_atomic(req, s, output->crtc_id, fb);
+}
+
+/*
+ * Commits the mode, if it needs setting, and the primary, overlay and
+ * cursor planes of the output in one request. The kernel sends a
+ * single page flip event once all of it is on screen.
+ */
+static int
+drm_output_commit_atomic(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_mode *mode;
+	drmModeAtomicReq *req;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+	int ret = 0;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	if (!output->current) {
+		mode = container_of(output->base.current_mode,
+				    struct drm_mode, base);
+		if (!mode->blob_id &&
+		    drmModeCreatePropertyBlob(b->drm.fd, &mode->mode_info,
+					      sizeof mode->mode_info,
+					      &mode->blob_id) != 0) {
+			ret = -1;
+			goto out;
+		}
+
+		ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+						output->crtc_prop_mode_id,
+						mode->blob_id) < 0;
+		ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+						output->crtc_prop_active,
+						1) < 0;
+		ret |= drmModeAtomicAddProperty(req, output->connector_id,
+						output->connector_prop_crtc_id,
+						output->crtc_id) < 0;
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	ret |= drm_output_add_atomic_planes(output, req, output->next);
+	ret |= drm_output_add_atomic_cursor(output, req);
+
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req, flags, output);
+
+out:
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+#endif
+
+/* With atomic modesetting, the overlays of an output change along with
+ * its primary plane. Makes their next buffer current after a flip, or
+ * drops it if the commit failed. */
+static void
+drm_output_release_sprites(struct drm_output *output, int flipped)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY || s->output != output)
+			continue;
+
+		if (flipped) {
+			drm_output_release_fb(output, s->current);
+			s->current = s->next;
+		} else {
+			drm_output_release_fb(output, s->next);
+		}
+		s->next = NULL;
+
+		if (!s->current)
+			s->output = NULL;
+	}
+}
+
 static uint32_t
 drm_output_check_scanout_format(struct drm_output *output,
 				struct weston_surface *es, struct gbm_bo *bo)
@@ -466,16 +827,16 @@ drm_output_check_scanout_format(struct drm_output *output,
 	return 0;
 }
 
-static struct weston_plane *
-drm_output_prepare_scanout_view(struct drm_output *output,
-				struct weston_view *ev)
+static int
+drm_view_scanout_possible(struct drm_output *output, struct weston_view *ev)
 {
 	struct drm_backend *b =
 		(struct drm_backend *)output->base.compositor->backend;
 	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-	struct gbm_bo *bo;
-	uint32_t format;
+
+	if (output->dev != &b->drm)
+		return 0;
 
 	if (ev->geometry.x != output->base.x ||
 	    ev->geometry.y != output->base.y ||
@@ -484,9 +845,25 @@ drm_output_prepare_scanout_view(struct drm_output *output,
 	    buffer->height != output->base.current_mode->height ||
 	    output->base.transform != viewport->buffer.transform ||
 	    ev->transform.enabled)
-		return NULL;
+		return 0;
 
 	if (ev->geometry.scissor_enabled)
+		return 0;
+
+	return 1;
+}
+
+static struct weston_plane *
+drm_output_prepare_scanout_view(struct drm_output *output,
+				struct weston_view *ev)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct gbm_bo *bo;
+	uint32_t format;
+
+	if (!drm_view_scanout_possible(output, ev))
 		return NULL;
 
 	bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
@@ -510,9 +887,130 @@ drm_output_prepare_scanout_view(struct drm_output *output,
 
 	drm_fb_set_buffer(output->next, buffer);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset &&
+	    drm_output_test_atomic(output, output->next) < 0) {
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+		return NULL;
+	}
+#endif
+
 	return &output->fb_plane;
 }
 
+/* Moves on to the next dumb buffer of the output, and returns in
+ * total_damage what it misses: the damage of this frame, and of every
+ * frame drawn since that buffer was last drawn to. */
+static void
+drm_output_next_dumb(struct drm_output *output, pixman_region32_t *damage,
+		     pixman_region32_t *total_damage)
+{
+	pixman_region32_t *buffer_damage;
+	int i;
+
+	for (i = 0; i < output->num_dumb; i++)
+		pixman_region32_union(&output->dumb_damage[i],
+				      &output->dumb_damage[i], damage);
+
+	output->current_image = (output->current_image + 1) % output->num_dumb;
+
+	buffer_damage = &output->dumb_damage[output->current_image];
+	pixman_region32_intersect(total_damage, buffer_damage,
+				  &output->base.region);
+	pixman_region32_clear(buffer_damage);
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *r;
+	uint64_t area = 0;
+	int i, n;
+
+	r = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++)
+		area += (uint64_t) (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	return area;
+}
+
+/* Dumb buffers are always 32 bits per pixel */
+static void
+drm_output_count_copied(struct drm_output *output, uint64_t pixels)
+{
+	output->copy_stats.bytes_copied = pixels * 4;
+	output->copy_stats.total_bytes_copied += pixels * 4;
+	output->copy_stats.frames++;
+}
+
+/* Collects the damage that the next dumb buffer of an output on a
+ * secondary device misses, in framebuffer coordinates. */
+static void
+drm_output_prepare_copy(struct drm_output *output, pixman_region32_t *damage)
+{
+	pixman_region32_t total_damage;
+
+	pixman_region32_init(&total_damage);
+	drm_output_next_dumb(output, damage, &total_damage);
+
+	pixman_region32_translate(&total_damage,
+				  -output->base.x, -output->base.y);
+	weston_transformed_region(output->base.width, output->base.height,
+				  output->base.transform,
+				  output->base.current_scale,
+				  &total_damage, &output->copy_damage);
+	pixman_region32_fini(&total_damage);
+
+	drm_output_count_copied(output, region_area(&output->copy_damage));
+}
+
+/* Reads back what the GL renderer drew for an output on a secondary
+ * device into its dumb buffer. Runs from the frame signal, before the
+ * renderer swaps buffers. */
+static void
+drm_output_copy_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct drm_output *output =
+		container_of(listener, struct drm_output, copy_frame_listener);
+	struct weston_compositor *ec = output->base.compositor;
+	pixman_image_t *src;
+	pixman_box32_t *r;
+	int i, j, n, width, height, y_orig, do_yflip;
+
+	do_yflip = !!(ec->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	r = pixman_region32_rectangles(&output->copy_damage, &n);
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (do_yflip)
+			y_orig = output->base.current_mode->height - r[i].y2;
+		else
+			y_orig = r[i].y1;
+
+		if (ec->renderer->read_pixels(&output->base, ec->read_format,
+					      output->copy_buf, r[i].x1, y_orig,
+					      width, height) < 0)
+			continue;
+
+		src = pixman_image_create_bits(ec->read_format, width, height,
+					       output->copy_buf, width * 4);
+		if (!src)
+			continue;
+
+		/* Row by row, to flip and convert at once */
+		for (j = 0; j < height; j++)
+			pixman_image_composite32(PIXMAN_OP_SRC, src, NULL,
+					output->image[output->current_image],
+					0, do_yflip ? height - j - 1 : j,
+					0, 0, r[i].x1, r[i].y1 + j, width, 1);
+
+		pixman_image_unref(src);
+	}
+}
+
 static void
 drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
 {
@@ -520,6 +1018,9 @@ drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
 		(struct drm_backend *)output->base.compositor->backend;
 	struct gbm_bo *bo;
 
+	if (output->dev != &b->drm)
+		drm_output_prepare_copy(output, damage);
+
 	output->base.compositor->renderer->repaint_output(&output->base,
 							  damage);
 
@@ -529,6 +1030,13 @@ drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
 		return;
 	}
 
+	/* The frame was copied to the secondary device already */
+	if (output->dev != &b->drm) {
+		gbm_surface_release_buffer(output->surface, bo);
+		output->next = output->dumb[output->current_image];
+		return;
+	}
+
 	output->next = drm_fb_get_from_bo(bo, b, output->format);
 	if (!output->next) {
 		weston_log("failed to get drm_fb for bo\n");
@@ -541,26 +1049,33 @@ static void
 drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *ec = output->base.compositor;
-	pixman_region32_t total_damage, previous_damage;
+	struct pixman_renderer_job *job = NULL;
+	pixman_region32_t total_damage;
+	int scale = output->base.current_scale;
 
 	pixman_region32_init(&total_damage);
-	pixman_region32_init(&previous_damage);
-
-	pixman_region32_copy(&previous_damage, damage);
-
-	pixman_region32_union(&total_damage, damage, &output->previous_damage);
-	pixman_region32_copy(&output->previous_damage, &previous_damage);
-
-	output->current_image ^= 1;
+	drm_output_next_dumb(output, damage, &total_damage);
+	drm_output_count_copied(output,
+				region_area(&total_damage) * scale * scale);
 
 	output->next = output->dumb[output->current_image];
 	pixman_renderer_output_set_buffer(&output->base,
 					  output->image[output->current_image]);
 
-	ec->renderer->repaint_output(&output->base, &total_damage);
+	if (output->render_thread_running)
+		job = pixman_renderer_output_prepare_job(&output->base,
+							 &total_damage);
+	if (job) {
+		pthread_mutex_lock(&output->render_lock);
+		output->render_queued = job;
+		pthread_cond_signal(&output->render_cond);
+		pthread_mutex_unlock(&output->render_lock);
+		output->render_job = job;
+	} else {
+		ec->renderer->repaint_output(&output->base, &total_damage);
+	}
 
 	pixman_region32_fini(&total_damage);
-	pixman_region32_fini(&previous_damage);
 }
 
 static void
@@ -584,8 +1099,6 @@ drm_output_set_gamma(struct weston_output *output_base,
 {
 	int rc;
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend =
-		(struct drm_backend *) output->base.compositor->backend;
 
 	/* check */
 	if (output_base->gamma_size != size)
@@ -593,7 +1106,7 @@ drm_output_set_gamma(struct weston_output *output_base,
 	if (!output->original_crtc)
 		return;
 
-	rc = drmModeCrtcSetGamma(backend->drm.fd,
+	rc = drmModeCrtcSetGamma(output->dev->fd,
 				 output->crtc_id,
 				 size, r, g, b);
 	if (rc)
@@ -625,50 +1138,156 @@ drm_waitvblank_pipe(struct drm_output *output)
 		return 0;
 }
 
+/* Whether the repaint only changes the cursor plane: nothing on the
+ * primary plane was damaged, no client buffer goes to scanout and no
+ * overlay is in use. Nobody may be waiting for the frame to be
+ * rendered either, like the screenshooter, as only the renderer
+ * emits the frame signal. */
 static int
-drm_output_repaint(struct weston_output *output_base,
-		   pixman_region32_t *damage)
+drm_output_cursor_only_update(struct drm_output *output,
+			      pixman_region32_t *damage)
 {
-	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend =
+	struct drm_backend *b =
 		(struct drm_backend *)output->base.compositor->backend;
 	struct drm_sprite *s;
-	struct drm_mode *mode;
-	int ret = 0;
 
-	if (output->destroy_pending)
-		return -1;
+	if (!output->current || output->next ||
+	    pixman_region32_not_empty(damage))
+		return 0;
 
-	if (!output->next)
-		drm_output_render(output, damage);
-	if (!output->next)
-		return -1;
+	if (output->base.disable_planes ||
+	    !wl_list_empty(&output->base.frame_signal.listener_list))
+		return 0;
 
-	mode = container_of(output->base.current_mode, struct drm_mode, base);
-	if (!output->current ||
-	    output->current->stride != output->next->stride) {
-		ret = drmModeSetCrtc(backend->drm.fd, output->crtc_id,
-				     output->next->fb_id, 0, 0,
-				     &output->connector_id, 1,
-				     &mode->mode_info);
-		if (ret) {
-			weston_log("set mode failed: %m\n");
-			goto err_pageflip;
-		}
-		output_base->set_dpms(output_base, WESTON_DPMS_ON);
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY ||
+		    (s->output && s->output != output) ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		if (s->current || s->next)
+			return 0;
 	}
 
-	if (drmModePageFlip(backend->drm.fd, output->crtc_id,
-			    output->next->fb_id,
+	return 1;
+}
+
+/* Updates the cursor and keeps the current buffer on the primary
+ * plane, without rendering. Like in drm_output_start_repaint_loop(),
+ * the flip only asks for the page flip event that finishes the
+ * frame. */
+static int
+drm_output_repaint_cursor(struct drm_output *output)
+{
+	int ret;
+
+#ifdef HAVE_DRM_ATOMIC
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+
+	if (b->atomic_modeset && output->dev == &b->drm) {
+		drmModeAtomicReq *req;
+
+		req = drmModeAtomicAlloc();
+		if (!req)
+			return -1;
+
+		ret = drm_sprite_add_atomic(req, output->primary_sprite,
+					    output->crtc_id, output->current);
+		ret |= drm_output_add_atomic_cursor(output, req);
+		if (ret == 0)
+			ret = drmModeAtomicCommit(b->drm.fd, req,
+						  DRM_MODE_PAGE_FLIP_EVENT |
+						  DRM_MODE_ATOMIC_NONBLOCK,
+						  output);
+		drmModeAtomicFree(req);
+
+		if (ret < 0) {
+			weston_log("atomic cursor commit failed: %m\n");
+			drm_output_release_cursor_image(output, 0);
+			return -1;
+		}
+
+		weston_output_frame_submitted(&output->base);
+		return 0;
+	}
+#endif
+
+	drm_output_set_cursor(output);
+
+	ret = drmModePageFlip(output->dev->fd, output->crtc_id,
+			      output->current->fb_id,
+			      DRM_MODE_PAGE_FLIP_EVENT, output);
+	if (ret < 0) {
+		weston_log("queueing pageflip failed: %m\n");
+		return -1;
+	}
+
+	weston_output_frame_submitted(&output->base);
+	return 0;
+}
+
+/* Queues the page flip to output->next, along with the planes */
+static int
+drm_output_present(struct drm_output *output)
+{
+	struct weston_output *output_base = &output->base;
+	struct drm_backend *backend =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+	struct drm_mode *mode;
+	int ret = 0;
+
+#ifdef HAVE_DRM_ATOMIC
+	if (backend->atomic_modeset && output->dev == &backend->drm) {
+		int modeset = !output->current;
+
+		if (drm_output_commit_atomic(output) < 0) {
+			weston_log("atomic commit failed: %m\n");
+			drm_output_release_sprites(output, 0);
+			drm_output_release_cursor_image(output, 0);
+			goto err_pageflip;
+		}
+
+		output->page_flip_pending = 1;
+		weston_output_frame_submitted(output_base);
+		if (modeset)
+			output_base->set_dpms(output_base, WESTON_DPMS_ON);
+
+		return 0;
+	}
+#endif
+
+	mode = container_of(output->base.current_mode, struct drm_mode, base);
+	if (!output->current ||
+	    output->current->stride != output->next->stride) {
+		ret = drmModeSetCrtc(output->dev->fd, output->crtc_id,
+				     output->next->fb_id, 0, 0,
+				     &output->connector_id, 1,
+				     &mode->mode_info);
+		if (ret) {
+			weston_log("set mode failed: %m\n");
+			goto err_pageflip;
+		}
+		output_base->set_dpms(output_base, WESTON_DPMS_ON);
+	}
+
+	if (drmModePageFlip(output->dev->fd, output->crtc_id,
+			    output->next->fb_id,
 			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
 		weston_log("queueing pageflip failed: %m\n");
 		goto err_pageflip;
 	}
 
 	output->page_flip_pending = 1;
+	weston_output_frame_submitted(output_base);
 
 	drm_output_set_cursor(output);
 
+	/* The sprites all belong to the primary device */
+	if (output->dev != &backend->drm)
+		return 0;
+
 	/*
 	 * Now, update all the sprite surfaces
 	 */
@@ -725,12 +1344,183 @@ err_pageflip:
 	return -1;
 }
 
+static int
+drm_output_repaint(struct weston_output *output_base,
+		   pixman_region32_t *damage)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+
+	if (output->destroy_pending)
+		return -1;
+
+	if (drm_output_cursor_only_update(output, damage))
+		return drm_output_repaint_cursor(output);
+
+	if (!output->next)
+		drm_output_render(output, damage);
+	if (!output->next)
+		return -1;
+
+	/* Presented by drm_output_finish_render() */
+	if (output->render_job)
+		return 0;
+
+	return drm_output_present(output);
+}
+
+/* Waits for the render thread to be done with the frame of the output,
+ * and queues the page flip unless present is 0. */
+static void
+drm_output_finish_render(struct drm_output *output, int present)
+{
+	struct timespec ts;
+
+	if (!output->render_job)
+		return;
+
+	pixman_renderer_job_finish(output->render_job);
+	output->render_job = NULL;
+
+	if (!present)
+		return;
+
+	if (drm_output_present(output) < 0) {
+		/* There will be no page flip event to finish the frame */
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &ts);
+		weston_output_finish_frame(&output->base, &ts,
+					   PRESENTATION_FEEDBACK_INVALID);
+	}
+}
+
+/* weston_log() is not thread-safe, so the render thread leaves its
+ * errors for the main thread to log. */
+static void
+drm_output_log_render_errors(struct drm_output *output)
+{
+	if (__atomic_exchange_n(&output->render_wake_failed, 0,
+				__ATOMIC_ACQ_REL))
+		weston_log("render thread of %s failed to wake up the main "
+			   "thread\n", output->base.name);
+}
+
+static int
+on_render_done(int fd, uint32_t mask, void *data)
+{
+	struct drm_output *output = data;
+	uint64_t value;
+
+	if (read(fd, &value, sizeof value) != sizeof value &&
+	    errno != EAGAIN)
+		weston_log("failed to read the render thread eventfd: %m\n");
+
+	drm_output_log_render_errors(output);
+
+	drm_output_finish_render(output, 1);
+
+	return 0;
+}
+
+static void *
+drm_output_render_thread(void *data)
+{
+	struct drm_output *output = data;
+	struct pixman_renderer_job *job;
+	uint64_t value = 1;
+
+	pthread_mutex_lock(&output->render_lock);
+	while (1) {
+		while (!output->render_queued && output->render_thread_running)
+			pthread_cond_wait(&output->render_cond,
+					  &output->render_lock);
+
+		/* A queued job is always run, the main thread waits for it */
+		job = output->render_queued;
+		if (!job)
+			break;
+		output->render_queued = NULL;
+		pthread_mutex_unlock(&output->render_lock);
+
+		pixman_renderer_job_run(job);
+		if (write(output->render_fd, &value,
+			  sizeof value) != sizeof value)
+			__atomic_store_n(&output->render_wake_failed, 1,
+					 __ATOMIC_RELEASE);
+
+		pthread_mutex_lock(&output->render_lock);
+	}
+	pthread_mutex_unlock(&output->render_lock);
+
+	return NULL;
+}
+
+static void
+drm_output_init_render_thread(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct wl_event_loop *loop;
+
+	if (!b->render_threads)
+		return;
+
+	output->render_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (output->render_fd < 0)
+		goto err;
+
+	loop = wl_display_get_event_loop(b->compositor->wl_display);
+	output->render_source =
+		wl_event_loop_add_fd(loop, output->render_fd,
+				     WL_EVENT_READABLE, on_render_done, output);
+	if (!output->render_source)
+		goto err_fd;
+
+	pthread_mutex_init(&output->render_lock, NULL);
+	pthread_cond_init(&output->render_cond, NULL);
+	output->render_thread_running = 1;
+	if (pthread_create(&output->render_thread, NULL,
+			   drm_output_render_thread, output) != 0) {
+		output->render_thread_running = 0;
+		pthread_cond_destroy(&output->render_cond);
+		pthread_mutex_destroy(&output->render_lock);
+		wl_event_source_remove(output->render_source);
+		goto err_fd;
+	}
+
+	return;
+
+err_fd:
+	close(output->render_fd);
+err:
+	weston_log("failed to start the render thread of %s, "
+		   "rendering on the main thread\n", output->base.name);
+}
+
+static void
+drm_output_fini_render_thread(struct drm_output *output)
+{
+	if (!output->render_thread_running)
+		return;
+
+	drm_output_finish_render(output, 0);
+
+	pthread_mutex_lock(&output->render_lock);
+	output->render_thread_running = 0;
+	pthread_cond_signal(&output->render_cond);
+	pthread_mutex_unlock(&output->render_lock);
+	pthread_join(output->render_thread, NULL);
+	drm_output_log_render_errors(output);
+
+	pthread_cond_destroy(&output->render_cond);
+	pthread_mutex_destroy(&output->render_lock);
+	wl_event_source_remove(output->render_source);
+	close(output->render_fd);
+}
+
 static void
 drm_output_start_repaint_loop(struct weston_output *output_base)
 {
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend = (struct drm_backend *)
-		output_base->compositor->backend;
 	uint32_t fb_id;
 	struct timespec ts;
 
@@ -744,7 +1534,7 @@ drm_output_start_repaint_loop(struct weston_output *output_base)
 
 	fb_id = output->current->fb_id;
 
-	if (drmModePageFlip(backend->drm.fd, output->crtc_id, fb_id,
+	if (drmModePageFlip(output->dev->fd, output->crtc_id, fb_id,
 			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
 		weston_log("queueing pageflip failed: %m\n");
 		goto finish_frame;
@@ -802,6 +1592,8 @@ page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
 	struct timespec ts;
 	uint32_t flags = PRESENTATION_FEEDBACK_KIND_VSYNC |
 			 PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
@@ -809,6 +1601,8 @@ page_flip_handler(int fd, unsigned int frame,
 
 	drm_output_update_msc(output, frame);
 
+	drm_output_release_cursor_image(output, 1);
+
 	/* We don't set page_flip_pending on start_repaint_loop, in that case
 	 * we just want to page flip to the current buffer to get an accurate
 	 * timestamp */
@@ -816,6 +1610,8 @@ page_flip_handler(int fd, unsigned int frame,
 		drm_output_release_fb(output, output->current);
 		output->current = output->next;
 		output->next = NULL;
+		if (b->atomic_modeset)
+			drm_output_release_sprites(output, 1);
 	}
 
 	output->page_flip_pending = 0;
@@ -870,52 +1666,74 @@ drm_view_transform_supported(struct weston_view *ev)
 		(ev->transform.matrix.type < WESTON_MATRIX_TRANSFORM_ROTATE);
 }
 
-static struct weston_plane *
-drm_output_prepare_overlay_view(struct drm_output *output,
-				struct weston_view *ev)
+static int
+drm_view_overlay_possible(struct drm_output *output, struct weston_view *ev)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	struct drm_backend *b = (struct drm_backend *)ec->backend;
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-	struct drm_sprite *s;
-	int found = 0;
-	struct gbm_bo *bo;
-	pixman_region32_t dest_rect, src_rect;
-	pixman_box32_t *box, tbox;
-	uint32_t format;
-	wl_fixed_t sx1, sy1, sx2, sy2;
 
-	if (b->gbm == NULL)
-		return NULL;
+	if (b->gbm == NULL || output->dev != &b->drm)
+		return 0;
 
 	if (viewport->buffer.transform != output->base.transform)
-		return NULL;
+		return 0;
 
 	if (viewport->buffer.scale != output->base.current_scale)
-		return NULL;
+		return 0;
 
 	if (b->sprites_are_broken)
-		return NULL;
+		return 0;
 
 	if (ev->output_mask != (1u << output->base.id))
-		return NULL;
+		return 0;
 
 	if (ev->surface->buffer_ref.buffer == NULL)
-		return NULL;
+		return 0;
 
 	if (ev->alpha != 1.0f)
-		return NULL;
+		return 0;
 
 	if (wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource))
-		return NULL;
+		return 0;
 
 	if (!drm_view_transform_supported(ev))
+		return 0;
+
+	return 1;
+}
+
+static struct weston_plane *
+drm_output_prepare_overlay_view(struct drm_output *output,
+				struct weston_view *ev)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_backend *b = (struct drm_backend *)ec->backend;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct drm_sprite *s;
+	int found = 0;
+	struct gbm_bo *bo;
+	pixman_region32_t dest_rect, src_rect;
+	pixman_box32_t *box, tbox;
+	uint32_t format;
+	wl_fixed_t sx1, sy1, sx2, sy2;
+
+	if (!drm_view_overlay_possible(output, ev))
 		return NULL;
 
 	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY)
+			continue;
+
 		if (!drm_sprite_crtc_supported(output, s->possible_crtcs))
 			continue;
 
+		/* With atomic modesetting, a sprite is updated along with
+		 * the output showing it, so it cannot move to another
+		 * output until it has been turned off. */
+		if (b->atomic_modeset && s->output && s->output != output)
+			continue;
+
 		if (!s->next) {
 			found = 1;
 			break;
@@ -1011,34 +1829,59 @@ drm_output_prepare_overlay_view(struct drm_output *output,
 	s->src_h = (tbox.y2 - tbox.y1) << 8;
 	pixman_region32_fini(&src_rect);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset) {
+		s->output = output;
+		if (drm_output_test_atomic(output, output->next ?
+					   output->next : output->current) < 0) {
+			drm_output_release_fb(output, s->next);
+			s->next = NULL;
+			if (!s->current)
+				s->output = NULL;
+			return NULL;
+		}
+	}
+#endif
+
 	return &s->plane;
 }
 
-static struct weston_plane *
-drm_output_prepare_cursor_view(struct drm_output *output,
-			       struct weston_view *ev)
+static int
+drm_view_cursor_possible(struct drm_output *output, struct weston_view *ev)
 {
 	struct drm_backend *b =
 		(struct drm_backend *)output->base.compositor->backend;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
 
-	if (b->gbm == NULL)
-		return NULL;
+	if (b->gbm == NULL || output->dev != &b->drm)
+		return 0;
 	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
+		return 0;
 	if (viewport->buffer.scale != output->base.current_scale)
-		return NULL;
-	if (output->cursor_view)
-		return NULL;
+		return 0;
 	if (ev->output_mask != (1u << output->base.id))
-		return NULL;
+		return 0;
 	if (b->cursors_are_broken)
-		return NULL;
+		return 0;
+	if (b->atomic_modeset && output->cursor_sprite == NULL)
+		return 0;
 	if (ev->geometry.scissor_enabled)
-		return NULL;
+		return 0;
 	if (ev->surface->buffer_ref.buffer == NULL ||
 	    !wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
 	    ev->surface->width > 64 || ev->surface->height > 64)
+		return 0;
+
+	return 1;
+}
+
+static struct weston_plane *
+drm_output_prepare_cursor_view(struct drm_output *output,
+			       struct weston_view *ev)
+{
+	if (output->cursor_view)
+		return NULL;
+	if (!drm_view_cursor_possible(output, ev))
 		return NULL;
 
 	output->cursor_view = ev;
@@ -1046,51 +1889,295 @@ drm_output_prepare_cursor_view(struct drm_output *output,
 	return &output->cursor_plane;
 }
 
+static uint32_t
+drm_cursor_hash(const unsigned char *data, int32_t stride,
+		int32_t width, int32_t height)
+{
+	const uint32_t *row;
+	uint32_t hash = 2166136261u;
+	int32_t x, y;
+
+	/* FNV-1a over the pixels */
+	for (y = 0; y < height; y++) {
+		row = (const uint32_t *) (data + y * stride);
+		for (x = 0; x < width; x++)
+			hash = (hash ^ row[x]) * 16777619u;
+	}
+
+	return hash;
+}
+
+static int
+drm_cursor_image_matches(struct drm_cursor_image *image, uint32_t hash,
+			 const unsigned char *data, int32_t stride,
+			 int32_t width, int32_t height)
+{
+	int32_t y;
+
+	if (image->hash != hash ||
+	    image->width != width || image->height != height)
+		return 0;
+
+	for (y = 0; y < height; y++)
+		if (memcmp(image->pixels + y * width, data + y * stride,
+			   width * 4) != 0)
+			return 0;
+
+	return 1;
+}
+
+static struct drm_cursor_image *
+drm_cursor_image_create(struct drm_backend *b)
+{
+	struct drm_cursor_image *image;
+
+	if (b->cursor_buf == NULL) {
+		b->cursor_buf = zalloc(b->cursor_width * b->cursor_height *
+				       sizeof *b->cursor_buf);
+		if (b->cursor_buf == NULL)
+			return NULL;
+	}
+
+	image = zalloc(sizeof *image);
+	if (image == NULL)
+		return NULL;
+
+	image->bo = gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
+				  GBM_FORMAT_ARGB8888,
+				  GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+	if (image->bo == NULL) {
+		free(image);
+		return NULL;
+	}
+
+	/* Nothing is known about the contents of a new bo, so the
+	 * first upload clears all of it */
+	image->height = b->cursor_height;
+
+	wl_list_insert(b->cursor_cache.prev, &image->link);
+	b->cursor_cache_size++;
+
+	return image;
+}
+
+static void
+drm_cursor_image_destroy(struct drm_backend *b, struct drm_cursor_image *image)
+{
+	wl_list_remove(&image->link);
+	b->cursor_cache_size--;
+	gbm_bo_destroy(image->bo);
+	free(image->pixels);
+	free(image);
+}
+
+static void
+drm_backend_destroy_cursor_cache(struct drm_backend *b)
+{
+	struct drm_cursor_image *image, *next;
+
+	wl_list_for_each_safe(image, next, &b->cursor_cache, link)
+		drm_cursor_image_destroy(b, image);
+
+	free(b->cursor_buf);
+	b->cursor_buf = NULL;
+}
+
+/* Finds a cache entry to upload a new image to: an empty one, a new one
+ * if the cache is not full yet, or else the least recently used image
+ * that no output is showing. */
+static struct drm_cursor_image *
+drm_cursor_cache_get_free(struct drm_backend *b)
+{
+	struct drm_cursor_image *image;
+
+	wl_list_for_each_reverse(image, &b->cursor_cache, link)
+		if (image->width == 0 && image->outputs == 0)
+			return image;
+
+	if (b->cursor_cache_size < DRM_CURSOR_CACHE_SIZE)
+		return drm_cursor_image_create(b);
+
+	wl_list_for_each_reverse(image, &b->cursor_cache, link)
+		if (image->outputs == 0)
+			return image;
+
+	return NULL;
+}
+
+/* Writes the image to its bo. gbm_bo_write() always starts at the top
+ * of the bo, but the rows below both the old and the new image are
+ * clear already and are not written again. */
+static int
+drm_cursor_image_upload(struct drm_backend *b, struct drm_cursor_image *image,
+			uint32_t hash, const unsigned char *data,
+			int32_t stride, int32_t width, int32_t height)
+{
+	uint32_t *pixels;
+	size_t size;
+	int32_t y;
+
+	if (image->pixels == NULL ||
+	    image->width * image->height != width * height) {
+		pixels = realloc(image->pixels, width * height * 4);
+		if (pixels == NULL)
+			goto err;
+		image->pixels = pixels;
+	}
+
+	size = MAX(height, image->height) * b->cursor_width *
+	       sizeof *b->cursor_buf;
+	memset(b->cursor_buf, 0, size);
+	for (y = 0; y < height; y++) {
+		memcpy(b->cursor_buf + y * b->cursor_width,
+		       data + y * stride, width * 4);
+		memcpy(image->pixels + y * width, data + y * stride,
+		       width * 4);
+	}
+
+	if (gbm_bo_write(image->bo, b->cursor_buf, size) < 0) {
+		weston_log("failed update cursor: %m\n");
+		goto err;
+	}
+
+	image->hash = hash;
+	image->width = width;
+	image->height = height;
+
+	return 0;
+
+err:
+	image->width = 0;
+	image->height = b->cursor_height;
+	return -1;
+}
+
+/* Returns the cursor image showing the cursor view's buffer, from the
+ * cache or newly uploaded. The buffer is only looked at again when the
+ * cursor plane was damaged. Returns NULL if there is no bo to upload
+ * to. */
+static struct drm_cursor_image *
+drm_output_get_cursor_image(struct drm_output *output, struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	struct drm_cursor_image *image;
+	int32_t width = ev->surface->width, height = ev->surface->height;
+	const unsigned char *data;
+	int32_t stride;
+	uint32_t hash;
+
+	if (output->cursor_image &&
+	    (!buffer ||
+	     !pixman_region32_not_empty(&output->cursor_plane.damage)))
+		return output->cursor_image;
+
+	if (!buffer)
+		return NULL;
+
+	pixman_region32_clear(&output->cursor_plane.damage);
+
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	hash = drm_cursor_hash(data, stride, width, height);
+	wl_list_for_each(image, &b->cursor_cache, link)
+		if (drm_cursor_image_matches(image, hash, data, stride,
+					     width, height))
+			goto found;
+
+	image = drm_cursor_cache_get_free(b);
+	if (image && drm_cursor_image_upload(b, image, hash, data, stride,
+					     width, height) < 0)
+		image = NULL;
+
+found:
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	if (image) {
+		wl_list_remove(&image->link);
+		wl_list_insert(&b->cursor_cache, &image->link);
+	}
+
+	return image;
+}
+
+/* Makes the image the one of the cursor plane in the next commit. The
+ * previous image stays on screen until that commit completes, so it
+ * keeps its reference until drm_output_release_cursor_image(). */
+static void
+drm_output_set_cursor_image(struct drm_output *output,
+			    struct drm_cursor_image *image)
+{
+	/* A pending image was never shown, the previous one still is */
+	if (!output->cursor_image_pending)
+		output->prev_cursor_image = output->cursor_image;
+	else if (output->cursor_image)
+		output->cursor_image->outputs--;
+
+	output->cursor_image = image;
+	output->cursor_image_pending = 1;
+	if (image)
+		image->outputs++;
+}
+
+/* Drops the previous cursor image once the commit that replaced it
+ * flipped, or goes back to it if the commit failed. */
+static void
+drm_output_release_cursor_image(struct drm_output *output, int flipped)
+{
+	struct drm_cursor_image *image;
+
+	if (!output->cursor_image_pending)
+		return;
+
+	if (flipped) {
+		image = output->prev_cursor_image;
+	} else {
+		image = output->cursor_image;
+		output->cursor_image = output->prev_cursor_image;
+	}
+
+	output->prev_cursor_image = NULL;
+	output->cursor_image_pending = 0;
+	if (image)
+		image->outputs--;
+}
+
 static void
 drm_output_set_cursor(struct drm_output *output)
 {
 	struct weston_view *ev = output->cursor_view;
-	struct weston_buffer *buffer;
 	struct drm_backend *b =
 		(struct drm_backend *) output->base.compositor->backend;
-	EGLint handle, stride;
-	struct gbm_bo *bo;
-	uint32_t buf[b->cursor_width * b->cursor_height];
-	unsigned char *s;
-	int i, x, y;
+	struct drm_cursor_image *image;
+	EGLint handle;
+	int x, y;
 
 	output->cursor_view = NULL;
 	if (ev == NULL) {
-		drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+		drmModeSetCursor(output->dev->fd, output->crtc_id, 0, 0, 0);
+		drm_output_set_cursor_image(output, NULL);
 		return;
 	}
 
-	buffer = ev->surface->buffer_ref.buffer;
-
-	if (buffer &&
-	    pixman_region32_not_empty(&output->cursor_plane.damage)) {
-		pixman_region32_fini(&output->cursor_plane.damage);
-		pixman_region32_init(&output->cursor_plane.damage);
-		output->current_cursor ^= 1;
-		bo = output->cursor_bo[output->current_cursor];
-		memset(buf, 0, sizeof buf);
-		stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
-		s = wl_shm_buffer_get_data(buffer->shm_buffer);
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		for (i = 0; i < ev->surface->height; i++)
-			memcpy(buf + i * b->cursor_width, s + i * stride,
-			       ev->surface->width * 4);
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-
-		if (gbm_bo_write(bo, buf, sizeof buf) < 0)
-			weston_log("failed update cursor: %m\n");
+	image = drm_output_get_cursor_image(output, ev);
+	if (image == NULL) {
+		weston_log("no cursor buffer available\n");
+		b->cursors_are_broken = 1;
+		return;
+	}
 
-		handle = gbm_bo_get_handle(bo).s32;
+	/* A cached image only needs its bo set on the CRTC */
+	if (image != output->cursor_image) {
+		handle = gbm_bo_get_handle(image->bo).s32;
 		if (drmModeSetCursor(b->drm.fd, output->crtc_id, handle,
 				b->cursor_width, b->cursor_height)) {
 			weston_log("failed to set cursor: %m\n");
 			b->cursors_are_broken = 1;
 		}
+		drm_output_set_cursor_image(output, image);
 	}
 
 	x = (ev->geometry.x - output->base.x) * output->base.current_scale;
@@ -1106,6 +2193,130 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+static int
+drm_output_count_overlays(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+	int count = 0;
+
+	if (b->sprites_are_broken || output->dev != &b->drm)
+		return 0;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		if (b->atomic_modeset && s->output && s->output != output)
+			continue;
+
+		count++;
+	}
+
+	return count;
+}
+
+static int
+drm_view_is_opaque(struct weston_view *ev)
+{
+	pixman_region32_t r;
+	int opaque;
+
+	pixman_region32_init_rect(&r, 0, 0,
+				  ev->surface->width, ev->surface->height);
+	pixman_region32_subtract(&r, &r, &ev->surface->opaque);
+	opaque = !pixman_region32_not_empty(&r);
+	pixman_region32_fini(&r);
+
+	return opaque;
+}
+
+static int
+drm_view_on_sprite(struct drm_output *output, struct weston_view *ev)
+{
+	struct weston_compositor *ec = output->base.compositor;
+
+	return ev->plane != NULL && ev->plane != &ec->primary_plane &&
+	       ev->plane != &output->cursor_plane &&
+	       ev->plane != &output->fb_plane;
+}
+
+/*
+ * Lets the plane planner pick the views that are worth an overlay, from
+ * their size, commit rate and blending, and the previous assignment.
+ * The views of the output are in output->plan in stacking order.
+ * Returns the number of them, or -1 on error.
+ */
+static int
+drm_output_plan_overlays(struct drm_output *output)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct plane_planner_view *plan, *v;
+	struct weston_view *ev;
+	pixman_box32_t *box, *region;
+	struct timespec now;
+	int count = 0, num_overlays, cursor = 0, scanout = 0;
+
+	num_overlays = drm_output_count_overlays(output);
+	if (num_overlays == 0)
+		return -1;
+
+	wl_list_for_each(ev, &ec->view_list, link)
+		if (ev->output_mask & (1u << output->base.id))
+			count++;
+
+	if (count > output->plan_size) {
+		plan = realloc(output->plan, count * sizeof *plan);
+		if (!plan)
+			return -1;
+		output->plan = plan;
+		output->plan_size = count;
+	}
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	region = pixman_region32_extents(&output->base.region);
+
+	v = output->plan;
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!(ev->output_mask & (1u << output->base.id)))
+			continue;
+
+		box = pixman_region32_extents(&ev->transform.boundingbox);
+		v->box.x1 = MAX(box->x1, region->x1);
+		v->box.y1 = MAX(box->y1, region->y1);
+		v->box.x2 = MIN(box->x2, region->x2);
+		v->box.y2 = MIN(box->y2, region->y2);
+
+		/* Like the cursor plane, only the topmost cursor candidate
+		 * makes it there. Scanout is tried before the overlays, so
+		 * a view that may get it must not take an overlay slot. */
+		if (!cursor && drm_view_cursor_possible(output, ev)) {
+			v->kind = PLANE_PLANNER_ABOVE;
+			cursor = 1;
+		} else if (!scanout && drm_view_scanout_possible(output, ev)) {
+			v->kind = PLANE_PLANNER_SCANOUT;
+			scanout = 1;
+		} else if (drm_view_overlay_possible(output, ev)) {
+			v->kind = PLANE_PLANNER_OVERLAY;
+		} else {
+			v->kind = PLANE_PLANNER_PRIMARY;
+		}
+
+		v->commit_rate =
+			commit_rate_current(ev->surface->commit_rate,
+					    &ev->surface->last_commit, &now);
+		v->opaque = drm_view_is_opaque(ev);
+		v->was_on_overlay = drm_view_on_sprite(output, ev);
+		v++;
+	}
+
+	plane_planner_assign(output->plan, count, num_overlays);
+
+	return count;
+}
+
 static void
 drm_assign_planes(struct weston_output *output_base)
 {
@@ -1115,6 +2326,7 @@ drm_assign_planes(struct weston_output *output_base)
 	struct weston_view *ev, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	int i = 0, planned;
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
@@ -1132,8 +2344,14 @@ drm_assign_planes(struct weston_output *output_base)
 	pixman_region32_init(&overlap);
 	primary = &output_base->compositor->primary_plane;
 
+	planned = drm_output_plan_overlays(output);
+
 	wl_list_for_each_safe(ev, next, &output_base->compositor->view_list, link) {
 		struct weston_surface *es = ev->surface;
+		int on_overlay = 0;
+
+		if (planned > 0 && (ev->output_mask & (1u << output->base.id)))
+			on_overlay = output->plan[i++].on_overlay;
 
 		/* Test whether this buffer can ever go into a plane:
 		 * non-shm, or small enough to be a cursor.
@@ -1162,7 +2380,7 @@ drm_assign_planes(struct weston_output *output_base)
 			next_plane = drm_output_prepare_cursor_view(output, ev);
 		if (next_plane == NULL)
 			next_plane = drm_output_prepare_scanout_view(output, ev);
-		if (next_plane == NULL)
+		if (next_plane == NULL && on_overlay)
 			next_plane = drm_output_prepare_overlay_view(output, ev);
 		if (next_plane == NULL)
 			next_plane = primary;
@@ -1184,13 +2402,58 @@ drm_assign_planes(struct weston_output *output_base)
 			ev->psf_flags = PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
 		}
 
-		pixman_region32_fini(&surface_overlap);
+		pixman_region32_fini(&surface_overlap);
+	}
+	pixman_region32_fini(&overlap);
+}
+
+static void
+drm_output_fini_pixman(struct drm_output *output);
+static void
+drm_output_fini_copy(struct drm_output *output);
+
+static void
+drm_output_unclaim_sprites(struct drm_output *output)
+{
+	if (output->primary_sprite)
+		output->primary_sprite->output = NULL;
+	if (output->cursor_sprite)
+		output->cursor_sprite->output = NULL;
+	output->primary_sprite = NULL;
+	output->cursor_sprite = NULL;
+}
+
+#ifdef HAVE_DRM_ATOMIC
+static void
+drm_output_fini_atomic(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_mode *mode;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != DRM_SPRITE_OVERLAY || s->output != output)
+			continue;
+
+		drmModeSetPlane(b->drm.fd, s->plane_id, output->crtc_id,
+				0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		drm_output_release_fb(output, s->current);
+		drm_output_release_fb(output, s->next);
+		s->current = NULL;
+		s->next = NULL;
+		s->output = NULL;
 	}
-	pixman_region32_fini(&overlap);
-}
 
-static void
-drm_output_fini_pixman(struct drm_output *output);
+	drm_output_unclaim_sprites(output);
+
+	wl_list_for_each(mode, &output->base.mode_list, base.link) {
+		if (mode->blob_id)
+			drmModeDestroyPropertyBlob(b->drm.fd, mode->blob_id);
+		mode->blob_id = 0;
+	}
+}
+#endif
 
 static void
 drm_output_destroy(struct weston_output *output_base)
@@ -1212,22 +2475,30 @@ drm_output_destroy(struct weston_output *output_base)
 	drmModeFreeProperty(output->dpms_prop);
 
 	/* Turn off hardware cursor */
-	drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+	drmModeSetCursor(output->dev->fd, output->crtc_id, 0, 0, 0);
+	drm_output_set_cursor_image(output, NULL);
+	drm_output_release_cursor_image(output, 1);
+
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset && output->dev == &b->drm)
+		drm_output_fini_atomic(output);
+#endif
 
 	/* Restore original CRTC state */
-	drmModeSetCrtc(b->drm.fd, origcrtc->crtc_id, origcrtc->buffer_id,
+	drmModeSetCrtc(output->dev->fd, origcrtc->crtc_id, origcrtc->buffer_id,
 		       origcrtc->x, origcrtc->y,
 		       &output->connector_id, 1, &origcrtc->mode);
 	drmModeFreeCrtc(origcrtc);
 
-	b->crtc_allocator &= ~(1 << output->crtc_id);
-	b->connector_allocator &= ~(1 << output->connector_id);
+	output->dev->crtc_allocator &= ~(1 << output->crtc_id);
+	output->dev->connector_allocator &= ~(1 << output->connector_id);
 
 	if (b->use_pixman) {
 		drm_output_fini_pixman(output);
 	} else {
 		gl_renderer->output_destroy(output_base);
 		gbm_surface_destroy(output->surface);
+		drm_output_fini_copy(output);
 	}
 
 	weston_plane_release(&output->fb_plane);
@@ -1235,6 +2506,7 @@ drm_output_destroy(struct weston_output *output_base)
 
 	weston_output_destroy(&output->base);
 
+	free(output->plan);
 	free(output);
 }
 
@@ -1267,6 +2539,8 @@ static int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b);
 static int
 drm_output_init_pixman(struct drm_output *output, struct drm_backend *b);
+static int
+drm_output_init_copy(struct drm_output *output);
 
 static int
 drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mode)
@@ -1274,6 +2548,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	struct drm_output *output;
 	struct drm_mode *drm_mode;
 	struct drm_backend *b;
+	struct timespec ts;
 
 	if (output_base == NULL) {
 		weston_log("output is NULL.\n");
@@ -1297,6 +2572,16 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	if (&drm_mode->base == output->base.current_mode)
 		return 0;
 
+	/* A frame rendered for the old mode is dropped. There will be no
+	 * page flip to finish it. */
+	if (output->render_job) {
+		drm_output_finish_render(output, 0);
+		weston_compositor_read_presentation_clock(output->base.compositor,
+							  &ts);
+		weston_output_finish_frame(&output->base, &ts,
+					   PRESENTATION_FEEDBACK_INVALID);
+	}
+
 	output->base.current_mode->flags = 0;
 
 	output->base.current_mode = &drm_mode->base;
@@ -1318,6 +2603,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	} else {
 		gl_renderer->output_destroy(&output->base);
 		gbm_surface_destroy(output->surface);
+		drm_output_fini_copy(output);
 
 		if (drm_output_init_egl(output, b) < 0) {
 			weston_log("failed to init output egl state with "
@@ -1343,18 +2629,41 @@ on_drm_input(int fd, uint32_t mask, void *data)
 	return 1;
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static void
+drm_backend_init_atomic(struct drm_backend *b)
+{
+	const char *str;
+
+	/* Atomic modesetting can be turned off with
+	 * WESTON_DRM_ATOMIC=0, to use the legacy KMS API instead. */
+	str = getenv("WESTON_DRM_ATOMIC");
+	if (str && strcmp(str, "0") == 0)
+		return;
+
+	/* This also exposes the primary and cursor planes */
+	if (drmSetClientCap(b->drm.fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0)
+		return;
+
+	b->atomic_modeset = 1;
+
+	/* Plane updates are synchronized with the page flip now */
+	b->sprites_are_broken = 0;
+	b->cursors_are_broken = 0;
+}
+#endif
+
 static int
-init_drm(struct drm_backend *b, struct udev_device *device)
+drm_device_open(struct drm_backend *b, struct drm_device *dev,
+		struct udev_device *device)
 {
 	const char *filename, *sysnum;
-	uint64_t cap;
-	int fd, ret;
-	clockid_t clk_id;
+	int fd;
 
 	sysnum = udev_device_get_sysnum(device);
 	if (sysnum)
-		b->drm.id = atoi(sysnum);
-	if (!sysnum || b->drm.id < 0) {
+		dev->id = atoi(sysnum);
+	if (!sysnum || dev->id < 0) {
 		weston_log("cannot get device sysnum\n");
 		return -1;
 	}
@@ -1370,8 +2679,95 @@ init_drm(struct drm_backend *b, struct udev_device *device)
 
 	weston_log("using %s\n", filename);
 
-	b->drm.fd = fd;
-	b->drm.filename = strdup(filename);
+	dev->backend = b;
+	dev->fd = fd;
+	dev->filename = strdup(filename);
+
+	return 0;
+}
+
+static void
+drm_device_destroy(struct drm_device *dev)
+{
+	if (dev->source)
+		wl_event_source_remove(dev->source);
+	weston_launcher_close(dev->backend->compositor->launcher, dev->fd);
+	udev_device_unref(dev->udev_device);
+	wl_list_remove(&dev->link);
+	free(dev->filename);
+	free(dev);
+}
+
+static void
+drm_backend_destroy_secondary_devices(struct drm_backend *b)
+{
+	struct drm_device *dev, *next;
+
+	wl_list_for_each_safe(dev, next, &b->secondary_devices, link)
+		drm_device_destroy(dev);
+}
+
+/* Opens the devices given with --additional-devices, as a comma
+ * separated list of names such as card1. Only their outputs are used,
+ * so they need dumb buffers but no rendering support. */
+static void
+drm_backend_open_secondary_devices(struct drm_backend *b, const char *names,
+				   struct udev_device *primary)
+{
+	struct udev_device *device;
+	struct drm_device *dev;
+	const char *p, *end;
+	char name[64];
+	uint64_t cap;
+
+	for (p = names; p && *p; p = end) {
+		end = strchrnul(p, ',');
+		snprintf(name, sizeof name, "%.*s", (int) (end - p), p);
+		while (*end == ',')
+			end++;
+
+		device = udev_device_new_from_subsystem_sysname(b->udev,
+								"drm", name);
+		if (!device) {
+			weston_log("no drm device %s\n", name);
+			continue;
+		}
+
+		if (strcmp(udev_device_get_syspath(device),
+			   udev_device_get_syspath(primary)) == 0) {
+			udev_device_unref(device);
+			continue;
+		}
+
+		dev = zalloc(sizeof *dev);
+		if (!dev || drm_device_open(b, dev, device) < 0) {
+			udev_device_unref(device);
+			free(dev);
+			continue;
+		}
+		dev->udev_device = device;
+		wl_list_insert(b->secondary_devices.prev, &dev->link);
+
+		if (drmGetCap(dev->fd, DRM_CAP_DUMB_BUFFER, &cap) < 0 ||
+		    cap == 0) {
+			weston_log("%s has no dumb buffers, skipping\n",
+				   dev->filename);
+			drm_device_destroy(dev);
+		}
+	}
+}
+
+static int
+init_drm(struct drm_backend *b, struct udev_device *device)
+{
+	uint64_t cap;
+	int fd, ret;
+	clockid_t clk_id;
+
+	if (drm_device_open(b, &b->drm, device) < 0)
+		return -1;
+
+	fd = b->drm.fd;
 
 	ret = drmGetCap(fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap);
 	if (ret == 0 && cap == 1)
@@ -1397,6 +2793,12 @@ init_drm(struct drm_backend *b, struct udev_device *device)
 	else
 		b->cursor_height = 64;
 
+#ifdef HAVE_DRM_ATOMIC
+	drm_backend_init_atomic(b);
+#endif
+	weston_log("atomic modesetting: %s\n",
+		   b->atomic_modeset ? "yes" : "no");
+
 	return 0;
 }
 
@@ -1606,13 +3008,11 @@ static void
 drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 {
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct weston_compositor *ec = output_base->compositor;
-	struct drm_backend *b = (struct drm_backend *)ec->backend;
 
 	if (!output->dpms_prop)
 		return;
 
-	drmModeConnectorSetProperty(b->drm.fd, output->connector_id,
+	drmModeConnectorSetProperty(output->dev->fd, output->connector_id,
 				    output->dpms_prop->prop_id, level);
 }
 
@@ -1635,7 +3035,7 @@ static const char *connector_type_names[] = {
 };
 
 static int
-find_crtc_for_connector(struct drm_backend *b,
+find_crtc_for_connector(struct drm_device *dev,
 			drmModeRes *resources, drmModeConnector *connector)
 {
 	drmModeEncoder *encoder;
@@ -1643,7 +3043,7 @@ find_crtc_for_connector(struct drm_backend *b,
 	int i, j;
 
 	for (j = 0; j < connector->count_encoders; j++) {
-		encoder = drmModeGetEncoder(b->drm.fd, connector->encoders[j]);
+		encoder = drmModeGetEncoder(dev->fd, connector->encoders[j]);
 		if (encoder == NULL) {
 			weston_log("Failed to get encoder.\n");
 			return -1;
@@ -1653,7 +3053,7 @@ find_crtc_for_connector(struct drm_backend *b,
 
 		for (i = 0; i < resources->count_crtcs; i++) {
 			if (possible_crtcs & (1 << i) &&
-			    !(b->crtc_allocator & (1 << resources->crtcs[i])))
+			    !(dev->crtc_allocator & (1 << resources->crtcs[i])))
 				return i;
 		}
 	}
@@ -1669,7 +3069,7 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		output->format,
 		fallback_format_for(output->format),
 	};
-	int i, flags, n_formats = 1;
+	int n_formats = 1;
 
 	output->surface = gbm_surface_create(b->gbm,
 					     output->base.current_mode->width,
@@ -1695,18 +3095,19 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		return -1;
 	}
 
-	flags = GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE;
-
-	for (i = 0; i < 2; i++) {
-		if (output->cursor_bo[i])
-			continue;
-
-		output->cursor_bo[i] =
-			gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
-				GBM_FORMAT_ARGB8888, flags);
+	if (output->dev != &b->drm) {
+		if (drm_output_init_copy(output) < 0) {
+			weston_log("failed to create copy buffers\n");
+			gl_renderer->output_destroy(&output->base);
+			gbm_surface_destroy(output->surface);
+			return -1;
+		}
+		return 0;
 	}
 
-	if (output->cursor_bo[0] == NULL || output->cursor_bo[1] == NULL) {
+	/* The other cursor bos are created on demand */
+	if (wl_list_empty(&b->cursor_cache) &&
+	    drm_cursor_image_create(b) == NULL) {
 		weston_log("cursor buffers unavailable, using gl cursors\n");
 		b->cursors_are_broken = 1;
 	}
@@ -1714,17 +3115,22 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 	return 0;
 }
 
+/* Creates the dumb buffers an output is shown from when it is rendered
+ * by pixman, or lives on a secondary device. */
 static int
-drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
+drm_output_init_dumb(struct drm_output *output)
 {
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
 	int w = output->base.current_mode->width;
 	int h = output->base.current_mode->height;
-	unsigned int i;
+	int i;
 
-	/* FIXME error checking */
+	output->num_dumb = b->num_dumb;
+	output->current_image = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
-		output->dumb[i] = drm_fb_create_dumb(b, w, h);
+	for (i = 0; i < output->num_dumb; i++) {
+		output->dumb[i] = drm_fb_create_dumb(output->dev, w, h);
 		if (!output->dumb[i])
 			goto err;
 
@@ -1736,16 +3142,16 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
-		goto err;
-
-	pixman_region32_init_rect(&output->previous_damage,
-				  output->base.x, output->base.y, output->base.width, output->base.height);
+	for (i = 0; i < output->num_dumb; i++)
+		pixman_region32_init_rect(&output->dumb_damage[i],
+					  output->base.x, output->base.y,
+					  output->base.width,
+					  output->base.height);
 
 	return 0;
 
 err:
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+	for (i = 0; i < output->num_dumb; i++) {
 		if (output->dumb[i])
 			drm_fb_destroy_dumb(output->dumb[i]);
 		if (output->image[i])
@@ -1759,14 +3165,12 @@ err:
 }
 
 static void
-drm_output_fini_pixman(struct drm_output *output)
+drm_output_fini_dumb(struct drm_output *output)
 {
-	unsigned int i;
-
-	pixman_renderer_output_destroy(&output->base);
-	pixman_region32_fini(&output->previous_damage);
+	int i;
 
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+	for (i = 0; i < output->num_dumb; i++) {
+		pixman_region32_fini(&output->dumb_damage[i]);
 		drm_fb_destroy_dumb(output->dumb[i]);
 		pixman_image_unref(output->image[i]);
 		output->dumb[i] = NULL;
@@ -1774,6 +3178,69 @@ drm_output_fini_pixman(struct drm_output *output)
 	}
 }
 
+static int
+drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
+{
+	if (drm_output_init_dumb(output) < 0)
+		return -1;
+
+	if (pixman_renderer_output_create(&output->base) < 0) {
+		drm_output_fini_dumb(output);
+		return -1;
+	}
+
+	drm_output_init_render_thread(output);
+
+	return 0;
+}
+
+static void
+drm_output_fini_pixman(struct drm_output *output)
+{
+	drm_output_fini_render_thread(output);
+	pixman_renderer_output_destroy(&output->base);
+	drm_output_fini_dumb(output);
+}
+
+/* With the GL renderer, an output on a secondary device is rendered on
+ * the primary one as usual, and then read back into dumb buffers on its
+ * own device. The dumb buffers are kept when switching from pixman. */
+static int
+drm_output_init_copy(struct drm_output *output)
+{
+	int w = output->base.current_mode->width;
+	int h = output->base.current_mode->height;
+
+	if (!output->dumb[0] && drm_output_init_dumb(output) < 0)
+		return -1;
+
+	output->copy_buf = malloc(w * h * 4);
+	if (!output->copy_buf) {
+		drm_output_fini_dumb(output);
+		return -1;
+	}
+
+	pixman_region32_init(&output->copy_damage);
+	output->copy_frame_listener.notify = drm_output_copy_frame_notify;
+	wl_signal_add(&output->base.frame_signal,
+		      &output->copy_frame_listener);
+
+	return 0;
+}
+
+static void
+drm_output_fini_copy(struct drm_output *output)
+{
+	if (!output->copy_buf)
+		return;
+
+	wl_list_remove(&output->copy_frame_listener.link);
+	pixman_region32_fini(&output->copy_damage);
+	free(output->copy_buf);
+	output->copy_buf = NULL;
+	drm_output_fini_dumb(output);
+}
+
 static void
 edid_parse_string(const uint8_t *data, char text[])
 {
@@ -1870,8 +3337,7 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
 }
 
 static void
-find_and_parse_output_edid(struct drm_backend *b,
-			   struct drm_output *output,
+find_and_parse_output_edid(struct drm_output *output,
 			   drmModeConnector *connector)
 {
 	drmModePropertyBlobPtr edid_blob = NULL;
@@ -1880,12 +3346,13 @@ find_and_parse_output_edid(struct drm_backend *b,
 	int rc;
 
 	for (i = 0; i < connector->count_props && !edid_blob; i++) {
-		property = drmModeGetProperty(b->drm.fd, connector->props[i]);
+		property = drmModeGetProperty(output->dev->fd,
+					      connector->props[i]);
 		if (!property)
 			continue;
 		if ((property->flags & DRM_MODE_PROP_BLOB) &&
 		    !strcmp(property->name, "EDID")) {
-			edid_blob = drmModeGetPropertyBlob(b->drm.fd,
+			edid_blob = drmModeGetPropertyBlob(output->dev->fd,
 							   connector->prop_values[i]);
 		}
 		drmModeFreeProperty(property);
@@ -2004,8 +3471,131 @@ get_gbm_format_from_section(struct weston_config_section *section,
 	return ret;
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static uint32_t
+drm_get_object_prop(int fd, uint32_t object_id, uint32_t object_type,
+		    const char *name, uint64_t *value)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	uint32_t i, prop_id = 0;
+
+	props = drmModeObjectGetProperties(fd, object_id, object_type);
+	if (!props)
+		return 0;
+
+	for (i = 0; i < props->count_props && prop_id == 0; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, name)) {
+			prop_id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return prop_id;
+}
+
+static int
+drm_sprite_get_props(struct drm_backend *b, struct drm_sprite *sprite)
+{
+	struct drm_plane_props *p = &sprite->props;
+	const struct {
+		const char *name;
+		uint32_t *prop_id;
+	} props[] = {
+		{ "FB_ID", &p->fb_id },
+		{ "CRTC_ID", &p->crtc_id },
+		{ "SRC_X", &p->src_x },
+		{ "SRC_Y", &p->src_y },
+		{ "SRC_W", &p->src_w },
+		{ "SRC_H", &p->src_h },
+		{ "CRTC_X", &p->crtc_x },
+		{ "CRTC_Y", &p->crtc_y },
+		{ "CRTC_W", &p->crtc_w },
+		{ "CRTC_H", &p->crtc_h },
+	};
+	uint64_t type;
+	unsigned int i;
+
+	if (!drm_get_object_prop(b->drm.fd, sprite->plane_id,
+				 DRM_MODE_OBJECT_PLANE, "type", &type))
+		return -1;
+	sprite->type = type;
+
+	for (i = 0; i < ARRAY_LENGTH(props); i++) {
+		*props[i].prop_id =
+			drm_get_object_prop(b->drm.fd, sprite->plane_id,
+					    DRM_MODE_OBJECT_PLANE,
+					    props[i].name, NULL);
+		if (*props[i].prop_id == 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static struct drm_sprite *
+drm_output_claim_sprite(struct drm_output *output, enum drm_sprite_type type)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != type || s->output ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		s->output = output;
+		return s;
+	}
+
+	return NULL;
+}
+
+/* Finds the property ids and planes an output needs for atomic commits.
+ * Each CRTC has a primary plane; a cursor plane is optional. */
 static int
-create_output_for_connector(struct drm_backend *b,
+drm_output_init_atomic(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+
+	output->crtc_prop_mode_id =
+		drm_get_object_prop(b->drm.fd, output->crtc_id,
+				    DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+	output->crtc_prop_active =
+		drm_get_object_prop(b->drm.fd, output->crtc_id,
+				    DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+	output->connector_prop_crtc_id =
+		drm_get_object_prop(b->drm.fd, output->connector_id,
+				    DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+	if (!output->crtc_prop_mode_id || !output->crtc_prop_active ||
+	    !output->connector_prop_crtc_id)
+		return -1;
+
+	output->primary_sprite =
+		drm_output_claim_sprite(output, DRM_SPRITE_PRIMARY);
+	if (!output->primary_sprite)
+		return -1;
+
+	output->cursor_sprite =
+		drm_output_claim_sprite(output, DRM_SPRITE_CURSOR);
+
+	return 0;
+}
+#endif
+
+static int
+create_output_for_connector(struct drm_backend *b, struct drm_device *dev,
 			    drmModeRes *resources,
 			    drmModeConnector *connector,
 			    int x, int y, struct udev_device *drm_device)
@@ -2023,7 +3613,7 @@ create_output_for_connector(struct drm_backend *b,
 	enum output_config config;
 	uint32_t transform;
 
-	i = find_crtc_for_connector(b, resources, connector);
+	i = find_crtc_for_connector(dev, resources, connector);
 	if (i < 0) {
 		weston_log("No usable crtc/encoder pair for connector.\n");
 		return -1;
@@ -2033,6 +3623,7 @@ create_output_for_connector(struct drm_backend *b,
 	if (output == NULL)
 		return -1;
 
+	output->dev = dev;
 	output->base.subpixel = drm_subpixel_to_wayland(connector->subpixel);
 	output->base.make = "unknown";
 	output->base.model = "unknown";
@@ -2085,19 +3676,19 @@ create_output_for_connector(struct drm_backend *b,
 
 	output->crtc_id = resources->crtcs[i];
 	output->pipe = i;
-	b->crtc_allocator |= (1 << output->crtc_id);
+	dev->crtc_allocator |= (1 << output->crtc_id);
 	output->connector_id = connector->connector_id;
-	b->connector_allocator |= (1 << output->connector_id);
+	dev->connector_allocator |= (1 << output->connector_id);
 
-	output->original_crtc = drmModeGetCrtc(b->drm.fd, output->crtc_id);
-	output->dpms_prop = drm_get_prop(b->drm.fd, connector, "DPMS");
+	output->original_crtc = drmModeGetCrtc(dev->fd, output->crtc_id);
+	output->dpms_prop = drm_get_prop(dev->fd, connector, "DPMS");
 
 	/* Get the current mode on the crtc that's currently driving
 	 * this connector. */
-	encoder = drmModeGetEncoder(b->drm.fd, connector->encoder_id);
+	encoder = drmModeGetEncoder(dev->fd, connector->encoder_id);
 	memset(&crtc_mode, 0, sizeof crtc_mode);
 	if (encoder != NULL) {
-		crtc = drmModeGetCrtc(b->drm.fd, encoder->crtc_id);
+		crtc = drmModeGetCrtc(dev->fd, encoder->crtc_id);
 		drmModeFreeEncoder(encoder);
 		if (crtc == NULL)
 			goto err_free;
@@ -2114,7 +3705,7 @@ create_output_for_connector(struct drm_backend *b,
 
 	if (config == OUTPUT_CONFIG_OFF) {
 		weston_log("Disabling output %s\n", output->base.name);
-		drmModeSetCrtc(b->drm.fd, output->crtc_id,
+		drmModeSetCrtc(dev->fd, output->crtc_id,
 			       0, 0, 0, 0, 0, NULL);
 		goto err_free;
 	}
@@ -2173,6 +3764,15 @@ create_output_for_connector(struct drm_backend *b,
 			   connector->mmWidth, connector->mmHeight,
 			   transform, scale);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (b->atomic_modeset && dev == &b->drm &&
+	    drm_output_init_atomic(output) < 0) {
+		weston_log("No primary plane for atomic modesetting on %s\n",
+			   output->base.name);
+		goto err_output;
+	}
+#endif
+
 	if (b->use_pixman) {
 		if (drm_output_init_pixman(output, b) < 0) {
 			weston_log("Failed to init output pixman state\n");
@@ -2196,7 +3796,7 @@ create_output_for_connector(struct drm_backend *b,
 
 	weston_compositor_add_output(b->compositor, &output->base);
 
-	find_and_parse_output_edid(b, output, connector);
+	find_and_parse_output_edid(output, connector);
 	if (connector->connector_type == DRM_MODE_CONNECTOR_LVDS)
 		output->base.connection_internal = 1;
 
@@ -2217,8 +3817,10 @@ create_output_for_connector(struct drm_backend *b,
 	weston_compositor_stack_plane(b->compositor, &output->fb_plane,
 				      &b->compositor->primary_plane);
 
-	weston_log("Output %s, (connector %d, crtc %d)\n",
-		   output->base.name, output->connector_id, output->crtc_id);
+	weston_log("Output %s, (connector %d, crtc %d)%s%s\n",
+		   output->base.name, output->connector_id, output->crtc_id,
+		   dev != &b->drm ? ", on " : "",
+		   dev != &b->drm ? dev->filename : "");
 	wl_list_for_each(m, &output->base.mode_list, link)
 		weston_log_continue(STAMP_SPACE "mode %dx%d@%.1f%s%s%s\n",
 				    m->width, m->height, m->refresh / 1000.0,
@@ -2238,6 +3840,7 @@ create_output_for_connector(struct drm_backend *b,
 err_output:
 	weston_output_destroy(&output->base);
 err_free:
+	drm_output_unclaim_sprites(output);
 	wl_list_for_each_safe(drm_mode, next, &output->base.mode_list,
 							base.link) {
 		wl_list_remove(&drm_mode->base.link);
@@ -2245,8 +3848,8 @@ err_free:
 	}
 
 	drmModeFreeCrtc(output->original_crtc);
-	b->crtc_allocator &= ~(1 << output->crtc_id);
-	b->connector_allocator &= ~(1 << output->connector_id);
+	dev->crtc_allocator &= ~(1 << output->crtc_id);
+	dev->connector_allocator &= ~(1 << output->connector_id);
 	free(output);
 
 	return -1;
@@ -2290,6 +3893,16 @@ create_sprites(struct drm_backend *b)
 		memcpy(sprite->formats, plane->formats,
 		       plane->count_formats * sizeof(plane->formats[0]));
 		drmModeFreePlane(plane);
+
+#ifdef HAVE_DRM_ATOMIC
+		if (b->atomic_modeset &&
+		    drm_sprite_get_props(b, sprite) < 0) {
+			weston_log("plane %d is missing properties, "
+				   "not using it\n", sprite->plane_id);
+			free(sprite);
+			continue;
+		}
+#endif
 		weston_plane_init(&sprite->plane, b->compositor, 0, 0);
 		weston_compositor_stack_plane(b->compositor, &sprite->plane,
 					      &b->compositor->primary_plane);
@@ -2306,14 +3919,18 @@ destroy_sprites(struct drm_backend *backend)
 	struct drm_sprite *sprite, *next;
 	struct drm_output *output;
 
+	wl_list_for_each(output, &backend->compositor->output_list, base.link)
+		drm_output_unclaim_sprites(output);
+
 	output = container_of(backend->compositor->output_list.next,
 			      struct drm_output, base.link);
 
 	wl_list_for_each_safe(sprite, next, &backend->sprite_list, link) {
-		drmModeSetPlane(backend->drm.fd,
-				sprite->plane_id,
-				output->crtc_id, 0, 0,
-				0, 0, 0, 0, 0, 0, 0, 0);
+		if (sprite->type == DRM_SPRITE_OVERLAY)
+			drmModeSetPlane(backend->drm.fd,
+					sprite->plane_id,
+					output->crtc_id, 0, 0,
+					0, 0, 0, 0, 0, 0, 0, 0);
 		drm_output_release_fb(output, sprite->current);
 		drm_output_release_fb(output, sprite->next);
 		weston_plane_release(&sprite->plane);
@@ -2321,10 +3938,15 @@ destroy_sprites(struct drm_backend *backend)
 	}
 }
 
+static void
+update_outputs(struct drm_backend *b, struct drm_device *dev,
+	       struct udev_device *drm_device);
+
 static int
 create_outputs(struct drm_backend *b, uint32_t option_connector,
 	       struct udev_device *drm_device)
 {
+	struct drm_device *dev;
 	drmModeConnector *connector;
 	drmModeRes *resources;
 	int i;
@@ -2359,7 +3981,7 @@ create_outputs(struct drm_backend *b, uint32_t option_connector,
 		if (connector->connection == DRM_MODE_CONNECTED &&
 		    (option_connector == 0 ||
 		     connector->connector_id == option_connector)) {
-			if (create_output_for_connector(b, resources,
+			if (create_output_for_connector(b, &b->drm, resources,
 							connector, x, y,
 							drm_device) < 0) {
 				drmModeFreeConnector(connector);
@@ -2374,6 +3996,10 @@ create_outputs(struct drm_backend *b, uint32_t option_connector,
 		drmModeFreeConnector(connector);
 	}
 
+	/* Outputs of secondary devices go to the right of the others */
+	wl_list_for_each(dev, &b->secondary_devices, link)
+		update_outputs(b, dev, dev->udev_device);
+
 	if (wl_list_empty(&b->compositor->output_list)) {
 		weston_log("No currently active connector found.\n");
 		drmModeFreeResources(resources);
@@ -2385,8 +4011,24 @@ create_outputs(struct drm_backend *b, uint32_t option_connector,
 	return 0;
 }
 
+static int
+drm_backend_has_outputs(struct drm_backend *b)
+{
+	struct drm_device *dev;
+
+	if (b->drm.connector_allocator)
+		return 1;
+
+	wl_list_for_each(dev, &b->secondary_devices, link)
+		if (dev->connector_allocator)
+			return 1;
+
+	return 0;
+}
+
 static void
-update_outputs(struct drm_backend *b, struct udev_device *drm_device)
+update_outputs(struct drm_backend *b, struct drm_device *dev,
+	       struct udev_device *drm_device)
 {
 	drmModeConnector *connector;
 	drmModeRes *resources;
@@ -2395,7 +4037,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	uint32_t connected = 0, disconnects = 0;
 	int i;
 
-	resources = drmModeGetResources(b->drm.fd);
+	resources = drmModeGetResources(dev->fd);
 	if (!resources) {
 		weston_log("drmModeGetResources failed\n");
 		return;
@@ -2405,7 +4047,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	for (i = 0; i < resources->count_connectors; i++) {
 		int connector_id = resources->connectors[i];
 
-		connector = drmModeGetConnector(b->drm.fd, connector_id);
+		connector = drmModeGetConnector(dev->fd, connector_id);
 		if (connector == NULL)
 			continue;
 
@@ -2416,7 +4058,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 
 		connected |= (1 << connector_id);
 
-		if (!(b->connector_allocator & (1 << connector_id))) {
+		if (!(dev->connector_allocator & (1 << connector_id))) {
 			struct weston_output *last =
 				container_of(b->compositor->output_list.prev,
 					     struct weston_output, link);
@@ -2427,7 +4069,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 			else
 				x = 0;
 			y = 0;
-			create_output_for_connector(b, resources,
+			create_output_for_connector(b, dev, resources,
 						    connector, x, y,
 						    drm_device);
 			weston_log("connector %d connected\n", connector_id);
@@ -2437,11 +4079,12 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	}
 	drmModeFreeResources(resources);
 
-	disconnects = b->connector_allocator & ~connected;
+	disconnects = dev->connector_allocator & ~connected;
 	if (disconnects) {
 		wl_list_for_each_safe(output, next, &b->compositor->output_list,
 				      base.link) {
-			if (disconnects & (1 << output->connector_id)) {
+			if (output->dev == dev &&
+			    disconnects & (1 << output->connector_id)) {
 				disconnects &= ~(1 << output->connector_id);
 				weston_log("connector %d disconnected\n",
 				       output->connector_id);
@@ -2451,25 +4094,37 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	}
 
 	/* FIXME: handle zero outputs, without terminating */
-	if (b->connector_allocator == 0)
+	if (!drm_backend_has_outputs(b))
 		weston_compositor_exit(b->compositor);
 }
 
-static int
-udev_event_is_hotplug(struct drm_backend *b, struct udev_device *device)
+/* Returns the device a hotplug event is for, if it is one of ours */
+static struct drm_device *
+udev_event_get_hotplug_device(struct drm_backend *b,
+			      struct udev_device *device)
 {
+	struct drm_device *dev;
 	const char *sysnum;
 	const char *val;
+	int id;
 
 	sysnum = udev_device_get_sysnum(device);
-	if (!sysnum || atoi(sysnum) != b->drm.id)
-		return 0;
+	if (!sysnum)
+		return NULL;
 
 	val = udev_device_get_property_value(device, "HOTPLUG");
-	if (!val)
-		return 0;
+	if (!val || strcmp(val, "1") != 0)
+		return NULL;
 
-	return strcmp(val, "1") == 0;
+	id = atoi(sysnum);
+	if (id == b->drm.id)
+		return &b->drm;
+
+	wl_list_for_each(dev, &b->secondary_devices, link)
+		if (id == dev->id)
+			return dev;
+
+	return NULL;
 }
 
 static int
@@ -2477,11 +4132,13 @@ udev_drm_event(int fd, uint32_t mask, void *data)
 {
 	struct drm_backend *b = data;
 	struct udev_device *event;
+	struct drm_device *dev;
 
 	event = udev_monitor_receive_device(b->udev_monitor);
 
-	if (udev_event_is_hotplug(b, event))
-		update_outputs(b, event);
+	dev = udev_event_get_hotplug_device(b, event);
+	if (dev)
+		update_outputs(b, dev, event);
 
 	udev_device_unref(event);
 
@@ -2502,12 +4159,15 @@ drm_destroy(struct weston_compositor *ec)
 	udev_input_destroy(&b->input);
 
 	wl_event_source_remove(b->udev_drm_source);
-	wl_event_source_remove(b->drm_source);
+	wl_event_source_remove(b->drm.source);
 
 	destroy_sprites(b);
 
 	weston_compositor_shutdown(ec);
 
+	drm_backend_destroy_cursor_cache(b);
+	drm_backend_destroy_secondary_devices(b);
+
 	if (b->gbm)
 		gbm_device_destroy(b->gbm);
 
@@ -2537,7 +4197,7 @@ drm_backend_set_modes(struct drm_backend *backend)
 		}
 
 		drm_mode = (struct drm_mode *) output->base.current_mode;
-		ret = drmModeSetCrtc(backend->drm.fd, output->crtc_id,
+		ret = drmModeSetCrtc(output->dev->fd, output->crtc_id,
 				     output->current->fb_id, 0, 0,
 				     &output->connector_id, 1,
 				     &drm_mode->mode_info);
@@ -2550,6 +4210,24 @@ drm_backend_set_modes(struct drm_backend *backend)
 	}
 }
 
+/* Takes back drm master of a secondary device. Under logind, the
+ * session resumes every device it handed out, master included, and
+ * drmSetMaster() would fail; a device that cannot be taken back only
+ * loses its outputs. */
+static void
+drm_device_set_master(struct drm_device *dev)
+{
+	drm_magic_t magic;
+
+	if (drmGetMagic(dev->fd, &magic) == 0 &&
+	    drmAuthMagic(dev->fd, magic) == 0)
+		return;
+
+	if (drmSetMaster(dev->fd) < 0)
+		weston_log("failed to become drm master of %s, "
+			   "its outputs stay off: %m\n", dev->filename);
+}
+
 static void
 session_notify(struct wl_listener *listener, void *data)
 {
@@ -2557,9 +4235,12 @@ session_notify(struct wl_listener *listener, void *data)
 	struct drm_backend *b = (struct drm_backend *)compositor->backend;
 	struct drm_sprite *sprite;
 	struct drm_output *output;
+	struct drm_device *dev;
 
 	if (compositor->session_active) {
 		weston_log("activating session\n");
+		wl_list_for_each(dev, &b->secondary_devices, link)
+			drm_device_set_master(dev);
 		compositor->state = b->prev_state;
 		drm_backend_set_modes(b);
 		weston_compositor_damage_all(compositor);
@@ -2581,17 +4262,27 @@ session_notify(struct wl_listener *listener, void *data)
 
 		wl_list_for_each(output, &compositor->output_list, base.link) {
 			output->base.repaint_needed = 0;
-			drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+			drmModeSetCursor(output->dev->fd, output->crtc_id,
+					 0, 0, 0);
+			drm_output_set_cursor_image(output, NULL);
+			drm_output_release_cursor_image(output, 1);
 		}
 
+		wl_list_for_each(dev, &b->secondary_devices, link)
+			drmDropMaster(dev->fd);
+
 		output = container_of(compositor->output_list.next,
 				      struct drm_output, base.link);
 
-		wl_list_for_each(sprite, &b->sprite_list, link)
+		wl_list_for_each(sprite, &b->sprite_list, link) {
+			if (sprite->type != DRM_SPRITE_OVERLAY)
+				continue;
+
 			drmModeSetPlane(b->drm.fd,
 					sprite->plane_id,
 					output->crtc_id, 0, 0,
 					0, 0, 0, 0, 0, 0, 0, 0);
+		}
 	};
 }
 
@@ -2679,6 +4370,28 @@ planes_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data
 	}
 }
 
+static void
+dumb_stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		   void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_output *output;
+
+	weston_log("dumb buffer copies per output:\n");
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		if (!output->dumb[0])
+			continue;
+
+		weston_log_continue(STAMP_SPACE "%s: %d buffers, %" PRIu64
+				    " bytes in the last frame, %" PRIu64
+				    " bytes in %u frames\n",
+				    output->base.name, output->num_dumb,
+				    output->copy_stats.bytes_copied,
+				    output->copy_stats.total_bytes_copied,
+				    output->copy_stats.frames);
+	}
+}
+
 #ifdef BUILD_VAAPI_RECORDER
 static void
 recorder_destroy(struct drm_output *output)
@@ -2757,6 +4470,12 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 			return;
 		}
 
+		if (output->dev != &b->drm) {
+			weston_log("failed to start vaapi recorder: "
+				   "output is not on the primary device\n");
+			return;
+		}
+
 		width = output->base.current_mode->width;
 		height = output->base.current_mode->height;
 
@@ -2806,8 +4525,11 @@ switch_to_gl_renderer(struct drm_backend *b)
 		return;
 	}
 
-	wl_list_for_each(output, &b->compositor->output_list, base.link)
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		drm_output_finish_render(output, 1);
+		drm_output_fini_render_thread(output);
 		pixman_renderer_output_destroy(&output->base);
+	}
 
 	b->compositor->renderer->destroy(b->compositor);
 
@@ -2842,8 +4564,9 @@ drm_backend_create(struct weston_compositor *compositor,
 	struct drm_backend *b;
 	struct weston_config_section *section;
 	struct udev_device *drm_device;
+	struct drm_device *dev;
 	struct wl_event_loop *loop;
-	const char *path;
+	const char *path, *str;
 	uint32_t key;
 
 	weston_log("initializing drm backend\n");
@@ -2859,11 +4582,13 @@ drm_backend_create(struct weston_compositor *compositor,
 	 * waits for vblanks which means dropping the compositor framerate
 	 * to a fraction.
 	 *
-	 * These can be enabled again when nuclear/atomic support lands.
+	 * They are enabled again in drm_backend_init_atomic(), when the
+	 * device supports atomic modesetting.
 	 */
 	b->sprites_are_broken = 1;
 	b->cursors_are_broken = 1;
 	b->compositor = compositor;
+	wl_list_init(&b->secondary_devices);
 
 	section = weston_config_get_section(config, "core", NULL, NULL);
 	if (get_gbm_format_from_section(section,
@@ -2873,6 +4598,18 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	b->use_pixman = param->use_pixman;
 
+	b->num_dumb = param->dumb_buffers;
+	if (b->num_dumb < 2 || b->num_dumb > DRM_OUTPUT_MAX_DUMB) {
+		weston_log("%d dumb buffers not supported, using 2\n",
+			   b->num_dumb);
+		b->num_dumb = 2;
+	}
+
+	/* Rendering on a thread per output can be turned off with
+	 * WESTON_DRM_RENDER_THREADS=0. */
+	str = getenv("WESTON_DRM_RENDER_THREADS");
+	b->render_threads = b->use_pixman && !(str && strcmp(str, "0") == 0);
+
 	/* Check if we run drm-backend using weston-launch */
 	compositor->launcher = weston_launcher_connect(compositor, param->tty,
 						       param->seat_id, true);
@@ -2898,6 +4635,11 @@ drm_backend_create(struct weston_compositor *compositor,
 	}
 	path = udev_device_get_syspath(drm_device);
 
+	/* The launcher drops and sets master on VT switches for the drm
+	 * device opened last, so the primary one is opened after these. */
+	drm_backend_open_secondary_devices(b, param->additional_devices,
+					   drm_device);
+
 	if (init_drm(b, drm_device) < 0) {
 		weston_log("failed to initialize kms\n");
 		goto err_udev_dev;
@@ -2927,6 +4669,7 @@ drm_backend_create(struct weston_compositor *compositor,
 
 	wl_list_init(&b->sprite_list);
 	create_sprites(b);
+	wl_list_init(&b->cursor_cache);
 
 	if (udev_input_init(&b->input,
 			    compositor, b->udev, param->seat_id) < 0) {
@@ -2947,9 +4690,13 @@ drm_backend_create(struct weston_compositor *compositor,
 	path = NULL;
 
 	loop = wl_display_get_event_loop(compositor->wl_display);
-	b->drm_source =
+	b->drm.source =
 		wl_event_loop_add_fd(loop, b->drm.fd,
 				     WL_EVENT_READABLE, on_drm_input, b);
+	wl_list_for_each(dev, &b->secondary_devices, link)
+		dev->source =
+			wl_event_loop_add_fd(loop, dev->fd, WL_EVENT_READABLE,
+					     on_drm_input, b);
 
 	b->udev_monitor = udev_monitor_new_from_netlink(b->udev, "udev");
 	if (b->udev_monitor == NULL) {
@@ -2980,6 +4727,8 @@ drm_backend_create(struct weston_compositor *compositor,
 					    recorder_binding, b);
 	weston_compositor_add_debug_binding(compositor, KEY_W,
 					    renderer_switch_binding, b);
+	weston_compositor_add_debug_binding(compositor, KEY_B,
+					    dumb_stats_binding, b);
 
 	compositor->backend = &b->base;
 	return b;
@@ -2988,14 +4737,16 @@ err_udev_monitor:
 	wl_event_source_remove(b->udev_drm_source);
 	udev_monitor_unref(b->udev_monitor);
 err_drm_source:
-	wl_event_source_remove(b->drm_source);
+	wl_event_source_remove(b->drm.source);
 err_udev_input:
 	udev_input_destroy(&b->input);
 err_sprite:
 	compositor->renderer->destroy(compositor);
+	drm_backend_destroy_cursor_cache(b);
 	gbm_device_destroy(b->gbm);
 	destroy_sprites(b);
 err_udev_dev:
+	drm_backend_destroy_secondary_devices(b);
 	udev_device_unref(drm_device);
 err_launcher:
 	weston_launcher_destroy(compositor->launcher);
@@ -3021,9 +4772,14 @@ backend_init(struct weston_compositor *compositor, int *argc, char *argv[],
 		{ WESTON_OPTION_INTEGER, "tty", 0, &param.tty },
 		{ WESTON_OPTION_BOOLEAN, "current-mode", 0, &option_current_mode },
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &param.use_pixman },
+		{ WESTON_OPTION_INTEGER, "dumb-buffers", 0,
+		  &param.dumb_buffers },
+		{ WESTON_OPTION_STRING, "additional-devices", 0,
+		  &param.additional_devices },
 	};
 
 	param.seat_id = default_seat;
+	param.dumb_buffers = 2;
 
 	parse_options(drm_options, ARRAY_LENGTH(drm_options), argc, argv);
 
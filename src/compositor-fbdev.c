@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -58,12 +59,15 @@ struct fbdev_backend {
 	struct udev *udev;
 	struct udev_input input;
 	int use_pixman;
+	int use_panning;
 	struct wl_listener session_listener;
 };
 
 struct fbdev_screeninfo {
 	unsigned int x_resolution; /* pixels, visible area */
 	unsigned int y_resolution; /* pixels, visible area */
+	unsigned int y_virtual; /* pixels, all of the frame buffer */
+	unsigned int y_panstep; /* pixels, 0 if panning is not supported */
 	unsigned int width_mm; /* visible screen width in mm */
 	unsigned int height_mm; /* visible screen height in mm */
 	unsigned int bits_per_pixel;
@@ -87,9 +91,18 @@ struct fbdev_output {
 	const char *device; /* ownership shared with fbdev_parameters */
 	struct fbdev_screeninfo fb_info;
 	void *fb; /* length is fb_info.buffer_length */
-
-	/* pixman details. */
-	pixman_image_t *hw_surface;
+	int fb_fd; /* kept open for panning while mapped */
+
+	/* pixman details. With panning, frames alternate between the two
+	 * halves of the frame buffer. Each half collects the damage of the
+	 * frames shown since it was last written to, so only that is
+	 * copied into it from the shadow. Once panning has failed, the
+	 * half left on screen is the only surface, at index 0. */
+	pixman_image_t *hw_surface[2];
+	pixman_region32_t hw_damage[2];
+	int num_hw_surfaces;
+	int current_hw_surface; /* the one on screen */
+	int needs_repaint; /* forced from the next finish_frame_handler() */
 	pixman_image_t *shadow_surface;
 	void *shadow_buf;
 	uint8_t depth;
@@ -126,20 +139,79 @@ fbdev_output_start_repaint_loop(struct weston_output *output)
 	weston_output_finish_frame(output, &ts, PRESENTATION_FEEDBACK_INVALID);
 }
 
+/* Shows the given half of the frame buffer from the next vblank on, if
+ * the driver honours FB_ACTIVATE_VBL. */
+static int
+fbdev_output_pan(struct fbdev_output *output, int index)
+{
+	struct fb_var_screeninfo varinfo;
+
+	if (ioctl(output->fb_fd, FBIOGET_VSCREENINFO, &varinfo) < 0)
+		return -1;
+
+	varinfo.xoffset = 0;
+	varinfo.yoffset = index * output->fb_info.y_resolution;
+	varinfo.activate = FB_ACTIVATE_VBL;
+
+	return ioctl(output->fb_fd, FBIOPAN_DISPLAY, &varinfo);
+}
+
+/* Keeps drawing into the half of the frame buffer that is on screen,
+ * after a pan to the other one failed. The frame just drawn went to the
+ * hidden half, so the shown one is redrawn from the shadow with the
+ * next repaint. That cannot be scheduled from within the repaint, as
+ * the repaint request would be cleared when it returns. */
+static void
+fbdev_output_stop_panning(struct fbdev_output *output)
+{
+	int shown = output->current_hw_surface;
+	pixman_image_t *surface;
+	pixman_region32_t damage;
+
+	if (shown != 0) {
+		surface = output->hw_surface[0];
+		output->hw_surface[0] = output->hw_surface[shown];
+		output->hw_surface[shown] = surface;
+
+		damage = output->hw_damage[0];
+		output->hw_damage[0] = output->hw_damage[shown];
+		output->hw_damage[shown] = damage;
+	}
+
+	output->num_hw_surfaces = 1;
+	output->current_hw_surface = 0;
+	pixman_region32_union(&output->hw_damage[0], &output->hw_damage[0],
+	                      &output->base.region);
+	output->needs_repaint = 1;
+}
+
 static void
 fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damage)
 {
 	struct fbdev_output *output = to_fbdev_output(base);
 	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t total_damage;
 	pixman_box32_t *rects;
-	int nrects, i;
+	int nrects, i, next;
 
 	/* Repaint the damaged region onto the back buffer. */
 	pixman_renderer_output_set_buffer(base, output->shadow_surface);
 	ec->renderer->repaint_output(base, damage);
 
+	/* Bring the next frame buffer half up to date with the shadow. */
+	for (i = 0; i < output->num_hw_surfaces; i++)
+		pixman_region32_union(&output->hw_damage[i],
+				      &output->hw_damage[i], damage);
+
+	next = (output->current_hw_surface + 1) % output->num_hw_surfaces;
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_intersect(&total_damage, &output->hw_damage[next],
+				  &base->region);
+	pixman_region32_clear(&output->hw_damage[next]);
+
 	/* Transform and composite onto the frame buffer. */
-	rects = pixman_region32_rectangles(damage, &nrects);
+	rects = pixman_region32_rectangles(&total_damage, &nrects);
 
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t transformed_rect;
@@ -154,7 +226,7 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 		pixman_image_composite32(PIXMAN_OP_SRC,
 			output->shadow_surface, /* src */
 			NULL /* mask */,
-			output->hw_surface, /* dest */
+			output->hw_surface[next], /* dest */
 			transformed_rect.x1, /* src_x */
 			transformed_rect.y1, /* src_y */
 			0, 0, /* mask_x, mask_y */
@@ -164,14 +236,27 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 			height /* height */);
 	}
 
+	pixman_region32_fini(&total_damage);
+
+	if (next != output->current_hw_surface &&
+	    fbdev_output_pan(output, next) < 0) {
+		weston_log("Panning frame buffer failed: %s, "
+		           "not double-buffering any more\n", strerror(errno));
+		fbdev_output_stop_panning(output);
+	} else {
+		output->current_hw_surface = next;
+	}
+
 	/* Update the damage region. */
 	pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
 
 	/* Schedule the end of the frame. We do not sync this to the frame
 	 * buffer clock because users who want that should be using the DRM
-	 * compositor. FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires
-	 * panning, which is broken in most kernel drivers.
+	 * compositor. FBIO_WAITFORVSYNC blocks, and FB_ACTIVATE_VBL is
+	 * ignored by many kernel drivers, so the pan may take effect at
+	 * once. The next frame goes to the other half only after this
+	 * timer, by which the pan has been latched in either case.
 	 *
 	 * Finish the frame synchronised to the specified refresh rate. The
 	 * refresh rate is given in mHz and the interval in ms. */
@@ -207,6 +292,12 @@ finish_frame_handler(void *data)
 	struct fbdev_output *output = data;
 	struct timespec ts;
 
+	/* Picked up by weston_output_finish_frame() */
+	if (output->needs_repaint) {
+		output->needs_repaint = 0;
+		weston_output_schedule_repaint(&output->base);
+	}
+
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
 
@@ -331,6 +422,8 @@ fbdev_query_screen_info(struct fbdev_output *output, int fd,
 	/* Store the pertinent data. */
 	info->x_resolution = varinfo.xres;
 	info->y_resolution = varinfo.yres;
+	info->y_virtual = varinfo.yres_virtual;
+	info->y_panstep = fixinfo.ypanstep;
 	info->width_mm = varinfo.width;
 	info->height_mm = varinfo.height;
 	info->bits_per_pixel = varinfo.bits_per_pixel;
@@ -364,6 +457,9 @@ fbdev_set_screen_info(struct fbdev_output *output, int fd,
 	/* Update the information. */
 	varinfo.xres = info->x_resolution;
 	varinfo.yres = info->y_resolution;
+	varinfo.yres_virtual = info->y_virtual;
+	varinfo.xoffset = 0;
+	varinfo.yoffset = 0;
 	varinfo.width = info->width_mm;
 	varinfo.height = info->height_mm;
 	varinfo.bits_per_pixel = info->bits_per_pixel;
@@ -422,14 +518,32 @@ fbdev_frame_buffer_open(struct fbdev_output *output, const char *fb_dev,
 	return fd;
 }
 
-/* Closes the FD on success or failure. */
+/* Double-buffering needs room for two screens in the frame buffer, and
+ * a driver that can pan between them. */
+static int
+fbdev_frame_buffer_can_pan(struct fbdev_output *output)
+{
+	struct fbdev_screeninfo *info = &output->fb_info;
+
+	return output->backend->use_panning &&
+	       info->y_panstep != 0 &&
+	       info->y_resolution % info->y_panstep == 0 &&
+	       info->y_virtual >= 2 * info->y_resolution &&
+	       info->buffer_length >= 2 * info->y_resolution *
+				      info->line_length;
+}
+
+/* Closes the FD on failure, or in fbdev_frame_buffer_destroy(). */
 static int
 fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 {
 	int retval = -1;
+	int i;
 
 	weston_log("Mapping fbdev frame buffer.\n");
 
+	output->fb_fd = fd;
+
 	/* Map the frame buffer. Write-only mode, since we don't want to read
 	 * anything back (because it's slow). */
 	output->fb = mmap(NULL, output->fb_info.buffer_length,
@@ -437,45 +551,99 @@ fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 	if (output->fb == MAP_FAILED) {
 		weston_log("Failed to mmap frame buffer: %s\n",
 		           strerror(errno));
+		output->fb = NULL;
 		goto out_close;
 	}
 
-	/* Create a pixman image to wrap the memory mapped frame buffer. */
-	output->hw_surface =
-		pixman_image_create_bits(output->fb_info.pixel_format,
-		                         output->fb_info.x_resolution,
-		                         output->fb_info.y_resolution,
-		                         output->fb,
-		                         output->fb_info.line_length);
-	if (output->hw_surface == NULL) {
-		weston_log("Failed to create surface for frame buffer.\n");
-		goto out_unmap;
+	/* Panning to the first half also makes sure the driver can pan. */
+	output->num_hw_surfaces = 1;
+	if (fbdev_frame_buffer_can_pan(output) &&
+	    fbdev_output_pan(output, 0) == 0)
+		output->num_hw_surfaces = 2;
+	output->current_hw_surface = 0;
+
+	weston_log("%s frame buffer\n", output->num_hw_surfaces == 2 ?
+		   "Double-buffering with panning in the" :
+		   "Drawing directly to the");
+
+	/* Create pixman images to wrap the memory mapped frame buffer. */
+	for (i = 0; i < output->num_hw_surfaces; i++) {
+		output->hw_surface[i] =
+			pixman_image_create_bits(output->fb_info.pixel_format,
+			                         output->fb_info.x_resolution,
+			                         output->fb_info.y_resolution,
+			                         (uint32_t *) ((uint8_t *) output->fb +
+			                         i * output->fb_info.y_resolution *
+			                         output->fb_info.line_length),
+			                         output->fb_info.line_length);
+		if (output->hw_surface[i] == NULL) {
+			weston_log("Failed to create surface for frame buffer.\n");
+			goto out_unmap;
+		}
+
+		pixman_region32_init(&output->hw_damage[i]);
 	}
 
 	/* Success! */
-	retval = 0;
+	return 0;
 
 out_unmap:
-	if (retval != 0 && output->fb != NULL)
-		fbdev_frame_buffer_destroy(output);
+	fbdev_frame_buffer_destroy(output);
+	return retval;
 
 out_close:
-	if (fd >= 0)
-		close(fd);
+	close(fd);
+	output->fb_fd = -1;
 
 	return retval;
 }
 
+/* Whatever was in the frame buffer has to go. The damage is in global
+ * coordinates, so this needs the output initialised. */
+static void
+fbdev_output_damage_frame_buffer(struct fbdev_output *output)
+{
+	int i;
+
+	for (i = 0; i < output->num_hw_surfaces; i++)
+		pixman_region32_union(&output->hw_damage[i],
+		                      &output->hw_damage[i],
+		                      &output->base.region);
+}
+
 static void
 fbdev_frame_buffer_destroy(struct fbdev_output *output)
 {
+	unsigned int i;
+
 	weston_log("Destroying fbdev frame buffer.\n");
 
-	if (munmap(output->fb, output->fb_info.buffer_length) < 0)
+	for (i = 0; i < ARRAY_LENGTH(output->hw_surface); i++) {
+		if (output->hw_surface[i] == NULL)
+			continue;
+
+		pixman_image_unref(output->hw_surface[i]);
+		output->hw_surface[i] = NULL;
+		pixman_region32_fini(&output->hw_damage[i]);
+	}
+
+	/* Leave the frame buffer the way the console expects it. The
+	 * second half may still be shown after panning failed. */
+	if (output->fb_fd >= 0 && fbdev_frame_buffer_can_pan(output))
+		fbdev_output_pan(output, 0);
+	output->num_hw_surfaces = 0;
+	output->current_hw_surface = 0;
+
+	if (output->fb != NULL &&
+	    munmap(output->fb, output->fb_info.buffer_length) < 0)
 		weston_log("Failed to munmap frame buffer: %s\n",
 		           strerror(errno));
 
 	output->fb = NULL;
+
+	if (output->fb_fd >= 0)
+		close(output->fb_fd);
+	output->fb_fd = -1;
 }
 
 static void fbdev_output_destroy(struct weston_output *base);
@@ -502,6 +670,7 @@ fbdev_output_create(struct fbdev_backend *backend,
 
 	output->backend = backend;
 	output->device = device;
+	output->fb_fd = -1;
 
 	/* Create the frame buffer. */
 	fb_fd = fbdev_frame_buffer_open(output, device, &output->fb_info);
@@ -551,6 +720,7 @@ fbdev_output_create(struct fbdev_backend *backend,
 	                   output->fb_info.height_mm,
 	                   config_transform,
 			   1);
+	fbdev_output_damage_frame_buffer(output);
 
 	width = output->mode.width;
 	height = output->mode.height;
@@ -600,8 +770,6 @@ out_shadow_surface:
 	output->shadow_surface = NULL;
 out_hw_surface:
 	free(output->shadow_buf);
-	pixman_image_unref(output->hw_surface);
-	output->hw_surface = NULL;
 	weston_output_destroy(&output->base);
 	fbdev_frame_buffer_destroy(output);
 out_free:
@@ -653,6 +821,7 @@ compare_screen_info (const struct fbdev_screeninfo *a,
 	    a->y_resolution == b->y_resolution &&
 	    a->width_mm == b->width_mm &&
 	    a->height_mm == b->height_mm &&
+	    a->y_virtual == b->y_virtual &&
 	    a->bits_per_pixel == b->bits_per_pixel &&
 	    a->pixel_format == b->pixel_format &&
 	    a->refresh_rate == b->refresh_rate)
@@ -708,6 +877,7 @@ fbdev_output_reenable(struct fbdev_backend *backend,
 			weston_log("Mapping frame buffer failed.\n");
 			goto err;
 		}
+		fbdev_output_damage_frame_buffer(output);
 	}
 
 	return 0;
@@ -729,11 +899,6 @@ fbdev_output_disable(struct weston_output *base)
 
 	if ( ! backend->use_pixman) return;
 
-	if (output->hw_surface != NULL) {
-		pixman_image_unref(output->hw_surface);
-		output->hw_surface = NULL;
-	}
-
 	fbdev_frame_buffer_destroy(output);
 }
 
@@ -817,6 +982,7 @@ fbdev_backend_create(struct weston_compositor *compositor, int *argc, char *argv
 {
 	struct fbdev_backend *backend;
 	const char *seat_id = default_seat;
+	const char *str;
 	uint32_t key;
 
 	weston_log("initializing fbdev backend\n");
@@ -854,6 +1020,11 @@ fbdev_backend_create(struct weston_compositor *compositor, int *argc, char *argv
 	backend->prev_state = WESTON_COMPOSITOR_ACTIVE;
 	backend->use_pixman = !param->use_gl;
 
+	/* Double-buffering can be turned off with WESTON_FBDEV_PANNING=0,
+	 * for drivers that claim to pan but do not. */
+	str = getenv("WESTON_FBDEV_PANNING");
+	backend->use_panning = !(str && strcmp(str, "0") == 0);
+
 	for (key = KEY_F1; key < KEY_F9; key++)
 		weston_compositor_add_key_binding(compositor, key,
 		                                  MODIFIER_CTRL | MODIFIER_ALT,
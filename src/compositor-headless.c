@@ -34,6 +34,7 @@
 #include "shared/helpers.h"
 #include "compositor.h"
 #include "pixman-renderer.h"
+#include "gl-renderer.h"
 #include "presentation_timing-server-protocol.h"
 
 struct headless_backend {
@@ -41,6 +42,7 @@ struct headless_backend {
 	struct weston_compositor *compositor;
 	struct weston_seat fake_seat;
 	bool use_pixman;
+	bool use_gl;
 };
 
 struct headless_output {
@@ -55,9 +57,12 @@ struct headless_parameters {
 	int width;
 	int height;
 	int use_pixman;
+	int use_gl;
 	uint32_t transform;
 };
 
+static struct gl_renderer_interface *gl_renderer;
+
 static void
 headless_output_start_repaint_loop(struct weston_output *output)
 {
@@ -109,6 +114,8 @@ headless_output_destroy(struct weston_output *output_base)
 		pixman_renderer_output_destroy(&output->base);
 		pixman_image_unref(output->image);
 		free(output->image_buf);
+	} else if (b->use_gl) {
+		gl_renderer->output_destroy(&output->base);
 	}
 
 	weston_output_destroy(&output->base);
@@ -173,6 +180,14 @@ headless_backend_create_output(struct headless_backend *b,
 
 		pixman_renderer_output_set_buffer(&output->base,
 						  output->image);
+	} else if (b->use_gl) {
+		if (gl_renderer->output_pbuffer_create(&output->base,
+						       param->width,
+						       param->height,
+						       gl_renderer->pbuffer_attribs) < 0) {
+			weston_log("failed to create gl renderer output state\n");
+			return -1;
+		}
 	}
 
 	weston_compositor_add_output(c, &output->base);
@@ -180,6 +195,27 @@ headless_backend_create_output(struct headless_backend *b,
 	return 0;
 }
 
+static int
+headless_gl_renderer_init(struct headless_backend *b)
+{
+	gl_renderer = weston_load_module("gl-renderer.so",
+					 "gl_renderer_interface");
+	if (!gl_renderer)
+		return -1;
+
+	/* Without a window system, prefer Mesa's surfaceless platform
+	 * and fall back to whatever the default display is. Both take
+	 * EGL_DEFAULT_DISPLAY, i.e. NULL, as the native display. */
+	if (gl_renderer->create(b->compositor, EGL_PLATFORM_SURFACELESS_MESA,
+				NULL,
+				gl_renderer->pbuffer_attribs, NULL, 0) == 0)
+		return 0;
+
+	return gl_renderer->create(b->compositor, NO_EGL_PLATFORM,
+				   NULL,
+				   gl_renderer->pbuffer_attribs, NULL, 0);
+}
+
 static int
 headless_input_create(struct headless_backend *b)
 {
@@ -237,13 +273,20 @@ headless_backend_create(struct weston_compositor *compositor,
 	b->base.restore = headless_restore;
 
 	b->use_pixman = param->use_pixman;
+	b->use_gl = param->use_gl && !param->use_pixman;
 	if (b->use_pixman) {
 		pixman_renderer_init(compositor);
+	} else if (b->use_gl) {
+		if (headless_gl_renderer_init(b) < 0) {
+			weston_log("failed to initialize gl renderer\n");
+			goto err_input;
+		}
 	}
 	if (headless_backend_create_output(b, param) < 0)
 		goto err_input;
 
-	if (!b->use_pixman && noop_renderer_init(compositor) < 0)
+	if (!b->use_pixman && !b->use_gl &&
+	    noop_renderer_init(compositor) < 0)
 		goto err_input;
 
 	compositor->backend = &b->base;
@@ -272,6 +315,7 @@ backend_init(struct weston_compositor *compositor,
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &param.use_pixman },
+		{ WESTON_OPTION_BOOLEAN, "use-gl", 0, &param.use_gl },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
 	};
 
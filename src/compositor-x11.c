@@ -43,6 +43,9 @@
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
@@ -77,6 +80,7 @@ struct x11_backend {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	unsigned int		 has_present;
 	int			 use_pixman;
 
 	int			 has_net_wm_state_fullscreen;
@@ -120,6 +124,20 @@ struct x11_output {
 	void		       *buf;
 	uint8_t			depth;
 	int32_t                 scale;
+
+	/* Without Present, the frame is finished by the timer once the X
+	 * server has replied to this, sent after the SHM puts, so that it
+	 * has read the segment before the next frame is drawn into it. */
+	xcb_get_input_focus_cookie_t shm_sync;
+	int			shm_sync_pending;
+
+#ifdef HAVE_XCB_PRESENT
+	/* Frames are finished at the vblank of the host that follows
+	 * them, as reported by a PresentNotifyMSC. */
+	uint32_t		present_eid;
+	xcb_special_event_t    *present_events;
+	uint32_t		present_serial;
+#endif
 };
 
 struct window_delete_data {
@@ -346,13 +364,56 @@ x11_input_destroy(struct x11_backend *b)
 	weston_seat_release(&b->core_seat);
 }
 
+static int
+x11_output_has_present(struct x11_output *output)
+{
+#ifdef HAVE_XCB_PRESENT
+	return output->present_events != NULL;
+#else
+	return 0;
+#endif
+}
+
+/* Finishes the frame of the output at the next vblank of the host X
+ * server, or after a fixed delay without Present. */
 static void
-x11_output_start_repaint_loop(struct weston_output *output)
+x11_output_queue_frame(struct x11_output *output)
+{
+	struct x11_backend *b =
+		(struct x11_backend *)output->base.compositor->backend;
+
+#ifdef HAVE_XCB_PRESENT
+	if (output->present_events) {
+		output->present_serial++;
+		xcb_present_notify_msc(b->conn, output->window,
+				       output->present_serial, 0, 1, 0);
+		xcb_flush(b->conn);
+		return;
+	}
+#endif
+
+	xcb_flush(b->conn);
+	wl_event_source_timer_update(output->finish_frame_timer, 10);
+}
+
+static void
+x11_output_start_repaint_loop(struct weston_output *output_base)
 {
 	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, PRESENTATION_FEEDBACK_INVALID);
+#ifdef HAVE_XCB_PRESENT
+	struct x11_output *output = (struct x11_output *)output_base;
+
+	/* Wait for a vblank to get an accurate timestamp */
+	if (output->present_events) {
+		x11_output_queue_frame(output);
+		return;
+	}
+#endif
+
+	weston_compositor_read_presentation_clock(output_base->compositor, &ts);
+	weston_output_finish_frame(output_base, &ts,
+				   PRESENTATION_FEEDBACK_INVALID);
 }
 
 static int
@@ -367,25 +428,25 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	x11_output_queue_frame(output);
 	return 0;
 }
 
+/* Copies the damaged rectangles of the output from the SHM segment to
+ * its window, each with a request of its own, so the X server does not
+ * read more of the segment than changed. Errors come back as events. */
 static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+x11_output_put_shm_damage(struct x11_output *output, pixman_region32_t *damage)
 {
-	struct x11_output *output = (struct x11_output *)output_base;
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = (struct x11_backend *)ec->backend;
+	struct weston_output *output_base = &output->base;
+	struct x11_backend *b =
+		(struct x11_backend *)output_base->compositor->backend;
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
 	int nrects, i;
-	xcb_generic_error_t *err;
 
 	pixman_region32_init(&transformed_region);
-	pixman_region32_copy(&transformed_region, region);
+	pixman_region32_copy(&transformed_region, damage);
 	pixman_region32_translate(&transformed_region,
 				  -output_base->x, -output_base->y);
 	weston_transformed_region(output_base->width, output_base->height,
@@ -394,35 +455,20 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 				  &transformed_region, &transformed_region);
 
 	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
-
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
-		return;
-	}
-
-	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
-	}
+	for (i = 0; i < nrects; i++)
+		xcb_shm_put_image(b->conn, output->window, output->gc,
+				  pixman_image_get_width(output->hw_surface),
+				  pixman_image_get_height(output->hw_surface),
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1,
+				  rects[i].x1, rects[i].y1,
+				  output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  0, output->segment, 0);
 
 	pixman_region32_fini(&transformed_region);
-
-	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
-	free(output_rects);
 }
 
-
 static int
 x11_output_repaint_shm(struct weston_output *output_base,
 		       pixman_region32_t *damage)
@@ -430,30 +476,21 @@ x11_output_repaint_shm(struct weston_output *output_base,
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
 	struct x11_backend *b = (struct x11_backend *)ec->backend;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 
 	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
-	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(b->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
+	x11_output_put_shm_damage(output, damage);
+
+	/* The CompleteNotify of Present already comes after the puts */
+	if (!x11_output_has_present(output)) {
+		output->shm_sync = xcb_get_input_focus(b->conn);
+		output->shm_sync_pending = 1;
 	}
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	x11_output_queue_frame(output);
 	return 0;
 }
 
@@ -461,8 +498,17 @@ static int
 finish_frame_handler(void *data)
 {
 	struct x11_output *output = data;
+	struct x11_backend *b =
+		(struct x11_backend *)output->base.compositor->backend;
 	struct timespec ts;
 
+	/* Usually in by now, so this does not wait for the server */
+	if (output->shm_sync_pending) {
+		free(xcb_get_input_focus_reply(b->conn, output->shm_sync,
+					       NULL));
+		output->shm_sync_pending = 0;
+	}
+
 	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
 	weston_output_finish_frame(&output->base, &ts, 0);
 
@@ -487,6 +533,73 @@ x11_output_deinit_shm(struct x11_backend *b, struct x11_output *output)
 	shmdt(output->buf);
 }
 
+#ifdef HAVE_XCB_PRESENT
+static void
+x11_output_init_present(struct x11_backend *b, struct x11_output *output)
+{
+	if (!b->has_present)
+		return;
+
+	output->present_eid = xcb_generate_id(b->conn);
+	output->present_events =
+		xcb_register_for_special_xge(b->conn, &xcb_present_id,
+					     output->present_eid, NULL);
+	xcb_present_select_input(b->conn, output->present_eid, output->window,
+				 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+}
+
+static void
+x11_output_fini_present(struct x11_backend *b, struct x11_output *output)
+{
+	if (!output->present_events)
+		return;
+
+	xcb_present_select_input(b->conn, output->present_eid, output->window,
+				 XCB_PRESENT_EVENT_MASK_NO_EVENT);
+	xcb_unregister_for_special_event(b->conn, output->present_events);
+	output->present_events = NULL;
+}
+
+static int
+x11_output_deliver_present_events(struct x11_output *output)
+{
+	xcb_present_complete_notify_event_t *complete;
+	xcb_generic_event_t *event;
+	struct x11_backend *b =
+		(struct x11_backend *)output->base.compositor->backend;
+	struct timespec ts;
+	int count = 0;
+
+	if (!output->present_events)
+		return 0;
+
+	while ((event = xcb_poll_for_special_event(b->conn,
+						   output->present_events))) {
+		complete = (xcb_present_complete_notify_event_t *) event;
+		count++;
+
+		if (complete->event_type != XCB_PRESENT_EVENT_COMPLETE_NOTIFY ||
+		    complete->kind != XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC ||
+		    complete->serial != output->present_serial) {
+			free(event);
+			continue;
+		}
+
+		/* The X server stamps vblanks on CLOCK_MONOTONIC */
+		ts.tv_sec = complete->ust / 1000000;
+		ts.tv_nsec = (complete->ust % 1000000) * 1000;
+		output->base.msc = complete->msc;
+		free(event);
+
+		weston_output_finish_frame(&output->base, &ts,
+					   PRESENTATION_FEEDBACK_KIND_VSYNC |
+					   PRESENTATION_FEEDBACK_KIND_HW_CLOCK);
+	}
+
+	return count;
+}
+#endif
+
 static void
 x11_output_destroy(struct weston_output *output_base)
 {
@@ -495,6 +608,11 @@ x11_output_destroy(struct weston_output *output_base)
 		(struct x11_backend *)output->base.compositor->backend;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->shm_sync_pending)
+		xcb_discard_reply(backend->conn, output->shm_sync.sequence);
+#ifdef HAVE_XCB_PRESENT
+	x11_output_fini_present(backend, output);
+#endif
 
 	if (backend->use_pixman) {
 		pixman_renderer_output_destroy(output_base);
@@ -926,6 +1044,9 @@ x11_backend_create_output(struct x11_backend *b, int x, int y,
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+#ifdef HAVE_XCB_PRESENT
+	x11_output_init_present(b, output);
+#endif
 
 	weston_compositor_add_output(b->compositor, &output->base);
 
@@ -1173,6 +1294,9 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 {
 	struct x11_backend *b = data;
 	struct x11_output *output;
+#ifdef HAVE_XCB_PRESENT
+	struct x11_output *next;
+#endif
 	xcb_generic_event_t *event, *prev;
 	xcb_client_message_event_t *client_message;
 	xcb_enter_notify_event_t *enter_notify;
@@ -1180,6 +1304,7 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 	xcb_keymap_notify_event_t *keymap_notify;
 	xcb_focus_in_event_t *focus_in;
 	xcb_expose_event_t *expose;
+	xcb_generic_error_t *error;
 	xcb_atom_t atom;
 	xcb_window_t window;
 	uint32_t *k;
@@ -1349,6 +1474,14 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 			notify_keyboard_focus_out(&b->core_seat);
 			break;
 
+		case 0:
+			/* Errors of unchecked requests, like the SHM puts */
+			error = (xcb_generic_error_t *) event;
+			weston_log("X11 error %d, request %d.%d\n",
+				   error->error_code, error->major_code,
+				   error->minor_code);
+			break;
+
 		default:
 			break;
 		}
@@ -1392,6 +1525,13 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 		break;
 	}
 
+#ifdef HAVE_XCB_PRESENT
+	/* Reading the connection above queued the Present events */
+	wl_list_for_each_safe(output, next, &b->compositor->output_list,
+			      base.link)
+		count += x11_output_deliver_present_events(output);
+#endif
+
 	return count;
 }
 
@@ -1509,6 +1649,52 @@ init_gl_renderer(struct x11_backend *b)
 
 	return ret;
 }
+
+static void
+x11_backend_setup_present(struct x11_backend *b)
+{
+#ifndef HAVE_XCB_PRESENT
+	weston_log("XCB-Present not available during build\n");
+	b->has_present = 0;
+#else
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_cookie_t version;
+	xcb_present_query_version_reply_t *version_reply;
+	const char *str;
+
+	b->has_present = 0;
+
+	/* Pacing by vblanks can be turned off with WESTON_X11_PRESENT=0 */
+	str = getenv("WESTON_X11_PRESENT");
+	if (str && strcmp(str, "0") == 0)
+		return;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_present_id);
+	if (!ext || !ext->present) {
+		weston_log("Present extension not available on host X11 server\n");
+		return;
+	}
+
+	version = xcb_present_query_version(b->conn,
+					    XCB_PRESENT_MAJOR_VERSION,
+					    XCB_PRESENT_MINOR_VERSION);
+	version_reply = xcb_present_query_version_reply(b->conn, version,
+							NULL);
+	if (!version_reply) {
+		weston_log("error: failed to query Present version\n");
+		return;
+	}
+	free(version_reply);
+
+	if (weston_compositor_set_presentation_clock(b->compositor,
+						     CLOCK_MONOTONIC) < 0)
+		return;
+
+	weston_log("Pacing outputs with the Present extension\n");
+	b->has_present = 1;
+#endif
+}
+
 static struct x11_backend *
 x11_backend_create(struct weston_compositor *compositor,
 		   int fullscreen,
@@ -1520,6 +1706,7 @@ x11_backend_create(struct weston_compositor *compositor,
 	struct x11_backend *b;
 	struct x11_output *output;
 	struct weston_config_section *section;
+	struct wl_event_loop *loop;
 	xcb_screen_iterator_t s;
 	int i, x = 0, output_count = 0;
 	int width, height, scale, count;
@@ -1553,6 +1740,7 @@ x11_backend_create(struct weston_compositor *compositor,
 
 	x11_backend_get_resources(b);
 	x11_backend_get_wm_info(b);
+	x11_backend_setup_present(b);
 
 	if (!b->has_net_wm_state_fullscreen && fullscreen) {
 		weston_log("Can not fullscreen without window manager support"
@@ -1650,8 +1838,14 @@ x11_backend_create(struct weston_compositor *compositor,
 		x = pixman_region32_extents(&output->base.region)->x2;
 	}
 
+	/* Frames are finished from the X events with Present, which must
+	 * not wait for the input loop to run with the next repaint. */
+	if (b->has_present)
+		loop = wl_display_get_event_loop(compositor->wl_display);
+	else
+		loop = compositor->input_loop;
 	b->xcb_source =
-		wl_event_loop_add_fd(compositor->input_loop,
+		wl_event_loop_add_fd(loop,
 				     xcb_get_file_descriptor(b->conn),
 				     WL_EVENT_READABLE,
 				     x11_backend_handle_event, b);
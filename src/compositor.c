@@ -54,8 +54,13 @@
 #include "timeline.h"
 
 #include "compositor.h"
+#include "fast-region.h"
+#include "frame-stats.h"
+#include "object-pool.h"
+#include "commit-rate.h"
 #include "scaler-server-protocol.h"
 #include "presentation_timing-server-protocol.h"
+#include "frame-timing-server-protocol.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "git-version.h"
@@ -65,6 +70,12 @@
 
 #define NSEC_PER_SEC 1000000000
 
+/* Number of consecutive repaints with more than one buffer commit
+ * before a surface gets its commits coalesced, and the cap on the
+ * strike count, which sets how long it takes to recover. */
+#define COALESCE_STRIKES_ACTIVATE 4
+#define COALESCE_STRIKES_MAX 8
+
 static void
 timespec_sub(struct timespec *r,
 	     const struct timespec *a, const struct timespec *b)
@@ -83,6 +94,23 @@ timespec_to_nsec(const struct timespec *a)
 	return (int64_t)a->tv_sec * NSEC_PER_SEC + a->tv_nsec;
 }
 
+/* The time from b to a in microseconds, clamped to what fits */
+static uint32_t
+timespec_sub_to_usec(const struct timespec *a, const struct timespec *b)
+{
+	struct timespec d;
+	int64_t usec;
+
+	timespec_sub(&d, a, b);
+	usec = timespec_to_nsec(&d) / 1000;
+	if (usec < 0)
+		return 0;
+	if (usec > UINT32_MAX)
+		return UINT32_MAX;
+
+	return usec;
+}
+
 static void
 weston_output_transform_scale_init(struct weston_output *output,
 				   uint32_t transform, uint32_t scale);
@@ -408,12 +436,27 @@ region_init_infinite(pixman_region32_t *region)
 static struct weston_subsurface *
 weston_surface_to_subsurface(struct weston_surface *surface);
 
+static void
+weston_surface_flush_coalesced(struct weston_surface *surface);
+
+static void
+weston_surface_update_coalesce(struct weston_surface *surface);
+
+/* Views, frame callbacks and presentation feedback are created and
+ * destroyed at a high rate, so they come from slab pools instead of
+ * malloc. Frame callbacks and feedback can outlive the compositor
+ * (they are wl_resources destroyed along with the display), so the
+ * pools are global rather than per compositor.
+ */
+static struct object_pool view_pool =
+	OBJECT_POOL_INITIALIZER("view", sizeof(struct weston_view), 32);
+
 WL_EXPORT struct weston_view *
 weston_view_create(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = zalloc(sizeof *view);
+	view = object_pool_zalloc(&view_pool);
 	if (view == NULL)
 		return NULL;
 
@@ -458,6 +501,15 @@ struct weston_presentation_feedback {
 	uint32_t psf_flags;
 };
 
+static struct object_pool frame_callback_pool =
+	OBJECT_POOL_INITIALIZER("frame callback",
+				sizeof(struct weston_frame_callback), 64);
+
+static struct object_pool feedback_pool =
+	OBJECT_POOL_INITIALIZER("presentation feedback",
+				sizeof(struct weston_presentation_feedback),
+				64);
+
 static void
 weston_presentation_feedback_discard(
 		struct weston_presentation_feedback *feedback)
@@ -629,6 +681,9 @@ weston_surface_create(struct weston_compositor *compositor)
 	weston_matrix_init(&surface->buffer_to_surface_matrix);
 	weston_matrix_init(&surface->surface_to_buffer_matrix);
 
+	weston_surface_state_init(&surface->coalesce.state);
+	wl_list_init(&surface->coalesce.link);
+
 	return surface;
 }
 
@@ -1827,7 +1882,7 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->surface_link);
 
-	free(view);
+	object_pool_free(&view_pool, view);
 }
 
 WL_EXPORT void
@@ -1851,6 +1906,10 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	weston_surface_state_fini(&surface->pending);
 
+	wl_list_remove(&surface->coalesce.link);
+	weston_surface_state_fini(&surface->coalesce.state);
+	weston_buffer_reference(&surface->coalesce.buffer_ref, NULL);
+
 	weston_buffer_reference(&surface->buffer_ref, NULL);
 
 	pixman_region32_fini(&surface->damage);
@@ -2021,14 +2080,37 @@ view_accumulate_damage(struct weston_view *view,
 					  view->geometry.x, view->geometry.y);
 	}
 
-	pixman_region32_intersect(&damage, &damage,
-				  &view->transform.boundingbox);
-	pixman_region32_subtract(&damage, &damage, opaque);
-	pixman_region32_union(&view->plane->damage,
-			      &view->plane->damage, &damage);
+	fast_region_intersect(&damage, &damage,
+			      &view->transform.boundingbox);
+	fast_region_subtract(&damage, &damage, opaque);
+	fast_region_union(&view->plane->damage,
+			  &view->plane->damage, &damage);
 	pixman_region32_fini(&damage);
 	pixman_region32_copy(&view->clip, opaque);
-	pixman_region32_union(opaque, opaque, &view->transform.opaque);
+	fast_region_union(opaque, opaque, &view->transform.opaque);
+
+	view->occluded =
+		view->plane == &view->surface->compositor->primary_plane &&
+		pixman_region32_contains_rectangle(&view->clip,
+			pixman_region32_extents(&view->transform.boundingbox)) ==
+		PIXMAN_REGION_IN;
+}
+
+/* A surface is occluded if all of its views in the view list are. Its
+ * renderer state does not need to be brought up to date then; damage
+ * is kept in surface->damage until the surface becomes visible again.
+ */
+static bool
+surface_is_occluded(struct weston_surface *surface)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (!wl_list_empty(&view->link) && !view->occluded)
+			return false;
+	}
+
+	return true;
 }
 
 static void
@@ -2052,7 +2134,7 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 			view_accumulate_damage(ev, &opaque);
 		}
 
-		pixman_region32_union(&clip, &clip, &opaque);
+		fast_region_union(&clip, &clip, &opaque);
 		pixman_region32_fini(&opaque);
 	}
 
@@ -2066,6 +2148,12 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 			continue;
 		ev->surface->touched = 1;
 
+		/* An occluded surface keeps its damage and buffer reference
+		 * until it becomes visible again, so that the renderer
+		 * can still catch up with the contents then. */
+		if (surface_is_occluded(ev->surface))
+			continue;
+
 		surface_flush_damage(ev->surface);
 
 		/* Both the renderer and the backend have seen the buffer
@@ -2081,6 +2169,35 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 	}
 }
 
+static void
+weston_output_build_visible_list(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev, **v;
+
+	output->visible_views.size = 0;
+	output->culled_views = 0;
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (ev->plane != &ec->primary_plane ||
+		    !(ev->output_mask & (1u << output->id)))
+			continue;
+
+		if (ev->occluded) {
+			output->culled_views++;
+			continue;
+		}
+
+		v = wl_array_add(&output->visible_views, sizeof *v);
+		if (v == NULL) {
+			weston_log("out of memory building the view list of "
+				   "output %s\n", output->name);
+			continue;
+		}
+		*v = ev;
+	}
+}
+
 static void
 surface_stash_subsurface_views(struct weston_surface *surface)
 {
@@ -2235,6 +2352,7 @@ weston_output_repaint(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
 	struct weston_view *ev;
+	struct weston_surface *es, *es_next;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
@@ -2246,6 +2364,16 @@ weston_output_repaint(struct weston_output *output)
 
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
+	weston_compositor_read_presentation_clock(ec, &output->repaint_start);
+	output->frame_submitted = 0;
+
+	/* Apply the state coalesced since the last repaint. */
+	wl_list_for_each_safe(es, es_next, &ec->coalesced_surface_list,
+			      coalesce.link) {
+		if (es->output == output || es->output == NULL)
+			weston_surface_flush_coalesced(es);
+	}
+
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec);
 
@@ -2269,16 +2397,18 @@ weston_output_repaint(struct weston_output *output)
 			wl_list_init(&ev->surface->frame_callback_list);
 
 			weston_output_take_feedback_list(output, ev->surface);
+			weston_surface_update_coalesce(ev->surface);
 		}
 	}
 
 	compositor_accumulate_damage(ec);
+	weston_output_build_visible_list(output);
 
 	pixman_region32_init(&output_damage);
-	pixman_region32_intersect(&output_damage,
-				  &ec->primary_plane.damage, &output->region);
-	pixman_region32_subtract(&output_damage,
-				 &output_damage, &ec->primary_plane.clip);
+	fast_region_intersect(&output_damage,
+			      &ec->primary_plane.damage, &output->region);
+	fast_region_subtract(&output_damage,
+			     &output_damage, &ec->primary_plane.clip);
 
 	if (output->dirty)
 		weston_output_update_matrix(output);
@@ -2354,6 +2484,43 @@ output_repaint_timer_handler(void *data)
 	return 0;
 }
 
+/** Tells the core that the frame of the output is on its way to the
+ * display.
+ *
+ * \param output The output that is being repainted.
+ *
+ * Backends call this once they queued the page flip, or whatever stands
+ * for it, of the frame being repainted. The frame then counts in the
+ * frame statistics of the output once weston_output_finish_frame()
+ * reports it was shown.
+ */
+WL_EXPORT void
+weston_output_frame_submitted(struct weston_output *output)
+{
+	weston_compositor_read_presentation_clock(output->compositor,
+						  &output->submit_time);
+	output->frame_submitted = 1;
+}
+
+static void
+weston_output_record_frame(struct weston_output *output,
+			   const struct timespec *stamp,
+			   uint32_t presented_flags, int32_t refresh_nsec)
+{
+	if (!output->frame_submitted || !output->frame_stats)
+		return;
+
+	output->frame_submitted = 0;
+	if (presented_flags & PRESENTATION_FEEDBACK_INVALID)
+		return;
+
+	frame_stats_add(output->frame_stats,
+			timespec_sub_to_usec(&output->submit_time,
+					     &output->repaint_start),
+			timespec_sub_to_usec(stamp, &output->submit_time),
+			refresh_nsec / 1000);
+}
+
 WL_EXPORT void
 weston_output_finish_frame(struct weston_output *output,
 			   const struct timespec *stamp,
@@ -2369,6 +2536,8 @@ weston_output_finish_frame(struct weston_output *output,
 		 TLP_VBLANK(stamp), TLP_END);
 
 	refresh_nsec = 1000000000000LL / output->current_mode->refresh;
+	weston_output_record_frame(output, stamp, presented_flags,
+				   refresh_nsec);
 	weston_presentation_feedback_present_list(&output->feedback_list,
 						  output, refresh_nsec, stamp,
 						  output->msc,
@@ -2531,9 +2700,9 @@ surface_damage(struct wl_client *client,
 {
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	pixman_region32_union_rect(&surface->pending.damage,
-				   &surface->pending.damage,
-				   x, y, width, height);
+	fast_region_union_rect(&surface->pending.damage,
+			       &surface->pending.damage,
+			       x, y, width, height);
 }
 
 static void
@@ -2542,7 +2711,7 @@ destroy_frame_callback(struct wl_resource *resource)
 	struct weston_frame_callback *cb = wl_resource_get_user_data(resource);
 
 	wl_list_remove(&cb->link);
-	free(cb);
+	object_pool_free(&frame_callback_pool, cb);
 }
 
 static void
@@ -2552,7 +2721,7 @@ surface_frame(struct wl_client *client,
 	struct weston_frame_callback *cb;
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	cb = malloc(sizeof *cb);
+	cb = object_pool_zalloc(&frame_callback_pool);
 	if (cb == NULL) {
 		wl_resource_post_no_memory(resource);
 		return;
@@ -2561,7 +2730,7 @@ surface_frame(struct wl_client *client,
 	cb->resource = wl_resource_create(client, &wl_callback_interface, 1,
 					  callback);
 	if (cb->resource == NULL) {
-		free(cb);
+		object_pool_free(&frame_callback_pool, cb);
 		wl_resource_post_no_memory(resource);
 		return;
 	}
@@ -2695,6 +2864,18 @@ weston_surface_build_buffer_matrix(struct weston_surface *surface,
 	weston_matrix_scale(matrix, vp->buffer.scale, vp->buffer.scale, 1);
 }
 
+static void
+weston_surface_update_commit_rate(struct weston_surface *surface)
+{
+	struct timespec now;
+
+	weston_compositor_read_presentation_clock(surface->compositor, &now);
+	surface->commit_rate =
+		commit_rate_update(surface->commit_rate,
+				   &surface->last_commit, &now);
+	surface->last_commit = now;
+}
+
 static void
 weston_surface_commit_state(struct weston_surface *surface,
 			    struct weston_surface_state *state)
@@ -2708,8 +2889,10 @@ weston_surface_commit_state(struct weston_surface *surface,
 	surface->buffer_viewport = state->buffer_viewport;
 
 	/* wl_surface.attach */
-	if (state->newly_attached)
+	if (state->newly_attached) {
 		weston_surface_attach(surface, state->buffer);
+		weston_surface_update_commit_rate(surface);
+	}
 	weston_surface_state_set_buffer(state, NULL);
 
 	weston_surface_build_buffer_matrix(surface,
@@ -2732,16 +2915,16 @@ weston_surface_commit_state(struct weston_surface *surface,
 	if (weston_timeline_enabled_ &&
 	    pixman_region32_not_empty(&state->damage))
 		TL_POINT("core_commit_damage", TLP_SURFACE(surface), TLP_END);
-	pixman_region32_union(&surface->damage, &surface->damage,
-			      &state->damage);
-	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
-				       0, 0, surface->width, surface->height);
+	fast_region_union(&surface->damage, &surface->damage,
+			  &state->damage);
+	fast_region_intersect_rect(&surface->damage, &surface->damage,
+				   0, 0, surface->width, surface->height);
 	pixman_region32_clear(&state->damage);
 
 	/* wl_surface.set_opaque_region */
 	pixman_region32_init(&opaque);
-	pixman_region32_intersect_rect(&opaque, &state->opaque,
-				       0, 0, surface->width, surface->height);
+	fast_region_intersect_rect(&opaque, &state->opaque,
+				   0, 0, surface->width, surface->height);
 
 	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
 		pixman_region32_copy(&surface->opaque, &opaque);
@@ -2752,8 +2935,8 @@ weston_surface_commit_state(struct weston_surface *surface,
 	pixman_region32_fini(&opaque);
 
 	/* wl_surface.set_input_region */
-	pixman_region32_intersect_rect(&surface->input, &state->input,
-				       0, 0, surface->width, surface->height);
+	fast_region_intersect_rect(&surface->input, &state->input,
+				   0, 0, surface->width, surface->height);
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
@@ -2771,9 +2954,188 @@ weston_surface_commit_state(struct weston_surface *surface,
 	wl_list_init(&state->feedback_list);
 }
 
+/* Merge the pending state of a surface into a cached state, as if the
+ * pending state was committed on top of it. The cached buffer is kept
+ * busy through cached_buffer_ref, which also releases the buffer it
+ * replaces.
+ */
+static void
+weston_surface_state_merge_pending(struct weston_surface *surface,
+				   struct weston_surface_state *cached,
+				   struct weston_buffer_reference *cached_buffer_ref)
+{
+	/*
+	 * If this commit would cause the surface to move by the
+	 * attach(dx, dy) parameters, the old damage region must be
+	 * translated to correspond to the new surface coordinate system
+	 * original_mode.
+	 */
+	pixman_region32_translate(&cached->damage,
+				  -surface->pending.sx, -surface->pending.sy);
+	fast_region_union(&cached->damage, &cached->damage,
+			  &surface->pending.damage);
+	pixman_region32_clear(&surface->pending.damage);
+
+	if (surface->pending.newly_attached) {
+		cached->newly_attached = 1;
+		weston_surface_state_set_buffer(cached,
+						surface->pending.buffer);
+		weston_buffer_reference(cached_buffer_ref,
+					surface->pending.buffer);
+		weston_presentation_feedback_discard_list(
+					&cached->feedback_list);
+	}
+	cached->sx += surface->pending.sx;
+	cached->sy += surface->pending.sy;
+
+	cached->buffer_viewport.changed |=
+		surface->pending.buffer_viewport.changed;
+	cached->buffer_viewport.buffer =
+		surface->pending.buffer_viewport.buffer;
+	cached->buffer_viewport.surface =
+		surface->pending.buffer_viewport.surface;
+
+	weston_surface_reset_pending_buffer(surface);
+
+	pixman_region32_copy(&cached->opaque, &surface->pending.opaque);
+
+	pixman_region32_copy(&cached->input, &surface->pending.input);
+
+	wl_list_insert_list(&cached->frame_callback_list,
+			    &surface->pending.frame_callback_list);
+	wl_list_init(&surface->pending.frame_callback_list);
+
+	wl_list_insert_list(&cached->feedback_list,
+			    &surface->pending.feedback_list);
+	wl_list_init(&surface->pending.feedback_list);
+}
+
+static void
+weston_surface_flush_coalesced(struct weston_surface *surface)
+{
+	if (!surface->coalesce.has_data)
+		return;
+
+	weston_surface_commit_state(surface, &surface->coalesce.state);
+	weston_buffer_reference(&surface->coalesce.buffer_ref, NULL);
+
+	weston_surface_commit_subsurface_order(surface);
+
+	weston_surface_schedule_repaint(surface);
+
+	wl_list_remove(&surface->coalesce.link);
+	wl_list_init(&surface->coalesce.link);
+	surface->coalesce.has_data = 0;
+}
+
+static void
+weston_surface_coalesce_pending(struct weston_surface *surface)
+{
+	struct weston_compositor *ec = surface->compositor;
+
+	if (surface->pending.newly_attached &&
+	    surface->coalesce.state.newly_attached)
+		surface->coalesce.dropped++;
+
+	weston_surface_state_merge_pending(surface, &surface->coalesce.state,
+					   &surface->coalesce.buffer_ref);
+
+	if (!surface->coalesce.has_data) {
+		wl_list_insert(&ec->coalesced_surface_list,
+			       &surface->coalesce.link);
+		surface->coalesce.has_data = 1;
+	}
+}
+
+/* Only plain, mapped surfaces with content are coalesced: unmapping,
+ * first maps and anything taking part in the sub-surface
+ * synchronization is always applied straight away.
+ */
+static bool
+weston_surface_can_coalesce(struct weston_surface *surface)
+{
+	if (!surface->coalesce.active || surface->output == NULL)
+		return false;
+
+	if (!weston_surface_is_mapped(surface))
+		return false;
+
+	if (surface->pending.newly_attached && !surface->pending.buffer)
+		return false;
+
+	if (!wl_list_empty(&surface->subsurface_list) ||
+	    weston_surface_to_subsurface(surface))
+		return false;
+
+	return true;
+}
+
+static void
+weston_surface_log_coalesce(struct weston_surface *surface,
+			    const char *msg)
+{
+	char label[100];
+
+	if (!surface->get_label ||
+	    surface->get_label(surface, label, sizeof label) < 0)
+		snprintf(label, sizeof label, "surface %p", surface);
+
+	weston_log("%s: %s (%u buffers dropped)\n",
+		   label, msg, surface->coalesce.dropped);
+}
+
+/* Called once per repaint of the surface's output, after its frame
+ * callbacks have been collected. A surface that keeps attaching more
+ * than one buffer per repaint is committing faster than the output
+ * refresh rate, and from then on its commits are coalesced until it
+ * calms down again.
+ */
+static void
+weston_surface_update_coalesce(struct weston_surface *surface)
+{
+	if (surface->coalesce.commits > 1) {
+		if (surface->coalesce.strikes < COALESCE_STRIKES_MAX)
+			surface->coalesce.strikes++;
+	} else if (surface->coalesce.commits == 1 &&
+		   surface->coalesce.strikes > 0) {
+		surface->coalesce.strikes--;
+	}
+
+	surface->coalesce.commits = 0;
+
+	if (!surface->coalesce.active &&
+	    surface->coalesce.strikes >= COALESCE_STRIKES_ACTIVATE) {
+		surface->coalesce.active = 1;
+		weston_surface_log_coalesce(surface,
+					    "commits faster than the output "
+					    "refresh, coalescing commits");
+	} else if (surface->coalesce.active &&
+		   surface->coalesce.strikes == 0) {
+		surface->coalesce.active = 0;
+		weston_surface_log_coalesce(surface,
+					    "no longer coalescing commits");
+		surface->coalesce.dropped = 0;
+	}
+}
+
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
+	if (surface->pending.newly_attached)
+		surface->coalesce.commits++;
+
+	if (weston_surface_can_coalesce(surface)) {
+		weston_surface_coalesce_pending(surface);
+		weston_surface_schedule_repaint(surface);
+		return;
+	}
+
+	if (surface->coalesce.has_data) {
+		weston_surface_coalesce_pending(surface);
+		weston_surface_flush_coalesced(surface);
+		return;
+	}
+
 	weston_surface_commit_state(surface, &surface->pending);
 
 	weston_surface_commit_subsurface_order(surface);
@@ -2976,52 +3338,8 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 static void
 weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 {
-	struct weston_surface *surface = sub->surface;
-
-	/*
-	 * If this commit would cause the surface to move by the
-	 * attach(dx, dy) parameters, the old damage region must be
-	 * translated to correspond to the new surface coordinate system
-	 * original_mode.
-	 */
-	pixman_region32_translate(&sub->cached.damage,
-				  -surface->pending.sx, -surface->pending.sy);
-	pixman_region32_union(&sub->cached.damage, &sub->cached.damage,
-			      &surface->pending.damage);
-	pixman_region32_clear(&surface->pending.damage);
-
-	if (surface->pending.newly_attached) {
-		sub->cached.newly_attached = 1;
-		weston_surface_state_set_buffer(&sub->cached,
-						surface->pending.buffer);
-		weston_buffer_reference(&sub->cached_buffer_ref,
-					surface->pending.buffer);
-		weston_presentation_feedback_discard_list(
-					&sub->cached.feedback_list);
-	}
-	sub->cached.sx += surface->pending.sx;
-	sub->cached.sy += surface->pending.sy;
-
-	sub->cached.buffer_viewport.changed |=
-		surface->pending.buffer_viewport.changed;
-	sub->cached.buffer_viewport.buffer =
-		surface->pending.buffer_viewport.buffer;
-	sub->cached.buffer_viewport.surface =
-		surface->pending.buffer_viewport.surface;
-
-	weston_surface_reset_pending_buffer(surface);
-
-	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
-
-	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
-
-	wl_list_insert_list(&sub->cached.frame_callback_list,
-			    &surface->pending.frame_callback_list);
-	wl_list_init(&surface->pending.frame_callback_list);
-
-	wl_list_insert_list(&sub->cached.feedback_list,
-			    &surface->pending.feedback_list);
-	wl_list_init(&surface->pending.feedback_list);
+	weston_surface_state_merge_pending(sub->surface, &sub->cached,
+					   &sub->cached_buffer_ref);
 
 	sub->has_cached_data = 1;
 }
@@ -3911,8 +4229,10 @@ weston_output_destroy(struct weston_output *output)
 	wl_signal_emit(&output->destroy_signal, output);
 
 	free(output->name);
+	free(output->frame_stats);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
+	wl_array_release(&output->visible_views);
 	output->compositor->output_id_pool &= ~(1 << output->id);
 
 	wl_resource_for_each(resource, &output->resource_list) {
@@ -3922,6 +4242,49 @@ weston_output_destroy(struct weston_output *output)
 	wl_global_destroy(output->global);
 }
 
+/** Read back a rectangle of the output contents without waiting for it
+ *
+ * \param output The output to read from.
+ * \param format The pixel format of \c pixels, as for read_pixels.
+ * \param pixels Destination, must stay valid until \c done is called.
+ * \param x, y, width, height The rectangle to read, as for read_pixels.
+ * \param done Called once the pixels are available.
+ * \param data User data for \c done.
+ * \return 0 if the read-back was started, -1 on error, in which case
+ * \c done is not called.
+ *
+ * Like the renderer read_pixels hook, this reads what has been rendered
+ * for the current frame, so it is meant to be called from the output
+ * frame signal. Renderers that cannot read back asynchronously, like the
+ * pixman renderer, complete the read immediately and call \c done before
+ * this returns. Otherwise \c done is called later from the event loop,
+ * in the order the read-backs were started; if the output is destroyed
+ * first, the pending read-backs are completed during its destruction.
+ */
+WL_EXPORT int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+
+	if (renderer->read_pixels_async)
+		return renderer->read_pixels_async(output, format, pixels,
+						   x, y, width, height,
+						   done, data);
+
+	if (renderer->read_pixels(output, format, pixels,
+				  x, y, width, height) < 0)
+		return -1;
+
+	done(data, 0);
+
+	return 0;
+}
+
 WL_EXPORT void
 weston_output_update_matrix(struct weston_output *output)
 {
@@ -4085,6 +4448,10 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
 	wl_list_init(&output->feedback_list);
+	wl_array_init(&output->visible_views);
+
+	/* Without it the output just keeps no statistics */
+	output->frame_stats = zalloc(sizeof *output->frame_stats);
 
 	loop = wl_display_get_event_loop(c->wl_display);
 	output->repaint_timer = wl_event_loop_add_timer(loop,
@@ -4335,7 +4702,7 @@ destroy_presentation_feedback(struct wl_resource *feedback_resource)
 	feedback = wl_resource_get_user_data(feedback_resource);
 
 	wl_list_remove(&feedback->link);
-	free(feedback);
+	object_pool_free(&feedback_pool, feedback);
 }
 
 static void
@@ -4355,7 +4722,7 @@ presentation_feedback(struct wl_client *client,
 
 	surface = wl_resource_get_user_data(surface_resource);
 
-	feedback = zalloc(sizeof *feedback);
+	feedback = object_pool_zalloc(&feedback_pool);
 	if (feedback == NULL)
 		goto err_calloc;
 
@@ -4373,7 +4740,7 @@ presentation_feedback(struct wl_client *client,
 	return;
 
 err_create:
-	free(feedback);
+	object_pool_free(&feedback_pool, feedback);
 
 err_calloc:
 	wl_client_post_no_memory(client);
@@ -4403,6 +4770,171 @@ bind_presentation(struct wl_client *client,
 	presentation_send_clock_id(resource, compositor->presentation_clock);
 }
 
+static void
+frame_timing_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+/* A wl_output resource may outlive its output, so it is only trusted
+ * while the output is still around. */
+static struct frame_stats *
+frame_timing_get_output_stats(struct wl_resource *resource,
+			      struct wl_resource *output_resource)
+{
+	struct weston_compositor *compositor =
+		wl_resource_get_user_data(resource);
+	void *data = wl_resource_get_user_data(output_resource);
+	struct weston_output *output;
+
+	wl_list_for_each(output, &compositor->output_list, link)
+		if (output == data)
+			return output->frame_stats;
+
+	return NULL;
+}
+
+static void
+frame_timing_get_stats(struct wl_client *client,
+		       struct wl_resource *resource, uint32_t id,
+		       struct wl_resource *output_resource)
+{
+	struct frame_stats empty = { 0 };
+	struct frame_stats *s;
+	struct wl_resource *stats_resource;
+
+	stats_resource = wl_resource_create(client,
+					    &weston_frame_stats_interface,
+					    1, id);
+	if (stats_resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	s = frame_timing_get_output_stats(resource, output_resource);
+	if (!s)
+		s = &empty;
+
+	weston_frame_stats_send_stats(stats_resource, s->frames, s->missed,
+				      frame_histogram_percentile(&s->repaint, 50),
+				      frame_histogram_percentile(&s->repaint, 90),
+				      frame_histogram_percentile(&s->repaint, 99),
+				      s->repaint.max_usec,
+				      frame_histogram_percentile(&s->latency, 50),
+				      frame_histogram_percentile(&s->latency, 90),
+				      frame_histogram_percentile(&s->latency, 99),
+				      s->latency.max_usec);
+	wl_resource_destroy(stats_resource);
+}
+
+static void
+frame_timing_reset(struct wl_client *client, struct wl_resource *resource,
+		   struct wl_resource *output_resource)
+{
+	struct frame_stats *s;
+
+	s = frame_timing_get_output_stats(resource, output_resource);
+	if (s)
+		frame_stats_reset(s);
+}
+
+static const struct weston_frame_timing_interface frame_timing_implementation = {
+	frame_timing_destroy,
+	frame_timing_get_stats,
+	frame_timing_reset
+};
+
+static void
+bind_frame_timing(struct wl_client *client,
+		  void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_frame_timing_interface,
+				      MIN(version, 1), id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &frame_timing_implementation,
+				       compositor, NULL);
+}
+
+static void
+log_frame_stats(struct weston_output *output)
+{
+	struct frame_stats *s = output->frame_stats;
+
+	weston_log_continue(STAMP_SPACE "%s: %u frames, %u missed vblanks, "
+			    "repaint p50/p90/p99/max %u/%u/%u/%u us, "
+			    "latency p50/p90/p99/max %u/%u/%u/%u us\n",
+			    output->name, s->frames, s->missed,
+			    frame_histogram_percentile(&s->repaint, 50),
+			    frame_histogram_percentile(&s->repaint, 90),
+			    frame_histogram_percentile(&s->repaint, 99),
+			    s->repaint.max_usec,
+			    frame_histogram_percentile(&s->latency, 50),
+			    frame_histogram_percentile(&s->latency, 90),
+			    frame_histogram_percentile(&s->latency, 99),
+			    s->latency.max_usec);
+}
+
+static int
+frame_stats_log_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_output *output;
+
+	weston_log("frame statistics of the last %d seconds:\n",
+		   compositor->frame_stats_log_sec);
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (!output->frame_stats)
+			continue;
+
+		log_frame_stats(output);
+		frame_stats_reset(output->frame_stats);
+	}
+
+	wl_event_source_timer_update(compositor->frame_stats_log_source,
+				     compositor->frame_stats_log_sec * 1000);
+
+	return 0;
+}
+
+/** Logs the frame statistics of all outputs periodically.
+ *
+ * \param compositor The compositor instance.
+ * \param seconds The logging period, or 0 to stop logging.
+ *
+ * The statistics of the outputs are reset after each log entry, so
+ * every entry covers one period.
+ */
+WL_EXPORT void
+weston_compositor_set_frame_stats_log(struct weston_compositor *compositor,
+				      int32_t seconds)
+{
+	struct wl_event_loop *loop;
+
+	compositor->frame_stats_log_sec = seconds;
+
+	if (!compositor->frame_stats_log_source) {
+		if (seconds <= 0)
+			return;
+
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		compositor->frame_stats_log_source =
+			wl_event_loop_add_timer(loop, frame_stats_log_handler,
+						compositor);
+		if (!compositor->frame_stats_log_source)
+			return;
+	}
+
+	wl_event_source_timer_update(compositor->frame_stats_log_source,
+				     seconds > 0 ? seconds * 1000 : 0);
+}
+
 static void
 compositor_bind(struct wl_client *client,
 		void *data, uint32_t version, uint32_t id)
@@ -4456,6 +4988,28 @@ timeline_key_binding_handler(struct weston_seat *seat, uint32_t time,
 		weston_timeline_open(compositor);
 }
 
+static void
+object_pool_log(struct object_pool *pool)
+{
+	weston_log_continue(STAMP_SPACE "%s: %u live, %u peak, %u slabs "
+			    "of %u, %llu allocations served by %llu "
+			    "slab allocations\n",
+			    pool->name, pool->live, pool->peak, pool->slabs,
+			    pool->objects_per_slab,
+			    (unsigned long long) pool->allocs,
+			    (unsigned long long) pool->slab_allocs);
+}
+
+static void
+object_pools_binding_handler(struct weston_seat *seat, uint32_t time,
+			     uint32_t key, void *data)
+{
+	weston_log("object pool statistics:\n");
+	object_pool_log(&view_pool);
+	object_pool_log(&frame_callback_pool);
+	object_pool_log(&feedback_pool);
+}
+
 /** Create the compositor.
  *
  * This functions creates and initializes a compositor instance.
@@ -4513,6 +5067,10 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 			      ec, bind_presentation))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display, &weston_frame_timing_interface,
+			      1, ec, bind_frame_timing))
+		goto fail;
+
 	wl_list_init(&ec->view_list);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
@@ -4524,6 +5082,7 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
+	wl_list_init(&ec->coalesced_surface_list);
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
@@ -4543,6 +5102,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	weston_compositor_add_debug_binding(ec, KEY_T,
 					    timeline_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_P,
+					    object_pools_binding_handler, ec);
 
 	weston_compositor_schedule_repaint(ec);
 
@@ -4561,6 +5122,8 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	wl_event_source_remove(ec->idle_source);
 	if (ec->input_loop_source)
 		wl_event_source_remove(ec->input_loop_source);
+	if (ec->frame_stats_log_source)
+		wl_event_source_remove(ec->frame_stats_log_source);
 
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
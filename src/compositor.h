@@ -56,6 +56,7 @@ struct shell_surface;
 struct weston_seat;
 struct weston_output;
 struct input_method;
+struct frame_stats;
 
 enum weston_keyboard_modifier {
 	MODIFIER_CTRL = (1 << 0),
@@ -204,6 +205,20 @@ struct weston_output {
 	int destroying;
 	struct wl_list feedback_list;
 
+	/* Views of the primary plane the renderer has to draw for the
+	 * current repaint, topmost first, as struct weston_view pointers.
+	 * Views fully covered by opaque views above them are left out and
+	 * counted in culled_views. */
+	struct wl_array visible_views;
+	uint32_t culled_views;
+
+	/* Frame pacing of the frames the backend reports with
+	 * weston_output_frame_submitted() */
+	struct frame_stats *frame_stats;
+	struct timespec repaint_start;
+	struct timespec submit_time;
+	int frame_submitted;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -560,11 +575,23 @@ struct weston_plane {
 	struct wl_list link;
 };
 
+/** Called once an asynchronous read-back has finished, with status 0
+ * if 'pixels' now holds the result and -1 if it failed. */
+typedef void (*weston_read_pixels_done_func_t)(void *data, int status);
+
 struct weston_renderer {
 	int (*read_pixels)(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+
+	/** See weston_output_read_pixels_async(); optional */
+	int (*read_pixels_async)(struct weston_output *output,
+				 pixman_format_code_t format, void *pixels,
+				 uint32_t x, uint32_t y,
+				 uint32_t width, uint32_t height,
+				 weston_read_pixels_done_func_t done,
+				 void *data);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -653,6 +680,7 @@ struct weston_compositor {
 	struct wl_list touch_binding_list;
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
+	struct wl_list coalesced_surface_list; /* weston_surface::coalesce.link */
 
 	uint32_t state;
 	struct wl_event_source *idle_source;
@@ -688,6 +716,9 @@ struct weston_compositor {
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
 
+	int32_t frame_stats_log_sec;
+	struct wl_event_source *frame_stats_log_source;
+
 	int exit_code;
 
 	void *user_data;
@@ -706,6 +737,11 @@ struct weston_buffer {
 	int32_t width, height;
 	uint32_t busy_count;
 	int y_inverted;
+
+	/* The range of a wl_shm buffer the renderer last found to lie in
+	 * its pool, which only moves if the pool is resized */
+	const void *shm_checked_data;
+	size_t shm_checked_size;
 };
 
 struct weston_buffer_reference {
@@ -787,6 +823,7 @@ struct weston_view {
 	struct weston_view *parent_view;
 
 	pixman_region32_t clip;          /* See weston_view_damage_below() */
+	int occluded;                    /* fully inside clip, primary plane */
 	float alpha;                     /* part of geometry, see below */
 
 	void *renderer_state;
@@ -927,6 +964,11 @@ struct weston_surface {
 	int32_t height_from_buffer;
 	bool keep_buffer; /* for backends to prevent early release */
 
+	/* When a buffer was last committed, and the smoothed number of
+	 * buffer commits per second, for backends choosing planes */
+	struct timespec last_commit;
+	float commit_rate;
+
 	/* wl_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
 
@@ -966,6 +1008,24 @@ struct weston_surface {
 	const char *role_name;
 
 	struct weston_timeline_object timeline;
+
+	/*
+	 * Commit coalescing for clients that attach new buffers faster
+	 * than the output repaints. While active, commits are merged
+	 * into 'state' and applied once, right before the repaint of
+	 * 'output'. Superseded buffers are released as soon as they are
+	 * replaced.
+	 */
+	struct {
+		int commits;	/* buffer commits since the last repaint */
+		int strikes;
+		int active;
+		int has_data;
+		uint32_t dropped;
+		struct weston_surface_state state;
+		struct weston_buffer_reference buffer_ref;
+		struct wl_list link; /* weston_compositor::coalesced_surface_list */
+	} coalesce;
 };
 
 struct weston_subsurface {
@@ -1125,6 +1185,8 @@ weston_output_finish_frame(struct weston_output *output,
 			   const struct timespec *stamp,
 			   uint32_t presented_flags);
 void
+weston_output_frame_submitted(struct weston_output *output);
+void
 weston_output_schedule_repaint(struct weston_output *output);
 void
 weston_output_damage(struct weston_output *output);
@@ -1359,6 +1421,10 @@ weston_compositor_read_presentation_clock(
 			const struct weston_compositor *compositor,
 			struct timespec *ts);
 
+void
+weston_compositor_set_frame_stats_log(struct weston_compositor *compositor,
+				      int32_t seconds);
+
 void
 weston_compositor_shutdown(struct weston_compositor *ec);
 void
@@ -1382,6 +1448,13 @@ weston_compositor_add_output(struct weston_compositor *compositor,
                              struct weston_output *output);
 void
 weston_output_destroy(struct weston_output *output);
+int
+weston_output_read_pixels_async(struct weston_output *output,
+				pixman_format_code_t format, void *pixels,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_read_pixels_done_func_t done,
+				void *data);
 void
 weston_output_transform_coordinate(struct weston_output *output,
 				   wl_fixed_t device_x, wl_fixed_t device_y,
@@ -0,0 +1,188 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "config.h"
+
+#include <string.h>
+
+#include "damage-history.h"
+#include "fast-region.h"
+
+static int64_t
+box_area(const pixman_box32_t *b)
+{
+	return (int64_t) (b->x2 - b->x1) * (b->y2 - b->y1);
+}
+
+static void
+box_bounds(pixman_box32_t *r,
+	   const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	r->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+	r->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+	r->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+	r->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+}
+
+/* Replace the two boxes whose bounding box covers the least area they
+ * did not cover already by that bounding box. */
+static void
+damage_boxes_merge_cheapest(struct damage_boxes *d)
+{
+	pixman_box32_t bounds;
+	int64_t cost, best_cost = INT64_MAX;
+	int i, j, best_i = 0, best_j = 1;
+
+	for (i = 0; i < d->n; i++) {
+		for (j = i + 1; j < d->n; j++) {
+			box_bounds(&bounds, &d->boxes[i], &d->boxes[j]);
+			cost = box_area(&bounds) - box_area(&d->boxes[i]) -
+			       box_area(&d->boxes[j]);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+
+	box_bounds(&d->boxes[best_i], &d->boxes[best_i], &d->boxes[best_j]);
+	d->boxes[best_j] = d->boxes[--d->n];
+}
+
+/** Add a box, merging boxes if there is no room left. */
+void
+damage_boxes_add(struct damage_boxes *d, const pixman_box32_t *box)
+{
+	if (fast_box_is_empty(box))
+		return;
+
+	if (d->n == DAMAGE_MAX_RECTS)
+		damage_boxes_merge_cheapest(d);
+
+	d->boxes[d->n++] = *box;
+}
+
+void
+damage_boxes_from_region(struct damage_boxes *d, pixman_region32_t *region)
+{
+	pixman_box32_t *boxes;
+	int i, n;
+
+	boxes = pixman_region32_rectangles(region, &n);
+
+	if (n <= DAMAGE_MAX_RECTS) {
+		memcpy(d->boxes, boxes, n * sizeof *boxes);
+		d->n = n;
+		return;
+	}
+
+	d->n = 0;
+	for (i = 0; i < n; i++)
+		damage_boxes_add(d, &boxes[i]);
+}
+
+void
+damage_history_init(struct damage_history *h)
+{
+	memset(h, 0, sizeof *h);
+}
+
+/** Record the damage of the frame just drawn. */
+void
+damage_history_push(struct damage_history *h, pixman_region32_t *damage,
+		    uint32_t flags)
+{
+	h->head = (h->head + 1) % DAMAGE_HISTORY_LENGTH;
+	if (h->count < DAMAGE_HISTORY_LENGTH)
+		h->count++;
+
+	damage_boxes_from_region(&h->entries[h->head].damage, damage);
+	h->entries[h->head].flags = flags;
+}
+
+/* Gather boxes for one pixman operation, folding a box into one already
+ * gathered where the two make up a single box. */
+static void
+box_list_add(pixman_box32_t *list, int *n, const pixman_box32_t *box)
+{
+	int i;
+
+	for (i = 0; i < *n; i++)
+		if (fast_box_union(&list[i], &list[i], box))
+			return;
+
+	list[(*n)++] = *box;
+}
+
+/** Collect the damage a back buffer of the given age is missing
+ *
+ * \param h The history.
+ * \param age The buffer age, as in EGL_EXT_buffer_age.
+ * \param damage Region the damage is added to.
+ * \param flags Set to the flags of the frames, or'ed together.
+ * \return 0 on success, -1 if the age is unknown or too old, in which
+ * case the whole buffer needs to be repainted.
+ *
+ * The boxes of all the frames are added to \a damage at once. Damage
+ * that stays a single box needs no allocation, as in fast-region.h.
+ */
+int
+damage_history_get(struct damage_history *h, int age,
+		   pixman_region32_t *damage, uint32_t *flags)
+{
+	pixman_box32_t boxes[DAMAGE_HISTORY_LENGTH * DAMAGE_MAX_RECTS];
+	pixman_region32_t collected;
+	const struct damage_boxes *d;
+	unsigned int index;
+	int i, j, n = 0;
+
+	if (age <= 0 || (unsigned int) age - 1 > h->count)
+		return -1;
+
+	*flags = 0;
+	index = h->head;
+	for (i = 0; i < age - 1; i++) {
+		d = &h->entries[index].damage;
+		*flags |= h->entries[index].flags;
+		for (j = 0; j < d->n; j++)
+			box_list_add(boxes, &n, &d->boxes[j]);
+
+		index = (index + DAMAGE_HISTORY_LENGTH - 1) %
+			DAMAGE_HISTORY_LENGTH;
+	}
+
+	if (n == 0)
+		return 0;
+
+	if (n == 1)
+		pixman_region32_init_rect(&collected, boxes[0].x1, boxes[0].y1,
+					  boxes[0].x2 - boxes[0].x1,
+					  boxes[0].y2 - boxes[0].y1);
+	else
+		pixman_region32_init_rects(&collected, boxes, n);
+
+	fast_region_union(damage, damage, &collected);
+	pixman_region32_fini(&collected);
+
+	return 0;
+}
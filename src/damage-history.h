@@ -0,0 +1,75 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_DAMAGE_HISTORY_H
+#define _WESTON_DAMAGE_HISTORY_H
+
+#include <stdint.h>
+#include <pixman.h>
+
+/*
+ * Damage of the last few frames of an output, for repainting a back
+ * buffer of a given age, kept without any allocation.
+ *
+ * Each frame's damage is stored as at most DAMAGE_MAX_RECTS boxes.
+ * Damage fragmented into more rectangles is reduced by merging the
+ * boxes whose bounding box adds the least undamaged area, so the stored
+ * damage always covers the real damage and is only ever a bit larger.
+ */
+
+#define DAMAGE_MAX_RECTS 16
+
+/* Buffer ages up to this plus one can be repainted partially. */
+#define DAMAGE_HISTORY_LENGTH 4
+
+struct damage_boxes {
+	int n;
+	pixman_box32_t boxes[DAMAGE_MAX_RECTS];
+};
+
+struct damage_history {
+	unsigned int head;	/* the newest entry */
+	unsigned int count;	/* entries holding a frame */
+	struct {
+		struct damage_boxes damage;
+		uint32_t flags;
+	} entries[DAMAGE_HISTORY_LENGTH];
+};
+
+void
+damage_boxes_add(struct damage_boxes *d, const pixman_box32_t *box);
+
+void
+damage_boxes_from_region(struct damage_boxes *d, pixman_region32_t *region);
+
+void
+damage_history_init(struct damage_history *h);
+
+void
+damage_history_push(struct damage_history *h, pixman_region32_t *damage,
+		    uint32_t flags);
+
+int
+damage_history_get(struct damage_history *h, int age,
+		   pixman_region32_t *damage, uint32_t *flags);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_FAST_REGION_H
+#define _WESTON_FAST_REGION_H
+
+#include <stdbool.h>
+#include <pixman.h>
+
+/*
+ * Drop-in replacements for the pixman_region32 operations used on the
+ * damage path.
+ *
+ * A pixman region that is a single rectangle keeps its box inline in
+ * 'extents', with no 'data' allocated. Most damage and opaque regions
+ * are exactly that, but pixman only special-cases a few such
+ * combinations. The others go through its generic band
+ * algorithm, which allocates a rectangle array even when the result is
+ * a single box again. These helpers compute rectangle-with-rectangle
+ * results that are again a single rectangle directly, and defer to
+ * pixman for everything else. The resulting regions cover exactly what
+ * pixman would produce; empty results are normalized like
+ * pixman_region32_clear() does.
+ */
+
+static inline bool
+fast_region_is_empty(const pixman_region32_t *r)
+{
+	return r->data && r->data->numRects == 0;
+}
+
+static inline bool
+fast_region_is_rect(const pixman_region32_t *r)
+{
+	return r->data == NULL;
+}
+
+static inline bool
+fast_box_is_empty(const pixman_box32_t *b)
+{
+	return b->x1 >= b->x2 || b->y1 >= b->y2;
+}
+
+static inline bool
+fast_box_contains(const pixman_box32_t *outer, const pixman_box32_t *inner)
+{
+	return outer->x1 <= inner->x1 && outer->x2 >= inner->x2 &&
+	       outer->y1 <= inner->y1 && outer->y2 >= inner->y2;
+}
+
+static inline bool
+fast_box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static inline void
+fast_region_set_box(pixman_region32_t *dst, pixman_box32_t *box)
+{
+	if (fast_box_is_empty(box))
+		pixman_region32_clear(dst);
+	else
+		pixman_region32_reset(dst, box);
+}
+
+static inline void
+fast_region_intersect(pixman_region32_t *dst,
+		      pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_box32_t box;
+
+	if (!fast_region_is_rect(a) || !fast_region_is_rect(b)) {
+		pixman_region32_intersect(dst, a, b);
+		return;
+	}
+
+	box.x1 = a->extents.x1 > b->extents.x1 ? a->extents.x1 : b->extents.x1;
+	box.y1 = a->extents.y1 > b->extents.y1 ? a->extents.y1 : b->extents.y1;
+	box.x2 = a->extents.x2 < b->extents.x2 ? a->extents.x2 : b->extents.x2;
+	box.y2 = a->extents.y2 < b->extents.y2 ? a->extents.y2 : b->extents.y2;
+
+	fast_region_set_box(dst, &box);
+}
+
+static inline void
+fast_region_intersect_rect(pixman_region32_t *dst, pixman_region32_t *src,
+			   int x, int y, unsigned int width,
+			   unsigned int height)
+{
+	pixman_region32_t rect;
+
+	if (!fast_region_is_rect(src)) {
+		pixman_region32_intersect_rect(dst, src, x, y, width, height);
+		return;
+	}
+
+	pixman_region32_init_rect(&rect, x, y, width, height);
+	fast_region_intersect(dst, src, &rect);
+	pixman_region32_fini(&rect);
+}
+
+/* The union of two boxes is a single box if one contains the other,
+ * or if they share the full extent along one axis and touch or overlap
+ * along the other. */
+static inline bool
+fast_box_union(pixman_box32_t *r,
+	       const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	if (fast_box_contains(a, b)) {
+		*r = *a;
+	} else if (fast_box_contains(b, a)) {
+		*r = *b;
+	} else if (a->x1 == b->x1 && a->x2 == b->x2 &&
+		   a->y1 <= b->y2 && b->y1 <= a->y2) {
+		r->x1 = a->x1;
+		r->x2 = a->x2;
+		r->y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+		r->y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+	} else if (a->y1 == b->y1 && a->y2 == b->y2 &&
+		   a->x1 <= b->x2 && b->x1 <= a->x2) {
+		r->y1 = a->y1;
+		r->y2 = a->y2;
+		r->x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+		r->x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static inline void
+fast_region_union(pixman_region32_t *dst,
+		  pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_box32_t box;
+
+	if (fast_region_is_empty(b)) {
+		pixman_region32_copy(dst, a);
+	} else if (fast_region_is_empty(a)) {
+		pixman_region32_copy(dst, b);
+	} else if (fast_region_is_rect(a) && fast_region_is_rect(b) &&
+		   fast_box_union(&box, &a->extents, &b->extents)) {
+		pixman_region32_reset(dst, &box);
+	} else {
+		pixman_region32_union(dst, a, b);
+	}
+}
+
+static inline void
+fast_region_union_rect(pixman_region32_t *dst, pixman_region32_t *src,
+		       int x, int y, unsigned int width, unsigned int height)
+{
+	pixman_region32_t rect;
+
+	if (width == 0 || height == 0) {
+		pixman_region32_copy(dst, src);
+		return;
+	}
+
+	pixman_region32_init_rect(&rect, x, y, width, height);
+	fast_region_union(dst, src, &rect);
+	pixman_region32_fini(&rect);
+}
+
+/* Subtracting box b from box a leaves a single box if b fully covers
+ * one axis of a and overlaps only one edge of it along the other. */
+static inline bool
+fast_box_subtract(pixman_box32_t *r,
+		  const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	*r = *a;
+
+	if (!fast_box_overlaps(a, b))
+		return true;
+
+	if (fast_box_contains(b, a)) {
+		r->x2 = r->x1;
+		return true;
+	}
+
+	if (b->x1 <= a->x1 && b->x2 >= a->x2) {
+		if (b->y1 <= a->y1)
+			r->y1 = b->y2;
+		else if (b->y2 >= a->y2)
+			r->y2 = b->y1;
+		else
+			return false;
+	} else if (b->y1 <= a->y1 && b->y2 >= a->y2) {
+		if (b->x1 <= a->x1)
+			r->x1 = b->x2;
+		else if (b->x2 >= a->x2)
+			r->x2 = b->x1;
+		else
+			return false;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static inline void
+fast_region_subtract(pixman_region32_t *dst,
+		     pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_box32_t box;
+
+	if (fast_region_is_empty(a) || fast_region_is_empty(b)) {
+		pixman_region32_copy(dst, a);
+	} else if (fast_region_is_rect(a) && fast_region_is_rect(b) &&
+		   fast_box_subtract(&box, &a->extents, &b->extents)) {
+		fast_region_set_box(dst, &box);
+	} else {
+		pixman_region32_subtract(dst, a, b);
+	}
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "frame-stats.h"
+
+void
+frame_histogram_add(struct frame_histogram *h, uint32_t usec)
+{
+	uint32_t i = usec / FRAME_HISTOGRAM_BUCKET_USEC;
+
+	if (i >= FRAME_HISTOGRAM_BUCKETS)
+		i = FRAME_HISTOGRAM_BUCKETS - 1;
+
+	h->buckets[i]++;
+	h->count++;
+	if (usec > h->max_usec)
+		h->max_usec = usec;
+}
+
+/* Returns the duration that percent of the samples did not exceed,
+ * rounded up to the end of its bucket, or 0 without samples. */
+uint32_t
+frame_histogram_percentile(const struct frame_histogram *h,
+			   unsigned int percent)
+{
+	uint64_t rank, seen = 0;
+	uint32_t usec;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	if (percent > 100)
+		percent = 100;
+	rank = ((uint64_t) h->count * percent + 99) / 100;
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < FRAME_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			usec = (i + 1) * FRAME_HISTOGRAM_BUCKET_USEC;
+			return usec < h->max_usec ? usec : h->max_usec;
+		}
+	}
+
+	return h->max_usec;
+}
+
+void
+frame_stats_reset(struct frame_stats *s)
+{
+	memset(s, 0, sizeof *s);
+}
+
+/* A frame submitted right after a vblank is shown on the next one, up
+ * to a refresh period later. Every further period it took means a
+ * vblank it missed. */
+void
+frame_stats_add(struct frame_stats *s, uint32_t repaint_usec,
+		uint32_t latency_usec, uint32_t refresh_usec)
+{
+	s->frames++;
+	if (refresh_usec > 0)
+		s->missed += latency_usec / refresh_usec;
+
+	frame_histogram_add(&s->repaint, repaint_usec);
+	frame_histogram_add(&s->latency, latency_usec);
+}
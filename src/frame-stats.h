@@ -0,0 +1,70 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_FRAME_STATS_H
+#define _WESTON_FRAME_STATS_H
+
+#include <stdint.h>
+
+/*
+ * Frame pacing statistics of an output.
+ *
+ * Durations are kept in histograms of FRAME_HISTOGRAM_BUCKET_USEC wide
+ * buckets, so percentiles come out rounded up to that. Anything longer
+ * than the histogram covers falls into the last bucket, and its
+ * percentiles are the longest duration seen.
+ */
+
+#define FRAME_HISTOGRAM_BUCKETS 128
+#define FRAME_HISTOGRAM_BUCKET_USEC 250
+
+struct frame_histogram {
+	uint32_t count;
+	uint32_t max_usec;
+	uint32_t buckets[FRAME_HISTOGRAM_BUCKETS];
+};
+
+struct frame_stats {
+	uint32_t frames;
+	/* Vblanks that passed between submitting a frame and showing it */
+	uint32_t missed;
+	/* From the start of the repaint to submitting the frame */
+	struct frame_histogram repaint;
+	/* From submitting the frame to the vblank it was shown on */
+	struct frame_histogram latency;
+};
+
+void
+frame_histogram_add(struct frame_histogram *h, uint32_t usec);
+
+uint32_t
+frame_histogram_percentile(const struct frame_histogram *h,
+			   unsigned int percent);
+
+void
+frame_stats_reset(struct frame_stats *s);
+
+void
+frame_stats_add(struct frame_stats *s, uint32_t repaint_usec,
+		uint32_t latency_usec, uint32_t refresh_usec);
+
+#endif
@@ -30,19 +30,35 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <linux/input.h>
 
 #include "gl-renderer.h"
 #include "vertex-clipping.h"
+#include "damage-history.h"
+#include "fast-region.h"
+#include "atlas-allocator.h"
+#include "shm-dmabuf.h"
 
 #include "shared/helpers.h"
 #include "weston-egl-ext.h"
 
+/* From GLES3/gl3.h, for building against GLES 2 headers */
+#ifndef GL_RGB10_A2
+#define GL_RGB10_A2 0x8059
+#endif
+
 struct gl_shader {
 	GLuint program;
 	GLuint vertex_shader, fragment_shader;
@@ -51,10 +67,9 @@ struct gl_shader {
 	GLint alpha_uniform;
 	GLint color_uniform;
 	const char *vertex_source, *fragment_source;
+	uint32_t frame_serial;	/* last frame the per-frame uniforms were set */
 };
 
-#define BUFFER_DAMAGE_COUNT 2
-
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
 	BORDER_TOP_DIRTY = 1 << GL_RENDERER_BORDER_TOP,
@@ -74,28 +89,101 @@ struct gl_border_image {
 
 struct gl_output_state {
 	EGLSurface egl_surface;
-	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
-	int buffer_damage_index;
-	enum gl_border_status border_damage[BUFFER_DAMAGE_COUNT];
+	int pbuffer;
+	struct damage_history damage_history;
 	struct gl_border_image borders[4];
 	enum gl_border_status border_status;
 
 	struct weston_matrix output_matrix;
+
+	/* Swap damage, kept here so swapping needs no allocation. */
+	struct damage_boxes swap_damage;
+	EGLint swap_rects[4 * DAMAGE_MAX_RECTS];
+
+	/* What it took to draw the views in the last frame. */
+	struct {
+		uint32_t draw_calls;
+		uint32_t gl_calls;
+		uint32_t vertices;
+		uint32_t geometry_cache_hits;
+	} frame_stats;
+};
+
+/* A run of triangles in the frame's vertex buffer, drawn with one
+ * glDrawArrays() call. */
+struct gl_batch {
+	struct weston_view *view;
+	struct gl_shader *shader;
+	GLint filter;
+	int blend;
+	int first;
+	int count;
+};
+
+/* Small wl_shm surfaces share the textures of atlas pages, so that no
+ * texture switch is needed between their views and consecutive ones
+ * can be drawn together. */
+#define ATLAS_PAGE_SIZE 1024
+#define ATLAS_MAX_PAGES 4
+#define ATLAS_MAX_WIDTH 256
+#define ATLAS_MAX_HEIGHT 128
+/* Surfaces resized more often than this get a texture of their own. */
+#define ATLAS_MAX_RESIZES 2
+/* Each surface is framed by copies of its edge pixels, so that linear
+ * filtering does not pick up its neighbours. */
+#define ATLAS_GUTTER 1
+
+struct gl_atlas_page {
+	struct wl_list link;		/* gl_renderer::atlas_pages */
+	GLuint texture;
+	GLint filter;
+	struct atlas_allocator allocator;
 };
 
 enum buffer_type {
 	BUFFER_TYPE_NULL,
 	BUFFER_TYPE_SOLID, /* internal solid color surfaces without a buffer */
 	BUFFER_TYPE_SHM,
+	BUFFER_TYPE_SHM_DMABUF, /* wl_shm buffers read in place by the GPU */
 	BUFFER_TYPE_EGL
 };
 
+/* Large wl_shm buffers are wrapped in dma-bufs and imported as
+ * EGLImages, if the kernel and EGL allow, instead of being copied into
+ * a texture on every commit. Clients cycle through a few buffers, so the
+ * images of the last ones are kept until their buffers are destroyed,
+ * and /proc/self/maps is only read for new ones. Buffers that failed
+ * to import are kept too, so they are not tried again on every commit. */
+#define SHM_DMABUF_MIN_SIZE (1024 * 1024)
+#define SHM_IMAGE_CACHE_SIZE 3
+
+struct gl_shm_image {
+	struct weston_buffer *buffer;	/* NULL if unused */
+	struct wl_listener buffer_destroy_listener;
+	struct gl_surface_state *gs;
+	EGLImageKHR image;		/* NULL if the import failed */
+	const void *data;		/* moves if the pool is resized */
+	int32_t width, height, stride;
+	uint32_t format;
+};
+
+/* A plane of a wl_shm buffer, uploaded to a texture of its own. */
+struct gl_shm_plane {
+	int offset;		/* in bytes, from the start of the buffer */
+	int pitch;		/* in texels */
+	int hsub, vsub;		/* subsampling */
+	int bpp;		/* bytes per texel */
+	GLenum gl_format;
+	GLenum gl_internal_format;	/* for glTexImage2D */
+};
+
 struct gl_surface_state {
 	GLfloat color[4];
 	struct gl_shader *shader;
 
 	GLuint textures[3];
 	int num_textures;
+	GLint filter;		/* of all textures, 0 if unknown */
 	int needs_full_upload;
 	pixman_region32_t texture_damage;
 
@@ -104,6 +192,8 @@ struct gl_surface_state {
 	 * format */
 	GLenum gl_format;
 	GLenum gl_pixel_type;
+	struct gl_shm_plane shm_planes[3];
+	int num_shm_planes;
 
 	EGLImageKHR images[3];
 	GLenum target;
@@ -115,25 +205,93 @@ struct gl_surface_state {
 	int height; /* in pixels */
 	int y_inverted;
 
+	/* Set while the buffer lives in an atlas page, at atlas_rect. */
+	struct gl_atlas_page *atlas_page;
+	struct atlas_rect atlas_rect;	/* without the gutter */
+	int atlas_resizes;
+
+	struct gl_shm_image shm_images[SHM_IMAGE_CACHE_SIZE];
+	int shm_image_next;		/* to be replaced next */
+
 	struct weston_surface *surface;
 
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* The triangles last generated for a region of a view, kept as long
+ * as the view geometry does not change, and reused when the same
+ * region is repainted again. */
+struct gl_geometry_cache {
+	int valid;
+	pixman_region32_t region;	/* global coordinates */
+	pixman_region32_t surf_region;	/* surface coordinates */
+	struct wl_array vertices;
+};
+
+enum gl_geometry_slot {
+	GL_GEOMETRY_OPAQUE = 0,
+	GL_GEOMETRY_BLEND,
+	GL_GEOMETRY_SLOT_COUNT
+};
+
+struct gl_view_state {
+	struct weston_view *view;
+
+	/* Everything texture_region() depends on besides the regions. */
+	struct {
+		int transform_enabled;
+		struct weston_matrix matrix;
+		float x, y;
+		int32_t width, height;
+		int32_t width_from_buffer, height_from_buffer;
+		struct weston_buffer_viewport buffer_viewport;
+		int pitch, height_in_buffer, y_inverted;
+		struct gl_atlas_page *atlas_page;
+		int atlas_x, atlas_y;
+	} key;
+
+	struct gl_geometry_cache cache[GL_GEOMETRY_SLOT_COUNT];
+
+	struct wl_listener view_destroy_listener;
+	struct wl_listener renderer_destroy_listener;
+};
+
+/* An asynchronous read-back in flight: glReadPixels() into a pixel
+ * pack buffer, and a fence telling when the copy has landed. */
+struct gl_readback {
+	struct wl_list link;		/* gl_renderer::readbacks */
+	struct weston_output *output;
+	GLuint pbo;
+#ifdef EGL_KHR_fence_sync
+	EGLSyncKHR fence;
+#endif
+	void *pixels;
+	size_t size;
+	weston_read_pixels_done_func_t done;
+	void *data;
+};
+
 struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
 	int fan_debug;
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
+	struct weston_binding *stats_binding;
 
 	EGLDisplay egl_display;
 	EGLContext egl_context;
 	EGLConfig egl_config;
 
+	/* The vertices of all the views drawn in a frame, uploaded to
+	 * vertex_buffer at once, and the batches drawing them. */
 	struct wl_array vertices;
-	struct wl_array vtxcnt;
+	struct wl_array batches;
+	GLuint vertex_buffer;
+	uint32_t frame_serial;
+	uint32_t gl_calls;
+	uint32_t geometry_cache_hits;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -146,6 +304,8 @@ struct gl_renderer {
 	PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC create_platform_window;
 
 	int has_unpack_subimage;
+	int has_texture_2101010;
+	GLenum texture_2101010_internal_format;
 
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
@@ -158,8 +318,37 @@ struct gl_renderer {
 
 	int has_configless_context;
 
+	int has_pbo;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+
+#ifdef EGL_KHR_fence_sync
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+#endif
+	int has_fence_sync;
+
+	struct wl_list readbacks;	/* oldest first */
+	struct wl_event_source *readback_timer;
+
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+	char *shader_cache_dir;		/* NULL if programs are not cached */
+	uint64_t shader_cache_driver;	/* hash identifying the GL driver */
+
+	int has_atlas;
+	struct wl_list atlas_pages;
+
+	int has_dmabuf_import;
+	int has_shm_dmabuf;
+	int udmabuf_fd;
+	uint64_t shm_bytes_uploaded;
+	uint64_t shm_bytes_imported;	/* not uploaded thanks to dma-bufs */
+
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
+	struct gl_shader texture_shader_bgrx;
 	struct gl_shader texture_shader_egl_external;
 	struct gl_shader texture_shader_y_uv;
 	struct gl_shader texture_shader_y_u_v;
@@ -197,6 +386,18 @@ get_renderer(struct weston_compositor *ec)
 	return (struct gl_renderer *)ec->renderer;
 }
 
+static int
+gl_renderer_create_view(struct weston_view *view);
+
+static inline struct gl_view_state *
+get_view_state(struct weston_view *view)
+{
+	if (!view->renderer_state)
+		gl_renderer_create_view(view);
+
+	return (struct gl_view_state *)view->renderer_state;
+}
+
 static const char *
 egl_error_string(EGLint code)
 {
@@ -364,8 +565,8 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
-	unsigned int *vtxcnt, nvtx = 0;
+	GLfloat *v, inv_width, inv_height, offset_x, offset_y;
+	unsigned int nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
 	pixman_box32_t *raw_rects;
 	int i, j, k, nrects, nsurf, raw_nrects;
@@ -382,13 +583,26 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 		used_band_compression = true;
 	}
 	/* worst case we can have 8 vertices per rect (ie. clipped into
-	 * an octagon):
+	 * an octagon), which take 6 triangles:
 	 */
-	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
-	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
+	v = wl_array_add(&gr->vertices, nrects * nsurf * 6 * 3 * 4 * sizeof *v);
+	if (v == NULL) {
+		if (used_band_compression)
+			free(rects);
+		return 0;
+	}
 
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
+	if (gs->atlas_page) {
+		inv_width = 1.0 / ATLAS_PAGE_SIZE;
+		inv_height = 1.0 / ATLAS_PAGE_SIZE;
+		offset_x = gs->atlas_rect.x;
+		offset_y = gs->atlas_rect.y;
+	} else {
+		inv_width = 1.0 / gs->pitch;
+		inv_height = 1.0 / gs->height;
+		offset_x = 0;
+		offset_y = 0;
+	}
 
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t *rect = &rects[i];
@@ -396,6 +610,7 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 			pixman_box32_t *surf_rect = &surf_rects[j];
 			GLfloat sx, sy, bx, by;
 			GLfloat ex[8], ey[8];          /* edge points in screen space */
+			GLfloat p[8][4];               /* position and texcoord */
 			int n;
 
 			/* The transformed surface, after clipping to the clip region,
@@ -416,43 +631,170 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 			if (n < 3)
 				continue;
 
-			/* emit edge points: */
+			/* compute edge points: */
 			for (k = 0; k < n; k++) {
 				weston_view_from_global_float(ev, ex[k], ey[k],
 							      &sx, &sy);
 				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
+				p[k][0] = ex[k];
+				p[k][1] = ey[k];
 				/* texcoord: */
 				weston_surface_to_buffer_float(ev->surface,
 							       sx, sy,
 							       &bx, &by);
-				*(v++) = bx * inv_width;
+				p[k][2] = (offset_x + bx) * inv_width;
 				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
+					p[k][3] = (offset_y + by) * inv_height;
 				} else {
-					*(v++) = (gs->height - by) * inv_height;
+					p[k][3] = (gs->height - by) * inv_height;
 				}
 			}
 
-			vtxcnt[nvtx++] = n;
+			/* emit the polygon as the triangles of a fan around
+			 * its first vertex, so that all polygons of the
+			 * frame can go into a single draw call: */
+			for (k = 1; k < n - 1; k++) {
+				memcpy(v, p[0], sizeof p[0]);
+				memcpy(v + 4, p[k], sizeof p[k]);
+				memcpy(v + 8, p[k + 1], sizeof p[k + 1]);
+				v += 12;
+			}
+
+			nvtx += 3 * (n - 2);
 		}
 	}
 
+	/* trim the worst case allocation down to what was used */
+	gr->vertices.size = (char *) v - (char *) gr->vertices.data;
+
 	if (used_band_compression)
 		free(rects);
 	return nvtx;
 }
 
+static int
+view_state_key_update(struct gl_view_state *vs)
+{
+	struct weston_view *ev = vs->view;
+	struct weston_surface *es = ev->surface;
+	struct gl_surface_state *gs = get_surface_state(es);
+	int changed;
+
+	/* Compared bytewise: a spurious mismatch only costs a cache
+	 * miss. */
+	changed = vs->key.transform_enabled != ev->transform.enabled ||
+		  vs->key.width != es->width ||
+		  vs->key.height != es->height ||
+		  vs->key.width_from_buffer != es->width_from_buffer ||
+		  vs->key.height_from_buffer != es->height_from_buffer ||
+		  memcmp(&vs->key.buffer_viewport.buffer,
+			 &es->buffer_viewport.buffer,
+			 sizeof es->buffer_viewport.buffer) != 0 ||
+		  memcmp(&vs->key.buffer_viewport.surface,
+			 &es->buffer_viewport.surface,
+			 sizeof es->buffer_viewport.surface) != 0 ||
+		  vs->key.pitch != gs->pitch ||
+		  vs->key.height_in_buffer != gs->height ||
+		  vs->key.y_inverted != gs->y_inverted ||
+		  vs->key.atlas_page != gs->atlas_page ||
+		  vs->key.atlas_x != gs->atlas_rect.x ||
+		  vs->key.atlas_y != gs->atlas_rect.y;
+
+	if (ev->transform.enabled)
+		changed = changed ||
+			  memcmp(vs->key.matrix.d, ev->transform.matrix.d,
+				 sizeof vs->key.matrix.d) != 0;
+	else
+		changed = changed ||
+			  vs->key.x != ev->geometry.x ||
+			  vs->key.y != ev->geometry.y;
+
+	if (!changed)
+		return 0;
+
+	vs->key.transform_enabled = ev->transform.enabled;
+	vs->key.matrix = ev->transform.matrix;
+	vs->key.x = ev->geometry.x;
+	vs->key.y = ev->geometry.y;
+	vs->key.width = es->width;
+	vs->key.height = es->height;
+	vs->key.width_from_buffer = es->width_from_buffer;
+	vs->key.height_from_buffer = es->height_from_buffer;
+	vs->key.buffer_viewport = es->buffer_viewport;
+	vs->key.pitch = gs->pitch;
+	vs->key.height_in_buffer = gs->height;
+	vs->key.y_inverted = gs->y_inverted;
+	vs->key.atlas_page = gs->atlas_page;
+	vs->key.atlas_x = gs->atlas_rect.x;
+	vs->key.atlas_y = gs->atlas_rect.y;
+
+	return 1;
+}
+
+/* texture_region(), but reusing the triangles of the previous frame if
+ * neither the view geometry nor the regions changed since. That is
+ * the common case for a static scene where a small area, like a
+ * blinking cursor, keeps being repainted. */
+static int
+texture_region_cached(struct weston_view *ev, pixman_region32_t *region,
+		      pixman_region32_t *surf_region,
+		      enum gl_geometry_slot slot)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	struct gl_view_state *vs = get_view_state(ev);
+	struct gl_geometry_cache *cache;
+	size_t first, size;
+	int i, count;
+	void *v;
+
+	if (vs == NULL)
+		return texture_region(ev, region, surf_region);
+
+	if (view_state_key_update(vs))
+		for (i = 0; i < GL_GEOMETRY_SLOT_COUNT; i++)
+			vs->cache[i].valid = 0;
+
+	cache = &vs->cache[slot];
+	size = cache->vertices.size;
+
+	if (cache->valid &&
+	    pixman_region32_equal(&cache->region, region) &&
+	    pixman_region32_equal(&cache->surf_region, surf_region)) {
+		if (size > 0) {
+			v = wl_array_add(&gr->vertices, size);
+			if (v == NULL)
+				return 0;
+			memcpy(v, cache->vertices.data, size);
+		}
+
+		gr->geometry_cache_hits++;
+		return size / (4 * sizeof(GLfloat));
+	}
+
+	first = gr->vertices.size;
+	count = texture_region(ev, region, surf_region);
+	size = gr->vertices.size - first;
+
+	cache->valid = 0;
+	cache->vertices.size = 0;
+	if (size > 0) {
+		v = wl_array_add(&cache->vertices, size);
+		if (v == NULL)
+			return count;
+		memcpy(v, (char *) gr->vertices.data + first, size);
+	}
+
+	pixman_region32_copy(&cache->region, region);
+	pixman_region32_copy(&cache->surf_region, surf_region);
+	cache->valid = 1;
+
+	return count;
+}
+
 static void
-triangle_fan_debug(struct weston_view *view, int first, int count)
+triangle_debug(struct gl_renderer *gr, int first, int count)
 {
-	struct weston_compositor *compositor = view->surface->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
 	int i;
-	GLushort *buffer;
-	GLushort *index;
-	int nelems;
 	static int color_idx = 0;
 	static const GLfloat color[][4] = {
 			{ 1.0, 0.0, 0.0, 1.0 },
@@ -461,72 +803,74 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 			{ 1.0, 1.0, 1.0, 1.0 },
 	};
 
-	nelems = (count - 1 + count - 2) * 2;
-
-	buffer = malloc(sizeof(GLushort) * nelems);
-	index = buffer;
-
-	for (i = 1; i < count; i++) {
-		*index++ = first;
-		*index++ = first + i;
-	}
-
-	for (i = 2; i < count; i++) {
-		*index++ = first + i - 1;
-		*index++ = first + i;
-	}
-
 	glUseProgram(gr->solid_shader.program);
 	glUniform4fv(gr->solid_shader.color_uniform, 1,
 			color[color_idx++ % ARRAY_LENGTH(color)]);
-	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
+	for (i = 0; i < count; i += 3)
+		glDrawArrays(GL_LINE_LOOP, first + i, 3);
 	glUseProgram(gr->current_shader->program);
-	free(buffer);
+}
+
+/* Views of surfaces in the same atlas page need no texture switch, so
+ * they can share a draw call if they also need the same uniforms. */
+static int
+views_share_atlas_page(struct weston_view *a, struct weston_view *b)
+{
+	struct gl_surface_state *gs_a = get_surface_state(a->surface);
+	struct gl_surface_state *gs_b = get_surface_state(b->surface);
+
+	return gs_a->atlas_page && gs_a->atlas_page == gs_b->atlas_page &&
+	       a->alpha == b->alpha;
 }
 
 static void
-repaint_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+batch_region(struct weston_view *ev, pixman_region32_t *region,
+	     pixman_region32_t *surf_region, enum gl_geometry_slot slot,
+	     struct gl_shader *shader, int blend, GLint filter)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
-	unsigned int *vtxcnt;
-	int i, first, nfans;
+	struct gl_batch *batch;
+	int first, count;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
 	 * coordinates, and 'surf_region' is in the surface-local
 	 * coordinates. texture_region() will iterate over all pairs of
 	 * rectangles from both regions, compute the intersection
-	 * polygon for each pair, and store it as a triangle fan if
+	 * polygon for each pair, and append it as triangles if
 	 * it has a non-zero area (at least 3 vertices1, actually).
 	 */
-	nfans = texture_region(ev, region, surf_region);
-
-	v = gr->vertices.data;
-	vtxcnt = gr->vtxcnt.data;
-
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
-
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	first = gr->vertices.size / (4 * sizeof(GLfloat));
+	count = texture_region_cached(ev, region, surf_region, slot);
+	if (count == 0)
+		return;
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
+	if (gr->batches.size > 0) {
+		batch = (struct gl_batch *)
+			((char *) gr->batches.data + gr->batches.size) - 1;
+		if (batch->shader == shader && batch->blend == blend &&
+		    batch->filter == filter &&
+		    batch->first + batch->count == first &&
+		    (batch->view == ev ||
+		     views_share_atlas_page(batch->view, ev))) {
+			batch->count += count;
+			return;
+		}
 	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
+	batch = wl_array_add(&gr->batches, sizeof *batch);
+	if (batch == NULL) {
+		gr->vertices.size = first * 4 * sizeof(GLfloat);
+		return;
+	}
 
-	gr->vertices.size = 0;
-	gr->vtxcnt.size = 0;
+	batch->view = ev;
+	batch->shader = shader;
+	batch->filter = filter;
+	batch->blend = blend;
+	batch->first = first;
+	batch->count = count;
 }
 
 static int
@@ -576,27 +920,86 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 	gr->current_shader = shader;
 }
 
+/* Uniforms that are the same for all the views of a frame, set once
+ * per frame on the first use of the shader. */
+static void
+shader_frame_uniforms(struct gl_shader *shader, struct gl_renderer *gr,
+		      struct weston_output *output)
+{
+	struct gl_output_state *go = get_output_state(output);
+	int i;
+
+	if (shader->frame_serial == gr->frame_serial)
+		return;
+
+	glUniformMatrix4fv(shader->proj_uniform,
+			   1, GL_FALSE, go->output_matrix.d);
+	gr->gl_calls++;
+
+	for (i = 0; i < (int) ARRAY_LENGTH(shader->tex_uniforms); i++) {
+		if (shader->tex_uniforms[i] == -1)
+			continue;
+		glUniform1i(shader->tex_uniforms[i], i);
+		gr->gl_calls++;
+	}
+
+	shader->frame_serial = gr->frame_serial;
+}
+
 static void
 shader_uniforms(struct gl_shader *shader,
+		struct gl_renderer *gr,
 		struct weston_view *view,
 		struct weston_output *output)
 {
-	int i;
 	struct gl_surface_state *gs = get_surface_state(view->surface);
-	struct gl_output_state *go = get_output_state(output);
 
-	glUniformMatrix4fv(shader->proj_uniform,
-			   1, GL_FALSE, go->output_matrix.d);
+	shader_frame_uniforms(shader, gr, output);
+
 	glUniform4fv(shader->color_uniform, 1, gs->color);
 	glUniform1f(shader->alpha_uniform, view->alpha);
+	gr->gl_calls += 2;
+}
 
-	for (i = 0; i < gs->num_textures; i++)
-		glUniform1i(shader->tex_uniforms[i], i);
+static void
+bind_textures(struct gl_renderer *gr, struct gl_surface_state *gs,
+	      GLint filter)
+{
+	struct gl_atlas_page *page = gs->atlas_page;
+	int i;
+
+	if (page) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, page->texture);
+		gr->gl_calls += 2;
+		if (page->filter != filter) {
+			glTexParameteri(GL_TEXTURE_2D,
+					GL_TEXTURE_MIN_FILTER, filter);
+			glTexParameteri(GL_TEXTURE_2D,
+					GL_TEXTURE_MAG_FILTER, filter);
+			gr->gl_calls += 2;
+			page->filter = filter;
+		}
+		return;
+	}
+
+	for (i = 0; i < gs->num_textures; i++) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(gs->target, gs->textures[i]);
+		gr->gl_calls += 2;
+		if (gs->filter == filter)
+			continue;
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
+		gr->gl_calls += 2;
+	}
+
+	gs->filter = filter;
 }
 
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
+batch_view(struct weston_view *ev, struct weston_output *output,
+	   pixman_region32_t *damage) /* in global coordinates */
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
@@ -607,8 +1010,8 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	pixman_region32_t surface_opaque;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
+	struct gl_shader *shader;
 	GLint filter;
-	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
 	 * an attach for this surface since the switch. In that case we don't
@@ -624,29 +1027,12 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
-
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
-
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
 		filter = GL_LINEAR;
 	else
 		filter = GL_NEAREST;
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
-
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
 				  ev->surface->width, ev->surface->height);
@@ -666,29 +1052,24 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		pixman_region32_copy(&surface_opaque, &ev->surface->opaque);
 
 	if (pixman_region32_not_empty(&surface_opaque)) {
+		shader = gs->shader;
 		if (gs->shader == &gr->texture_shader_rgba) {
 			/* Special case for RGBA textures with possibly
 			 * bad data in alpha channel: use the shader
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+			shader = &gr->texture_shader_rgbx;
 		}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(ev, &repaint, &surface_opaque);
+		batch_region(ev, &repaint, &surface_opaque,
+			     GL_GEOMETRY_OPAQUE, shader,
+			     ev->alpha < 1.0, filter);
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
-	}
+	if (pixman_region32_not_empty(&surface_blend))
+		batch_region(ev, &repaint, &surface_blend,
+			     GL_GEOMETRY_BLEND, gs->shader, 1, filter);
 
 	pixman_region32_fini(&surface_blend);
 	pixman_region32_fini(&surface_opaque);
@@ -697,15 +1078,122 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+/* Uploads the vertices of all batches at once and draws them in
+ * order, skipping the GL state changes between batches that do not
+ * need them. */
+static void
+draw_batches(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_batch *batch;
+	struct gl_surface_state *gs;
+	struct weston_view *view = NULL;
+	struct gl_shader *shader = NULL;
+	struct gl_atlas_page *page = NULL;
+	int blend = -1;
+
+	if (gr->batches.size == 0)
+		goto out;
+
+	gr->frame_serial++;
+	gr->gl_calls = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, gr->vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, gr->vertices.size, gr->vertices.data,
+		     GL_STREAM_DRAW);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat), (void *) 0);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat),
+			      (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	gr->gl_calls += 7;
+
+	if (gr->fan_debug) {
+		use_shader(gr, &gr->solid_shader);
+		shader_frame_uniforms(&gr->solid_shader, gr, output);
+	}
+
+	wl_array_for_each(batch, &gr->batches) {
+		gs = get_surface_state(batch->view->surface);
+
+		if (gr->current_shader != batch->shader)
+			gr->gl_calls++;
+		use_shader(gr, batch->shader);
+
+		if (batch->view != view || batch->shader != shader)
+			shader_uniforms(batch->shader, gr,
+					batch->view, output);
+
+		if (batch->view != view &&
+		    (gs->atlas_page == NULL || gs->atlas_page != page ||
+		     page->filter != batch->filter))
+			bind_textures(gr, gs, batch->filter);
+		page = gs->atlas_page;
+
+		if (batch->blend != blend) {
+			if (batch->blend)
+				glEnable(GL_BLEND);
+			else
+				glDisable(GL_BLEND);
+			gr->gl_calls++;
+		}
+
+		glDrawArrays(GL_TRIANGLES, batch->first, batch->count);
+		gr->gl_calls++;
+
+		view = batch->view;
+		shader = batch->shader;
+		blend = batch->blend;
+
+		/* The lines are drawn with the color uniform of the solid
+		 * shader, which the next batch may have to set again */
+		if (gr->fan_debug) {
+			triangle_debug(gr, batch->first, batch->count);
+			if (shader == &gr->solid_shader)
+				view = NULL;
+		}
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gr->gl_calls += 3;
+
+	go->frame_stats.draw_calls += gr->batches.size / sizeof *batch;
+	go->frame_stats.gl_calls += gr->gl_calls;
+	go->frame_stats.vertices += gr->vertices.size / (4 * sizeof(GLfloat));
+
+out:
+	gr->vertices.size = 0;
+	gr->batches.size = 0;
+}
+
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_view **views = output->visible_views.data;
+	int i, n = output->visible_views.size / sizeof *views;
+
+	gr->geometry_cache_hits = 0;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	/* Occluded views have already been culled by the core. */
+	for (i = n - 1; i >= 0; i--)
+		batch_view(views[i], output, damage);
+
+	go->frame_stats.geometry_cache_hits += gr->geometry_cache_hits;
+
+	draw_batches(output);
 }
 
 static void
@@ -888,9 +1376,11 @@ output_get_damage(struct weston_output *output,
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	EGLint buffer_age = 0;
 	EGLBoolean ret;
-	int i;
 
-	if (gr->has_egl_buffer_age) {
+	/* A pbuffer is never swapped, it always holds the last frame. */
+	if (go->pbuffer) {
+		buffer_age = 1;
+	} else if (gr->has_egl_buffer_age) {
 		ret = eglQuerySurface(gr->egl_display, go->egl_surface,
 				      EGL_BUFFER_AGE_EXT, &buffer_age);
 		if (ret == EGL_FALSE) {
@@ -899,24 +1389,15 @@ output_get_damage(struct weston_output *output,
 		}
 	}
 
-	if (buffer_age == 0 || buffer_age - 1 > BUFFER_DAMAGE_COUNT) {
+	if (damage_history_get(&go->damage_history, buffer_age,
+			       buffer_damage, border_damage) < 0) {
 		pixman_region32_copy(buffer_damage, &output->region);
 		*border_damage = BORDER_ALL_DIRTY;
-	} else {
-		for (i = 0; i < buffer_age - 1; i++)
-			*border_damage |= go->border_damage[(go->buffer_damage_index + i) % BUFFER_DAMAGE_COUNT];
-
-		if (*border_damage & BORDER_SIZE_CHANGED) {
-			/* If we've had a resize, we have to do a full
-			 * repaint. */
-			*border_damage |= BORDER_ALL_DIRTY;
-			pixman_region32_copy(buffer_damage, &output->region);
-		} else {
-			for (i = 0; i < buffer_age - 1; i++)
-				pixman_region32_union(buffer_damage,
-						      buffer_damage,
-						      &go->buffer_damage[(go->buffer_damage_index + i) % BUFFER_DAMAGE_COUNT]);
-		}
+	} else if (*border_damage & BORDER_SIZE_CHANGED) {
+		/* If we've had a resize, we have to do a full
+		 * repaint. */
+		*border_damage |= BORDER_ALL_DIRTY;
+		pixman_region32_copy(buffer_damage, &output->region);
 	}
 }
 
@@ -931,11 +1412,7 @@ output_rotate_damage(struct weston_output *output,
 	if (!gr->has_egl_buffer_age)
 		return;
 
-	go->buffer_damage_index += BUFFER_DAMAGE_COUNT - 1;
-	go->buffer_damage_index %= BUFFER_DAMAGE_COUNT;
-
-	pixman_region32_copy(&go->buffer_damage[go->buffer_damage_index], output_damage);
-	go->border_damage[go->buffer_damage_index] = border_status;
+	damage_history_push(&go->damage_history, output_damage, border_status);
 }
 
 /* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
@@ -956,16 +1433,18 @@ gl_renderer_repaint_output(struct weston_output *output,
 	EGLBoolean ret;
 	static int errored;
 #ifdef EGL_EXT_swap_buffers_with_damage
-	int i, nrects, buffer_height;
-	EGLint *egl_damage, *d;
+	int i, buffer_height;
+	EGLint *d;
 	pixman_box32_t *rects;
 #endif
 	pixman_region32_t buffer_damage, total_damage;
-	enum gl_border_status border_damage = BORDER_STATUS_CLEAN;
+	uint32_t border_damage = BORDER_STATUS_CLEAN;
 
 	if (use_output(output) < 0)
 		return;
 
+	memset(&go->frame_stats, 0, sizeof go->frame_stats);
+
 	/* Calculate the viewport */
 	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
 		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
@@ -1001,7 +1480,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	output_get_damage(output, &buffer_damage, &border_damage);
 	output_rotate_damage(output, output_damage, go->border_status);
 
-	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	fast_region_union(&total_damage, &buffer_damage, output_damage);
 	border_damage |= go->border_status;
 
 	repaint_views(output, &total_damage);
@@ -1030,15 +1509,17 @@ gl_renderer_repaint_output(struct weston_output *output,
 						 &buffer_damage);
 		}
 
-		rects = pixman_region32_rectangles(&buffer_damage, &nrects);
-		egl_damage = malloc(nrects * 4 * sizeof(EGLint));
+		/* Coarsened to at most DAMAGE_MAX_RECTS boxes; swapping
+		 * a bit more than the damage is harmless. */
+		damage_boxes_from_region(&go->swap_damage, &buffer_damage);
+		rects = go->swap_damage.boxes;
 
 		buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
 				output->current_mode->height +
 				go->borders[GL_RENDERER_BORDER_BOTTOM].height;
 
-		d = egl_damage;
-		for (i = 0; i < nrects; ++i) {
+		d = go->swap_rects;
+		for (i = 0; i < go->swap_damage.n; ++i) {
 			*d++ = rects[i].x1;
 			*d++ = buffer_height - rects[i].y2;
 			*d++ = rects[i].x2 - rects[i].x1;
@@ -1046,8 +1527,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 		}
 		ret = gr->swap_buffers_with_damage(gr->egl_display,
 						   go->egl_surface,
-						   egl_damage, nrects);
-		free(egl_damage);
+						   go->swap_rects,
+						   go->swap_damage.n);
 		pixman_region32_fini(&buffer_damage);
 	} else {
 		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
@@ -1065,6 +1546,21 @@ gl_renderer_repaint_output(struct weston_output *output,
 	go->border_status = BORDER_STATUS_CLEAN;
 }
 
+static int
+read_format_to_gl(pixman_format_code_t format, GLenum *gl_format)
+{
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		*gl_format = GL_BGRA_EXT;
+		return 0;
+	case PIXMAN_a8b8g8r8:
+		*gl_format = GL_RGBA;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
 static int
 gl_renderer_read_pixels(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -1077,16 +1573,8 @@ gl_renderer_read_pixels(struct weston_output *output,
 	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
 	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
 
-	switch (format) {
-	case PIXMAN_a8r8g8b8:
-		gl_format = GL_BGRA_EXT;
-		break;
-	case PIXMAN_a8b8g8r8:
-		gl_format = GL_RGBA;
-		break;
-	default:
+	if (read_format_to_gl(format, &gl_format) < 0)
 		return -1;
-	}
 
 	if (use_output(output) < 0)
 		return -1;
@@ -1099,25 +1587,435 @@ gl_renderer_read_pixels(struct weston_output *output,
 }
 
 static void
-gl_renderer_flush_damage(struct weston_surface *surface)
+readback_destroy(struct gl_renderer *gr, struct gl_readback *rb)
 {
-	struct gl_renderer *gr = get_renderer(surface->compositor);
-	struct gl_surface_state *gs = get_surface_state(surface);
-	struct weston_buffer *buffer = gs->buffer_ref.buffer;
-	struct weston_view *view;
-	int texture_used;
+	wl_list_remove(&rb->link);
+#ifdef EGL_KHR_fence_sync
+	if (rb->fence != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, rb->fence);
+#endif
+	glDeleteBuffers(1, &rb->pbo);
+	free(rb);
+}
 
-#ifdef GL_EXT_unpack_subimage
-	pixman_box32_t *rectangles;
-	void *data;
-	int i, n;
+static int
+readback_is_done(struct gl_renderer *gr, struct gl_readback *rb)
+{
+#ifdef EGL_KHR_fence_sync
+	if (rb->fence != EGL_NO_SYNC_KHR)
+		return gr->client_wait_sync(gr->egl_display, rb->fence,
+					    0, 0) != EGL_TIMEOUT_EXPIRED_KHR;
 #endif
 
-	pixman_region32_union(&gs->texture_damage,
-			      &gs->texture_damage, &surface->damage);
+	/* Without fences, mapping the buffer waits for the copy. */
+	return 1;
+}
 
-	if (!buffer)
-		return;
+/* Copy the pixels out of the pack buffer and hand them to the caller. */
+static void
+readback_finish(struct gl_renderer *gr, struct gl_readback *rb)
+{
+	weston_read_pixels_done_func_t done = rb->done;
+	void *data = rb->data;
+	void *map;
+	int status = -1;
+
+	if (use_output(rb->output) == 0) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+		map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, rb->size,
+					   GL_MAP_READ_BIT);
+		if (map) {
+			memcpy(rb->pixels, map, rb->size);
+			gr->unmap_buffer(GL_PIXEL_PACK_BUFFER);
+			status = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	readback_destroy(gr, rb);
+	done(data, status);
+}
+
+static int
+readback_timer_handler(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_readback *rb, *next;
+
+	/* Read-backs complete in the order they were started. */
+	wl_list_for_each_safe(rb, next, &gr->readbacks, link) {
+		if (!readback_is_done(gr, rb))
+			break;
+		readback_finish(gr, rb);
+	}
+
+	if (!wl_list_empty(&gr->readbacks))
+		wl_event_source_timer_update(gr->readback_timer, 1);
+
+	return 0;
+}
+
+static void
+readback_finish_all(struct gl_renderer *gr)
+{
+	struct gl_readback *rb, *next;
+
+	wl_list_for_each_safe(rb, next, &gr->readbacks, link)
+		readback_finish(gr, rb);
+}
+
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      pixman_format_code_t format, void *pixels,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height,
+			      weston_read_pixels_done_func_t done,
+			      void *data)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct wl_event_loop *loop;
+	struct gl_readback *rb;
+	GLenum gl_format;
+
+	if (!gr->has_pbo) {
+		if (gl_renderer_read_pixels(output, format, pixels,
+					    x, y, width, height) < 0)
+			return -1;
+
+		done(data, 0);
+		return 0;
+	}
+
+	if (read_format_to_gl(format, &gl_format) < 0)
+		return -1;
+
+	if (!gr->readback_timer) {
+		loop = wl_display_get_event_loop(output->compositor->wl_display);
+		gr->readback_timer =
+			wl_event_loop_add_timer(loop, readback_timer_handler,
+						gr);
+		if (!gr->readback_timer)
+			return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	rb = zalloc(sizeof *rb);
+	if (rb == NULL)
+		return -1;
+
+	rb->output = output;
+	rb->pixels = pixels;
+	rb->size = (size_t) width * height * 4;
+	rb->done = done;
+	rb->data = data;
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, rb->size, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+#ifdef EGL_KHR_fence_sync
+	rb->fence = EGL_NO_SYNC_KHR;
+	if (gr->has_fence_sync)
+		rb->fence = gr->create_sync(gr->egl_display,
+					    EGL_SYNC_FENCE_KHR, NULL);
+#endif
+
+	/* Submit the copy now, not only with the next swap. */
+	glFlush();
+
+	wl_list_insert(gr->readbacks.prev, &rb->link);
+	wl_event_source_timer_update(gr->readback_timer, 1);
+
+	return 0;
+}
+
+static struct gl_atlas_page *
+atlas_page_create(struct gl_renderer *gr)
+{
+	struct gl_atlas_page *page;
+
+	page = zalloc(sizeof *page);
+	if (page == NULL)
+		return NULL;
+
+	glGenTextures(1, &page->texture);
+	glBindTexture(GL_TEXTURE_2D, page->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+		     ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 0,
+		     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	atlas_allocator_init(&page->allocator,
+			     ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+	wl_list_insert(gr->atlas_pages.prev, &page->link);
+
+	return page;
+}
+
+static void
+atlas_page_destroy(struct gl_atlas_page *page)
+{
+	glDeleteTextures(1, &page->texture);
+	atlas_allocator_fini(&page->allocator);
+	wl_list_remove(&page->link);
+	free(page);
+}
+
+static int
+surface_atlas_place(struct gl_renderer *gr, struct gl_surface_state *gs,
+		    int width, int height)
+{
+	struct gl_atlas_page *page;
+	struct atlas_rect rect;
+	int pages = 0;
+
+	width += 2 * ATLAS_GUTTER;
+	height += 2 * ATLAS_GUTTER;
+
+	wl_list_for_each(page, &gr->atlas_pages, link) {
+		if (atlas_allocator_alloc(&page->allocator,
+					  width, height, &rect) == 0)
+			goto found;
+		pages++;
+	}
+
+	if (pages == ATLAS_MAX_PAGES)
+		return -1;
+
+	page = atlas_page_create(gr);
+	if (page == NULL)
+		return -1;
+
+	if (atlas_allocator_alloc(&page->allocator, width, height, &rect) < 0) {
+		atlas_page_destroy(page);
+		return -1;
+	}
+
+found:
+	gs->atlas_page = page;
+	gs->atlas_rect.x = rect.x + ATLAS_GUTTER;
+	gs->atlas_rect.y = rect.y + ATLAS_GUTTER;
+	gs->atlas_rect.width = rect.width - 2 * ATLAS_GUTTER;
+	gs->atlas_rect.height = rect.height - 2 * ATLAS_GUTTER;
+
+	return 0;
+}
+
+static void
+surface_atlas_release(struct gl_surface_state *gs)
+{
+	struct gl_atlas_page *page = gs->atlas_page;
+	struct atlas_rect rect;
+
+	if (page == NULL)
+		return;
+
+	rect.x = gs->atlas_rect.x - ATLAS_GUTTER;
+	rect.y = gs->atlas_rect.y - ATLAS_GUTTER;
+	rect.width = gs->atlas_rect.width + 2 * ATLAS_GUTTER;
+	rect.height = gs->atlas_rect.height + 2 * ATLAS_GUTTER;
+	atlas_allocator_free(&page->allocator, &rect);
+
+	if (page->allocator.count == 0)
+		atlas_page_destroy(page);
+
+	gs->atlas_page = NULL;
+	memset(&gs->atlas_rect, 0, sizeof gs->atlas_rect);
+}
+
+#ifdef GL_EXT_unpack_subimage
+struct atlas_band {
+	int dst, src, size, repeat;
+};
+
+/* Upload a box of the buffer to its place in the atlas page, and where
+ * it touches the buffer edges, the edge pixels into the gutter. */
+static void
+atlas_upload_box(struct gl_surface_state *gs, void *data,
+		 const pixman_box32_t *box)
+{
+	struct atlas_band cols[3], rows[3];
+	int w = gs->atlas_rect.width, h = gs->atlas_rect.height;
+	int nc = 0, nr = 0, i, j, k, l;
+
+	if (box->x1 == 0)
+		cols[nc++] = (struct atlas_band) { -ATLAS_GUTTER, 0, 1,
+						   ATLAS_GUTTER };
+	cols[nc++] = (struct atlas_band) { box->x1, box->x1,
+					   box->x2 - box->x1, 1 };
+	if (box->x2 == w)
+		cols[nc++] = (struct atlas_band) { w, w - 1, 1, ATLAS_GUTTER };
+
+	if (box->y1 == 0)
+		rows[nr++] = (struct atlas_band) { -ATLAS_GUTTER, 0, 1,
+						   ATLAS_GUTTER };
+	rows[nr++] = (struct atlas_band) { box->y1, box->y1,
+					   box->y2 - box->y1, 1 };
+	if (box->y2 == h)
+		rows[nr++] = (struct atlas_band) { h, h - 1, 1, ATLAS_GUTTER };
+
+	for (i = 0; i < nr; i++)
+	for (j = 0; j < nc; j++)
+	for (k = 0; k < rows[i].repeat; k++)
+	for (l = 0; l < cols[j].repeat; l++) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, cols[j].src);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, rows[i].src);
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				gs->atlas_rect.x + cols[j].dst + l,
+				gs->atlas_rect.y + rows[i].dst + k,
+				cols[j].size, rows[i].size,
+				gs->gl_format, gs->gl_pixel_type, data);
+	}
+}
+
+static void
+atlas_flush_damage(struct weston_surface *surface,
+		   struct gl_surface_state *gs, struct weston_buffer *buffer)
+{
+	pixman_box32_t *rectangles, box;
+	void *data;
+	int i, n;
+
+	glBindTexture(GL_TEXTURE_2D, gs->atlas_page->texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
+	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	if (gs->needs_full_upload) {
+		box.x1 = 0;
+		box.y1 = 0;
+		box.x2 = gs->atlas_rect.width;
+		box.y2 = gs->atlas_rect.height;
+		atlas_upload_box(gs, data, &box);
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+		for (i = 0; i < n; i++) {
+			box = weston_surface_to_buffer_rect(surface,
+							    rectangles[i]);
+			if (box.x1 < 0)
+				box.x1 = 0;
+			if (box.y1 < 0)
+				box.y1 = 0;
+			box.x2 = MIN(box.x2, gs->atlas_rect.width);
+			box.y2 = MIN(box.y2, gs->atlas_rect.height);
+			if (box.x1 < box.x2 && box.y1 < box.y2)
+				atlas_upload_box(gs, data, &box);
+		}
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
+#endif
+
+/* What uploading the texture damage of a wl_shm surface copies. */
+static uint64_t
+shm_damage_bytes(struct weston_surface *surface,
+		 struct gl_surface_state *gs, int full)
+{
+	const struct gl_shm_plane *plane;
+	pixman_box32_t *rectangles, r;
+	uint64_t pixels = 0, bytes = 0;
+	int i, n;
+
+	if (!full) {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			pixels += (uint64_t) (r.x2 - r.x1) * (r.y2 - r.y1);
+		}
+	}
+
+	for (i = 0; i < gs->num_shm_planes; i++) {
+		plane = &gs->shm_planes[i];
+		if (full)
+			bytes += (uint64_t) plane->pitch * plane->bpp *
+				 ((gs->height + plane->vsub - 1) / plane->vsub);
+		else
+			bytes += pixels * plane->bpp /
+				 (plane->hsub * plane->vsub);
+	}
+
+	return bytes;
+}
+
+/* Uploads box, in buffer coordinates, of a plane of a wl_shm buffer to
+ * its texture, or all of the plane if box is NULL. */
+static void
+shm_plane_upload(struct gl_renderer *gr, struct gl_surface_state *gs,
+		 int i, uint8_t *data, const pixman_box32_t *box)
+{
+	const struct gl_shm_plane *plane = &gs->shm_planes[i];
+#ifdef GL_EXT_unpack_subimage
+	int x1, y1, x2, y2;
+#endif
+
+	glBindTexture(GL_TEXTURE_2D, gs->textures[i]);
+	data += plane->offset;
+
+	if (!box) {
+#ifdef GL_EXT_unpack_subimage
+		if (gr->has_unpack_subimage) {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, plane->pitch);
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+			glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+		}
+#endif
+		glTexImage2D(GL_TEXTURE_2D, 0, plane->gl_internal_format,
+			     plane->pitch,
+			     (gs->height + plane->vsub - 1) / plane->vsub, 0,
+			     plane->gl_format, gs->gl_pixel_type, data);
+		return;
+	}
+
+#ifdef GL_EXT_unpack_subimage
+	x1 = box->x1 / plane->hsub;
+	y1 = box->y1 / plane->vsub;
+	x2 = (box->x2 + plane->hsub - 1) / plane->hsub;
+	y2 = (box->y2 + plane->vsub - 1) / plane->vsub;
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, plane->pitch);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x1);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x1, y1, x2 - x1, y2 - y1,
+			plane->gl_format, gs->gl_pixel_type, data);
+#endif
+}
+
+static void
+gl_renderer_flush_damage(struct weston_surface *surface)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	struct weston_view *view;
+	int texture_used, j;
+	void *data;
+
+#ifdef GL_EXT_unpack_subimage
+	pixman_box32_t *rectangles;
+	int i, n;
+#endif
+
+	pixman_region32_union(&gs->texture_damage,
+			      &gs->texture_damage, &surface->damage);
+
+	if (!buffer)
+		return;
 
 	/* Avoid upload, if the texture won't be used this time.
 	 * We still accumulate the damage in texture_damage, and
@@ -1134,50 +2032,52 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (!texture_used)
 		return;
 
+	/* The GPU reads the buffer itself, so it is kept until the next
+	 * one is attached, like EGL buffers. */
+	if (gs->buffer_type == BUFFER_TYPE_SHM_DMABUF) {
+		gr->shm_bytes_imported +=
+			shm_damage_bytes(surface, gs, gs->needs_full_upload ||
+					 !gr->has_unpack_subimage);
+		pixman_region32_clear(&gs->texture_damage);
+		gs->needs_full_upload = 0;
+		return;
+	}
+
 	if (!pixman_region32_not_empty(&gs->texture_damage) &&
 	    !gs->needs_full_upload)
 		goto done;
 
-	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
-
-	if (!gr->has_unpack_subimage) {
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
-			     gs->pitch, buffer->height, 0,
-			     gs->gl_format, gs->gl_pixel_type,
-			     wl_shm_buffer_get_data(buffer->shm_buffer));
-		wl_shm_buffer_end_access(buffer->shm_buffer);
+	gr->shm_bytes_uploaded +=
+		shm_damage_bytes(surface, gs, gs->needs_full_upload ||
+				 !gr->has_unpack_subimage);
 
+#ifdef GL_EXT_unpack_subimage
+	if (gs->atlas_page) {
+		atlas_flush_damage(surface, gs, buffer);
 		goto done;
 	}
+#endif
 
-#ifdef GL_EXT_unpack_subimage
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
-	if (gs->needs_full_upload) {
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	if (!gr->has_unpack_subimage || gs->needs_full_upload) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
-			     gs->pitch, buffer->height, 0,
-			     gs->gl_format, gs->gl_pixel_type, data);
+		for (j = 0; j < gs->num_shm_planes; j++)
+			shm_plane_upload(gr, gs, j, data, NULL);
 		wl_shm_buffer_end_access(buffer->shm_buffer);
+
 		goto done;
 	}
 
+#ifdef GL_EXT_unpack_subimage
 	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
 	for (i = 0; i < n; i++) {
 		pixman_box32_t r;
 
 		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
-
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
-				r.x2 - r.x1, r.y2 - r.y1,
-				gs->gl_format, gs->gl_pixel_type, data);
+		for (j = 0; j < gs->num_shm_planes; j++)
+			shm_plane_upload(gr, gs, j, data, &r);
 	}
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 #endif
@@ -1207,9 +2107,203 @@ ensure_textures(struct gl_surface_state *gs, int num_textures)
 				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	}
 	gs->num_textures = num_textures;
+	gs->filter = 0;
 	glBindTexture(gs->target, 0);
 }
 
+static void
+shm_image_clear(struct gl_renderer *gr, struct gl_shm_image *si)
+{
+	if (!si->buffer)
+		return;
+
+	if (si->image)
+		gr->destroy_image(gr->egl_display, si->image);
+	wl_list_remove(&si->buffer_destroy_listener.link);
+	memset(si, 0, sizeof *si);
+}
+
+static void
+shm_image_buffer_destroyed(struct wl_listener *listener, void *data)
+{
+	struct gl_shm_image *si =
+		container_of(listener, struct gl_shm_image,
+			     buffer_destroy_listener);
+
+	shm_image_clear(get_renderer(si->gs->surface->compositor), si);
+}
+
+static void
+surface_shm_images_release(struct gl_renderer *gr,
+			   struct gl_surface_state *gs)
+{
+	int i;
+
+	for (i = 0; i < SHM_IMAGE_CACHE_SIZE; i++)
+		shm_image_clear(gr, &gs->shm_images[i]);
+}
+
+/* Wraps the buffer in a dma-buf and imports that. Returns NULL if it
+ * cannot be, which for most reasons only holds for this buffer. */
+static EGLImageKHR
+shm_image_create(struct gl_renderer *gr, struct wl_shm_buffer *shm_buffer)
+{
+	struct shm_mapping mapping;
+	EGLImageKHR image;
+	EGLint attribs[13];
+	int32_t width, height, stride;
+	uint32_t format;
+	void *data;
+	int fd;
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	format = wl_shm_buffer_get_format(shm_buffer);
+	data = wl_shm_buffer_get_data(shm_buffer);
+
+	if (shm_dmabuf_find_mapping(data, (size_t) stride * height,
+				    &mapping) < 0)
+		return NULL;
+
+	fd = shm_dmabuf_create(gr->udmabuf_fd, &mapping, data,
+			       (size_t) stride * height);
+	if (fd < 0 && (errno == EPERM || errno == EACCES || errno == ENOTTY)) {
+		/* No pool can be reopened without the capability, and
+		 * a udmabuf device without the ioctl will not grow it. */
+		weston_log("warning: cannot wrap wl_shm buffers in "
+			   "dma-bufs (%m), uploading them instead\n");
+		close(gr->udmabuf_fd);
+		gr->udmabuf_fd = -1;
+		gr->has_shm_dmabuf = 0;
+		return NULL;
+	}
+	if (fd < 0)
+		return NULL;
+
+	attribs[0] = EGL_WIDTH;
+	attribs[1] = width;
+	attribs[2] = EGL_HEIGHT;
+	attribs[3] = height;
+	attribs[4] = EGL_LINUX_DRM_FOURCC_EXT;
+	/* DRM_FORMAT_ARGB8888 and DRM_FORMAT_XRGB8888 */
+	attribs[5] = format == WL_SHM_FORMAT_ARGB8888 ?
+		     0x34325241 : 0x34325258;
+	attribs[6] = EGL_DMA_BUF_PLANE0_FD_EXT;
+	attribs[7] = fd;
+	attribs[8] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+	attribs[9] = 0;
+	attribs[10] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
+	attribs[11] = stride;
+	attribs[12] = EGL_NONE;
+
+	image = gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
+				 EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	close(fd);
+
+	return image;
+}
+
+static EGLImageKHR
+shm_image_import(struct gl_renderer *gr, struct gl_surface_state *gs,
+		 struct weston_buffer *buffer, struct wl_shm_buffer *shm_buffer)
+{
+	struct gl_shm_image *si;
+	int32_t width, height, stride;
+	uint32_t format;
+	void *data;
+	int i;
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	format = wl_shm_buffer_get_format(shm_buffer);
+	data = wl_shm_buffer_get_data(shm_buffer);
+
+	/* The buffer keeps its pool, and so the mapping, alive. */
+	for (i = 0; i < SHM_IMAGE_CACHE_SIZE; i++) {
+		si = &gs->shm_images[i];
+		if (si->buffer == buffer && si->data == data &&
+		    si->width == width && si->height == height &&
+		    si->stride == stride && si->format == format)
+			return si->image;
+	}
+
+	si = &gs->shm_images[gs->shm_image_next];
+	gs->shm_image_next = (gs->shm_image_next + 1) % SHM_IMAGE_CACHE_SIZE;
+	shm_image_clear(gr, si);
+
+	si->image = shm_image_create(gr, shm_buffer);
+	si->buffer = buffer;
+	si->gs = gs;
+	si->data = data;
+	si->width = width;
+	si->height = height;
+	si->stride = stride;
+	si->format = format;
+	si->buffer_destroy_listener.notify = shm_image_buffer_destroyed;
+	wl_signal_add(&buffer->destroy_signal, &si->buffer_destroy_listener);
+
+	return si->image;
+}
+
+/* Let the GPU read a large wl_shm buffer in place. Returns -1 if it has
+ * to be uploaded instead. */
+static int
+gl_renderer_attach_shm_dmabuf(struct weston_surface *es,
+			      struct weston_buffer *buffer,
+			      struct wl_shm_buffer *shm_buffer)
+{
+	struct gl_renderer *gr = get_renderer(es->compositor);
+	struct gl_surface_state *gs = get_surface_state(es);
+	uint32_t format = wl_shm_buffer_get_format(shm_buffer);
+	EGLImageKHR image;
+
+	if (!gr->has_shm_dmabuf ||
+	    (format != WL_SHM_FORMAT_ARGB8888 &&
+	     format != WL_SHM_FORMAT_XRGB8888) ||
+	    (size_t) wl_shm_buffer_get_stride(shm_buffer) * buffer->height <
+	    SHM_DMABUF_MIN_SIZE)
+		return -1;
+
+	image = shm_image_import(gr, gs, buffer, shm_buffer);
+	if (!image)
+		return -1;
+
+	surface_atlas_release(gs);
+
+	if (gs->buffer_type != BUFFER_TYPE_SHM_DMABUF) {
+		glDeleteTextures(gs->num_textures, gs->textures);
+		gs->num_textures = 0;
+		gs->needs_full_upload = 1;
+	}
+
+	gs->target = GL_TEXTURE_2D;
+	ensure_textures(gs, 1);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(gs->target, gs->textures[0]);
+	gr->image_target_texture_2d(gs->target, image);
+
+	gs->shader = format == WL_SHM_FORMAT_ARGB8888 ?
+		     &gr->texture_shader_rgba : &gr->texture_shader_rgbx;
+	gs->pitch = buffer->width;
+	gs->height = buffer->height;
+	gs->gl_format = GL_BGRA_EXT;
+	gs->gl_pixel_type = GL_UNSIGNED_BYTE;
+	memset(gs->shm_planes, 0, sizeof gs->shm_planes);
+	gs->shm_planes[0].pitch = buffer->width;
+	gs->shm_planes[0].hsub = gs->shm_planes[0].vsub = 1;
+	gs->shm_planes[0].bpp = 4;
+	gs->shm_planes[0].gl_format = GL_BGRA_EXT;
+	gs->shm_planes[0].gl_internal_format = GL_BGRA_EXT;
+	gs->num_shm_planes = 1;
+	gs->buffer_type = BUFFER_TYPE_SHM_DMABUF;
+	gs->y_inverted = 1;
+	gs->surface = es;
+
+	return 0;
+}
+
 static void
 gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		       struct wl_shm_buffer *shm_buffer)
@@ -1217,38 +2311,141 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	struct weston_compositor *ec = es->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
-	GLenum gl_format, gl_pixel_type;
-	int pitch;
+	struct gl_shm_plane planes[3];
+	struct gl_shader *shader;
+	GLenum gl_format, gl_internal_format, gl_pixel_type;
+	int pitch, bpp, stride, num_planes, chroma_height;
+	void *data;
+	size_t size;
 
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
+	if (gl_renderer_attach_shm_dmabuf(es, buffer, shm_buffer) == 0)
+		return;
+
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	chroma_height = (buffer->height + 1) / 2;
+	num_planes = 1;
+	gl_internal_format = 0;
+
 	switch (wl_shm_buffer_get_format(shm_buffer)) {
 	case WL_SHM_FORMAT_XRGB8888:
-		gs->shader = &gr->texture_shader_rgbx;
-		pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
+		shader = &gr->texture_shader_rgbx;
+		bpp = 4;
 		gl_format = GL_BGRA_EXT;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		break;
 	case WL_SHM_FORMAT_ARGB8888:
-		gs->shader = &gr->texture_shader_rgba;
-		pitch = wl_shm_buffer_get_stride(shm_buffer) / 4;
+		shader = &gr->texture_shader_rgba;
+		bpp = 4;
 		gl_format = GL_BGRA_EXT;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		break;
 	case WL_SHM_FORMAT_RGB565:
-		gs->shader = &gr->texture_shader_rgbx;
-		pitch = wl_shm_buffer_get_stride(shm_buffer) / 2;
+		shader = &gr->texture_shader_rgbx;
+		bpp = 2;
 		gl_format = GL_RGB;
 		gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
+	case WL_SHM_FORMAT_XRGB2101010:
+		if (!gr->has_texture_2101010)
+			goto unknown;
+		/* GL puts the low bits, blue here, in the red channel. */
+		shader = &gr->texture_shader_bgrx;
+		bpp = 4;
+		gl_format = GL_RGBA;
+		gl_internal_format = gr->texture_2101010_internal_format;
+		gl_pixel_type = GL_UNSIGNED_INT_2_10_10_10_REV_EXT;
+		break;
+	case WL_SHM_FORMAT_NV12:
+		/* The CbCr pairs read as luminance and alpha. */
+		shader = &gr->texture_shader_y_xuxv;
+		bpp = 1;
+		gl_format = GL_LUMINANCE;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		num_planes = 2;
+		planes[1].offset = stride * buffer->height;
+		planes[1].pitch = stride / 2;
+		planes[1].bpp = 2;
+		planes[1].gl_format = GL_LUMINANCE_ALPHA;
+		planes[1].gl_internal_format = GL_LUMINANCE_ALPHA;
+		break;
+	case WL_SHM_FORMAT_YUV420:
+		shader = &gr->texture_shader_y_u_v;
+		bpp = 1;
+		gl_format = GL_LUMINANCE;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		num_planes = 3;
+		planes[1].offset = stride * buffer->height;
+		planes[1].pitch = stride / 2;
+		planes[1].bpp = 1;
+		planes[1].gl_format = GL_LUMINANCE;
+		planes[1].gl_internal_format = GL_LUMINANCE;
+		planes[2] = planes[1];
+		planes[2].offset += stride / 2 * chroma_height;
+		break;
 	default:
+	unknown:
 		weston_log("warning: unknown shm buffer format: %08x\n",
 			   wl_shm_buffer_get_format(shm_buffer));
 		return;
 	}
 
+	pitch = stride / bpp;
+	planes[0].offset = 0;
+	planes[0].pitch = pitch;
+	planes[0].hsub = 1;
+	planes[0].vsub = 1;
+	planes[0].bpp = bpp;
+	planes[0].gl_format = gl_format;
+	planes[0].gl_internal_format =
+		gl_internal_format ? gl_internal_format : gl_format;
+
+	if (num_planes > 1) {
+		planes[1].hsub = planes[1].vsub = 2;
+		planes[2].hsub = planes[2].vsub = 2;
+
+		/* libwayland only checked that the first plane fits in
+		 * the pool. */
+		size = planes[num_planes - 1].offset +
+		       (size_t) planes[num_planes - 1].pitch *
+		       planes[num_planes - 1].bpp * chroma_height;
+		data = wl_shm_buffer_get_data(shm_buffer);
+		if (stride < ((buffer->width + 1) & ~1) ||
+		    ((buffer->shm_checked_data != data ||
+		      buffer->shm_checked_size < size) &&
+		     shm_dmabuf_check_range(data, size) < 0)) {
+			weston_log("warning: invalid YUV shm buffer\n");
+			return;
+		}
+		buffer->shm_checked_data = data;
+		buffer->shm_checked_size = size;
+	}
+
+	gs->shader = shader;
+
+	if (gs->atlas_page &&
+	    (buffer->width != gs->atlas_rect.width ||
+	     buffer->height != gs->atlas_rect.height ||
+	     gl_format != GL_BGRA_EXT)) {
+		surface_atlas_release(gs);
+		gs->atlas_resizes++;
+		gs->buffer_type = BUFFER_TYPE_NULL;
+	}
+
+	if (!gs->atlas_page && gr->has_atlas &&
+	    gl_format == GL_BGRA_EXT &&
+	    buffer->width <= ATLAS_MAX_WIDTH &&
+	    buffer->height <= ATLAS_MAX_HEIGHT &&
+	    gs->atlas_resizes < ATLAS_MAX_RESIZES &&
+	    surface_atlas_place(gr, gs, buffer->width, buffer->height) == 0) {
+		glDeleteTextures(gs->num_textures, gs->textures);
+		gs->num_textures = 0;
+		gs->buffer_type = BUFFER_TYPE_NULL;
+	}
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
 	 * happening, we need to allocate a new texture buffer. */
@@ -1256,19 +2453,24 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	    buffer->height != gs->height ||
 	    gl_format != gs->gl_format ||
 	    gl_pixel_type != gs->gl_pixel_type ||
+	    num_planes != gs->num_shm_planes ||
+	    memcmp(planes, gs->shm_planes, num_planes * sizeof planes[0]) ||
 	    gs->buffer_type != BUFFER_TYPE_SHM) {
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->target = GL_TEXTURE_2D;
 		gs->gl_format = gl_format;
 		gs->gl_pixel_type = gl_pixel_type;
+		memcpy(gs->shm_planes, planes, num_planes * sizeof planes[0]);
+		gs->num_shm_planes = num_planes;
 		gs->buffer_type = BUFFER_TYPE_SHM;
 		gs->needs_full_upload = 1;
 		gs->y_inverted = 1;
 
 		gs->surface = es;
 
-		ensure_textures(gs, 1);
+		if (!gs->atlas_page)
+			ensure_textures(gs, num_planes);
 	}
 }
 
@@ -1360,6 +2562,12 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 
 	weston_buffer_reference(&gs->buffer_ref, buffer);
 
+	shm_buffer = buffer ? wl_shm_buffer_get(buffer->resource) : NULL;
+	if (!shm_buffer) {
+		surface_atlas_release(gs);
+		surface_shm_images_release(gr, gs);
+	}
+
 	if (!buffer) {
 		for (i = 0; i < gs->num_images; i++) {
 			gr->destroy_image(gr->egl_display, gs->images[i]);
@@ -1373,8 +2581,6 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		return;
 	}
 
-	shm_buffer = wl_shm_buffer_get(buffer->resource);
-
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
 	else if (gr->query_buffer(gr->egl_display, (void *) buffer->resource,
@@ -1415,6 +2621,9 @@ gl_renderer_surface_get_content_size(struct weston_surface *surface,
 	if (gs->buffer_type == BUFFER_TYPE_NULL) {
 		*width = 0;
 		*height = 0;
+	} else if (gs->atlas_page) {
+		*width = gs->atlas_rect.width;
+		*height = gs->atlas_rect.height;
 	} else {
 		*width = gs->pitch;
 		*height = gs->height;
@@ -1472,6 +2681,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	GLuint tex;
 	GLenum status;
 	const GLfloat *proj;
+	GLfloat texcoords[4 * 2];
 	int i;
 
 	gl_renderer_surface_get_content_size(surface, &cw, &ch);
@@ -1485,6 +2695,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	case BUFFER_TYPE_SHM:
 		gl_renderer_flush_damage(surface);
 		/* fall through */
+	case BUFFER_TYPE_SHM_DMABUF:
 	case BUFFER_TYPE_EGL:
 		break;
 	}
@@ -1519,6 +2730,26 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glUniformMatrix4fv(gs->shader->proj_uniform, 1, GL_FALSE, proj);
 	glUniform1f(gs->shader->alpha_uniform, 1.0f);
 
+	memcpy(texcoords, verts, sizeof texcoords);
+
+	if (gs->atlas_page) {
+		for (i = 0; i < 4; i++) {
+			texcoords[2 * i] = (gs->atlas_rect.x +
+					    verts[2 * i] * cw) /
+					   ATLAS_PAGE_SIZE;
+			texcoords[2 * i + 1] = (gs->atlas_rect.y +
+						verts[2 * i + 1] * ch) /
+					       ATLAS_PAGE_SIZE;
+		}
+
+		glUniform1i(gs->shader->tex_uniforms[0], 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, gs->atlas_page->texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		gs->atlas_page->filter = GL_NEAREST;
+	}
+
 	for (i = 0; i < gs->num_textures; i++) {
 		glUniform1i(gs->shader->tex_uniforms[i], i);
 
@@ -1527,13 +2758,14 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	}
+	gs->filter = GL_NEAREST;
 
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
 	glEnableVertexAttribArray(0);
 
 	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoords);
 	glEnableVertexAttribArray(1);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -1561,42 +2793,119 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	surface_atlas_release(gs);
+	surface_shm_images_release(gr, gs);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
 	for (i = 0; i < gs->num_images; i++)
 		gr->destroy_image(gr->egl_display, gs->images[i]);
 
-	weston_buffer_reference(&gs->buffer_ref, NULL);
-	pixman_region32_fini(&gs->texture_damage);
-	free(gs);
+	weston_buffer_reference(&gs->buffer_ref, NULL);
+	pixman_region32_fini(&gs->texture_damage);
+	free(gs);
+}
+
+static void
+surface_state_handle_surface_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_surface_state *gs;
+	struct gl_renderer *gr;
+
+	gs = container_of(listener, struct gl_surface_state,
+			  surface_destroy_listener);
+
+	gr = get_renderer(gs->surface->compositor);
+
+	surface_state_destroy(gs, gr);
+}
+
+static void
+surface_state_handle_renderer_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_surface_state *gs;
+	struct gl_renderer *gr;
+
+	gr = data;
+
+	gs = container_of(listener, struct gl_surface_state,
+			  renderer_destroy_listener);
+
+	surface_state_destroy(gs, gr);
+}
+
+static void
+view_state_destroy(struct gl_view_state *vs)
+{
+	int i;
+
+	wl_list_remove(&vs->view_destroy_listener.link);
+	wl_list_remove(&vs->renderer_destroy_listener.link);
+
+	vs->view->renderer_state = NULL;
+
+	for (i = 0; i < GL_GEOMETRY_SLOT_COUNT; i++) {
+		pixman_region32_fini(&vs->cache[i].region);
+		pixman_region32_fini(&vs->cache[i].surf_region);
+		wl_array_release(&vs->cache[i].vertices);
+	}
+
+	free(vs);
+}
+
+static void
+view_state_handle_view_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_view_state *vs;
+
+	vs = container_of(listener, struct gl_view_state,
+			  view_destroy_listener);
+
+	view_state_destroy(vs);
 }
 
 static void
-surface_state_handle_surface_destroy(struct wl_listener *listener, void *data)
+view_state_handle_renderer_destroy(struct wl_listener *listener, void *data)
 {
-	struct gl_surface_state *gs;
-	struct gl_renderer *gr;
-
-	gs = container_of(listener, struct gl_surface_state,
-			  surface_destroy_listener);
+	struct gl_view_state *vs;
 
-	gr = get_renderer(gs->surface->compositor);
+	vs = container_of(listener, struct gl_view_state,
+			  renderer_destroy_listener);
 
-	surface_state_destroy(gs, gr);
+	view_state_destroy(vs);
 }
 
-static void
-surface_state_handle_renderer_destroy(struct wl_listener *listener, void *data)
+static int
+gl_renderer_create_view(struct weston_view *view)
 {
-	struct gl_surface_state *gs;
-	struct gl_renderer *gr;
+	struct gl_view_state *vs;
+	struct gl_renderer *gr = get_renderer(view->surface->compositor);
+	int i;
 
-	gr = data;
+	vs = zalloc(sizeof *vs);
+	if (vs == NULL)
+		return -1;
 
-	gs = container_of(listener, struct gl_surface_state,
-			  renderer_destroy_listener);
+	vs->view = view;
 
-	surface_state_destroy(gs, gr);
+	for (i = 0; i < GL_GEOMETRY_SLOT_COUNT; i++) {
+		pixman_region32_init(&vs->cache[i].region);
+		pixman_region32_init(&vs->cache[i].surf_region);
+		wl_array_init(&vs->cache[i].vertices);
+	}
+
+	view->renderer_state = vs;
+
+	vs->view_destroy_listener.notify =
+		view_state_handle_view_destroy;
+	wl_signal_add(&view->destroy_signal,
+		      &vs->view_destroy_listener);
+
+	vs->renderer_destroy_listener.notify =
+		view_state_handle_renderer_destroy;
+	wl_signal_add(&gr->destroy_signal,
+		      &vs->renderer_destroy_listener);
+
+	return 0;
 }
 
 static int
@@ -1687,6 +2996,17 @@ static const char texture_fragment_shader_rgbx[] =
 	"   gl_FragColor.a = alpha;\n"
 	;
 
+static const char texture_fragment_shader_bgrx[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor.rgb = alpha * texture2D(tex, v_texcoord).bgr;\n"
+	"   gl_FragColor.a = alpha;\n"
+	;
+
 static const char texture_fragment_shader_egl_external[] =
 	"#extension GL_OES_EGL_image_external : require\n"
 	"precision mediump float;\n"
@@ -1767,18 +3087,243 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
+/* Linked programs are kept on disk with GL_OES_get_program_binary, so
+ * that each shader is compiled once per driver instead of at every
+ * start. Bump the version when programs are built differently in a way
+ * their sources do not show, like the attribute bindings. */
+#define SHADER_CACHE_VERSION 1
+
+struct shader_cache_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t format;
+	uint32_t length;
+};
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+/* 64-bit FNV-1a, with a terminator so that concatenations differ */
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+	if (str == NULL)
+		str = "";
+
+	while (*str) {
+		hash ^= (unsigned char) *str++;
+		hash *= FNV_PRIME;
+	}
+
+	hash ^= 0xff;
+	hash *= FNV_PRIME;
+
+	return hash;
+}
+
+static void
+shader_cache_path(struct gl_renderer *gr, char *path, size_t size,
+		  const char *vertex_source, int count, const char **sources)
+{
+	uint64_t key = gr->shader_cache_driver;
+	int i;
+
+	key = hash_string(key, vertex_source);
+	for (i = 0; i < count; i++)
+		key = hash_string(key, sources[i]);
+
+	snprintf(path, size, "%s/shader-%016" PRIx64 ".bin",
+		 gr->shader_cache_dir, key);
+}
+
+static int
+shader_cache_load(struct gl_renderer *gr, struct gl_shader *shader,
+		  const char *path)
+{
+	struct shader_cache_header header;
+	struct stat st;
+	void *binary;
+	GLuint program;
+	GLint status;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 ||
+	    read(fd, &header, sizeof header) != sizeof header ||
+	    memcmp(header.magic, "WSPB", 4) != 0 ||
+	    header.version != SHADER_CACHE_VERSION ||
+	    st.st_size != (off_t) (sizeof header + header.length)) {
+		close(fd);
+		return -1;
+	}
+
+	binary = malloc(header.length);
+	if (binary == NULL ||
+	    read(fd, binary, header.length) != (ssize_t) header.length) {
+		free(binary);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	program = glCreateProgram();
+	gr->program_binary(program, header.format, binary, header.length);
+	free(binary);
+
+	/* The driver may reject binaries of an older build of itself. */
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		unlink(path);
+		return -1;
+	}
+
+	shader->program = program;
+
+	return 0;
+}
+
+static void
+shader_cache_store(struct gl_renderer *gr, struct gl_shader *shader,
+		   const char *path)
+{
+	struct shader_cache_header header = {
+		.magic = { 'W', 'S', 'P', 'B' },
+		.version = SHADER_CACHE_VERSION,
+	};
+	char tmp[PATH_MAX];
+	GLint length = 0;
+	GLsizei written = 0;
+	GLenum format;
+	void *binary;
+	int fd, ok;
+
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (binary == NULL)
+		return;
+
+	gr->get_program_binary(shader->program, length, &written, &format,
+			       binary);
+	if (written <= 0) {
+		free(binary);
+		return;
+	}
+
+	header.format = format;
+	header.length = written;
+
+	/* Written aside and renamed into place, so that a crash or a
+	 * second compositor never leaves a truncated binary behind. */
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(binary);
+		return;
+	}
+
+	ok = write(fd, &header, sizeof header) == sizeof header &&
+	     write(fd, binary, written) == written;
+	close(fd);
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+
+	free(binary);
+}
+
+static int
+make_directories(char *path)
+{
+	char *p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+			*p = '/';
+			return -1;
+		}
+		*p = '/';
+	}
+
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static void
+shader_cache_init(struct gl_renderer *gr, const char *extensions)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char path[PATH_MAX];
+	GLint formats = 0;
+	int len;
+
+	if (!strstr(extensions, "GL_OES_get_program_binary"))
+		return;
+
+	/* Some drivers expose the extension without any format. */
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0)
+		return;
+
+	gr->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	gr->program_binary =
+		(void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!gr->get_program_binary || !gr->program_binary)
+		return;
+
+	if (cache_home && cache_home[0] == '/')
+		len = snprintf(path, sizeof path, "%s/weston", cache_home);
+	else if (home && home[0] == '/')
+		len = snprintf(path, sizeof path, "%s/.cache/weston", home);
+	else
+		return;
+
+	if (len < 0 || len >= (int) sizeof path)
+		return;
+
+	if (make_directories(path) < 0) {
+		weston_log("cannot create shader cache directory %s: %m\n",
+			   path);
+		return;
+	}
+
+	gr->shader_cache_dir = strdup(path);
+
+	/* Binaries are only valid for the driver that produced them. */
+	gr->shader_cache_driver =
+		hash_string(FNV_OFFSET_BASIS, "weston shader cache");
+	gr->shader_cache_driver =
+		hash_string(gr->shader_cache_driver,
+			    (const char *) glGetString(GL_VENDOR));
+	gr->shader_cache_driver =
+		hash_string(gr->shader_cache_driver,
+			    (const char *) glGetString(GL_RENDERER));
+	gr->shader_cache_driver =
+		hash_string(gr->shader_cache_driver,
+			    (const char *) glGetString(GL_VERSION));
+}
+
 static int
 shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		   const char *vertex_source, const char *fragment_source)
 {
 	char msg[512];
+	char path[PATH_MAX];
 	GLint status;
 	int count;
 	const char *sources[3];
 
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
-
 	if (renderer->fragment_shader_debug) {
 		sources[0] = fragment_source;
 		sources[1] = fragment_debug;
@@ -1790,6 +3335,16 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		count = 2;
 	}
 
+	if (renderer->shader_cache_dir) {
+		shader_cache_path(renderer, path, sizeof path,
+				  vertex_source, count, sources);
+		if (shader_cache_load(renderer, shader, path) == 0)
+			goto out;
+	}
+
+	shader->vertex_shader =
+		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+
 	shader->fragment_shader =
 		compile_shader(GL_FRAGMENT_SHADER, count, sources);
 
@@ -1807,6 +3362,10 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+	if (renderer->shader_cache_dir)
+		shader_cache_store(renderer, shader, path);
+
+out:
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
@@ -2010,26 +3569,21 @@ static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface);
 
 static int
-gl_renderer_output_create(struct weston_output *output,
-			  EGLNativeWindowType window_for_legacy,
-			  void *window_for_platform,
-			  const EGLint *attribs,
-			  const EGLint *visual_id,
-			  int n_ids)
+gl_renderer_output_choose_config(struct weston_output *output,
+				 const EGLint *attribs,
+				 const EGLint *visual_id,
+				 int n_ids,
+				 EGLConfig *config_out)
 {
-	struct weston_compositor *ec = output->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_output_state *go;
-	EGLConfig egl_config;
-	int i;
+	struct gl_renderer *gr = get_renderer(output->compositor);
 
 	if (egl_choose_config(gr, attribs, visual_id,
-			      n_ids, &egl_config) == -1) {
+			      n_ids, config_out) == -1) {
 		weston_log("failed to choose EGL config for output\n");
 		return -1;
 	}
 
-	if (egl_config != gr->egl_config &&
+	if (*config_out != gr->egl_config &&
 	    !gr->has_configless_context) {
 		weston_log("attempted to use a different EGL config for an "
 			   "output but EGL_MESA_configless_context is not "
@@ -2037,41 +3591,118 @@ gl_renderer_output_create(struct weston_output *output,
 		return -1;
 	}
 
+	return 0;
+}
+
+static struct gl_output_state *
+gl_renderer_output_state_create(struct weston_output *output,
+				EGLSurface egl_surface,
+				EGLConfig egl_config)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_output_state *go;
+
 	go = zalloc(sizeof *go);
 	if (go == NULL)
+		return NULL;
+
+	go->egl_surface = egl_surface;
+
+	if (gr->egl_context == NULL)
+		if (gl_renderer_setup(ec, go->egl_surface) < 0) {
+			free(go);
+			return NULL;
+		}
+
+	damage_history_init(&go->damage_history);
+
+	output->renderer_state = go;
+
+	log_egl_config_info(gr->egl_display, egl_config);
+
+	return go;
+}
+
+static int
+gl_renderer_output_create(struct weston_output *output,
+			  EGLNativeWindowType window_for_legacy,
+			  void *window_for_platform,
+			  const EGLint *attribs,
+			  const EGLint *visual_id,
+			  int n_ids)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	EGLConfig egl_config;
+	EGLSurface egl_surface;
+
+	if (gl_renderer_output_choose_config(output, attribs, visual_id,
+					     n_ids, &egl_config) < 0)
 		return -1;
 
 	if (gr->create_platform_window) {
-		go->egl_surface =
+		egl_surface =
 			gr->create_platform_window(gr->egl_display,
 						   egl_config,
 						   window_for_platform,
 						   NULL);
 	} else {
-		go->egl_surface =
+		egl_surface =
 			eglCreateWindowSurface(gr->egl_display,
 					       egl_config,
 					       window_for_legacy, NULL);
 	}
 
-	if (go->egl_surface == EGL_NO_SURFACE) {
+	if (egl_surface == EGL_NO_SURFACE) {
 		weston_log("failed to create egl surface\n");
-		free(go);
 		return -1;
 	}
 
-	if (gr->egl_context == NULL)
-		if (gl_renderer_setup(ec, go->egl_surface) < 0) {
-			free(go);
-			return -1;
-		}
+	if (!gl_renderer_output_state_create(output, egl_surface,
+					     egl_config)) {
+		eglDestroySurface(gr->egl_display, egl_surface);
+		return -1;
+	}
+
+	return 0;
+}
 
-	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
-		pixman_region32_init(&go->buffer_damage[i]);
+/* Creates an output rendering into an offscreen pbuffer instead of a
+ * native window, for backends without any window system to present
+ * to. */
+static int
+gl_renderer_output_pbuffer_create(struct weston_output *output,
+				  int width, int height,
+				  const EGLint *attribs)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go;
+	EGLConfig egl_config;
+	EGLSurface egl_surface;
+	const EGLint pbuffer_attribs[] = {
+		EGL_WIDTH, width,
+		EGL_HEIGHT, height,
+		EGL_NONE
+	};
 
-	output->renderer_state = go;
+	if (gl_renderer_output_choose_config(output, attribs,
+					     NULL, 0, &egl_config) < 0)
+		return -1;
 
-	log_egl_config_info(gr->egl_display, egl_config);
+	egl_surface = eglCreatePbufferSurface(gr->egl_display, egl_config,
+					      pbuffer_attribs);
+	if (egl_surface == EGL_NO_SURFACE) {
+		weston_log("failed to create egl pbuffer surface\n");
+		gl_renderer_print_egl_error_state();
+		return -1;
+	}
+
+	go = gl_renderer_output_state_create(output, egl_surface, egl_config);
+	if (!go) {
+		eglDestroySurface(gr->egl_display, egl_surface);
+		return -1;
+	}
+	go->pbuffer = 1;
 
 	return 0;
 }
@@ -2081,10 +3712,10 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
-	int i;
 
-	for (i = 0; i < 2; i++)
-		pixman_region32_fini(&go->buffer_damage[i]);
+	/* Callers are promised completion, and the outputs may share
+	 * them; keep the order by finishing all. */
+	readback_finish_all(gr);
 
 	eglDestroySurface(gr->egl_display, go->egl_surface);
 
@@ -2101,9 +3732,25 @@ static void
 gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_readback *rb, *next;
+	weston_read_pixels_done_func_t done;
+	void *data;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	/* The outputs are gone, so these cannot be read any more. */
+	wl_list_for_each_safe(rb, next, &gr->readbacks, link) {
+		done = rb->done;
+		data = rb->data;
+		readback_destroy(gr, rb);
+		done(data, -1);
+	}
+
+	if (gr->readback_timer)
+		wl_event_source_remove(gr->readback_timer);
+
+	glDeleteBuffers(1, &gr->vertex_buffer);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
@@ -2116,12 +3763,19 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	eglReleaseThread();
 
 	wl_array_release(&gr->vertices);
-	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->batches);
+
+	free(gr->shader_cache_dir);
+
+	if (gr->udmabuf_fd >= 0)
+		close(gr->udmabuf_fd);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->stats_binding)
+		weston_binding_destroy(gr->stats_binding);
 
 	free(gr);
 }
@@ -2175,6 +3829,9 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			gr->has_bind_display = 0;
 	}
 
+	if (strstr(extensions, "EGL_EXT_image_dma_buf_import"))
+		gr->has_dmabuf_import = 1;
+
 	if (strstr(extensions, "EGL_EXT_buffer_age"))
 		gr->has_egl_buffer_age = 1;
 	else
@@ -2195,6 +3852,18 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 		gr->has_configless_context = 1;
 #endif
 
+#ifdef EGL_KHR_fence_sync
+	if (strstr(extensions, "EGL_KHR_fence_sync")) {
+		gr->create_sync =
+			(void *) eglGetProcAddress("eglCreateSyncKHR");
+		gr->destroy_sync =
+			(void *) eglGetProcAddress("eglDestroySyncKHR");
+		gr->client_wait_sync =
+			(void *) eglGetProcAddress("eglClientWaitSyncKHR");
+		gr->has_fence_sync = 1;
+	}
+#endif
+
 	renderer_setup_egl_client_extensions(gr);
 
 	return 0;
@@ -2220,6 +3889,16 @@ static const EGLint gl_renderer_alpha_attribs[] = {
 	EGL_NONE
 };
 
+static const EGLint gl_renderer_pbuffer_attribs[] = {
+	EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	EGL_RED_SIZE, 1,
+	EGL_GREEN_SIZE, 1,
+	EGL_BLUE_SIZE, 1,
+	EGL_ALPHA_SIZE, 0,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+	EGL_NONE
+};
+
 /** Checks whether a platform EGL client extension is supported
  *
  * \param ec The weston compositor
@@ -2292,6 +3971,8 @@ platform_to_extension(EGLenum platform)
 		return "wayland";
 	case EGL_PLATFORM_X11_KHR:
 		return "x11";
+	case EGL_PLATFORM_SURFACELESS_MESA:
+		return "surfaceless";
 	default:
 		assert(0 && "bad EGL platform enum");
 	}
@@ -2317,7 +3998,9 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 	if (gr == NULL)
 		return -1;
 
+	gr->udmabuf_fd = -1;
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -2327,6 +4010,8 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 		gl_renderer_surface_get_content_size;
 	gr->base.surface_copy_content = gl_renderer_surface_copy_content;
 	gr->egl_display = NULL;
+	wl_list_init(&gr->readbacks);
+	wl_list_init(&gr->atlas_pages);
 
 	/* extension_suffix is supported */
 	if (supports) {
@@ -2378,6 +4063,8 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 		goto fail_with_error;
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUV420);
 
 	wl_signal_init(&gr->destroy_signal);
 
@@ -2407,6 +4094,9 @@ compile_shaders(struct weston_compositor *ec)
 	gr->texture_shader_rgbx.vertex_source = vertex_shader;
 	gr->texture_shader_rgbx.fragment_source = texture_fragment_shader_rgbx;
 
+	gr->texture_shader_bgrx.vertex_source = vertex_shader;
+	gr->texture_shader_bgrx.fragment_source = texture_fragment_shader_bgrx;
+
 	gr->texture_shader_egl_external.vertex_source = vertex_shader;
 	gr->texture_shader_egl_external.fragment_source =
 		texture_fragment_shader_egl_external;
@@ -2440,6 +4130,7 @@ fragment_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 
 	shader_release(&gr->texture_shader_rgba);
 	shader_release(&gr->texture_shader_rgbx);
+	shader_release(&gr->texture_shader_bgrx);
 	shader_release(&gr->texture_shader_egl_external);
 	shader_release(&gr->texture_shader_y_uv);
 	shader_release(&gr->texture_shader_y_u_v);
@@ -2465,13 +4156,48 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+frame_stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+	struct weston_output *output;
+	struct gl_output_state *go;
+
+	weston_log("GL renderer, last frame per output:\n");
+	wl_list_for_each(output, &compositor->output_list, link) {
+		go = get_output_state(output);
+		if (!go)
+			continue;
+
+		weston_log_continue(STAMP_SPACE "%s: %u views, %u culled, "
+				    "%u vertices (%u cached regions), "
+				    "%u draw calls, %u GL calls\n",
+				    output->name,
+				    (unsigned int) (output->visible_views.size /
+						    sizeof(struct weston_view *)),
+				    output->culled_views,
+				    go->frame_stats.vertices,
+				    go->frame_stats.geometry_cache_hits,
+				    go->frame_stats.draw_calls,
+				    go->frame_stats.gl_calls);
+	}
+
+	weston_log_continue(STAMP_SPACE "wl_shm since start: %" PRIu64
+			    " bytes uploaded, %" PRIu64 " bytes read in place "
+			    "through dma-bufs\n",
+			    gr->shm_bytes_uploaded, gr->shm_bytes_imported);
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
 	struct gl_renderer *gr = get_renderer(ec);
-	const char *extensions;
+	const char *extensions, *version, *str;
 	EGLConfig context_config;
 	EGLBoolean ret;
+	int gl_major = 0;
 
 	static const EGLint context_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -2533,11 +4259,64 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		gr->has_unpack_subimage = 1;
 #endif
 
+	/* The atlas needs sub-image uploads; it can be turned off with
+	 * WESTON_GL_ATLAS=0 to compare. */
+	str = getenv("WESTON_GL_ATLAS");
+	gr->has_atlas = gr->has_unpack_subimage &&
+			!(str && strcmp(str, "0") == 0);
+
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	/* Importing wl_shm buffers can be turned off with
+	 * WESTON_GL_SHM_DMABUF=0 to compare. */
+	str = getenv("WESTON_GL_SHM_DMABUF");
+	if (gr->has_dmabuf_import && gr->image_target_texture_2d &&
+	    !(str && strcmp(str, "0") == 0)) {
+		gr->udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+		gr->has_shm_dmabuf = gr->udmabuf_fd >= 0;
+	}
+
+	version = (const char *) glGetString(GL_VERSION);
+	if (version && sscanf(version, "OpenGL ES %d", &gl_major) == 1 &&
+	    gl_major >= 3) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBuffer");
+	} else if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+		   strstr(extensions, "GL_EXT_map_buffer_range") &&
+		   strstr(extensions, "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+	}
+	gr->has_pbo = gr->map_buffer_range && gr->unmap_buffer;
+
+	/* ES 3 only takes 2_10_10_10_REV texels into the sized format,
+	 * while the extension on ES 2 wants the unsized one. */
+	if (gl_major >= 3) {
+		gr->has_texture_2101010 = 1;
+		gr->texture_2101010_internal_format = GL_RGB10_A2;
+	} else if (strstr(extensions, "GL_EXT_texture_type_2_10_10_10_REV")) {
+		gr->has_texture_2101010 = 1;
+		gr->texture_2101010_internal_format = GL_RGBA;
+	}
+	if (gr->has_texture_2101010)
+		wl_display_add_shm_format(ec->wl_display,
+					  WL_SHM_FORMAT_XRGB2101010);
+
+	shader_cache_init(gr, extensions);
+
 	glActiveTexture(GL_TEXTURE0);
 
+	/* wl_shm rows, and the chroma rows derived from them, are only
+	 * byte aligned. */
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	glGenBuffers(1, &gr->vertex_buffer);
+
 	if (compile_shaders(ec))
 		return -1;
 
@@ -2549,14 +4328,29 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->stats_binding =
+		weston_compositor_add_debug_binding(ec, KEY_G,
+						    frame_stats_binding,
+						    ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm texture atlas: %s\n",
+			    gr->has_atlas ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm XRGB2101010: %s\n",
+			    gr->has_texture_2101010 ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm dma-buf import: %s\n",
+			    gr->has_shm_dmabuf ? "yes" : "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "asynchronous read-back: %s\n",
+			    !gr->has_pbo ? "no" :
+			    gr->has_fence_sync ? "yes" : "yes, without fences");
+	weston_log_continue(STAMP_SPACE "shader program cache: %s\n",
+			    gr->shader_cache_dir ? gr->shader_cache_dir : "no");
 
 
 	return 0;
@@ -2565,10 +4359,12 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 WL_EXPORT struct gl_renderer_interface gl_renderer_interface = {
 	.opaque_attribs = gl_renderer_opaque_attribs,
 	.alpha_attribs = gl_renderer_alpha_attribs,
+	.pbuffer_attribs = gl_renderer_pbuffer_attribs,
 
 	.create = gl_renderer_create,
 	.display = gl_renderer_display,
 	.output_create = gl_renderer_output_create,
+	.output_pbuffer_create = gl_renderer_output_pbuffer_create,
 	.output_destroy = gl_renderer_output_destroy,
 	.output_surface = gl_renderer_output_surface,
 	.output_set_border = gl_renderer_output_set_border,
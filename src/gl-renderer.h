@@ -62,6 +62,10 @@ typedef EGLSurface (*PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC) (EGLDisplay dpy,
 #define EGL_PLATFORM_X11_KHR 0x31D5
 #endif
 
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
 #define NO_EGL_PLATFORM 0
 
 enum gl_renderer_border_side {
@@ -74,6 +78,7 @@ enum gl_renderer_border_side {
 struct gl_renderer_interface {
 	const EGLint *opaque_attribs;
 	const EGLint *alpha_attribs;
+	const EGLint *pbuffer_attribs;
 
 	int (*create)(struct weston_compositor *ec,
 		      EGLenum platform,
@@ -91,6 +96,13 @@ struct gl_renderer_interface {
 			     const EGLint *visual_id,
 			     const int n_ids);
 
+	/* Creates an output rendering to an offscreen pbuffer of the
+	 * given size. The attribs must select EGL_PBUFFER_BIT configs,
+	 * such as pbuffer_attribs. */
+	int (*output_pbuffer_create)(struct weston_output *output,
+				     int width, int height,
+				     const EGLint *attribs);
+
 	void (*output_destroy)(struct weston_output *output);
 
 	EGLSurface (*output_surface)(struct weston_output *output);
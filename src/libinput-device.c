@@ -38,6 +38,7 @@
 
 #include "compositor.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
@@ -348,8 +349,11 @@ notify_output_destroy(struct wl_listener *listener, void *data)
 		container_of(listener,
 			     struct evdev_device, output_destroy_listener);
 	struct weston_compositor *c = device->seat->compositor;
+	struct udev_seat *seat = (struct udev_seat *) device->seat;
 	struct weston_output *output;
 
+	/* Setting the calibration calls into libinput */
+	udev_input_lock(seat->input);
 	if (!device->output_name && !wl_list_empty(&c->output_list)) {
 		output = container_of(c->output_list.next,
 				      struct weston_output, link);
@@ -357,6 +361,7 @@ notify_output_destroy(struct wl_listener *listener, void *data)
 	} else {
 		device->output = NULL;
 	}
+	udev_input_unlock(seat->input);
 }
 
 /**
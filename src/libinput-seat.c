@@ -26,10 +26,14 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <libinput.h>
 #include <libudev.h>
 
@@ -48,6 +52,12 @@ static struct udev_seat *
 udev_seat_create(struct udev_input *input, const char *seat_name);
 static void
 udev_seat_destroy(struct udev_seat *seat);
+static void
+udev_input_stop_thread(struct udev_input *input);
+
+#define UDEV_INPUT_THREAD_POLL_FAILED		(1 << 0)
+#define UDEV_INPUT_THREAD_DISPATCH_FAILED	(1 << 1)
+#define UDEV_INPUT_THREAD_WAKE_FAILED		(1 << 2)
 
 static void
 device_added(struct udev_input *input, struct libinput_device *libinput_device)
@@ -115,6 +125,12 @@ udev_input_disable(struct udev_input *input)
 	if (input->suspended)
 		return;
 
+	udev_input_stop_thread(input);
+	if (input->libinput_source) {
+		wl_event_source_remove(input->libinput_source);
+		input->libinput_source = NULL;
+	}
+
 	libinput_suspend(input->libinput);
 	process_events(input);
 	input->suspended = 1;
@@ -132,11 +148,15 @@ udev_input_process_event(struct libinput_event *event)
 
 	switch (libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
+		udev_input_lock(input);
 		device_added(input, libinput_device);
+		udev_input_unlock(input);
 		break;
 	case LIBINPUT_EVENT_DEVICE_REMOVED:
 		device = libinput_device_get_user_data(libinput_device);
+		udev_input_lock(input);
 		evdev_device_destroy(device);
+		udev_input_unlock(input);
 		break;
 	default:
 		handled = 0;
@@ -154,15 +174,143 @@ process_event(struct libinput_event *event)
 		return;
 }
 
+static int
+udev_input_ring_push(struct udev_input *input, struct libinput_event *event)
+{
+	unsigned int head = input->ring_head;
+	unsigned int tail = __atomic_load_n(&input->ring_tail,
+					    __ATOMIC_ACQUIRE);
+
+	if (head - tail == UDEV_INPUT_RING_SIZE)
+		return 0;
+
+	input->ring[head & (UDEV_INPUT_RING_SIZE - 1)] = event;
+	__atomic_store_n(&input->ring_head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static struct libinput_event *
+udev_input_ring_pop(struct udev_input *input)
+{
+	unsigned int tail = input->ring_tail;
+	unsigned int head = __atomic_load_n(&input->ring_head,
+					    __ATOMIC_ACQUIRE);
+	struct libinput_event *event;
+
+	if (head == tail)
+		return NULL;
+
+	event = input->ring[tail & (UDEV_INPUT_RING_SIZE - 1)];
+	__atomic_store_n(&input->ring_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return event;
+}
+
+/* Carries out the device open or close the input thread is waiting
+ * for, if any. Called on the main thread with the request lock held. */
+static void
+udev_input_serve_request(struct udev_input *input)
+{
+	struct weston_launcher *launcher = input->compositor->launcher;
+
+	if (!input->request.pending)
+		return;
+
+	if (input->request.path)
+		input->request.fd = weston_launcher_open(launcher,
+							 input->request.path,
+							 input->request.flags);
+	else
+		weston_launcher_close(launcher, input->request.fd);
+
+	input->request.pending = 0;
+	pthread_cond_broadcast(&input->request_cond);
+}
+
+/* Takes the lock from the main thread. The input thread may hold it
+ * while waiting for a device to be opened, so requests are carried out
+ * in the meantime. */
+void
+udev_input_lock(struct udev_input *input)
+{
+	pthread_mutex_lock(&input->request_lock);
+	while (pthread_mutex_trylock(&input->lock) != 0) {
+		if (input->request.pending)
+			udev_input_serve_request(input);
+		else
+			pthread_cond_wait(&input->request_cond,
+					  &input->request_lock);
+	}
+	pthread_mutex_unlock(&input->request_lock);
+}
+
+void
+udev_input_unlock(struct udev_input *input)
+{
+	pthread_mutex_unlock(&input->lock);
+}
+
+static void
+udev_input_log_thread_errors(struct udev_input *input)
+{
+	int errors;
+
+	errors = __atomic_exchange_n(&input->thread_errors, 0,
+				     __ATOMIC_ACQ_REL);
+	if (errors & UDEV_INPUT_THREAD_POLL_FAILED)
+		weston_log("libinput: input thread poll failed\n");
+	if (errors & UDEV_INPUT_THREAD_DISPATCH_FAILED)
+		weston_log("libinput: Failed to dispatch libinput\n");
+	if (errors & UDEV_INPUT_THREAD_WAKE_FAILED)
+		weston_log("libinput: failed to wake up the main thread\n");
+}
+
+static void
+kick_thread(struct udev_input *input)
+{
+	uint64_t value = 1;
+
+	if (write(input->thread_fd, &value, sizeof value) != sizeof value)
+		weston_log("libinput: failed to wake up the input thread\n");
+}
+
+/* Process the events queued by the input thread. The libinput context
+ * is shared with it, so the lock is only taken for the calls into
+ * libinput that are not plain accessors of the event. */
+static void
+process_ring(struct udev_input *input)
+{
+	struct libinput_event *event;
+
+	while ((event = udev_input_ring_pop(input))) {
+		process_event(event);
+
+		udev_input_lock(input);
+		libinput_event_destroy(event);
+		udev_input_unlock(input);
+	}
+
+	/* The thread stops pulling events out of libinput when the ring
+	 * is full; let it continue now there is room again. */
+	if (__atomic_exchange_n(&input->ring_overflow, 0, __ATOMIC_ACQ_REL))
+		kick_thread(input);
+}
+
+/* Only called while the input thread is not running. Events it queued
+ * before stopping come first. */
 static void
 process_events(struct udev_input *input)
 {
 	struct libinput_event *event;
 
-	while ((event = libinput_get_event(input->libinput))) {
+	while ((event = udev_input_ring_pop(input)) ||
+	       (event = libinput_get_event(input->libinput))) {
 		process_event(event);
 		libinput_event_destroy(event);
 	}
+
+	input->ring_overflow = 0;
 }
 
 static int
@@ -184,12 +332,209 @@ libinput_source_dispatch(int fd, uint32_t mask, void *data)
 	return udev_input_dispatch(input) != 0;
 }
 
+static int
+ring_source_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	uint64_t value;
+
+	if (read(fd, &value, sizeof value) != sizeof value &&
+	    errno != EAGAIN)
+		weston_log("libinput: failed to read the input thread "
+			   "eventfd: %m\n");
+
+	pthread_mutex_lock(&input->request_lock);
+	udev_input_serve_request(input);
+	pthread_mutex_unlock(&input->request_lock);
+
+	udev_input_log_thread_errors(input);
+	process_ring(input);
+
+	return 0;
+}
+
+/* Move events from libinput to the ring, as many as fit. Called on the
+ * input thread with the lock held. */
+static int
+udev_input_ring_fill(struct udev_input *input)
+{
+	struct libinput_event *event;
+	int count = 0;
+
+	while (input->ring_head - __atomic_load_n(&input->ring_tail,
+						  __ATOMIC_ACQUIRE) <
+	       UDEV_INPUT_RING_SIZE) {
+		event = libinput_get_event(input->libinput);
+		if (event == NULL)
+			return count;
+
+		udev_input_ring_push(input, event);
+		count++;
+	}
+
+	if (libinput_next_event_type(input->libinput) != LIBINPUT_EVENT_NONE)
+		__atomic_store_n(&input->ring_overflow, 1, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+static void
+wake_main_thread(struct udev_input *input)
+{
+	uint64_t value = 1;
+
+	if (write(input->ring_fd, &value, sizeof value) != sizeof value)
+		__atomic_or_fetch(&input->thread_errors,
+				  UDEV_INPUT_THREAD_WAKE_FAILED,
+				  __ATOMIC_RELEASE);
+}
+
+static void *
+udev_input_thread(void *data)
+{
+	struct udev_input *input = data;
+	struct pollfd fds[2];
+	uint64_t value = 1;
+	int count;
+
+	pthread_mutex_lock(&input->lock);
+	fds[0].fd = libinput_get_fd(input->libinput);
+	pthread_mutex_unlock(&input->lock);
+	fds[0].events = POLLIN;
+	fds[1].fd = input->thread_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			__atomic_or_fetch(&input->thread_errors,
+					  UDEV_INPUT_THREAD_POLL_FAILED,
+					  __ATOMIC_RELEASE);
+			break;
+		}
+
+		/* Woken up to refill the ring, or to quit. */
+		if (fds[1].revents & POLLIN) {
+			while (read(input->thread_fd, &value,
+				    sizeof value) < 0 && errno == EINTR)
+				;
+			if (!__atomic_load_n(&input->thread_running,
+					     __ATOMIC_ACQUIRE))
+				break;
+		}
+
+		pthread_mutex_lock(&input->lock);
+		if ((fds[0].revents & POLLIN) &&
+		    libinput_dispatch(input->libinput) != 0)
+			__atomic_or_fetch(&input->thread_errors,
+					  UDEV_INPUT_THREAD_DISPATCH_FAILED,
+					  __ATOMIC_RELEASE);
+		count = udev_input_ring_fill(input);
+		pthread_mutex_unlock(&input->lock);
+
+		/* The main thread may be waiting for the lock */
+		pthread_mutex_lock(&input->request_lock);
+		pthread_cond_broadcast(&input->request_cond);
+		pthread_mutex_unlock(&input->request_lock);
+
+		if (count > 0)
+			wake_main_thread(input);
+	}
+
+	pthread_mutex_lock(&input->request_lock);
+	input->thread_exited = 1;
+	pthread_cond_broadcast(&input->request_cond);
+	pthread_mutex_unlock(&input->request_lock);
+
+	return NULL;
+}
+
+static int
+udev_input_start_thread(struct udev_input *input)
+{
+	if (input->ring_fd < 0 || input->thread_fd < 0)
+		return -1;
+
+	/* The thread takes the lock first, so input->thread is set
+	 * before it can tell itself apart in open_restricted(). */
+	pthread_mutex_lock(&input->lock);
+	input->thread_exited = 0;
+	input->thread_running = 1;
+	if (pthread_create(&input->thread, NULL,
+			   udev_input_thread, input) != 0) {
+		input->thread_running = 0;
+		pthread_mutex_unlock(&input->lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&input->lock);
+
+	return 0;
+}
+
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	if (!input->thread_running)
+		return;
+
+	__atomic_store_n(&input->thread_running, 0, __ATOMIC_RELEASE);
+	kick_thread(input);
+
+	/* It may be waiting for a device to be opened before it sees
+	 * the request to quit. */
+	pthread_mutex_lock(&input->request_lock);
+	while (!input->thread_exited) {
+		if (input->request.pending)
+			udev_input_serve_request(input);
+		else
+			pthread_cond_wait(&input->request_cond,
+					  &input->request_lock);
+	}
+	pthread_mutex_unlock(&input->request_lock);
+
+	pthread_join(input->thread, NULL);
+	udev_input_log_thread_errors(input);
+}
+
+static int
+on_input_thread(struct udev_input *input)
+{
+	return __atomic_load_n(&input->thread_running, __ATOMIC_ACQUIRE) &&
+	       pthread_equal(pthread_self(), input->thread);
+}
+
+/* Hands a device open or close over to the main thread and waits for
+ * it. Called on the input thread from inside libinput_dispatch(). */
+static int
+udev_input_request(struct udev_input *input, const char *path, int flags,
+		   int fd)
+{
+	pthread_mutex_lock(&input->request_lock);
+	input->request.path = path;
+	input->request.flags = flags;
+	input->request.fd = fd;
+	input->request.pending = 1;
+	pthread_cond_broadcast(&input->request_cond);
+	wake_main_thread(input);
+
+	while (input->request.pending)
+		pthread_cond_wait(&input->request_cond, &input->request_lock);
+	fd = input->request.fd;
+	pthread_mutex_unlock(&input->request_lock);
+
+	return fd;
+}
+
 static int
 open_restricted(const char *path, int flags, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (on_input_thread(input))
+		return udev_input_request(input, path, flags, -1);
+
 	return weston_launcher_open(launcher, path, flags);
 }
 
@@ -199,6 +544,11 @@ close_restricted(int fd, void *user_data)
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (on_input_thread(input)) {
+		udev_input_request(input, NULL, 0, fd);
+		return;
+	}
+
 	weston_launcher_close(launcher, fd);
 }
 
@@ -216,25 +566,32 @@ udev_input_enable(struct udev_input *input)
 	struct udev_seat *seat;
 	int devices_found = 0;
 
-	loop = wl_display_get_event_loop(c->wl_display);
-	fd = libinput_get_fd(input->libinput);
-	input->libinput_source =
-		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
-				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
-	}
-
 	if (input->suspended) {
-		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
-			input->libinput_source = NULL;
+		if (libinput_resume(input->libinput) != 0)
 			return -1;
-		}
 		input->suspended = 0;
 		process_events(input);
 	}
 
+	loop = wl_display_get_event_loop(c->wl_display);
+	if (udev_input_start_thread(input) == 0) {
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, input->ring_fd,
+					     WL_EVENT_READABLE,
+					     ring_source_dispatch, input);
+	} else {
+		weston_log("libinput: failed to start the input thread, "
+			   "reading input on the main thread\n");
+		fd = libinput_get_fd(input->libinput);
+		input->libinput_source =
+			wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					     libinput_source_dispatch, input);
+	}
+	if (!input->libinput_source) {
+		udev_input_stop_thread(input);
+		return -1;
+	}
+
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -264,22 +621,48 @@ libinput_log_func(struct libinput *libinput,
 	weston_vlog(format, args);
 }
 
+static void
+udev_input_close_fds(struct udev_input *input)
+{
+	if (input->ring_fd >= 0)
+		close(input->ring_fd);
+	if (input->thread_fd >= 0)
+		close(input->thread_fd);
+	pthread_mutex_destroy(&input->lock);
+	pthread_mutex_destroy(&input->request_lock);
+	pthread_cond_destroy(&input->request_cond);
+}
+
 int
 udev_input_init(struct udev_input *input, struct weston_compositor *c,
 		struct udev *udev, const char *seat_id)
 {
 	enum libinput_log_priority priority = LIBINPUT_LOG_PRIORITY_INFO;
 	const char *log_priority = NULL;
+	pthread_mutexattr_t attr;
 
 	memset(input, 0, sizeof *input);
 
 	input->compositor = c;
 
+	/* Device setup can lead to LED updates, which take the lock
+	 * again. */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&input->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&input->request_lock, NULL);
+	pthread_cond_init(&input->request_cond, NULL);
+
+	input->ring_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	input->thread_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
 	log_priority = getenv("WESTON_LIBINPUT_LOG_PRIORITY");
 
 	input->libinput = libinput_udev_create_context(&libinput_interface,
 						       input, udev);
 	if (!input->libinput) {
+		udev_input_close_fds(input);
 		return -1;
 	}
 
@@ -299,6 +682,7 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
 		libinput_unref(input->libinput);
+		udev_input_close_fds(input);
 		return -1;
 	}
 
@@ -311,11 +695,20 @@ void
 udev_input_destroy(struct udev_input *input)
 {
 	struct udev_seat *seat, *next;
+	struct libinput_event *event;
+
+	udev_input_stop_thread(input);
+
+	/* Nothing processes the events still queued by the thread now */
+	while ((event = udev_input_ring_pop(input)))
+		libinput_event_destroy(event);
 
-	wl_event_source_remove(input->libinput_source);
+	if (input->libinput_source)
+		wl_event_source_remove(input->libinput_source);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	libinput_unref(input->libinput);
+	udev_input_close_fds(input);
 }
 
 static void
@@ -324,8 +717,10 @@ udev_seat_led_update(struct weston_seat *seat_base, enum weston_led leds)
 	struct udev_seat *seat = (struct udev_seat *) seat_base;
 	struct evdev_device *device;
 
+	udev_input_lock(seat->input);
 	wl_list_for_each(device, &seat->devices_list, link)
 		evdev_led_update(device, leds);
+	udev_input_unlock(seat->input);
 }
 
 static void
@@ -336,6 +731,7 @@ notify_output_create(struct wl_listener *listener, void *data)
 	struct evdev_device *device;
 	struct weston_output *output = data;
 
+	udev_input_lock(seat->input);
 	wl_list_for_each(device, &seat->devices_list, link) {
 		if (device->output_name &&
 		    strcmp(output->name, device->output_name) == 0) {
@@ -345,6 +741,7 @@ notify_output_create(struct wl_listener *listener, void *data)
 		if (device->output_name == NULL && device->output == NULL)
 			evdev_device_set_output(device, output);
 	}
+	udev_input_unlock(seat->input);
 }
 
 static struct udev_seat *
@@ -359,6 +756,7 @@ udev_seat_create(struct udev_input *input, const char *seat_name)
 
 	weston_seat_init(&seat->base, c, seat_name);
 	seat->base.led_update = udev_seat_led_update;
+	seat->input = input;
 
 	seat->output_create_listener.notify = notify_output_create;
 	wl_signal_add(&c->output_created_signal,
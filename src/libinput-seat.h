@@ -29,21 +29,58 @@
 
 #include "config.h"
 
+#include <pthread.h>
 #include <libudev.h>
 
 #include "compositor.h"
 
 struct udev_seat {
 	struct weston_seat base;
+	struct udev_input *input;
 	struct wl_list devices_list;
 	struct wl_listener output_create_listener;
 };
 
+/* Must be a power of two. */
+#define UDEV_INPUT_RING_SIZE 256
+
 struct udev_input {
 	struct libinput *libinput;
 	struct wl_event_source *libinput_source;
 	struct weston_compositor *compositor;
 	int suspended;
+
+	/* libinput is read on a separate thread while the input is
+	 * enabled, so that the kernel queues get drained and libinput's
+	 * timers fire while the main loop is busy repainting. The
+	 * libinput context is not thread-safe, all calls into it are
+	 * made with the lock held. Events are handed to the main thread
+	 * through a single-producer, single-consumer ring. */
+	pthread_mutex_t lock;
+	pthread_t thread;
+	int thread_running;
+	int thread_fd;		/* eventfd, main thread to input thread */
+	int ring_fd;		/* eventfd, input thread to main thread */
+	unsigned int ring_head;	/* written by the input thread */
+	unsigned int ring_tail;	/* written by the main thread */
+	int ring_overflow;	/* events left in libinput's queue */
+	struct libinput_event *ring[UDEV_INPUT_RING_SIZE];
+	int thread_errors;	/* UDEV_INPUT_THREAD_*, logged by main */
+
+	/* libinput opens and closes devices from libinput_dispatch(),
+	 * but the launcher may only be used on the main thread. The
+	 * input thread posts the request here and waits until the main
+	 * thread has carried it out. The main thread also carries them
+	 * out while it waits for the lock above. */
+	pthread_mutex_t request_lock;
+	pthread_cond_t request_cond;
+	int thread_exited;
+	struct {
+		int pending;
+		const char *path;	/* NULL to close fd */
+		int flags;
+		int fd;
+	} request;
 };
 
 int
@@ -58,6 +95,11 @@ udev_input_init(struct udev_input *input,
 void
 udev_input_destroy(struct udev_input *input);
 
+void
+udev_input_lock(struct udev_input *input);
+void
+udev_input_unlock(struct udev_input *input);
+
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
 		    const char *seat_name);
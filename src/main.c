@@ -266,7 +266,10 @@ usage(int error_code)
 		"  --seat=SEAT\t\tThe seat that weston should run on\n"
 		"  --tty=TTY\t\tThe tty to use\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer\n"
-		"  --current-mode\tPrefer current KMS mode over EDID preferred mode\n\n");
+		"  --current-mode\tPrefer current KMS mode over EDID preferred mode\n"
+		"  --dumb-buffers=N\tShow pixman outputs from N buffers (2-4)\n"
+		"  --additional-devices=card1[,card2...]\n"
+		"\t\t\tAlso use the outputs of these DRM devices\n\n");
 #endif
 
 #if defined(BUILD_FBDEV_COMPOSITOR)
@@ -336,7 +339,8 @@ usage(int error_code)
 		"  --height=HEIGHT\tHeight of memory surface\n"
 		"  --transform=TR\tThe output transformation, TR is one of:\n"
 		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
-		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n\n");
+		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
+		"  --use-gl\t\tUse the GL renderer on an offscreen EGL surface\n\n");
 #endif
 
 	exit(error_code);
@@ -496,7 +500,7 @@ weston_compositor_init_config(struct weston_compositor *ec,
 {
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
-	int repaint_msec;
+	int repaint_msec, frame_stats_sec;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
@@ -530,6 +534,17 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_int(s, "frame-stats-interval",
+				      &frame_stats_sec, 0);
+	if (frame_stats_sec < 0) {
+		weston_log("Invalid frame-stats-interval value in config: %d\n",
+			   frame_stats_sec);
+	} else if (frame_stats_sec > 0) {
+		weston_compositor_set_frame_stats_log(ec, frame_stats_sec);
+		weston_log("Logging frame statistics every %d s.\n",
+			   frame_stats_sec);
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,198 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "object-pool.h"
+
+/* Every object is preceded by a header pointing back to its slab. The
+ * union keeps the objects suitably aligned for any member type. */
+union object_pool_header {
+	struct object_pool_slab *slab;
+	long long align_ll;
+	double align_d;
+	void *align_p;
+};
+
+struct object_pool_slab {
+	struct object_pool *pool;
+	struct object_pool_slab *prev, *next;
+
+	unsigned int used;	/* objects currently handed out */
+	unsigned int fresh;	/* objects never handed out so far */
+	void *free_list;	/* singly linked through the objects */
+
+	union object_pool_header data[];
+};
+
+static size_t
+object_pool_stride(struct object_pool *pool)
+{
+	size_t unit = sizeof(union object_pool_header);
+
+	return unit + (pool->object_size + unit - 1) / unit * unit;
+}
+
+static union object_pool_header *
+slab_item(struct object_pool_slab *slab, unsigned int index)
+{
+	char *base = (char *) slab->data;
+
+	return (union object_pool_header *)
+		(base + index * object_pool_stride(slab->pool));
+}
+
+static void
+slab_list_insert(struct object_pool_slab **head, struct object_pool_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *head;
+	if (*head)
+		(*head)->prev = slab;
+	*head = slab;
+}
+
+static void
+slab_list_remove(struct object_pool_slab **head, struct object_pool_slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*head = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+
+	slab->prev = slab->next = NULL;
+}
+
+static struct object_pool_slab *
+object_pool_get_slab(struct object_pool *pool)
+{
+	struct object_pool_slab *slab;
+
+	if (pool->partial)
+		return pool->partial;
+
+	if (pool->empty) {
+		slab = pool->empty;
+		pool->empty = NULL;
+	} else {
+		slab = malloc(sizeof *slab +
+			      pool->objects_per_slab *
+			      object_pool_stride(pool));
+		if (slab == NULL)
+			return NULL;
+
+		slab->pool = pool;
+		slab->used = 0;
+		slab->fresh = 0;
+		slab->free_list = NULL;
+
+		pool->slabs++;
+		pool->slab_allocs++;
+	}
+
+	slab_list_insert(&pool->partial, slab);
+
+	return slab;
+}
+
+void *
+object_pool_zalloc(struct object_pool *pool)
+{
+	struct object_pool_slab *slab;
+	union object_pool_header *item;
+	void *object;
+
+	assert(pool->objects_per_slab > 0);
+	assert(pool->object_size >= sizeof(void *));
+
+	slab = object_pool_get_slab(pool);
+	if (slab == NULL)
+		return NULL;
+
+	if (slab->free_list) {
+		object = slab->free_list;
+		slab->free_list = *(void **) object;
+	} else {
+		item = slab_item(slab, slab->fresh++);
+		item->slab = slab;
+		object = item + 1;
+	}
+
+	if (++slab->used == pool->objects_per_slab)
+		slab_list_remove(&pool->partial, slab);
+
+	pool->live++;
+	if (pool->live > pool->peak)
+		pool->peak = pool->live;
+	pool->allocs++;
+
+	return memset(object, 0, pool->object_size);
+}
+
+void
+object_pool_free(struct object_pool *pool, void *object)
+{
+	struct object_pool_slab *slab;
+
+	if (object == NULL)
+		return;
+
+	slab = ((union object_pool_header *) object - 1)->slab;
+	assert(slab->pool == pool);
+	assert(slab->used > 0);
+
+	*(void **) object = slab->free_list;
+	slab->free_list = object;
+
+	if (slab->used-- == pool->objects_per_slab)
+		slab_list_insert(&pool->partial, slab);
+
+	pool->live--;
+
+	if (slab->used > 0)
+		return;
+
+	slab_list_remove(&pool->partial, slab);
+
+	if (pool->empty == NULL) {
+		pool->empty = slab;
+	} else {
+		free(slab);
+		pool->slabs--;
+	}
+}
+
+/* Return the spare empty slab, if any, to the system. */
+void
+object_pool_trim(struct object_pool *pool)
+{
+	if (pool->empty == NULL)
+		return;
+
+	free(pool->empty);
+	pool->empty = NULL;
+	pool->slabs--;
+}
@@ -0,0 +1,72 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_OBJECT_POOL_H
+#define _WESTON_OBJECT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct object_pool_slab;
+
+/*
+ * A pool of fixed-size objects, carved out of slabs of
+ * 'objects_per_slab' objects each. Objects are handed out zeroed.
+ * A slab is returned to the system once all of its objects are freed,
+ * except for one empty slab that is kept around to absorb
+ * allocate/free cycles.
+ *
+ * Pools are meant to be statically initialized with
+ * OBJECT_POOL_INITIALIZER and need no teardown: objects may be freed
+ * at any time, also after the owner of the pool is gone.
+ */
+struct object_pool {
+	const char *name;
+	size_t object_size;
+	unsigned int objects_per_slab;
+
+	/* slabs with at least one free object */
+	struct object_pool_slab *partial;
+	struct object_pool_slab *empty;
+
+	/* statistics */
+	unsigned int live;
+	unsigned int peak;
+	unsigned int slabs;
+	uint64_t allocs;
+	uint64_t slab_allocs;
+};
+
+#define OBJECT_POOL_INITIALIZER(name_, size_, per_slab_) \
+	{ .name = (name_), .object_size = (size_), \
+	  .objects_per_slab = (per_slab_) }
+
+void *
+object_pool_zalloc(struct object_pool *pool);
+
+void
+object_pool_free(struct object_pool *pool, void *object);
+
+void
+object_pool_trim(struct object_pool *pool);
+
+#endif
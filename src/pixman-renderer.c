@@ -29,9 +29,13 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "pixman-renderer.h"
+#include "shm-dmabuf.h"
+#include "yuv-convert.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
@@ -48,6 +52,12 @@ struct pixman_surface_state {
 	pixman_image_t *image;
 	struct weston_buffer_reference buffer_ref;
 
+	/* NV12 and YUV420 buffers are converted into this, as pixman
+	 * cannot sample them. */
+	pixman_image_t *convert_image;
+
+	pixman_color_t color;	/* of a solid fill image */
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
@@ -61,6 +71,8 @@ struct pixman_renderer {
 	struct weston_binding *debug_binding;
 
 	struct wl_signal destroy_signal;
+
+	int jobs_pending;
 };
 
 static inline struct pixman_output_state *
@@ -310,8 +322,71 @@ composite_clipped(pixman_image_t *src,
 	}
 }
 
-/** Paint an intersected region
+/*
+ * A repaint is recorded as a list of composite operations on the main
+ * thread, and can then be run on any thread while the scene changes.
+ * Every operation has its own source image and holds references to the
+ * buffer and the pixels it samples, so nothing the main thread does to
+ * the surfaces in the meantime affects it.
+ */
+struct pixman_renderer_op {
+	struct pixman_renderer_job *job;
+
+	pixman_image_t *image;		/* keeps the pixels alive */
+	pixman_image_t *src;		/* private to this operation */
+	struct weston_buffer *buffer;
+	struct weston_buffer_reference buffer_ref;
+	struct wl_listener buffer_destroy_listener;
+
+	pixman_op_t op;
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	uint16_t alpha;
+	pixman_region32_t clip;		/* in output coordinates */
+	pixman_region32_t source_clip;	/* in source image coordinates */
+	int source_clipped;
+};
+
+struct pixman_renderer_job {
+	struct weston_output *output;
+	struct pixman_renderer *renderer;
+
+	pixman_image_t *shadow_image;
+	pixman_image_t *hw_buffer;	/* keeps the pixels alive */
+	pixman_image_t *dest;		/* private view of hw_buffer */
+	pixman_region32_t damage;	/* in global coordinates */
+	pixman_region32_t hw_damage;	/* in output coordinates */
+	int repaint_debug;
+	int direct;			/* skips the shadow image */
+
+	struct wl_array ops;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+};
+
+/* Creates an image on the same pixels, so that setting its transform
+ * and filter does not race with other threads using the original. */
+static pixman_image_t *
+image_create_private(pixman_image_t *image, pixman_color_t *color)
+{
+	uint32_t *data = pixman_image_get_data(image);
+
+	/* Solid fills have no pixels */
+	if (!data)
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 data,
+						 pixman_image_get_stride(image));
+}
+
+/** Record painting an intersected region
  *
+ * \param job The repaint being recorded.
  * \param ev The view to be painted.
  * \param output The output being painted.
  * \param repaint_output The region to be painted in output coordinates.
@@ -320,70 +395,59 @@ composite_clipped(pixman_image_t *src,
  * \param pixman_op Compositing operator, either SRC or OVER.
  */
 static void
-repaint_region(struct weston_view *ev, struct weston_output *output,
+repaint_region(struct pixman_renderer_job *job,
+	       struct weston_view *ev, struct weston_output *output,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
-	pixman_transform_t transform;
-	pixman_filter_t filter;
-	pixman_image_t *mask_image;
-	pixman_color_t mask = { 0, };
+	struct pixman_renderer_op *op;
+	pixman_image_t *src;
 
-	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
+	if (!pixman_region32_not_empty(repaint_output))
+		return;
 
-	pixman_renderer_compute_transform(&transform, ev, output);
+	src = image_create_private(ps->image, &ps->color);
+	if (!src)
+		return;
 
-	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
-		filter = PIXMAN_FILTER_BILINEAR;
-	else
-		filter = PIXMAN_FILTER_NEAREST;
+	op = wl_array_add(&job->ops, sizeof *op);
+	if (!op) {
+		pixman_image_unref(src);
+		return;
+	}
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+	memset(op, 0, sizeof *op);
+	op->job = job;
+	op->image = pixman_image_ref(ps->image);
+	op->src = src;
+	op->buffer = ps->buffer_ref.buffer;
+	op->op = pixman_op;
 
-	if (ev->alpha < 1.0) {
-		mask.alpha = 0xffff * ev->alpha;
-		mask_image = pixman_image_create_solid_fill(&mask);
-	} else {
-		mask_image = NULL;
-	}
+	pixman_renderer_compute_transform(&op->transform, ev, output);
 
-	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
-				  &transform, filter, source_clip);
+	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
+		op->filter = PIXMAN_FILTER_BILINEAR;
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		op->filter = PIXMAN_FILTER_NEAREST;
 
-	if (mask_image)
-		pixman_image_unref(mask_image);
+	op->alpha = ev->alpha < 1.0 ? 0xffff * ev->alpha : 0xffff;
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+	pixman_region32_init(&op->clip);
+	pixman_region32_copy(&op->clip, repaint_output);
 
-	if (pr->repaint_debug)
-		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
-					 NULL /* mask */,
-					 po->shadow_image, /* dest */
-					 0, 0, /* src_x, src_y */
-					 0, 0, /* mask_x, mask_y */
-					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
-
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_region32_init(&op->source_clip);
+	if (source_clip) {
+		pixman_region32_copy(&op->source_clip, source_clip);
+		op->source_clipped = 1;
+	}
 }
 
 static void
-draw_view_translated(struct weston_view *view, struct weston_output *output,
+draw_view_translated(struct pixman_renderer_job *job,
+		     struct weston_view *view, struct weston_output *output,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -411,8 +475,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  view);
 			region_global_to_output(output, &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+			repaint_region(job, view, output, &repaint_output,
+				       NULL, PIXMAN_OP_SRC);
 		}
 	}
 
@@ -422,7 +486,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 						  &surface_blend, view);
 		region_global_to_output(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
+		repaint_region(job, view, output, &repaint_output, NULL,
 			       PIXMAN_OP_OVER);
 	}
 
@@ -431,7 +495,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 }
 
 static void
-draw_view_source_clipped(struct weston_view *view,
+draw_view_source_clipped(struct pixman_renderer_job *job,
+			 struct weston_view *view,
 			 struct weston_output *output,
 			 pixman_region32_t *repaint_global)
 {
@@ -458,7 +523,7 @@ draw_view_source_clipped(struct weston_view *view,
 	pixman_region32_copy(&repaint_output, repaint_global);
 	region_global_to_output(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
+	repaint_region(job, view, output, &repaint_output, &buffer_region,
 		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
@@ -467,7 +532,8 @@ draw_view_source_clipped(struct weston_view *view,
 }
 
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
+draw_view(struct pixman_renderer_job *job,
+	  struct weston_view *ev, struct weston_output *output,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
 	static int zoom_logged = 0;
@@ -500,7 +566,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(job, ev, output, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -509,64 +575,285 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(job, ev, output, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
+
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct pixman_renderer_job *job,
+		 struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->visible_views.data;
+	int i, n = output->visible_views.size / sizeof *views;
+
+	/* Occluded views have already been culled by the core. */
+	for (i = n - 1; i >= 0; i--)
+		draw_view(job, views[i], output, damage);
+}
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+/* A fullscreen client that is the only thing to repaint, with its
+ * opaque buffer mapping 1:1 onto the output, is copied straight into
+ * the output buffer. Compositing it into the shadow image first would
+ * copy every damaged pixel twice. */
+static int
+job_can_skip_shadow(struct pixman_renderer_job *job)
+{
+	struct pixman_renderer_op *op = job->ops.data;
+	pixman_region32_t uncovered;
+	int covered;
+
+	if (job->ops.size != sizeof *op || job->repaint_debug)
+		return 0;
+
+	if (op->op != PIXMAN_OP_SRC || op->source_clipped ||
+	    op->alpha < 0xffff ||
+	    !pixman_transform_is_identity(&op->transform) ||
+	    pixman_image_get_width(op->src) !=
+	    pixman_image_get_width(job->dest) ||
+	    pixman_image_get_height(op->src) !=
+	    pixman_image_get_height(job->dest))
+		return 0;
+
+	/* Nothing else may show through in the damage */
+	pixman_region32_init(&uncovered);
+	pixman_region32_subtract(&uncovered, &job->hw_damage, &op->clip);
+	covered = !pixman_region32_not_empty(&uncovered);
+	pixman_region32_fini(&uncovered);
+
+	return covered;
 }
 
 static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+op_handle_buffer_destroy(struct wl_listener *listener, void *data)
 {
+	struct pixman_renderer_op *op =
+		container_of(listener, struct pixman_renderer_op,
+			     buffer_destroy_listener);
+
+	/* The client's pool may be unmapped with the buffer */
+	pixman_renderer_job_wait(op->job);
+	op->buffer = NULL;
+
+	wl_list_remove(&op->buffer_destroy_listener.link);
+	op->buffer_destroy_listener.notify = NULL;
+}
+
+/** Record the repaint of an output
+ *
+ * \param output The output to repaint, into the buffer set with
+ *               pixman_renderer_output_set_buffer().
+ * \param output_damage The damage to repaint, in global coordinates.
+ * \return The job, to be run with pixman_renderer_job_run() and
+ *         finished with pixman_renderer_job_finish(), or NULL.
+ *
+ * The job only depends on the renderer state of the output, which must
+ * not be destroyed before the job is finished.
+ */
+WL_EXPORT struct pixman_renderer_job *
+pixman_renderer_output_prepare_job(struct weston_output *output,
+				   pixman_region32_t *output_damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_output_state *po = get_output_state(output);
-	pixman_region32_t output_region;
+	struct pixman_renderer_job *job;
+	struct pixman_renderer_op *op;
 
-	pixman_region32_init(&output_region);
-	pixman_region32_copy(&output_region, region);
+	if (!po->hw_buffer)
+		return NULL;
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return NULL;
+
+	job->output = output;
+	job->renderer = pr;
+	job->repaint_debug = pr->repaint_debug;
+	job->shadow_image = pixman_image_ref(po->shadow_image);
+	job->hw_buffer = pixman_image_ref(po->hw_buffer);
+	job->dest = image_create_private(po->hw_buffer, NULL);
+	if (!job->dest) {
+		pixman_image_unref(job->hw_buffer);
+		pixman_image_unref(job->shadow_image);
+		free(job);
+		return NULL;
+	}
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->cond, NULL);
+	wl_array_init(&job->ops);
+
+	pixman_region32_init(&job->damage);
+	pixman_region32_copy(&job->damage, output_damage);
+	pixman_region32_init(&job->hw_damage);
+	pixman_region32_copy(&job->hw_damage, output_damage);
+	region_global_to_output(output, &job->hw_damage);
+
+	repaint_surfaces(job, output, output_damage);
+	job->direct = job_can_skip_shadow(job);
+
+	/* The array does not move anymore, the listeners can be linked */
+	wl_array_for_each(op, &job->ops) {
+		if (!op->buffer)
+			continue;
+
+		weston_buffer_reference(&op->buffer_ref, op->buffer);
+		op->buffer_destroy_listener.notify = op_handle_buffer_destroy;
+		wl_signal_add(&op->buffer->destroy_signal,
+			      &op->buffer_destroy_listener);
+	}
 
-	region_global_to_output(output, &output_region);
+	pr->jobs_pending++;
 
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
-	pixman_region32_fini(&output_region);
+	return job;
+}
 
-	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
-				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+/** Run a recorded repaint
+ *
+ * Can be called on any thread, once per job.
+ */
+WL_EXPORT void
+pixman_renderer_job_run(struct pixman_renderer_job *job)
+{
+	struct pixman_renderer_op *op;
+	pixman_image_t *mask_image, *debug_color = NULL;
+	pixman_image_t *target;
+	pixman_color_t mask = { 0, };
+	pixman_color_t red = { 0x3fff, 0x0000, 0x0000, 0x3fff };
+
+	target = job->direct ? job->dest : job->shadow_image;
+
+	if (job->repaint_debug)
+		debug_color = pixman_image_create_solid_fill(&red);
+
+	wl_array_for_each(op, &job->ops) {
+		/* Clip rendering to the damaged output region */
+		pixman_image_set_clip_region32(target, &op->clip);
+
+		if (op->buffer && op->buffer->shm_buffer)
+			wl_shm_buffer_begin_access(op->buffer->shm_buffer);
+
+		if (op->alpha < 0xffff) {
+			mask.alpha = op->alpha;
+			mask_image = pixman_image_create_solid_fill(&mask);
+		} else {
+			mask_image = NULL;
+		}
+
+		if (op->source_clipped)
+			composite_clipped(op->src, mask_image,
+					  target, &op->transform,
+					  op->filter, &op->source_clip);
+		else
+			composite_whole(op->op, op->src, mask_image,
+					target, &op->transform,
+					op->filter);
+
+		if (mask_image)
+			pixman_image_unref(mask_image);
+
+		if (op->buffer && op->buffer->shm_buffer)
+			wl_shm_buffer_end_access(op->buffer->shm_buffer);
+
+		if (debug_color)
+			pixman_image_composite32(PIXMAN_OP_OVER,
+						 debug_color, /* src */
+						 NULL /* mask */,
+						 target, /* dest */
+						 0, 0, /* src_x, src_y */
+						 0, 0, /* mask_x, mask_y */
+						 0, 0, /* dest_x, dest_y */
+						 pixman_image_get_width (target), /* width */
+						 pixman_image_get_height (target) /* height */);
+
+		pixman_image_set_clip_region32 (target, NULL);
+	}
+
+	if (debug_color)
+		pixman_image_unref(debug_color);
+
+	if (!job->direct) {
+		pixman_image_set_clip_region32 (job->dest, &job->hw_damage);
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 job->shadow_image, /* src */
+					 NULL /* mask */,
+					 job->dest, /* dest */
+					 0, 0, /* src_x, src_y */
+					 0, 0, /* mask_x, mask_y */
+					 0, 0, /* dest_x, dest_y */
+					 pixman_image_get_width (job->dest), /* width */
+					 pixman_image_get_height (job->dest) /* height */);
+		pixman_image_set_clip_region32 (job->dest, NULL);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	job->done = 1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/** Wait for a job to be run by another thread */
+WL_EXPORT void
+pixman_renderer_job_wait(struct pixman_renderer_job *job)
+{
+	pthread_mutex_lock(&job->lock);
+	while (!job->done)
+		pthread_cond_wait(&job->cond, &job->lock);
+	pthread_mutex_unlock(&job->lock);
+}
+
+/** Finish a job on the main thread
+ *
+ * Waits for the job to be run, emits the frame signal of the output and
+ * drops the references the job held.
+ */
+WL_EXPORT void
+pixman_renderer_job_finish(struct pixman_renderer_job *job)
+{
+	struct weston_output *output = job->output;
+	struct pixman_renderer_op *op;
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	pixman_renderer_job_wait(job);
+
+	pixman_region32_copy(&output->previous_damage, &job->damage);
+	wl_signal_emit(&output->frame_signal, output);
+
+	wl_array_for_each(op, &job->ops) {
+		if (op->buffer_destroy_listener.notify)
+			wl_list_remove(&op->buffer_destroy_listener.link);
+		weston_buffer_reference(&op->buffer_ref, NULL);
+		pixman_image_unref(op->src);
+		pixman_image_unref(op->image);
+		pixman_region32_fini(&op->clip);
+		pixman_region32_fini(&op->source_clip);
+	}
+	wl_array_release(&job->ops);
+
+	job->renderer->jobs_pending--;
+
+	pixman_region32_fini(&job->damage);
+	pixman_region32_fini(&job->hw_damage);
+	pixman_image_unref(job->dest);
+	pixman_image_unref(job->hw_buffer);
+	pixman_image_unref(job->shadow_image);
+	pthread_cond_destroy(&job->cond);
+	pthread_mutex_destroy(&job->lock);
+	free(job);
 }
 
 static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
-	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer_job *job;
 
-	if (!po->hw_buffer)
+	job = pixman_renderer_output_prepare_job(output, output_damage);
+	if (!job)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
-
-	pixman_region32_copy(&output->previous_damage, output_damage);
-	wl_signal_emit(&output->frame_signal, output);
+	pixman_renderer_job_run(job);
+	pixman_renderer_job_finish(job);
 
 	/* Actual flip should be done by caller */
 }
@@ -593,12 +880,85 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+static int
+convert_yuv_buffer(struct pixman_surface_state *ps,
+		   struct weston_buffer *buffer,
+		   struct wl_shm_buffer *shm_buffer)
+{
+	int32_t width = wl_shm_buffer_get_width(shm_buffer);
+	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	int uv_height = (height + 1) / 2;
+	struct yuv420_image src;
+	uint8_t *data;
+	size_t size;
+
+	if (stride < ((width + 1) & ~1))
+		return -1;
+
+	data = wl_shm_buffer_get_data(shm_buffer);
+	src.width = width;
+	src.height = height;
+	src.y = data;
+	src.y_stride = stride;
+
+	if (wl_shm_buffer_get_format(shm_buffer) == WL_SHM_FORMAT_NV12) {
+		src.u = data + (size_t) stride * height;
+		src.v = src.u + 1;
+		src.uv_stride = stride;
+		src.uv_step = 2;
+		size = (size_t) stride * (height + uv_height);
+	} else {
+		src.uv_stride = stride / 2;
+		src.u = data + (size_t) stride * height;
+		src.v = src.u + (size_t) src.uv_stride * uv_height;
+		src.uv_step = 1;
+		size = (size_t) stride * height +
+		       (size_t) 2 * src.uv_stride * uv_height;
+	}
+
+	/* libwayland only checked that the luma plane fits in the pool. */
+	if (buffer->shm_checked_data != data ||
+	    buffer->shm_checked_size < size) {
+		if (shm_dmabuf_check_range(data, size) < 0)
+			return -1;
+		buffer->shm_checked_data = data;
+		buffer->shm_checked_size = size;
+	}
+
+	/* Repaints still running may be reading the old one */
+	if (ps->convert_image &&
+	    (get_renderer(ps->surface->compositor)->jobs_pending > 0 ||
+	     pixman_image_get_width(ps->convert_image) != width ||
+	     pixman_image_get_height(ps->convert_image) != height)) {
+		pixman_image_unref(ps->convert_image);
+		ps->convert_image = NULL;
+	}
+
+	if (!ps->convert_image) {
+		ps->convert_image =
+			pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						 width, height, NULL, 0);
+		if (!ps->convert_image)
+			return -1;
+	}
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	yuv420_to_xrgb8888(pixman_image_get_data(ps->convert_image),
+			   pixman_image_get_stride(ps->convert_image),
+			   &src, 0, height);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	return 0;
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
 	pixman_format_code_t pixman_format;
+	int convert = 0;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
 
@@ -633,6 +993,14 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	case WL_SHM_FORMAT_RGB565:
 		pixman_format = PIXMAN_r5g6b5;
 		break;
+	case WL_SHM_FORMAT_XRGB2101010:
+		pixman_format = PIXMAN_x2r10g10b10;
+		break;
+	case WL_SHM_FORMAT_NV12:
+	case WL_SHM_FORMAT_YUV420:
+		pixman_format = PIXMAN_x8r8g8b8;
+		convert = 1;
+		break;
 	default:
 		weston_log("Unsupported SHM buffer format\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
@@ -644,10 +1012,19 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	ps->image = pixman_image_create_bits(pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		wl_shm_buffer_get_stride(shm_buffer));
+	if (convert) {
+		if (convert_yuv_buffer(ps, buffer, shm_buffer) < 0) {
+			weston_log("Invalid YUV SHM buffer\n");
+			weston_buffer_reference(&ps->buffer_ref, NULL);
+			return;
+		}
+		ps->image = pixman_image_ref(ps->convert_image);
+	} else {
+		ps->image = pixman_image_create_bits(pixman_format,
+			buffer->width, buffer->height,
+			wl_shm_buffer_get_data(shm_buffer),
+			wl_shm_buffer_get_stride(shm_buffer));
+	}
 
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
@@ -671,6 +1048,8 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	if (ps->convert_image)
+		pixman_image_unref(ps->convert_image);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
@@ -735,7 +1114,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
-	
+	ps->color = color;
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -855,6 +1235,9 @@ pixman_renderer_init(struct weston_compositor *ec)
 						    debug_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_XRGB2101010);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_NV12);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUV420);
 
 	wl_signal_init(&renderer->destroy_signal);
 
@@ -38,3 +38,18 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 
 void
 pixman_renderer_output_destroy(struct weston_output *output);
+
+struct pixman_renderer_job;
+
+struct pixman_renderer_job *
+pixman_renderer_output_prepare_job(struct weston_output *output,
+				   pixman_region32_t *output_damage);
+
+void
+pixman_renderer_job_run(struct pixman_renderer_job *job);
+
+void
+pixman_renderer_job_wait(struct pixman_renderer_job *job);
+
+void
+pixman_renderer_job_finish(struct pixman_renderer_job *job);
@@ -0,0 +1,151 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "plane-planner.h"
+
+static bool
+box_overlaps(const pixman_box32_t *a, const pixman_box32_t *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static float
+view_area(const struct plane_planner_view *v)
+{
+	if (v->box.x1 >= v->box.x2 || v->box.y1 >= v->box.y2)
+		return 0.0f;
+
+	return (float)(v->box.x2 - v->box.x1) * (v->box.y2 - v->box.y1);
+}
+
+/* Pixels per second the view costs to composite on the primary plane,
+ * or 0 if it does not update often enough to be worth an overlay. */
+static float
+view_score(const struct plane_planner_view *v)
+{
+	float rate = v->commit_rate, score;
+
+	if (v->kind != PLANE_PLANNER_OVERLAY)
+		return 0.0f;
+
+	if (rate < (v->was_on_overlay ? PLANE_PLANNER_KEEP_RATE :
+					PLANE_PLANNER_PROMOTE_RATE))
+		return 0.0f;
+
+	score = view_area(v) * rate;
+	if (!v->opaque)
+		score *= PLANE_PLANNER_BLEND_COST;
+	if (v->was_on_overlay)
+		score *= PLANE_PLANNER_KEEP_BONUS;
+
+	return score;
+}
+
+/*
+ * Marks the views that have to go on overlays for view i to: i itself
+ * and every overlay candidate above it that covers it or another view
+ * marked so. Returns the number of views marked, or -1 if a primary
+ * or scanout view is in the way.
+ */
+static int
+collect_group(struct plane_planner_view *views, int i)
+{
+	int j, k, n = 1;
+
+	for (j = 0; j < i; j++)
+		views[j].in_group = false;
+	views[i].in_group = true;
+
+	for (j = i - 1; j >= 0; j--) {
+		if (views[j].kind == PLANE_PLANNER_ABOVE ||
+		    views[j].on_overlay)
+			continue;
+
+		for (k = j + 1; k <= i; k++)
+			if (views[k].in_group &&
+			    box_overlaps(&views[j].box, &views[k].box))
+				break;
+		if (k > i)
+			continue;
+
+		if (views[j].kind != PLANE_PLANNER_OVERLAY)
+			return -1;
+
+		views[j].in_group = true;
+		n++;
+	}
+
+	return n;
+}
+
+/* The untried candidate with the highest score, the topmost one if
+ * several score the same, or -1 */
+static int
+best_candidate(struct plane_planner_view *views, int count)
+{
+	int i, best = -1;
+
+	for (i = 0; i < count; i++) {
+		if (views[i].tried || views[i].on_overlay ||
+		    views[i].score <= 0.0f)
+			continue;
+
+		if (best < 0 || views[i].score > views[best].score)
+			best = i;
+	}
+
+	return best;
+}
+
+int
+plane_planner_assign(struct plane_planner_view *views, int count,
+		     int num_overlays)
+{
+	int i, j, n, assigned = 0;
+
+	for (i = 0; i < count; i++) {
+		views[i].on_overlay = false;
+		views[i].tried = false;
+		views[i].score = view_score(&views[i]);
+	}
+
+	while (assigned < num_overlays) {
+		i = best_candidate(views, count);
+		if (i < 0)
+			break;
+
+		views[i].tried = true;
+
+		n = collect_group(views, i);
+		if (n < 0 || assigned + n > num_overlays)
+			continue;
+
+		for (j = 0; j <= i; j++)
+			if (views[j].in_group)
+				views[j].on_overlay = true;
+		assigned += n;
+	}
+
+	return assigned;
+}
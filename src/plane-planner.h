@@ -0,0 +1,82 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_PLANE_PLANNER_H
+#define _WESTON_PLANE_PLANNER_H
+
+#include <stdbool.h>
+#include <pixman.h>
+
+/*
+ * Chooses which views of an output go on overlay planes.
+ *
+ * A view on the primary plane costs a recomposite of its area every
+ * time it commits a new buffer, and more if it has to be blended. A
+ * view on an overlay costs nothing to composite, but moving a view
+ * between planes recomposites its area once, so views are only
+ * promoted when they update often enough and keep their overlay while
+ * they still update somewhat. The planner only knows about boxes and
+ * rates, the backend still validates each overlay it is given.
+ */
+
+/* Buffer commits per second needed to get an overlay, and to keep it */
+#define PLANE_PLANNER_PROMOTE_RATE 5.0f
+#define PLANE_PLANNER_KEEP_RATE 1.0f
+
+/* Extra weight of a view that is already on an overlay, and of a view
+ * that needs blending on the primary plane */
+#define PLANE_PLANNER_KEEP_BONUS 1.5f
+#define PLANE_PLANNER_BLEND_COST 2.0f
+
+enum plane_planner_kind {
+	PLANE_PLANNER_PRIMARY,	/* has to be composited */
+	PLANE_PLANNER_OVERLAY,	/* can be put on an overlay */
+	PLANE_PLANNER_ABOVE,	/* on a plane above the overlays */
+	PLANE_PLANNER_SCANOUT,	/* scanned out on the primary plane */
+};
+
+struct plane_planner_view {
+	/* Input */
+	pixman_box32_t box;	/* clipped to the output */
+	enum plane_planner_kind kind;
+	float commit_rate;	/* buffer commits per second */
+	bool opaque;
+	bool was_on_overlay;	/* in the previous frame */
+
+	/* Output */
+	bool on_overlay;
+
+	/* Used by the planner */
+	float score;
+	bool tried, in_group;
+};
+
+/* Sets on_overlay for at most num_overlays of the views, which are in
+ * stacking order, topmost first. A view is only put on an overlay if
+ * every primary or scanout view above it leaves it uncovered; overlay candidates
+ * above it that cover it go on overlays along with it, if there are
+ * enough. Returns the number of views put on overlays. */
+int
+plane_planner_assign(struct plane_planner_view *views, int count,
+		     int num_overlays);
+
+#endif
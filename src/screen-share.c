@@ -74,8 +74,19 @@ struct shared_output {
 
 	int cache_dirty;
 	pixman_image_t *cache_image;
-	uint32_t *tmp_data;
-	size_t tmp_data_size;
+	struct wl_list captures;	/* oldest first */
+};
+
+/* The damage of one output frame, read back from the renderer and
+ * copied into the cache once all of it has arrived. */
+struct ss_capture {
+	struct shared_output *so;	/* NULL once the output is gone */
+	struct wl_list link;
+	pixman_region32_t damage;	/* in buffer coordinates */
+	int32_t width, height;		/* of the cache image */
+	uint32_t *data;			/* the rectangles, one after another */
+	int pending;
+	int failed;
 };
 
 struct ss_seat {
@@ -541,42 +552,6 @@ output_compute_transform(struct weston_output *output,
 static void
 shared_output_destroy(struct shared_output *so);
 
-static int
-shared_output_ensure_tmp_data(struct shared_output *so,
-			      pixman_region32_t *region)
-{
-	pixman_box32_t *ext;
-	size_t size;
-
-	if (!pixman_region32_not_empty(region))
-		return 0;
-
-	ext = pixman_region32_extents(region);
-
-	/* Damage is in output coordinates.
-	 *
-	 * We are multiplying by 4 because the temporary data needs to be able
-	 * to store an 32 bit-per-pixel buffer.
-	 */
-	size = 4 * (ext->x2 - ext->x1) * (ext->y2 - ext->y1)
-		 * so->output->current_scale * so->output->current_scale;
-
-	if (so->tmp_data != NULL && size <= so->tmp_data_size)
-		return 0;
-
-	free(so->tmp_data);
-	so->tmp_data = malloc(size);
-	if (so->tmp_data == NULL) {
-		so->tmp_data_size = 0;
-		errno = ENOMEM;
-		return -1;
-	}
-
-	so->tmp_data_size = size;
-
-	return 0;
-}
-
 static void
 shared_output_update(struct shared_output *so);
 
@@ -772,6 +747,90 @@ struct _wl_fullscreen_shell_mode_feedback_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+static void
+ss_capture_destroy(struct ss_capture *capture)
+{
+	wl_list_remove(&capture->link);
+	pixman_region32_fini(&capture->damage);
+	free(capture->data);
+	free(capture);
+}
+
+static void
+ss_capture_blt(struct shared_output *so, struct ss_capture *capture)
+{
+	int32_t x, y, width, height, stride;
+	int i, nrects, do_yflip;
+	pixman_box32_t *r;
+	uint32_t *cache_data, *data;
+
+	/* The cache was recreated since, with full damage. */
+	if (pixman_image_get_width(so->cache_image) != capture->width ||
+	    pixman_image_get_height(so->cache_image) != capture->height)
+		return;
+
+	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	stride = capture->width;
+	cache_data = pixman_image_get_data(so->cache_image);
+	data = capture->data;
+	r = pixman_region32_rectangles(&capture->damage, &nrects);
+	for (i = 0; i < nrects; ++i) {
+		x = r[i].x1;
+		y = r[i].y1;
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (do_yflip)
+			pixman_blt(data, cache_data, -width, stride,
+				   32, 32, 0, 1 - height, x, y, width, height);
+		else
+			pixman_blt(data, cache_data, width, stride,
+				   32, 32, 0, 0, x, y, width, height);
+
+		data += width * height;
+	}
+
+	so->cache_dirty = 1;
+}
+
+/* Apply the captures that have arrived, in order, so that older pixels
+ * never overwrite newer ones. */
+static void
+shared_output_flush_captures(struct shared_output *so)
+{
+	struct ss_capture *capture, *next;
+
+	wl_list_for_each_safe(capture, next, &so->captures, link) {
+		if (capture->pending > 0)
+			break;
+
+		if (!capture->failed)
+			ss_capture_blt(so, capture);
+
+		ss_capture_destroy(capture);
+	}
+
+	shared_output_update(so);
+}
+
+static void
+ss_capture_read_done(void *data, int status)
+{
+	struct ss_capture *capture = data;
+
+	if (status < 0)
+		capture->failed = 1;
+
+	if (--capture->pending > 0)
+		return;
+
+	if (capture->so)
+		shared_output_flush_captures(capture->so);
+	else
+		ss_capture_destroy(capture);
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -779,10 +838,12 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		container_of(listener, struct shared_output, frame_listener);
 	pixman_region32_t damage;
 	struct ss_shm_buffer *sb;
+	struct ss_capture *capture;
 	int32_t x, y, width, height, stride;
 	int i, nrects, do_yflip;
 	pixman_box32_t *r;
-	uint32_t *cache_data;
+	size_t area;
+	uint32_t *pixels;
 
 	/* Damage in output coordinates */
 	pixman_region32_init(&damage);
@@ -823,44 +884,64 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		pixman_region32_init_rect(&damage, 0, 0, width, height);
 	}
 
-	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
+	r = pixman_region32_rectangles(&damage, &nrects);
+	if (nrects == 0) {
+		pixman_region32_fini(&damage);
+		return;
+	}
+
+	area = 0;
+	for (i = 0; i < nrects; ++i)
+		area += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	capture = zalloc(sizeof *capture);
+	if (capture)
+		capture->data = malloc(4 * area);
+	if (!capture || !capture->data) {
+		free(capture);
+		pixman_region32_fini(&damage);
 		shared_output_destroy(so);
 		return;
 	}
 
+	capture->so = so;
+	capture->width = width;
+	capture->height = height;
+	pixman_region32_init(&capture->damage);
+	pixman_region32_copy(&capture->damage, &damage);
+	pixman_region32_fini(&damage);
+	wl_list_insert(so->captures.prev, &capture->link);
+
 	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	cache_data = pixman_image_get_data(so->cache_image);
-	r = pixman_region32_rectangles(&damage, &nrects);
+	/* Keep the capture pending until all reads are started. */
+	capture->pending = 1;
+
+	pixels = capture->data;
+	r = pixman_region32_rectangles(&capture->damage, &nrects);
 	for (i = 0; i < nrects; ++i) {
 		x = r[i].x1;
 		y = r[i].y1;
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip) {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, so->output->current_mode->height - r[i].y2,
-				width, height);
-
-			pixman_blt(so->tmp_data, cache_data, -width, stride,
-				   32, 32, 0, 1 - height, x, y, width, height);
-		} else {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, y, width, height);
-
-			pixman_blt(so->tmp_data, cache_data, width, stride,
-				   32, 32, 0, 0, x, y, width, height);
+		if (do_yflip)
+			y = so->output->current_mode->height - r[i].y2;
+
+		capture->pending++;
+		if (weston_output_read_pixels_async(so->output,
+						    PIXMAN_a8r8g8b8, pixels,
+						    x, y, width, height,
+						    ss_capture_read_done,
+						    capture) < 0) {
+			capture->pending--;
+			capture->failed = 1;
 		}
-	}
-
-	pixman_region32_fini(&damage);
 
-	so->cache_dirty = 1;
+		pixels += width * height;
+	}
 
-	shared_output_update(so);
+	ss_capture_read_done(capture, 0);
 }
 
 static struct shared_output *
@@ -876,6 +957,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_close;
 
 	wl_list_init(&so->seat_list);
+	wl_list_init(&so->captures);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -970,6 +1052,7 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_capture *capture, *cnext;
 
 	so->output->disable_planes--;
 
@@ -984,8 +1067,20 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
 
+	/* Read-backs still in flight free their captures themselves, the
+	 * ones queued behind them are done with. */
+	wl_list_for_each_safe(capture, cnext, &so->captures, link) {
+		if (capture->pending == 0) {
+			ss_capture_destroy(capture);
+			continue;
+		}
+
+		capture->so = NULL;
+		wl_list_remove(&capture->link);
+		wl_list_init(&capture->link);
+	}
+
 	pixman_image_unref(so->cache_image);
-	free(so->tmp_data);
 
 	free(so);
 }
@@ -49,7 +49,12 @@ struct screenshooter {
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
 	struct weston_buffer *buffer;
+	pixman_format_code_t format;
+	int32_t height;
+	int do_yflip;
+	uint8_t *pixels;
 	weston_screenshooter_done_func_t done;
 	void *data;
 };
@@ -118,32 +123,24 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_read_done(void *data, int status)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
+	struct screenshooter_frame_listener *l = data;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint8_t *pixels = l->pixels, *d, *s;
 
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		goto out;
+	}
 
-	if (pixels == NULL) {
+	wl_list_remove(&l->buffer_destroy_listener.link);
+
+	if (status < 0) {
 		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
-		free(l);
-		return;
+		goto out;
 	}
 
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
-
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
@@ -151,20 +148,20 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 
 	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
 
-	switch (compositor->read_format) {
+	switch (l->format) {
 	case PIXMAN_a8r8g8b8:
 	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
+		if (l->do_yflip)
+			copy_bgra_yflip(d, s, l->height, stride);
 		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
+			copy_bgra(d, pixels, l->height, stride);
 		break;
 	case PIXMAN_x8b8g8r8:
 	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
+		if (l->do_yflip)
+			copy_rgba_yflip(d, s, l->height, stride);
 		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+			copy_rgba(d, pixels, l->height, stride);
 		break;
 	default:
 		break;
@@ -173,10 +170,72 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+
+out:
 	free(pixels);
 	free(l);
 }
 
+static void
+screenshooter_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener, struct screenshooter_frame_listener,
+			     buffer_destroy_listener);
+
+	wl_list_remove(&listener->link);
+	l->buffer = NULL;
+}
+
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	int32_t stride;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+		free(l);
+		return;
+	}
+
+	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	l->pixels = malloc(stride * l->buffer->height);
+
+	if (l->pixels == NULL) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+		free(l);
+		return;
+	}
+
+	l->format = compositor->read_format;
+	l->height = output->current_mode->height;
+	l->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	/* The copy into the client buffer happens once the renderer has
+	 * the pixels, which may be a few milliseconds later. */
+	if (weston_output_read_pixels_async(output,
+					    compositor->read_format,
+					    l->pixels, 0, 0,
+					    output->current_mode->width,
+					    output->current_mode->height,
+					    screenshooter_read_done, l) < 0) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+		free(l->pixels);
+		free(l);
+	}
+}
+
 WL_EXPORT int
 weston_screenshooter_shoot(struct weston_output *output,
 			   struct weston_buffer *buffer,
@@ -199,7 +258,7 @@ weston_screenshooter_shoot(struct weston_output *output,
 		return -1;
 	}
 
-	l = malloc(sizeof *l);
+	l = zalloc(sizeof *l);
 	if (l == NULL) {
 		done(data, WESTON_SCREENSHOOTER_NO_MEMORY);
 		return -1;
@@ -210,6 +269,8 @@ weston_screenshooter_shoot(struct weston_output *output,
 	l->data = data;
 	l->listener.notify = screenshooter_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->listener);
+	l->buffer_destroy_listener.notify = screenshooter_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
 	output->disable_planes++;
 	weston_output_schedule_repaint(output);
 
@@ -310,12 +371,27 @@ screenshooter_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
+	uint32_t *frame;
 	uint32_t *tmpbuf;
 	uint32_t total;
 	int fd;
 	struct wl_listener frame_listener;
-	int count, destroying;
+	int32_t output_width;
+	int do_yflip;
+	struct wl_list frames;	/* being read back, oldest first */
+	int count, destroying, stopped;
+};
+
+/* The damaged rectangles of one output frame, read back
+ * asynchronously and written out once all of them have arrived. */
+struct weston_recorder_frame {
+	struct weston_recorder *recorder;
+	struct wl_list link;
+	uint32_t msecs;
+	pixman_region32_t damage;	/* in output buffer coordinates */
+	uint32_t *pixels;		/* the rectangles, one after another */
+	int pending;
+	int failed;
 };
 
 static uint32_t *
@@ -350,18 +426,21 @@ component_delta(uint32_t next, uint32_t prev)
 }
 
 static void
-weston_recorder_destroy(struct weston_recorder *recorder);
+weston_recorder_free(struct weston_recorder *recorder)
+{
+	if (recorder == NULL)
+		return;
+
+	free(recorder->tmpbuf);
+	free(recorder->frame);
+	free(recorder);
+}
 
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+weston_recorder_write_frame(struct weston_recorder *recorder,
+			    struct weston_recorder_frame *frame)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
 	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
 	int i, j, k, n, width, height, run, stride;
 	uint32_t delta, prev, *d, *s, *p, next;
 	struct {
@@ -369,59 +448,36 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		uint32_t nrects;
 	} header;
 	struct iovec v[2];
-	int do_yflip;
 	int y_orig;
 	uint32_t *outbuf;
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
-
-	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
-	pixman_region32_translate(&damage, -output->x, -output->y);
-	weston_transformed_region(output->width, output->height,
-				 output->transform, output->current_scale,
-				 &damage, &transformed_damage);
-	pixman_region32_fini(&damage);
-
-	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
-	}
+	r = pixman_region32_rectangles(&frame->damage, &n);
 
-	header.msecs = msecs;
+	header.msecs = frame->msecs;
 	header.nrects = n;
 	v[0].iov_base = &header;
 	v[0].iov_len = sizeof header;
 	v[1].iov_base = r;
 	v[1].iov_len = n * sizeof *r;
 	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	stride = recorder->output_width;
 
+	s = frame->pixels;
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
+		/* The encoding never overtakes the pixels it reads, so
+		 * it can be done in place. */
+		if (recorder->do_yflip)
+			outbuf = s;
 		else
-			y_orig = r[i].y1;
+			outbuf = recorder->tmpbuf;
 
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
 		p = outbuf;
 		run = prev = 0; /* quiet gcc */
 		for (j = 0; j < height; j++) {
-			if (do_yflip)
+			if (recorder->do_yflip)
 				y_orig = r[i].y2 - j - 1;
 			else
 				y_orig = r[i].y1 + j;
@@ -456,23 +512,153 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 #endif
 	}
 
-	pixman_region32_fini(&transformed_damage);
 	recorder->count++;
+}
 
-	if (recorder->destroying)
-		weston_recorder_destroy(recorder);
+static void
+weston_recorder_frame_destroy(struct weston_recorder_frame *frame)
+{
+	wl_list_remove(&frame->link);
+	pixman_region32_fini(&frame->damage);
+	free(frame->pixels);
+	free(frame);
 }
 
+/* Write out the frames whose pixels have all arrived, in order, as
+ * each is encoded against the previous one. */
 static void
-weston_recorder_free(struct weston_recorder *recorder)
+weston_recorder_flush(struct weston_recorder *recorder)
 {
-	if (recorder == NULL)
-		return;
+	struct weston_recorder_frame *frame, *next;
 
-	free(recorder->tmpbuf);
-	free(recorder->rect);
-	free(recorder->frame);
-	free(recorder);
+	wl_list_for_each_safe(frame, next, &recorder->frames, link) {
+		if (frame->pending > 0)
+			break;
+
+		/* A frame that could not be read is left out; the
+		 * next one is still encoded against the last one
+		 * written, so the file stays consistent. */
+		if (!frame->failed)
+			weston_recorder_write_frame(recorder, frame);
+
+		weston_recorder_frame_destroy(frame);
+	}
+
+	if (recorder->stopped && wl_list_empty(&recorder->frames)) {
+		close(recorder->fd);
+		weston_recorder_free(recorder);
+	}
+}
+
+static void
+weston_recorder_read_done(void *data, int status)
+{
+	struct weston_recorder_frame *frame = data;
+
+	if (status < 0)
+		frame->failed = 1;
+
+	if (--frame->pending == 0)
+		weston_recorder_flush(frame->recorder);
+}
+
+static void
+weston_recorder_destroy(struct weston_recorder *recorder)
+{
+	wl_list_remove(&recorder->frame_listener.link);
+	recorder->output->disable_planes--;
+
+	/* Frames still being read back finish the file. */
+	recorder->stopped = 1;
+	weston_recorder_flush(recorder);
+}
+
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_recorder_frame *frame;
+	pixman_box32_t *r;
+	pixman_region32_t damage;
+	int i, n, width, height, area;
+	int do_yflip;
+	int y_orig;
+	uint32_t *pixels;
+
+	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	frame = zalloc(sizeof *frame);
+	if (frame == NULL) {
+		weston_log("%s: out of memory\n", __func__);
+		goto out;
+	}
+
+	pixman_region32_init(&damage);
+	pixman_region32_init(&frame->damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				 output->transform, output->current_scale,
+				 &damage, &frame->damage);
+	pixman_region32_fini(&damage);
+
+	r = pixman_region32_rectangles(&frame->damage, &n);
+	area = 0;
+	for (i = 0; i < n; i++)
+		area += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+
+	if (n > 0)
+		frame->pixels = malloc(area * 4);
+	if (n == 0 || frame->pixels == NULL) {
+		if (n > 0)
+			weston_log("%s: out of memory\n", __func__);
+		pixman_region32_fini(&frame->damage);
+		free(frame);
+		goto out;
+	}
+
+	frame->recorder = recorder;
+	frame->msecs = output->frame_time;
+	wl_list_insert(recorder->frames.prev, &frame->link);
+
+	/* Hold a reference of our own, so that read-backs completing
+	 * immediately do not write the frame out half-way. */
+	frame->pending = 1;
+
+	pixels = frame->pixels;
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (do_yflip)
+			y_orig = output->current_mode->height - r[i].y2;
+		else
+			y_orig = r[i].y1;
+
+		frame->pending++;
+		if (weston_output_read_pixels_async(output,
+						    compositor->read_format,
+						    pixels, r[i].x1, y_orig,
+						    width, height,
+						    weston_recorder_read_done,
+						    frame) < 0) {
+			frame->pending--;
+			frame->failed = 1;
+		}
+
+		pixels += width * height;
+	}
+
+	if (--frame->pending == 0)
+		weston_recorder_flush(recorder);
+
+out:
+	if (recorder->destroying)
+		weston_recorder_destroy(recorder);
 }
 
 static void
@@ -495,10 +681,12 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
 	recorder->output = output;
+	recorder->output_width = output->current_mode->width;
+	recorder->do_yflip = do_yflip;
+	wl_list_init(&recorder->frames);
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if (recorder->frame == NULL) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
@@ -550,15 +738,6 @@ err_recorder:
 	return;
 }
 
-static void
-weston_recorder_destroy(struct weston_recorder *recorder)
-{
-	wl_list_remove(&recorder->frame_listener.link);
-	close(recorder->fd);
-	recorder->output->disable_planes--;
-	weston_recorder_free(recorder);
-}
-
 static void
 recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data)
 {
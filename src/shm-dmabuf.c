@@ -0,0 +1,156 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "shm-dmabuf.h"
+
+/* From linux/udmabuf.h, which older kernel headers do not have. */
+struct shm_udmabuf_create {
+	uint32_t memfd;
+	uint32_t flags;
+	uint64_t offset;
+	uint64_t size;
+};
+
+#define SHM_UDMABUF_FLAGS_CLOEXEC 0x01
+#define SHM_UDMABUF_CREATE _IOW('u', 0x42, struct shm_udmabuf_create)
+
+int
+shm_dmabuf_find_mapping(const void *data, size_t size,
+			struct shm_mapping *mapping)
+{
+	uintptr_t p = (uintptr_t) data;
+	unsigned long start, end, inode;
+	unsigned long long offset;
+	unsigned int major, minor;
+	char perms[5], *line = NULL;
+	size_t line_size = 0;
+	int ret = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/self/maps", "re");
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &line_size, fp) > 0) {
+		if (sscanf(line, "%lx-%lx %4s %llx %x:%x %lu",
+			   &start, &end, perms, &offset,
+			   &major, &minor, &inode) != 7)
+			continue;
+
+		if (p < start || p >= end)
+			continue;
+
+		/* Private or anonymous memory cannot be shared. */
+		if (perms[3] != 's' || inode == 0 || size > end - p)
+			break;
+
+		mapping->start = start;
+		mapping->end = end;
+		mapping->offset = offset;
+		mapping->dev = makedev(major, minor);
+		mapping->inode = inode;
+		ret = 0;
+		break;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (ret < 0)
+		errno = EINVAL;
+
+	return ret;
+}
+
+int
+shm_dmabuf_check_range(const void *data, size_t size)
+{
+	struct shm_mapping mapping;
+	long page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start;
+
+	if (shm_dmabuf_find_mapping(data, size, &mapping) == 0)
+		return 0;
+	if (errno != ENOENT)
+		return -1;
+
+	/* msync() fails with ENOMEM on unmapped pages */
+	start = (uintptr_t) data & ~(uintptr_t) (page_size - 1);
+	return msync((void *) start, (uintptr_t) data + size - start,
+		     MS_ASYNC);
+}
+
+int
+shm_dmabuf_create(int udmabuf_fd, const struct shm_mapping *mapping,
+		  const void *data, size_t size)
+{
+	struct shm_udmabuf_create create;
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t offset;
+	char path[64];
+	struct stat st;
+	int fd, dmabuf_fd;
+
+	offset = mapping->offset + ((uintptr_t) data - mapping->start);
+	size = (size + page_size - 1) & ~(size_t) (page_size - 1);
+	if (offset % page_size != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	snprintf(path, sizeof path, "/proc/self/map_files/%lx-%lx",
+		 (unsigned long) mapping->start, (unsigned long) mapping->end);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/* The mapping may have been replaced since it was looked up. */
+	if (fstat(fd, &st) < 0 ||
+	    st.st_dev != mapping->dev || st.st_ino != mapping->inode ||
+	    (uint64_t) st.st_size < offset + size) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	create.memfd = fd;
+	create.flags = SHM_UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset;
+	create.size = size;
+	dmabuf_fd = ioctl(udmabuf_fd, SHM_UDMABUF_CREATE, &create);
+	close(fd);
+
+	return dmabuf_fd;
+}
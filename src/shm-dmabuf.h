@@ -0,0 +1,70 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_SHM_DMABUF_H
+#define _WESTON_SHM_DMABUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Wraps wl_shm buffer memory in dma-bufs through the udmabuf device, so
+ * that the GPU can read it directly instead of getting a copy.
+ *
+ * libwayland-server does not hand out the file descriptors of wl_shm
+ * pools, only their mappings. The file behind a mapping is found in
+ * /proc/self/maps and reopened through /proc/self/map_files, which the
+ * kernel only allows with CAP_SYS_ADMIN (CAP_CHECKPOINT_RESTORE on
+ * newer kernels). udmabuf then only takes memfds sealed against
+ * shrinking, and page aligned ranges of them. Everything else fails,
+ * and the caller keeps copying.
+ */
+
+struct shm_mapping {
+	uintptr_t start, end;
+	uint64_t offset;	/* in the file, of start */
+	dev_t dev;
+	ino_t inode;
+};
+
+/* Finds the shared file mapping holding size bytes at data. Returns 0
+ * on success, -1 with errno set if there is none, or if
+ * /proc/self/maps cannot be read. */
+int
+shm_dmabuf_find_mapping(const void *data, size_t size,
+			struct shm_mapping *mapping);
+
+/* Checks that size bytes at data lie in one shared file mapping, as
+ * those of a wl_shm pool do. Without /proc, only checks that reading
+ * them cannot fault. Returns 0 if they do, -1 if not. */
+int
+shm_dmabuf_check_range(const void *data, size_t size);
+
+/* Creates a dma-buf of size bytes at data, which must lie in mapping,
+ * using the already open udmabuf device. Returns the dma-buf fd, or -1
+ * with errno set. */
+int
+shm_dmabuf_create(int udmabuf_fd, const struct shm_mapping *mapping,
+		  const void *data, size_t size);
+
+#endif
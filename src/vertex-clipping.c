@@ -99,6 +99,33 @@ enum path_transition {
 	PATH_TRANSITION_IN_TO_IN = 3,
 };
 
+enum clip_edge {
+	CLIP_EDGE_LEFT,
+	CLIP_EDGE_RIGHT,
+	CLIP_EDGE_TOP,
+	CLIP_EDGE_BOTTOM,
+};
+
+/* The per-vertex work is split into kernels, with plain C and SIMD
+ * versions. The SIMD versions must produce bit-identical results:
+ * they do the same float comparisons and min/max selections, only on
+ * several vertices at once. The intersections stay scalar, as they
+ * are only computed for the few edges crossing the clip rectangle.
+ */
+struct vertex_clip_funcs {
+	const char *name;
+
+	/* Clamp the vertices of 'surf' to the clip rectangle. May write
+	 * 'ex' and 'ey' up to the next multiple of four vertices. */
+	void (*clamp)(const struct clip_context *ctx,
+		      const struct polygon8 *surf, float *ex, float *ey);
+
+	/* Bit i set if vertex i of 'src' is inside of 'edge'. */
+	unsigned int (*inside_mask)(const struct clip_context *ctx,
+				    const struct polygon8 *src,
+				    enum clip_edge edge);
+};
+
 static void
 clip_append_vertex(struct clip_context *ctx, float x, float y)
 {
@@ -106,30 +133,6 @@ clip_append_vertex(struct clip_context *ctx, float x, float y)
 	*ctx->vertices.y++ = y;
 }
 
-static enum path_transition
-path_transition_left_edge(struct clip_context *ctx, float x, float y)
-{
-	return ((ctx->prev.x >= ctx->clip.x1) << 1) | (x >= ctx->clip.x1);
-}
-
-static enum path_transition
-path_transition_right_edge(struct clip_context *ctx, float x, float y)
-{
-	return ((ctx->prev.x < ctx->clip.x2) << 1) | (x < ctx->clip.x2);
-}
-
-static enum path_transition
-path_transition_top_edge(struct clip_context *ctx, float x, float y)
-{
-	return ((ctx->prev.y >= ctx->clip.y1) << 1) | (y >= ctx->clip.y1);
-}
-
-static enum path_transition
-path_transition_bottom_edge(struct clip_context *ctx, float x, float y)
-{
-	return ((ctx->prev.y < ctx->clip.y2) << 1) | (y < ctx->clip.y2);
-}
-
 static void
 clip_polygon_leftright(struct clip_context *ctx,
 		       enum path_transition transition,
@@ -202,85 +205,308 @@ clip_context_prepare(struct clip_context *ctx, const struct polygon8 *src,
 	ctx->vertices.y = dst_y;
 }
 
+/* Clip 'src' against one edge of the clip rectangle, Sutherland-Hodgman
+ * style. 'inside' has bit i set if vertex i is on the inner side. */
 static int
-clip_polygon_left(struct clip_context *ctx, const struct polygon8 *src,
-		  float *dst_x, float *dst_y)
+clip_polygon_edge(struct clip_context *ctx, const struct polygon8 *src,
+		  float *dst_x, float *dst_y,
+		  enum clip_edge edge, unsigned int inside)
 {
 	enum path_transition trans;
+	unsigned int prev_inside;
 	int i;
 
 	if (src->n < 2)
 		return 0;
 
 	clip_context_prepare(ctx, src, dst_x, dst_y);
+	prev_inside = (inside >> (src->n - 1)) & 1;
 	for (i = 0; i < src->n; i++) {
-		trans = path_transition_left_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x1);
+		trans = (prev_inside << 1) | ((inside >> i) & 1);
+		prev_inside = trans & 1;
+
+		switch (edge) {
+		case CLIP_EDGE_LEFT:
+			clip_polygon_leftright(ctx, trans, src->x[i],
+					       src->y[i], ctx->clip.x1);
+			break;
+		case CLIP_EDGE_RIGHT:
+			clip_polygon_leftright(ctx, trans, src->x[i],
+					       src->y[i], ctx->clip.x2);
+			break;
+		case CLIP_EDGE_TOP:
+			clip_polygon_topbottom(ctx, trans, src->x[i],
+					       src->y[i], ctx->clip.y1);
+			break;
+		case CLIP_EDGE_BOTTOM:
+			clip_polygon_topbottom(ctx, trans, src->x[i],
+					       src->y[i], ctx->clip.y2);
+			break;
+		}
 	}
 	return ctx->vertices.x - dst_x;
 }
 
-static int
-clip_polygon_right(struct clip_context *ctx, const struct polygon8 *src,
-		   float *dst_x, float *dst_y)
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) > (b)) ? (b) : (a))
+#define clip(x, a, b)  min(max(x, a), b)
+
+static void
+clamp_c(const struct clip_context *ctx, const struct polygon8 *surf,
+	float *ex, float *ey)
 {
-	enum path_transition trans;
 	int i;
 
-	if (src->n < 2)
-		return 0;
+	for (i = 0; i < surf->n; i++) {
+		ex[i] = clip(surf->x[i], ctx->clip.x1, ctx->clip.x2);
+		ey[i] = clip(surf->y[i], ctx->clip.y1, ctx->clip.y2);
+	}
+}
+
+static unsigned int
+inside_mask_c(const struct clip_context *ctx, const struct polygon8 *src,
+	      enum clip_edge edge)
+{
+	unsigned int mask = 0;
+	int i;
 
-	clip_context_prepare(ctx, src, dst_x, dst_y);
 	for (i = 0; i < src->n; i++) {
-		trans = path_transition_right_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_leftright(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.x2);
+		switch (edge) {
+		case CLIP_EDGE_LEFT:
+			mask |= (src->x[i] >= ctx->clip.x1) << i;
+			break;
+		case CLIP_EDGE_RIGHT:
+			mask |= (src->x[i] < ctx->clip.x2) << i;
+			break;
+		case CLIP_EDGE_TOP:
+			mask |= (src->y[i] >= ctx->clip.y1) << i;
+			break;
+		case CLIP_EDGE_BOTTOM:
+			mask |= (src->y[i] < ctx->clip.y2) << i;
+			break;
+		}
 	}
-	return ctx->vertices.x - dst_x;
+
+	return mask;
 }
 
-static int
-clip_polygon_top(struct clip_context *ctx, const struct polygon8 *src,
-		 float *dst_x, float *dst_y)
+static const struct vertex_clip_funcs vertex_clip_c = {
+	"c",
+	clamp_c,
+	inside_mask_c,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+
+#define HAVE_VERTEX_CLIP_SIMD 1
+#define SSE2_FUNC __attribute__((target("sse2")))
+
+/* max(x, a) is x > a ? x : a, which is exactly _mm_max_ps(x, a), and
+ * min(m, b) is m > b ? b : m, which is exactly _mm_min_ps(b, m), also
+ * for signed zeros and NaNs. */
+static SSE2_FUNC void
+clamp_sse2(const struct clip_context *ctx, const struct polygon8 *surf,
+	   float *ex, float *ey)
 {
-	enum path_transition trans;
+	__m128 x1 = _mm_set1_ps(ctx->clip.x1);
+	__m128 x2 = _mm_set1_ps(ctx->clip.x2);
+	__m128 y1 = _mm_set1_ps(ctx->clip.y1);
+	__m128 y2 = _mm_set1_ps(ctx->clip.y2);
 	int i;
 
-	if (src->n < 2)
-		return 0;
+	for (i = 0; i < surf->n; i += 4) {
+		_mm_storeu_ps(ex + i,
+			      _mm_min_ps(x2, _mm_max_ps(_mm_loadu_ps(surf->x + i),
+							x1)));
+		_mm_storeu_ps(ey + i,
+			      _mm_min_ps(y2, _mm_max_ps(_mm_loadu_ps(surf->y + i),
+							y1)));
+	}
+}
 
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_top_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y1);
+static SSE2_FUNC unsigned int
+inside_mask_sse2(const struct clip_context *ctx, const struct polygon8 *src,
+		 enum clip_edge edge)
+{
+	const float *v;
+	__m128 e, lo, hi;
+	unsigned int mask;
+
+	v = (edge == CLIP_EDGE_LEFT || edge == CLIP_EDGE_RIGHT) ?
+		src->x : src->y;
+	lo = _mm_loadu_ps(v);
+	hi = _mm_loadu_ps(v + 4);
+
+	switch (edge) {
+	case CLIP_EDGE_LEFT:
+	case CLIP_EDGE_TOP:
+		e = _mm_set1_ps(edge == CLIP_EDGE_LEFT ?
+				ctx->clip.x1 : ctx->clip.y1);
+		mask = _mm_movemask_ps(_mm_cmpge_ps(lo, e)) |
+		       _mm_movemask_ps(_mm_cmpge_ps(hi, e)) << 4;
+		break;
+	default:
+		e = _mm_set1_ps(edge == CLIP_EDGE_RIGHT ?
+				ctx->clip.x2 : ctx->clip.y2);
+		mask = _mm_movemask_ps(_mm_cmplt_ps(lo, e)) |
+		       _mm_movemask_ps(_mm_cmplt_ps(hi, e)) << 4;
+		break;
 	}
-	return ctx->vertices.x - dst_x;
+
+	return mask & ((1u << src->n) - 1);
 }
 
+static const struct vertex_clip_funcs vertex_clip_simd = {
+	"sse2",
+	clamp_sse2,
+	inside_mask_sse2,
+};
+
 static int
-clip_polygon_bottom(struct clip_context *ctx, const struct polygon8 *src,
-		    float *dst_x, float *dst_y)
+vertex_clip_simd_supported(void)
 {
-	enum path_transition trans;
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define HAVE_VERTEX_CLIP_SIMD 1
+
+/* vmaxq_f32/vminq_f32 do not match the C selections for NaNs, so
+ * select with explicit comparisons instead. */
+static inline float32x4_t
+clamp_neon4(float32x4_t v, float32x4_t a, float32x4_t b)
+{
+	v = vbslq_f32(vcgtq_f32(v, a), v, a);
+	return vbslq_f32(vcgtq_f32(v, b), b, v);
+}
+
+static void
+clamp_neon(const struct clip_context *ctx, const struct polygon8 *surf,
+	   float *ex, float *ey)
+{
+	float32x4_t x1 = vdupq_n_f32(ctx->clip.x1);
+	float32x4_t x2 = vdupq_n_f32(ctx->clip.x2);
+	float32x4_t y1 = vdupq_n_f32(ctx->clip.y1);
+	float32x4_t y2 = vdupq_n_f32(ctx->clip.y2);
 	int i;
 
-	if (src->n < 2)
-		return 0;
+	for (i = 0; i < surf->n; i += 4) {
+		vst1q_f32(ex + i, clamp_neon4(vld1q_f32(surf->x + i), x1, x2));
+		vst1q_f32(ey + i, clamp_neon4(vld1q_f32(surf->y + i), y1, y2));
+	}
+}
 
-	clip_context_prepare(ctx, src, dst_x, dst_y);
-	for (i = 0; i < src->n; i++) {
-		trans = path_transition_bottom_edge(ctx, src->x[i], src->y[i]);
-		clip_polygon_topbottom(ctx, trans, src->x[i], src->y[i],
-				       ctx->clip.y2);
+static inline unsigned int
+movemask_neon(uint32x4_t m)
+{
+	static const uint32_t bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t v = vandq_u32(m, vld1q_u32(bits));
+	uint32x2_t s = vpadd_u32(vget_low_u32(v), vget_high_u32(v));
+
+	s = vpadd_u32(s, s);
+	return vget_lane_u32(s, 0);
+}
+
+static unsigned int
+inside_mask_neon(const struct clip_context *ctx, const struct polygon8 *src,
+		 enum clip_edge edge)
+{
+	const float *v;
+	float32x4_t e, lo, hi;
+	unsigned int mask;
+
+	v = (edge == CLIP_EDGE_LEFT || edge == CLIP_EDGE_RIGHT) ?
+		src->x : src->y;
+	lo = vld1q_f32(v);
+	hi = vld1q_f32(v + 4);
+
+	switch (edge) {
+	case CLIP_EDGE_LEFT:
+	case CLIP_EDGE_TOP:
+		e = vdupq_n_f32(edge == CLIP_EDGE_LEFT ?
+				ctx->clip.x1 : ctx->clip.y1);
+		mask = movemask_neon(vcgeq_f32(lo, e)) |
+		       movemask_neon(vcgeq_f32(hi, e)) << 4;
+		break;
+	default:
+		e = vdupq_n_f32(edge == CLIP_EDGE_RIGHT ?
+				ctx->clip.x2 : ctx->clip.y2);
+		mask = movemask_neon(vcltq_f32(lo, e)) |
+		       movemask_neon(vcltq_f32(hi, e)) << 4;
+		break;
 	}
-	return ctx->vertices.x - dst_x;
+
+	return mask & ((1u << src->n) - 1);
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-#define clip(x, a, b)  min(max(x, a), b)
+static const struct vertex_clip_funcs vertex_clip_simd = {
+	"neon",
+	clamp_neon,
+	inside_mask_neon,
+};
+
+static int
+vertex_clip_simd_supported(void)
+{
+	return 1;
+}
+
+#endif
+
+static const struct vertex_clip_funcs *vertex_clip_funcs;
+
+int
+vertex_clip_set_impl(enum vertex_clip_impl impl)
+{
+	switch (impl) {
+	case VERTEX_CLIP_IMPL_AUTO:
+#ifdef HAVE_VERTEX_CLIP_SIMD
+		if (vertex_clip_simd_supported()) {
+			vertex_clip_funcs = &vertex_clip_simd;
+			return 0;
+		}
+#endif
+		vertex_clip_funcs = &vertex_clip_c;
+		return 0;
+	case VERTEX_CLIP_IMPL_C:
+		vertex_clip_funcs = &vertex_clip_c;
+		return 0;
+	case VERTEX_CLIP_IMPL_SIMD:
+#ifdef HAVE_VERTEX_CLIP_SIMD
+		if (vertex_clip_simd_supported()) {
+			vertex_clip_funcs = &vertex_clip_simd;
+			return 0;
+		}
+#endif
+		return -1;
+	}
+
+	return -1;
+}
+
+const char *
+vertex_clip_impl_name(void)
+{
+	if (!vertex_clip_funcs)
+		vertex_clip_set_impl(VERTEX_CLIP_IMPL_AUTO);
+
+	return vertex_clip_funcs->name;
+}
+
+static inline const struct vertex_clip_funcs *
+get_funcs(void)
+{
+	if (!vertex_clip_funcs)
+		vertex_clip_set_impl(VERTEX_CLIP_IMPL_AUTO);
+
+	return vertex_clip_funcs;
+}
 
 int
 clip_simple(struct clip_context *ctx,
@@ -288,11 +514,7 @@ clip_simple(struct clip_context *ctx,
 	    float *ex,
 	    float *ey)
 {
-	int i;
-	for (i = 0; i < surf->n; i++) {
-		ex[i] = clip(surf->x[i], ctx->clip.x1, ctx->clip.x2);
-		ey[i] = clip(surf->y[i], ctx->clip.y1, ctx->clip.y2);
-	}
+	get_funcs()->clamp(ctx, surf, ex, ey);
 	return surf->n;
 }
 
@@ -302,13 +524,26 @@ clip_transformed(struct clip_context *ctx,
 		 float *ex,
 		 float *ey)
 {
+	const struct vertex_clip_funcs *funcs = get_funcs();
 	struct polygon8 polygon;
 	int i, n;
 
-	polygon.n = clip_polygon_left(ctx, surf, polygon.x, polygon.y);
-	surf->n = clip_polygon_right(ctx, &polygon, surf->x, surf->y);
-	polygon.n = clip_polygon_top(ctx, surf, polygon.x, polygon.y);
-	surf->n = clip_polygon_bottom(ctx, &polygon, surf->x, surf->y);
+	polygon.n = clip_polygon_edge(ctx, surf, polygon.x, polygon.y,
+				      CLIP_EDGE_LEFT,
+				      funcs->inside_mask(ctx, surf,
+							 CLIP_EDGE_LEFT));
+	surf->n = clip_polygon_edge(ctx, &polygon, surf->x, surf->y,
+				    CLIP_EDGE_RIGHT,
+				    funcs->inside_mask(ctx, &polygon,
+						       CLIP_EDGE_RIGHT));
+	polygon.n = clip_polygon_edge(ctx, surf, polygon.x, polygon.y,
+				      CLIP_EDGE_TOP,
+				      funcs->inside_mask(ctx, surf,
+							 CLIP_EDGE_TOP));
+	surf->n = clip_polygon_edge(ctx, &polygon, surf->x, surf->y,
+				    CLIP_EDGE_BOTTOM,
+				    funcs->inside_mask(ctx, &polygon,
+						       CLIP_EDGE_BOTTOM));
 
 	/* Get rid of duplicate vertices */
 	ex[0] = surf->x[0];
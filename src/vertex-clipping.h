@@ -48,6 +48,21 @@ struct clip_context {
 	} vertices;
 };
 
+enum vertex_clip_impl {
+	VERTEX_CLIP_IMPL_AUTO = 0,	/* SIMD if the CPU has it */
+	VERTEX_CLIP_IMPL_C,
+	VERTEX_CLIP_IMPL_SIMD,
+};
+
+/* Select the implementation of the clipping kernels; the default is
+ * chosen on first use. Returns -1 if not available on this CPU. Meant
+ * for tests and benchmarks. */
+int
+vertex_clip_set_impl(enum vertex_clip_impl impl);
+
+const char *
+vertex_clip_impl_name(void);
+
 float
 float_difference(float a, float b);
 
@@ -61,6 +76,6 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
 
 #endif
@@ -100,5 +100,40 @@ typedef struct wl_buffer * (EGLAPIENTRYP PFNEGLCREATEWAYLANDBUFFERFROMIMAGEWL) (
 #define GL_UNPACK_SKIP_PIXELS_EXT                               0x0CF4
 #endif
 
+/* Pixel pack buffers and buffer mapping are core in GL ES 3, and come
+ * from NV_pixel_buffer_object, EXT_map_buffer_range and OES_mapbuffer
+ * on GL ES 2. The GL ES 2 headers have no unsuffixed tokens for them. */
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER                                    0x88EB
+#endif
+
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ                                          0x88E1
+#endif
+
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT                                         0x0001
+#endif
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES                            0x8741
+#endif
+
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS_OES
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES                       0x87FE
+#endif
+
+#ifndef GL_UNSIGNED_INT_2_10_10_10_REV_EXT
+#define GL_UNSIGNED_INT_2_10_10_10_REV_EXT                      0x8368
+#endif
+
+#ifndef EGL_EXT_image_dma_buf_import
+#define EGL_LINUX_DMA_BUF_EXT                                   0x3270
+#define EGL_LINUX_DRM_FOURCC_EXT                                0x3271
+#define EGL_DMA_BUF_PLANE0_FD_EXT                               0x3272
+#define EGL_DMA_BUF_PLANE0_OFFSET_EXT                           0x3273
+#define EGL_DMA_BUF_PLANE0_PITCH_EXT                            0x3274
+#endif
+
 
 #endif
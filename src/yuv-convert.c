@@ -0,0 +1,241 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include "yuv-convert.h"
+
+/* Y' in 16..235 and Cb, Cr in 16..240 to R'G'B' in 0..255, with the
+ * coefficients scaled by 256. */
+#define YUV_Y	298
+#define YUV_RV	409
+#define YUV_GU	-100
+#define YUV_GV	-208
+#define YUV_BU	516
+
+struct yuv_convert_funcs {
+	const char *name;
+
+	/* Converts width pixels; pixel i takes its chroma from
+	 * u[i / 2 * uv_step] and v[i / 2 * uv_step]. */
+	void (*row)(uint32_t *dst, const uint8_t *y,
+		    const uint8_t *u, const uint8_t *v,
+		    int uv_step, int width);
+};
+
+static inline uint32_t
+clamp_u8(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static void
+row_c(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+      int uv_step, int width)
+{
+	int i, c, d, e, k;
+
+	for (i = 0; i < width; i++) {
+		k = i / 2 * uv_step;
+		c = YUV_Y * (y[i] - 16) + 128;
+		d = u[k] - 128;
+		e = v[k] - 128;
+
+		dst[i] = 0xff000000 |
+			 clamp_u8((c + YUV_RV * e) >> 8) << 16 |
+			 clamp_u8((c + YUV_GU * d + YUV_GV * e) >> 8) << 8 |
+			 clamp_u8((c + YUV_BU * d) >> 8);
+	}
+}
+
+static const struct yuv_convert_funcs yuv_convert_c = {
+	"c",
+	row_c,
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <emmintrin.h>
+
+#define HAVE_YUV_CONVERT_SIMD 1
+#define SSE2_FUNC __attribute__((target("sse2")))
+
+/* Each output channel is a sum of products of 16 bit terms, which
+ * _mm_madd_epi16() computes for pairs of them in 32 bits: (c, e) for
+ * red, (c, d) and (e, 1) for green, (c, d) for blue, with the rounding
+ * folded in. The results fit in 16 bits again, and the unsigned
+ * saturation when packing them to bytes is the clamping of the C code. */
+static SSE2_FUNC void
+row_sse2(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+	 int uv_step, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k16 = _mm_set1_epi16(16);
+	const __m128i k128 = _mm_set1_epi16(128);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi32(128);
+	const __m128i byte_mask = _mm_set1_epi16(0xff);
+	const __m128i alpha = _mm_set1_epi8((char) 0xff);
+	const __m128i k_r = _mm_setr_epi16(YUV_Y, YUV_RV, YUV_Y, YUV_RV,
+					   YUV_Y, YUV_RV, YUV_Y, YUV_RV);
+	const __m128i k_g = _mm_setr_epi16(YUV_Y, YUV_GU, YUV_Y, YUV_GU,
+					   YUV_Y, YUV_GU, YUV_Y, YUV_GU);
+	const __m128i k_gv = _mm_setr_epi16(YUV_GV, 128, YUV_GV, 128,
+					    YUV_GV, 128, YUV_GV, 128);
+	const __m128i k_b = _mm_setr_epi16(YUV_Y, YUV_BU, YUV_Y, YUV_BU,
+					   YUV_Y, YUV_BU, YUV_Y, YUV_BU);
+	__m128i c, d, e, lo, hi, r, g, b, bg, ra;
+	int i, n = width & ~7;
+	int32_t u4, v4;
+
+	for (i = 0; i < n; i += 8) {
+		c = _mm_loadl_epi64((const __m128i *) (y + i));
+		c = _mm_sub_epi16(_mm_unpacklo_epi8(c, zero), k16);
+
+		/* four Cb and Cr samples in the low 16 bit lanes */
+		if (uv_step == 2) {
+			d = _mm_loadl_epi64((const __m128i *) (u + i));
+			e = _mm_srli_epi16(d, 8);
+			d = _mm_and_si128(d, byte_mask);
+		} else {
+			memcpy(&u4, u + i / 2, sizeof u4);
+			memcpy(&v4, v + i / 2, sizeof v4);
+			d = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero);
+			e = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero);
+		}
+		d = _mm_sub_epi16(_mm_unpacklo_epi16(d, d), k128);
+		e = _mm_sub_epi16(_mm_unpacklo_epi16(e, e), k128);
+
+		lo = _mm_madd_epi16(_mm_unpacklo_epi16(c, e), k_r);
+		hi = _mm_madd_epi16(_mm_unpackhi_epi16(c, e), k_r);
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+		r = _mm_packs_epi32(lo, hi);
+
+		lo = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpacklo_epi16(c, d), k_g),
+			_mm_madd_epi16(_mm_unpacklo_epi16(e, one), k_gv));
+		hi = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpackhi_epi16(c, d), k_g),
+			_mm_madd_epi16(_mm_unpackhi_epi16(e, one), k_gv));
+		g = _mm_packs_epi32(_mm_srai_epi32(lo, 8),
+				    _mm_srai_epi32(hi, 8));
+
+		lo = _mm_madd_epi16(_mm_unpacklo_epi16(c, d), k_b);
+		hi = _mm_madd_epi16(_mm_unpackhi_epi16(c, d), k_b);
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+		b = _mm_packs_epi32(lo, hi);
+
+		r = _mm_packus_epi16(r, r);
+		g = _mm_packus_epi16(g, g);
+		b = _mm_packus_epi16(b, b);
+		bg = _mm_unpacklo_epi8(b, g);
+		ra = _mm_unpacklo_epi8(r, alpha);
+		_mm_storeu_si128((__m128i *) (dst + i),
+				 _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *) (dst + i + 4),
+				 _mm_unpackhi_epi16(bg, ra));
+	}
+
+	row_c(dst + n, y + n, u + n / 2 * uv_step, v + n / 2 * uv_step,
+	      uv_step, width - n);
+}
+
+static const struct yuv_convert_funcs yuv_convert_simd = {
+	"sse2",
+	row_sse2,
+};
+
+static int
+yuv_convert_simd_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+#endif
+
+static const struct yuv_convert_funcs *yuv_convert_funcs;
+
+int
+yuv_convert_set_impl(enum yuv_convert_impl impl)
+{
+	switch (impl) {
+	case YUV_CONVERT_IMPL_AUTO:
+#ifdef HAVE_YUV_CONVERT_SIMD
+		if (yuv_convert_simd_supported()) {
+			yuv_convert_funcs = &yuv_convert_simd;
+			return 0;
+		}
+#endif
+		yuv_convert_funcs = &yuv_convert_c;
+		return 0;
+	case YUV_CONVERT_IMPL_C:
+		yuv_convert_funcs = &yuv_convert_c;
+		return 0;
+	case YUV_CONVERT_IMPL_SIMD:
+#ifdef HAVE_YUV_CONVERT_SIMD
+		if (yuv_convert_simd_supported()) {
+			yuv_convert_funcs = &yuv_convert_simd;
+			return 0;
+		}
+#endif
+		return -1;
+	}
+
+	return -1;
+}
+
+static inline const struct yuv_convert_funcs *
+get_funcs(void)
+{
+	if (!yuv_convert_funcs)
+		yuv_convert_set_impl(YUV_CONVERT_IMPL_AUTO);
+
+	return yuv_convert_funcs;
+}
+
+const char *
+yuv_convert_impl_name(void)
+{
+	return get_funcs()->name;
+}
+
+void
+yuv420_to_xrgb8888(uint32_t *dst, int dst_stride,
+		   const struct yuv420_image *src, int y1, int y2)
+{
+	const struct yuv_convert_funcs *funcs = get_funcs();
+	ptrdiff_t uv_offset;
+	int j;
+
+	for (j = y1; j < y2; j++) {
+		uv_offset = (ptrdiff_t) (j / 2) * src->uv_stride;
+		funcs->row((uint32_t *) ((uint8_t *) dst +
+					 (ptrdiff_t) j * dst_stride),
+			   src->y + (ptrdiff_t) j * src->y_stride,
+			   src->u + uv_offset, src->v + uv_offset,
+			   src->uv_step, src->width);
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef _WESTON_YUV_CONVERT_H
+#define _WESTON_YUV_CONVERT_H
+
+#include <stdint.h>
+
+/*
+ * Conversion of 8 bit 4:2:0 YCbCr, as in NV12 and YUV420 buffers, to
+ * x8r8g8b8 for the renderers that cannot sample YUV themselves. Uses
+ * limited range BT.601 like the GL renderer's YUV shaders, in 8 bit
+ * fixed point, so that the C and SIMD versions give identical results.
+ */
+
+struct yuv420_image {
+	int width, height;
+	const uint8_t *y;
+	int y_stride;
+	const uint8_t *u, *v;	/* first Cb and Cr sample */
+	int uv_stride;
+	int uv_step;		/* 1 if planar, 2 if interleaved */
+};
+
+enum yuv_convert_impl {
+	YUV_CONVERT_IMPL_AUTO = 0,	/* SIMD if the CPU has it */
+	YUV_CONVERT_IMPL_C,
+	YUV_CONVERT_IMPL_SIMD,
+};
+
+/* Select the implementation of the row conversion; the default is
+ * chosen on first use. Returns -1 if not available on this CPU. Meant
+ * for tests and benchmarks. */
+int
+yuv_convert_set_impl(enum yuv_convert_impl impl);
+
+const char *
+yuv_convert_impl_name(void);
+
+/* Converts the rows y1 to y2 - 1 of src into dst, which has the same
+ * size. Chroma is not interpolated: each sample covers 2x2 pixels. */
+void
+yuv420_to_xrgb8888(uint32_t *dst, int dst_stride,
+		   const struct yuv420_image *src, int y1, int y2);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/atlas-allocator.h"
+
+#define SIZE 256
+
+static void
+assert_inside(const struct atlas_rect *r, int width, int height)
+{
+	assert(r->x >= 0 && r->y >= 0);
+	assert(r->x + r->width <= SIZE && r->y + r->height <= SIZE);
+	assert(r->width == width && r->height == height);
+}
+
+static int
+rects_overlap(const struct atlas_rect *a, const struct atlas_rect *b)
+{
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+	       a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+TEST(atlas_packs_same_size_rects_densely)
+{
+	struct atlas_allocator a;
+	struct atlas_rect r;
+	int n = 0;
+
+	atlas_allocator_init(&a, SIZE, SIZE);
+
+	while (atlas_allocator_alloc(&a, 32, 32, &r) == 0) {
+		assert_inside(&r, 32, 32);
+		n++;
+	}
+	assert(n == (SIZE / 32) * (SIZE / 32));
+	assert(a.count == n);
+
+	atlas_allocator_fini(&a);
+}
+
+TEST(atlas_rejects_what_does_not_fit)
+{
+	struct atlas_allocator a;
+	struct atlas_rect r;
+
+	atlas_allocator_init(&a, SIZE, SIZE);
+
+	assert(atlas_allocator_alloc(&a, SIZE + 1, 1, &r) < 0);
+	assert(atlas_allocator_alloc(&a, 1, SIZE + 1, &r) < 0);
+	assert(atlas_allocator_alloc(&a, 0, 10, &r) < 0);
+	assert(atlas_allocator_alloc(&a, SIZE, SIZE, &r) == 0);
+	assert(atlas_allocator_alloc(&a, 1, 1, &r) < 0);
+
+	atlas_allocator_free(&a, &r);
+	assert(a.count == 0 && a.num_shelves == 0 && a.top == 0);
+
+	atlas_allocator_fini(&a);
+}
+
+TEST(atlas_random_alloc_free)
+{
+	struct atlas_allocator a;
+	struct atlas_rect rects[200];
+	int used[ARRAY_LENGTH(rects)];
+	unsigned int i, j, k;
+	int w, h;
+
+	srand(3);
+	atlas_allocator_init(&a, SIZE, SIZE);
+	memset(used, 0, sizeof used);
+
+	for (k = 0; k < 100000; k++) {
+		i = rand() % ARRAY_LENGTH(rects);
+
+		if (used[i]) {
+			atlas_allocator_free(&a, &rects[i]);
+			used[i] = 0;
+			continue;
+		}
+
+		w = 1 + rand() % 64;
+		h = 1 + rand() % 48;
+		if (atlas_allocator_alloc(&a, w, h, &rects[i]) < 0)
+			continue;
+
+		assert_inside(&rects[i], w, h);
+		for (j = 0; j < ARRAY_LENGTH(rects); j++)
+			if (j != i && used[j])
+				assert(!rects_overlap(&rects[i], &rects[j]));
+		used[i] = 1;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(rects); i++)
+		if (used[i])
+			atlas_allocator_free(&a, &rects[i]);
+
+	/* everything is given back */
+	assert(a.count == 0);
+	assert(a.num_shelves == 0);
+	assert(a.top == 0);
+	assert(atlas_allocator_alloc(&a, SIZE, SIZE, &rects[0]) == 0);
+
+	atlas_allocator_fini(&a);
+}
+
+TEST(atlas_reuses_freed_space)
+{
+	struct atlas_allocator a;
+	struct atlas_rect small[16], tall, r;
+	int i;
+
+	atlas_allocator_init(&a, SIZE, SIZE);
+
+	/* a row of small rects, then free it: the space is cut again for
+	 * taller ones */
+	for (i = 0; i < 16; i++)
+		assert(atlas_allocator_alloc(&a, 16, 16, &small[i]) == 0);
+	assert(atlas_allocator_alloc(&a, SIZE, SIZE - 16, &tall) == 0);
+	assert(atlas_allocator_alloc(&a, 1, 1, &r) < 0);
+
+	for (i = 0; i < 16; i++)
+		atlas_allocator_free(&a, &small[i]);
+
+	assert(atlas_allocator_alloc(&a, 128, 8, &r) == 0);
+	assert(r.y == 0);
+	assert(atlas_allocator_alloc(&a, 128, 8, &r) == 0);
+	assert(r.y == 0 && r.x == 128);
+	assert(atlas_allocator_alloc(&a, 64, 8, &r) == 0);
+	assert(r.y == 8);
+
+	atlas_allocator_fini(&a);
+}
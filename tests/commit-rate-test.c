@@ -0,0 +1,59 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+
+#include "weston-test-runner.h"
+
+#include "src/commit-rate.h"
+
+TEST(commit_rate_smoothing)
+{
+	struct timespec never = { 0, 0 };
+	struct timespec last = { 100, 0 };
+	struct timespec now = last;
+	float rate = 0.0f;
+	int i;
+
+	/* The first commit gives no interval */
+	assert(commit_rate_update(rate, &never, &now) == 0.0f);
+	assert(commit_rate_current(rate, &never, &now) == 0.0f);
+
+	/* Converges to 60 commits per second */
+	for (i = 0; i < 100; i++) {
+		now.tv_nsec += 1000000000 / 60;
+		rate = commit_rate_update(rate, &last, &now);
+		last = now;
+	}
+	assert(rate > 59.0f && rate < 61.0f);
+	assert(commit_rate_current(rate, &last, &now) == rate);
+
+	/* Two commits at once do not make a burst */
+	assert(commit_rate_update(rate, &last, &now) == rate);
+
+	/* and going quiet decays the rate without a new commit */
+	now.tv_sec += 2;
+	assert(commit_rate_current(rate, &last, &now) < 0.6f);
+}
@@ -0,0 +1,284 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the per-frame damage bookkeeping of gl_renderer_repaint_output()
+ * before and after damage-history.h: buffer-age damage kept in a ring of
+ * pixman regions with the swap rectangles malloc'ed every frame, against
+ * the fixed-size history and swap rectangle array. Besides the time, it
+ * counts the heap allocations made per frame by interposing malloc.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "src/damage-history.h"
+#include "src/fast-region.h"
+
+/* glibc's own entry points, for the interposed allocator below */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations;
+
+void *
+malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define BUFFER_AGE 3
+
+enum scene {
+	SCENE_BLINKING_CURSOR,
+	SCENE_MOVING_WINDOW,
+	SCENE_FRAGMENTED,
+	SCENE_COUNT
+};
+
+static const char *scene_names[] = {
+	"a blinking cursor",
+	"a moving window",
+	"damage in 40 places",
+};
+
+static void
+frame_damage(enum scene scene, unsigned long frame, pixman_region32_t *damage)
+{
+	int i, x;
+
+	pixman_region32_clear(damage);
+
+	switch (scene) {
+	case SCENE_BLINKING_CURSOR:
+		pixman_region32_union_rect(damage, damage, 500, 300, 2, 20);
+		break;
+	case SCENE_MOVING_WINDOW:
+		x = frame % 512 * 2;
+		pixman_region32_union_rect(damage, damage, x, 100, 800, 600);
+		break;
+	case SCENE_FRAGMENTED:
+		for (i = 0; i < 40; i++)
+			pixman_region32_union_rect(damage, damage,
+						   (i * 97 + frame) % 1800,
+						   (i * 53) % 1000, 20, 20);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The renderer state each of the two paths keeps per output. */
+struct old_output {
+	pixman_region32_t buffer_damage[2];
+	int buffer_damage_index;
+};
+
+struct new_output {
+	struct damage_history history;
+	struct damage_boxes swap_damage;
+	int32_t swap_rects[4 * DAMAGE_MAX_RECTS];
+};
+
+static int32_t swapped;
+
+static void __attribute__((noinline))
+repaint_old(struct old_output *o, pixman_region32_t *output_damage)
+{
+	pixman_region32_t buffer_damage, total_damage;
+	pixman_box32_t *rects;
+	int32_t *egl_damage, *d;
+	int i, nrects;
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&buffer_damage);
+
+	for (i = 0; i < BUFFER_AGE - 1; i++)
+		pixman_region32_union(&buffer_damage, &buffer_damage,
+				      &o->buffer_damage[(o->buffer_damage_index + i) % 2]);
+
+	o->buffer_damage_index += 1;
+	o->buffer_damage_index %= 2;
+	pixman_region32_copy(&o->buffer_damage[o->buffer_damage_index],
+			     output_damage);
+
+	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+
+	pixman_region32_fini(&total_damage);
+	pixman_region32_fini(&buffer_damage);
+
+	rects = pixman_region32_rectangles(output_damage, &nrects);
+	egl_damage = malloc(nrects * 4 * sizeof(int32_t));
+	d = egl_damage;
+	for (i = 0; i < nrects; ++i) {
+		*d++ = rects[i].x1;
+		*d++ = OUTPUT_HEIGHT - rects[i].y2;
+		*d++ = rects[i].x2 - rects[i].x1;
+		*d++ = rects[i].y2 - rects[i].y1;
+	}
+	swapped += egl_damage[0];
+	free(egl_damage);
+}
+
+static void __attribute__((noinline))
+repaint_new(struct new_output *o, pixman_region32_t *output_damage)
+{
+	pixman_region32_t buffer_damage, total_damage;
+	pixman_box32_t *rects;
+	uint32_t flags;
+	int32_t *d;
+	int i;
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&buffer_damage);
+
+	damage_history_get(&o->history, BUFFER_AGE, &buffer_damage, &flags);
+	damage_history_push(&o->history, output_damage, 0);
+
+	fast_region_union(&total_damage, &buffer_damage, output_damage);
+
+	pixman_region32_fini(&total_damage);
+	pixman_region32_fini(&buffer_damage);
+
+	damage_boxes_from_region(&o->swap_damage, output_damage);
+	rects = o->swap_damage.boxes;
+	d = o->swap_rects;
+	for (i = 0; i < o->swap_damage.n; ++i) {
+		*d++ = rects[i].x1;
+		*d++ = OUTPUT_HEIGHT - rects[i].y2;
+		*d++ = rects[i].x2 - rects[i].x1;
+		*d++ = rects[i].y2 - rects[i].y1;
+	}
+	swapped += o->swap_rects[0];
+}
+
+static void
+run_scene(enum scene scene, int new)
+{
+	struct old_output old_output;
+	struct new_output new_output;
+	pixman_region32_t damage;
+	unsigned long count = 0, allocs = 0, before;
+	double t;
+
+	printf("\nRunning 3 s test on %s, %s...\n", scene_names[scene],
+	       new ? "damage history" : "pixman history");
+
+	pixman_region32_init(&old_output.buffer_damage[0]);
+	pixman_region32_init(&old_output.buffer_damage[1]);
+	old_output.buffer_damage_index = 0;
+	damage_history_init(&new_output.history);
+	pixman_region32_init(&damage);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		/* producing the damage is not part of the measurement */
+		frame_damage(scene, count, &damage);
+
+		before = allocations;
+		if (new)
+			repaint_new(&new_output, &damage);
+		else
+			repaint_old(&old_output, &damage);
+		allocs += allocations - before;
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu frames in %f seconds, avg. %.1f ns/frame, "
+	       "%.2f allocations/frame.\n",
+	       count, t, 1e9 * t / count, (double) allocs / count);
+
+	pixman_region32_fini(&old_output.buffer_damage[0]);
+	pixman_region32_fini(&old_output.buffer_damage[1]);
+	pixman_region32_fini(&damage);
+}
+
+int main(void)
+{
+	struct sigaction ding;
+	int i;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	for (i = 0; i < SCENE_COUNT; i++) {
+		run_scene(i, 0);
+		run_scene(i, 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/damage-history.h"
+
+#define GRID 64
+
+static void
+random_region(pixman_region32_t *r, int max_boxes)
+{
+	int x1, y1, x2, y2, n;
+
+	pixman_region32_init(r);
+
+	n = rand() % (max_boxes + 1);
+	while (n--) {
+		x1 = rand() % GRID;
+		y1 = rand() % GRID;
+		x2 = x1 + 1 + rand() % 8;
+		y2 = y1 + 1 + rand() % 8;
+		pixman_region32_union_rect(r, r, x1, y1, x2 - x1, y2 - y1);
+	}
+}
+
+static void
+boxes_to_region(pixman_region32_t *r, const struct damage_boxes *d)
+{
+	int i;
+
+	pixman_region32_init_rects(r, d->boxes, d->n);
+	for (i = 0; i < d->n; i++)
+		assert(d->boxes[i].x1 < d->boxes[i].x2 &&
+		       d->boxes[i].y1 < d->boxes[i].y2);
+}
+
+static int
+region_contains(pixman_region32_t *outer, pixman_region32_t *inner)
+{
+	pixman_region32_t rest;
+	int empty;
+
+	pixman_region32_init(&rest);
+	pixman_region32_subtract(&rest, inner, outer);
+	empty = !pixman_region32_not_empty(&rest);
+	pixman_region32_fini(&rest);
+
+	return empty;
+}
+
+TEST(damage_boxes_cover_region)
+{
+	struct damage_boxes d;
+	pixman_region32_t damage, stored;
+	int i, n;
+
+	srand(1);
+
+	for (i = 0; i < 5000; i++) {
+		random_region(&damage, 40);
+		pixman_region32_rectangles(&damage, &n);
+
+		damage_boxes_from_region(&d, &damage);
+		assert(d.n <= DAMAGE_MAX_RECTS);
+
+		boxes_to_region(&stored, &d);
+		assert(region_contains(&stored, &damage));
+		if (n <= DAMAGE_MAX_RECTS)
+			assert(pixman_region32_equal(&stored, &damage));
+
+		pixman_region32_fini(&stored);
+		pixman_region32_fini(&damage);
+	}
+}
+
+TEST(damage_boxes_merge_neighbours_first)
+{
+	struct damage_boxes d = { 0 };
+	pixman_box32_t box;
+	int i;
+
+	/* a row of boxes with one gap, and one far away box */
+	for (i = 0; i < DAMAGE_MAX_RECTS; i++) {
+		box.x1 = i * 10;
+		box.y1 = 0;
+		box.x2 = i * 10 + (i == 3 ? 10 : 9);
+		box.y2 = 10;
+		damage_boxes_add(&d, &box);
+	}
+	assert(d.n == DAMAGE_MAX_RECTS);
+
+	box.x1 = 1000;
+	box.y1 = 1000;
+	box.x2 = 1010;
+	box.y2 = 1010;
+	damage_boxes_add(&d, &box);
+	assert(d.n == DAMAGE_MAX_RECTS);
+
+	/* boxes 3 and 4 touch, merging them costs nothing */
+	for (i = 0; i < d.n; i++) {
+		assert(d.boxes[i].x2 - d.boxes[i].x1 <= 19);
+		if (d.boxes[i].x1 == 30)
+			assert(d.boxes[i].x2 == 49);
+	}
+}
+
+TEST(damage_history_accumulates_by_age)
+{
+	struct damage_history h;
+	pixman_region32_t frames[DAMAGE_HISTORY_LENGTH + 2];
+	pixman_region32_t expected, result;
+	unsigned int i, count;
+	uint32_t flags;
+	int age, j;
+
+	srand(2);
+	damage_history_init(&h);
+
+	pixman_region32_init(&result);
+	assert(damage_history_get(&h, 0, &result, &flags) < 0);
+	assert(damage_history_get(&h, 2, &result, &flags) < 0);
+
+	/* age 1 is the buffer drawn last, missing nothing */
+	assert(damage_history_get(&h, 1, &result, &flags) == 0);
+	assert(!pixman_region32_not_empty(&result));
+	assert(flags == 0);
+
+	for (i = 0; i < ARRAY_LENGTH(frames); i++) {
+		random_region(&frames[i], DAMAGE_MAX_RECTS / 2);
+		damage_history_push(&h, &frames[i], 1 << i);
+		count = i + 1 < DAMAGE_HISTORY_LENGTH ?
+			i + 1 : DAMAGE_HISTORY_LENGTH;
+
+		for (age = 1; age <= DAMAGE_HISTORY_LENGTH + 2; age++) {
+			pixman_region32_clear(&result);
+			if ((unsigned int) age - 1 > count) {
+				assert(damage_history_get(&h, age, &result,
+							  &flags) < 0);
+				continue;
+			}
+
+			assert(damage_history_get(&h, age, &result,
+						  &flags) == 0);
+
+			pixman_region32_init(&expected);
+			for (j = 0; j < age - 1; j++)
+				pixman_region32_union(&expected, &expected,
+						      &frames[i - j]);
+			assert(pixman_region32_equal(&expected, &result) ||
+			       (!pixman_region32_not_empty(&expected) &&
+				!pixman_region32_not_empty(&result)));
+			assert(flags == ((1u << (i + 1)) - 1) -
+					((1u << (i + 1 - (age - 1))) - 1));
+			pixman_region32_fini(&expected);
+		}
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(frames); i++)
+		pixman_region32_fini(&frames[i]);
+	pixman_region32_fini(&result);
+}
@@ -0,0 +1,168 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/fast-region.h"
+
+/* Coordinates on a small grid, so that touching, nested and
+ * overlapping boxes all come up frequently. */
+#define GRID 6
+
+enum op {
+	OP_INTERSECT,
+	OP_UNION,
+	OP_SUBTRACT,
+};
+
+static void
+random_region(pixman_region32_t *r)
+{
+	int x1, y1, x2, y2, n;
+
+	pixman_region32_init(r);
+
+	/* mostly single boxes, sometimes empty or a union of two */
+	n = rand() % 8 == 0 ? 2 : 1;
+	if (rand() % 10 == 0)
+		n = 0;
+
+	while (n--) {
+		x1 = rand() % GRID;
+		y1 = rand() % GRID;
+		x2 = x1 + 1 + rand() % (GRID - x1);
+		y2 = y1 + 1 + rand() % (GRID - y1);
+		pixman_region32_union_rect(r, r, x1, y1, x2 - x1, y2 - y1);
+	}
+}
+
+static void
+regions_assert_equal(pixman_region32_t *a, pixman_region32_t *b)
+{
+	if (!pixman_region32_not_empty(a)) {
+		assert(!pixman_region32_not_empty(b));
+		return;
+	}
+
+	assert(pixman_region32_equal(a, b));
+}
+
+static void
+check_op(enum op op, int in_place)
+{
+	pixman_region32_t a, b, expected, result, *dst;
+	int i;
+
+	srand(op * 2 + in_place);
+
+	for (i = 0; i < 20000; i++) {
+		random_region(&a);
+		random_region(&b);
+		pixman_region32_init(&expected);
+		pixman_region32_init(&result);
+
+		if (in_place) {
+			pixman_region32_copy(&result, &a);
+			dst = &result;
+		} else {
+			dst = &a;
+		}
+
+		switch (op) {
+		case OP_INTERSECT:
+			pixman_region32_intersect(&expected, &a, &b);
+			fast_region_intersect(&result, dst, &b);
+			break;
+		case OP_UNION:
+			pixman_region32_union(&expected, &a, &b);
+			fast_region_union(&result, dst, &b);
+			break;
+		case OP_SUBTRACT:
+			pixman_region32_subtract(&expected, &a, &b);
+			fast_region_subtract(&result, dst, &b);
+			break;
+		}
+
+		regions_assert_equal(&expected, &result);
+
+		pixman_region32_fini(&a);
+		pixman_region32_fini(&b);
+		pixman_region32_fini(&expected);
+		pixman_region32_fini(&result);
+	}
+}
+
+TEST(fast_region_intersect_matches_pixman)
+{
+	check_op(OP_INTERSECT, 0);
+	check_op(OP_INTERSECT, 1);
+}
+
+TEST(fast_region_union_matches_pixman)
+{
+	check_op(OP_UNION, 0);
+	check_op(OP_UNION, 1);
+}
+
+TEST(fast_region_subtract_matches_pixman)
+{
+	check_op(OP_SUBTRACT, 0);
+	check_op(OP_SUBTRACT, 1);
+}
+
+TEST(fast_region_rect_ops_match_pixman)
+{
+	pixman_region32_t a, expected, result;
+	int i, x, y, w, h;
+
+	srand(42);
+
+	for (i = 0; i < 20000; i++) {
+		random_region(&a);
+		x = rand() % GRID;
+		y = rand() % GRID;
+		w = rand() % GRID;
+		h = rand() % GRID;
+
+		pixman_region32_init(&expected);
+		pixman_region32_init(&result);
+
+		pixman_region32_intersect_rect(&expected, &a, x, y, w, h);
+		fast_region_intersect_rect(&result, &a, x, y, w, h);
+		regions_assert_equal(&expected, &result);
+
+		pixman_region32_union_rect(&expected, &a, x, y, w, h);
+		fast_region_union_rect(&result, &a, x, y, w, h);
+		regions_assert_equal(&expected, &result);
+
+		pixman_region32_fini(&a);
+		pixman_region32_fini(&expected);
+		pixman_region32_fini(&result);
+	}
+}
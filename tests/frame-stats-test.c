@@ -0,0 +1,121 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/frame-stats.h"
+
+TEST(frame_histogram_empty)
+{
+	struct frame_histogram h = { 0 };
+
+	assert(frame_histogram_percentile(&h, 50) == 0);
+	assert(frame_histogram_percentile(&h, 100) == 0);
+}
+
+TEST(frame_histogram_percentiles)
+{
+	struct frame_histogram h = { 0 };
+	int i;
+
+	/* 90 fast frames, 9 slow ones and one very slow one */
+	for (i = 0; i < 90; i++)
+		frame_histogram_add(&h, 2100);
+	for (i = 0; i < 9; i++)
+		frame_histogram_add(&h, 9900);
+	frame_histogram_add(&h, 14000);
+
+	assert(h.count == 100);
+	assert(h.max_usec == 14000);
+
+	/* Rounded up to the end of the bucket */
+	assert(frame_histogram_percentile(&h, 0) == 2250);
+	assert(frame_histogram_percentile(&h, 50) == 2250);
+	assert(frame_histogram_percentile(&h, 90) == 2250);
+	assert(frame_histogram_percentile(&h, 91) == 10000);
+	assert(frame_histogram_percentile(&h, 99) == 10000);
+	assert(frame_histogram_percentile(&h, 100) == 14000);
+}
+
+TEST(frame_histogram_never_above_max)
+{
+	struct frame_histogram h = { 0 };
+
+	frame_histogram_add(&h, 10);
+	frame_histogram_add(&h, 20);
+
+	assert(frame_histogram_percentile(&h, 50) == 20);
+	assert(frame_histogram_percentile(&h, 100) == 20);
+}
+
+TEST(frame_histogram_overflow)
+{
+	struct frame_histogram h = { 0 };
+	uint32_t end = FRAME_HISTOGRAM_BUCKETS * FRAME_HISTOGRAM_BUCKET_USEC;
+
+	frame_histogram_add(&h, 100);
+	frame_histogram_add(&h, end + 5000);
+	frame_histogram_add(&h, UINT32_MAX);
+
+	assert(h.buckets[FRAME_HISTOGRAM_BUCKETS - 1] == 2);
+	assert(frame_histogram_percentile(&h, 33) == FRAME_HISTOGRAM_BUCKET_USEC);
+	assert(frame_histogram_percentile(&h, 50) == UINT32_MAX);
+}
+
+TEST(frame_stats_count_missed_vblanks)
+{
+	struct frame_stats s;
+	uint32_t refresh = 16667;
+
+	frame_stats_reset(&s);
+
+	/* Shown on the first vblank after the flip */
+	frame_stats_add(&s, 4000, 12000, refresh);
+	frame_stats_add(&s, 4000, refresh - 1, refresh);
+	assert(s.frames == 2);
+	assert(s.missed == 0);
+
+	/* Shown one and two vblanks later */
+	frame_stats_add(&s, 4000, refresh + 1, refresh);
+	frame_stats_add(&s, 4000, 2 * refresh + 500, refresh);
+	assert(s.frames == 4);
+	assert(s.missed == 3);
+
+	/* Unknown refresh rates count no misses */
+	frame_stats_add(&s, 4000, 100000, 0);
+	assert(s.missed == 3);
+
+	assert(s.repaint.count == 5);
+	assert(s.latency.count == 5);
+	assert(s.latency.max_usec == 100000);
+
+	frame_stats_reset(&s);
+	assert(s.frames == 0 && s.missed == 0);
+	assert(s.repaint.count == 0 && s.latency.max_usec == 0);
+}
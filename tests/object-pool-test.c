@@ -0,0 +1,137 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/object-pool.h"
+
+struct test_object {
+	uint64_t a;
+	char name[13];
+	double d;
+};
+
+#define PER_SLAB 4
+
+TEST(pool_objects_are_zeroed_and_aligned)
+{
+	struct object_pool pool =
+		OBJECT_POOL_INITIALIZER("test", sizeof(struct test_object),
+					PER_SLAB);
+	struct test_object *obj;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		obj = object_pool_zalloc(&pool);
+		assert(obj);
+		assert(((uintptr_t) obj % sizeof(double)) == 0);
+		assert(obj->a == 0 && obj->d == 0.0 && obj->name[0] == 0);
+
+		obj->a = ~0ull;
+		memset(obj->name, 'x', sizeof obj->name);
+		object_pool_free(&pool, obj);
+	}
+
+	assert(pool.live == 0);
+	assert(pool.allocs == 2);
+	assert(pool.slab_allocs == 1);
+
+	object_pool_trim(&pool);
+	assert(pool.slabs == 0);
+}
+
+TEST(pool_grows_by_slab)
+{
+	struct object_pool pool =
+		OBJECT_POOL_INITIALIZER("test", sizeof(struct test_object),
+					PER_SLAB);
+	struct test_object *objs[3 * PER_SLAB];
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_LENGTH(objs); i++) {
+		objs[i] = object_pool_zalloc(&pool);
+		assert(objs[i]);
+		for (j = 0; j < i; j++)
+			assert(objs[i] != objs[j]);
+	}
+
+	assert(pool.live == ARRAY_LENGTH(objs));
+	assert(pool.peak == ARRAY_LENGTH(objs));
+	assert(pool.slabs == 3);
+
+	/* freeing a whole slab keeps it as the spare one */
+	for (i = 0; i < PER_SLAB; i++)
+		object_pool_free(&pool, objs[i]);
+	assert(pool.slabs == 3);
+	assert(pool.empty != NULL);
+
+	/* a second empty slab is released */
+	for (i = PER_SLAB; i < 2 * PER_SLAB; i++)
+		object_pool_free(&pool, objs[i]);
+	assert(pool.slabs == 2);
+
+	/* the spare slab is reused before allocating a new one */
+	for (i = 0; i < 2 * PER_SLAB; i++)
+		objs[i] = object_pool_zalloc(&pool);
+	assert(pool.slabs == 3);
+	assert(pool.slab_allocs == 4);
+	assert(pool.peak == ARRAY_LENGTH(objs));
+
+	for (i = 0; i < ARRAY_LENGTH(objs); i++)
+		object_pool_free(&pool, objs[i]);
+	assert(pool.live == 0);
+	assert(pool.slabs == 1);
+
+	object_pool_trim(&pool);
+	assert(pool.slabs == 0);
+}
+
+TEST(pool_reuses_freed_objects)
+{
+	struct object_pool pool =
+		OBJECT_POOL_INITIALIZER("test", sizeof(struct test_object),
+					PER_SLAB);
+	struct test_object *keep, *a, *b;
+
+	keep = object_pool_zalloc(&pool);
+	a = object_pool_zalloc(&pool);
+	object_pool_free(&pool, a);
+	b = object_pool_zalloc(&pool);
+	assert(a == b);
+
+	object_pool_free(&pool, b);
+	object_pool_free(&pool, keep);
+	object_pool_free(&pool, NULL);
+	assert(pool.live == 0);
+	assert(pool.slab_allocs == 1);
+
+	object_pool_trim(&pool);
+	assert(pool.slabs == 0);
+}
@@ -0,0 +1,200 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "src/plane-planner.h"
+
+/* A 1920x1080 output with a panel on top, a video window and a
+ * terminal next to it. The views are listed topmost first. */
+enum {
+	PANEL,
+	TERMINAL,
+	VIDEO,
+	BACKGROUND,
+};
+
+static void
+init_desktop(struct plane_planner_view *views)
+{
+	struct plane_planner_view desktop[] = {
+		[PANEL] = { { 0, 0, 1920, 32 }, PLANE_PLANNER_PRIMARY,
+			    1.0f, true },
+		[TERMINAL] = { { 1000, 100, 1800, 700 },
+			       PLANE_PLANNER_OVERLAY, 2.0f, true },
+		[VIDEO] = { { 100, 100, 900, 550 }, PLANE_PLANNER_OVERLAY,
+			    30.0f, true },
+		[BACKGROUND] = { { 0, 0, 1920, 1080 },
+				 PLANE_PLANNER_PRIMARY, 0.0f, true },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(desktop); i++)
+		views[i] = desktop[i];
+}
+
+TEST(plane_planner_promotes_frequently_updated_views)
+{
+	struct plane_planner_view views[4];
+
+	init_desktop(views);
+
+	/* The terminal updates too rarely to be worth an overlay */
+	assert(plane_planner_assign(views, 4, 3) == 1);
+	assert(views[VIDEO].on_overlay);
+	assert(!views[TERMINAL].on_overlay);
+	assert(!views[PANEL].on_overlay);
+	assert(!views[BACKGROUND].on_overlay);
+
+	/* Static views never are */
+	views[VIDEO].commit_rate = 0.0f;
+	assert(plane_planner_assign(views, 4, 3) == 0);
+	assert(!views[VIDEO].on_overlay);
+
+	/* Nor is anything without overlays */
+	init_desktop(views);
+	assert(plane_planner_assign(views, 4, 0) == 0);
+	assert(!views[VIDEO].on_overlay);
+}
+
+TEST(plane_planner_prefers_the_largest_cost)
+{
+	struct plane_planner_view views[4];
+
+	init_desktop(views);
+	views[TERMINAL].commit_rate = 30.0f;
+
+	/* The terminal is larger */
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[TERMINAL].on_overlay);
+	assert(!views[VIDEO].on_overlay);
+
+	/* Blending the video costs more */
+	views[VIDEO].opaque = false;
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[VIDEO].on_overlay);
+	assert(!views[TERMINAL].on_overlay);
+
+	/* Both fit with two overlays */
+	assert(plane_planner_assign(views, 4, 2) == 2);
+	assert(views[VIDEO].on_overlay);
+	assert(views[TERMINAL].on_overlay);
+}
+
+TEST(plane_planner_keeps_views_on_overlays)
+{
+	struct plane_planner_view views[4];
+
+	init_desktop(views);
+
+	/* Between the keep and promote rates, only a view already on an
+	 * overlay gets one */
+	views[VIDEO].commit_rate = 3.0f;
+	assert(plane_planner_assign(views, 4, 1) == 0);
+
+	views[VIDEO].was_on_overlay = true;
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[VIDEO].on_overlay);
+
+	views[VIDEO].commit_rate = 0.5f;
+	assert(plane_planner_assign(views, 4, 1) == 0);
+
+	/* A view on an overlay is not displaced by a slightly more
+	 * expensive one */
+	init_desktop(views);
+	views[TERMINAL].box = views[VIDEO].box;
+	views[TERMINAL].box.x1 += 1000;
+	views[TERMINAL].box.x2 += 1000;
+	views[TERMINAL].commit_rate = 40.0f;
+	views[VIDEO].was_on_overlay = true;
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[VIDEO].on_overlay);
+	assert(!views[TERMINAL].on_overlay);
+
+	/* but is by a much more expensive one */
+	views[TERMINAL].commit_rate = 60.0f;
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[TERMINAL].on_overlay);
+	assert(!views[VIDEO].on_overlay);
+}
+
+TEST(plane_planner_respects_stacking)
+{
+	struct plane_planner_view views[4];
+
+	/* A primary view covering the video keeps it composited */
+	init_desktop(views);
+	views[PANEL].box.y2 = 200;
+	assert(plane_planner_assign(views, 4, 3) == 0);
+	assert(!views[VIDEO].on_overlay);
+
+	/* A view on a plane above the overlays does not */
+	views[PANEL].kind = PLANE_PLANNER_ABOVE;
+	assert(plane_planner_assign(views, 4, 3) == 1);
+	assert(views[VIDEO].on_overlay);
+
+	/* An overlay candidate covering it goes along, if it fits */
+	init_desktop(views);
+	views[TERMINAL].box.x1 = 800;
+	assert(plane_planner_assign(views, 4, 2) == 2);
+	assert(views[VIDEO].on_overlay);
+	assert(views[TERMINAL].on_overlay);
+
+	assert(plane_planner_assign(views, 4, 1) == 0);
+	assert(!views[VIDEO].on_overlay);
+	assert(!views[TERMINAL].on_overlay);
+
+	/* Views below are never in the way */
+	init_desktop(views);
+	views[BACKGROUND].kind = PLANE_PLANNER_PRIMARY;
+	views[BACKGROUND].commit_rate = 60.0f;
+	assert(plane_planner_assign(views, 4, 1) == 1);
+	assert(views[VIDEO].on_overlay);
+}
+
+TEST(plane_planner_leaves_scanout_to_the_primary_plane)
+{
+	struct plane_planner_view views[4];
+
+	/* A fullscreen video that may be scanned out takes no overlay */
+	init_desktop(views);
+	views[BACKGROUND].kind = PLANE_PLANNER_SCANOUT;
+	views[BACKGROUND].commit_rate = 60.0f;
+	views[TERMINAL].commit_rate = 30.0f;
+	assert(plane_planner_assign(views, 4, 2) == 2);
+	assert(!views[BACKGROUND].on_overlay);
+	assert(views[TERMINAL].on_overlay);
+	assert(views[VIDEO].on_overlay);
+
+	/* and views below it stay composited */
+	init_desktop(views);
+	views[PANEL].kind = PLANE_PLANNER_SCANOUT;
+	views[PANEL].box = views[BACKGROUND].box;
+	assert(plane_planner_assign(views, 4, 3) == 0);
+	assert(!views[VIDEO].on_overlay);
+}
@@ -0,0 +1,202 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compares the region operations of the damage path, as done by
+ * view_accumulate_damage() and weston_output_repaint(), when using
+ * plain pixman and the fast-region.h helpers.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "src/fast-region.h"
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+struct scene {
+	const char *name;
+	pixman_box32_t damage;		/* surface-local */
+	int x, y;			/* view position */
+	pixman_box32_t bbox;		/* view bounding box */
+	pixman_box32_t opaque;		/* views stacked above */
+	pixman_box32_t output;
+};
+
+static const struct scene scenes[] = {
+	{
+		"damage in an unobscured window",
+		{ 10, 10, 300, 200 }, 100, 100,
+		{ 100, 100, 900, 700 }, { 0, 0, 0, 0 },
+		{ 0, 0, 1920, 1080 },
+	},
+	{
+		"damage partly under a panel",
+		{ 0, 0, 800, 100 }, 100, 0,
+		{ 100, 0, 900, 600 }, { 0, 0, 1920, 32 },
+		{ 0, 0, 1920, 1080 },
+	},
+	{
+		"full damage of a window under a fullscreen one",
+		{ 0, 0, 800, 600 }, 100, 100,
+		{ 100, 100, 900, 700 }, { 0, 0, 1920, 1080 },
+		{ 0, 0, 1920, 1080 },
+	},
+};
+
+static void
+init_box(pixman_region32_t *r, const pixman_box32_t *b)
+{
+	pixman_region32_init_rect(r, b->x1, b->y1,
+				  b->x2 - b->x1, b->y2 - b->y1);
+}
+
+static void __attribute__((noinline))
+accumulate_pixman(const struct scene *s, pixman_region32_t *surface_damage,
+		  pixman_region32_t *bbox, pixman_region32_t *opaque,
+		  pixman_region32_t *output)
+{
+	pixman_region32_t damage, plane_damage, output_damage;
+
+	pixman_region32_init(&plane_damage);
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, surface_damage);
+	pixman_region32_translate(&damage, s->x, s->y);
+	pixman_region32_intersect(&damage, &damage, bbox);
+	pixman_region32_subtract(&damage, &damage, opaque);
+	pixman_region32_union(&plane_damage, &plane_damage, &damage);
+	pixman_region32_fini(&damage);
+
+	pixman_region32_init(&output_damage);
+	pixman_region32_intersect(&output_damage, &plane_damage, output);
+	pixman_region32_subtract(&output_damage, &output_damage, opaque);
+	pixman_region32_fini(&output_damage);
+	pixman_region32_fini(&plane_damage);
+}
+
+static void __attribute__((noinline))
+accumulate_fast(const struct scene *s, pixman_region32_t *surface_damage,
+		pixman_region32_t *bbox, pixman_region32_t *opaque,
+		pixman_region32_t *output)
+{
+	pixman_region32_t damage, plane_damage, output_damage;
+
+	pixman_region32_init(&plane_damage);
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, surface_damage);
+	pixman_region32_translate(&damage, s->x, s->y);
+	fast_region_intersect(&damage, &damage, bbox);
+	fast_region_subtract(&damage, &damage, opaque);
+	fast_region_union(&plane_damage, &plane_damage, &damage);
+	pixman_region32_fini(&damage);
+
+	pixman_region32_init(&output_damage);
+	fast_region_intersect(&output_damage, &plane_damage, output);
+	fast_region_subtract(&output_damage, &output_damage, opaque);
+	pixman_region32_fini(&output_damage);
+	pixman_region32_fini(&plane_damage);
+}
+
+static void
+run_scene(const struct scene *s, int fast)
+{
+	pixman_region32_t surface_damage, bbox, opaque, output;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on %s, %s...\n", s->name,
+	       fast ? "fast-region" : "pixman");
+
+	init_box(&surface_damage, &s->damage);
+	init_box(&bbox, &s->bbox);
+	init_box(&opaque, &s->opaque);
+	init_box(&output, &s->output);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		if (fast)
+			accumulate_fast(s, &surface_damage, &bbox,
+					&opaque, &output);
+		else
+			accumulate_pixman(s, &surface_damage, &bbox,
+					  &opaque, &output);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+
+	pixman_region32_fini(&surface_damage);
+	pixman_region32_fini(&bbox);
+	pixman_region32_fini(&opaque);
+	pixman_region32_fini(&output);
+}
+
+int main(void)
+{
+	struct sigaction ding;
+	unsigned int i;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	for (i = 0; i < sizeof scenes / sizeof scenes[0]; i++) {
+		run_scene(&scenes[i], 0);
+		run_scene(&scenes[i], 1);
+	}
+
+	return 0;
+}
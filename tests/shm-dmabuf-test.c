@@ -0,0 +1,161 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "weston-test-runner.h"
+
+#include "src/shm-dmabuf.h"
+
+#define SKIP 77
+
+struct pool {
+	int fd;
+	size_t size;
+	char *data;
+};
+
+static void
+pool_create(struct pool *pool, int pages)
+{
+	pool->size = pages * sysconf(_SC_PAGESIZE);
+	pool->fd = memfd_create("shm-dmabuf-test",
+				MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	assert(pool->fd >= 0);
+	assert(ftruncate(pool->fd, pool->size) == 0);
+	assert(fcntl(pool->fd, F_ADD_SEALS, F_SEAL_SHRINK) == 0);
+
+	pool->data = mmap(NULL, pool->size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, pool->fd, 0);
+	assert(pool->data != MAP_FAILED);
+}
+
+static void
+pool_destroy(struct pool *pool)
+{
+	munmap(pool->data, pool->size);
+	close(pool->fd);
+}
+
+TEST(find_mapping_of_shared_file)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct shm_mapping mapping;
+	struct pool pool;
+	struct stat st;
+	char *p;
+
+	pool_create(&pool, 4);
+	assert(fstat(pool.fd, &st) == 0);
+
+	p = pool.data + 2 * page_size + 16;
+	assert(shm_dmabuf_find_mapping(p, 64, &mapping) == 0);
+	assert(mapping.start == (uintptr_t) pool.data);
+	assert(mapping.end == (uintptr_t) pool.data + pool.size);
+	assert(mapping.offset == 0);
+	assert(mapping.dev == st.st_dev);
+	assert(mapping.inode == st.st_ino);
+
+	/* ranges running past the mapping are refused */
+	assert(shm_dmabuf_find_mapping(p, pool.size, &mapping) == -1);
+
+	pool_destroy(&pool);
+}
+
+TEST(find_mapping_of_private_memory_fails)
+{
+	struct shm_mapping mapping;
+	char *p;
+
+	p = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(p != MAP_FAILED);
+	assert(shm_dmabuf_find_mapping(p, 16, &mapping) == -1);
+	munmap(p, 4096);
+
+	p = malloc(16);
+	assert(shm_dmabuf_find_mapping(p, 16, &mapping) == -1);
+	free(p);
+}
+
+TEST(check_range_of_pool)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct pool pool;
+	char *p;
+
+	pool_create(&pool, 4);
+
+	p = pool.data + page_size + 16;
+	assert(shm_dmabuf_check_range(p, 2 * page_size) == 0);
+	assert(shm_dmabuf_check_range(p, pool.size) == -1);
+
+	pool_destroy(&pool);
+}
+
+TEST(dmabuf_shares_pool_memory)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct shm_mapping mapping;
+	struct pool pool;
+	int udmabuf_fd, fd;
+	char *p;
+
+	udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (udmabuf_fd < 0)
+		exit(SKIP);
+
+	pool_create(&pool, 4);
+	assert(shm_dmabuf_find_mapping(pool.data, pool.size, &mapping) == 0);
+
+	fd = shm_dmabuf_create(udmabuf_fd, &mapping,
+			       pool.data + page_size, 2 * page_size - 100);
+	if (fd < 0 && (errno == EACCES || errno == EPERM))
+		exit(SKIP);
+	assert(fd >= 0);
+
+	p = mmap(NULL, 2 * page_size, PROT_READ, MAP_SHARED, fd, 0);
+	assert(p != MAP_FAILED);
+	memset(pool.data + page_size, 0x5a, 2 * page_size);
+	assert(p[0] == 0x5a && p[2 * page_size - 1] == 0x5a);
+	munmap(p, 2 * page_size);
+	close(fd);
+
+	/* buffers not starting on a page cannot be wrapped */
+	fd = shm_dmabuf_create(udmabuf_fd, &mapping,
+			       pool.data + 16, page_size);
+	assert(fd == -1 && errno == EINVAL);
+
+	pool_destroy(&pool);
+	close(udmabuf_fd);
+}
@@ -0,0 +1,162 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures the vertex clipping of gl-renderer's calculate_edges(), for
+ * untransformed views (clip_simple) and rotated ones
+ * (clip_transformed), with the plain C and the SIMD kernels.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "src/vertex-clipping.h"
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+#define NPOLYGONS 1024
+
+/* Rectangles rotated by various angles, straddling the clip
+ * rectangle (0, 0)-(256, 256) as damage rectangles typically do. */
+static void
+make_polygons(struct polygon8 *polygons, float angle_step)
+{
+	float cx, cy, a, s, c;
+	const float ux[4] = { -100, 100, 100, -100 };
+	const float uy[4] = { -60, -60, 60, 60 };
+	int i, j;
+
+	srand(0);
+	for (i = 0; i < NPOLYGONS; i++) {
+		cx = rand() % 512 - 128;
+		cy = rand() % 512 - 128;
+		a = i * angle_step;
+		s = sinf(a);
+		c = cosf(a);
+
+		memset(&polygons[i], 0, sizeof polygons[i]);
+		polygons[i].n = 4;
+		for (j = 0; j < 4; j++) {
+			polygons[i].x[j] = cx + ux[j] * c - uy[j] * s;
+			polygons[i].y[j] = cy + ux[j] * s + uy[j] * c;
+		}
+	}
+}
+
+static void
+run(const struct polygon8 *polygons, int transformed,
+    enum vertex_clip_impl impl)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon;
+	float ex[8], ey[8];
+	unsigned long count = 0, vertices = 0;
+	double t;
+	int i;
+
+	if (vertex_clip_set_impl(impl) < 0) {
+		printf("\nSIMD kernels not available, skipping.\n");
+		return;
+	}
+
+	printf("\nRunning 3 s test on %s polygons, %s...\n",
+	       transformed ? "rotated" : "axis-aligned",
+	       vertex_clip_impl_name());
+
+	ctx.clip.x1 = 0;
+	ctx.clip.y1 = 0;
+	ctx.clip.x2 = 256;
+	ctx.clip.y2 = 256;
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		for (i = 0; i < NPOLYGONS; i++) {
+			polygon = polygons[i];
+			if (transformed)
+				vertices += clip_transformed(&ctx, &polygon,
+							     ex, ey);
+			else
+				vertices += clip_simple(&ctx, &polygon,
+							ex, ey);
+		}
+		count += NPOLYGONS;
+	}
+	t = read_timer();
+
+	printf("%lu polygons in %f seconds, %.0f polygons/s, "
+	       "%.2f vertices/polygon.\n",
+	       count, t, count / t, (double) vertices / count);
+}
+
+int main(void)
+{
+	static struct polygon8 aligned[NPOLYGONS], rotated[NPOLYGONS];
+	struct sigaction ding;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	make_polygons(aligned, 0.0f);
+	make_polygons(rotated, 0.1f);
+
+	run(aligned, 0, VERTEX_CLIP_IMPL_C);
+	run(aligned, 0, VERTEX_CLIP_IMPL_SIMD);
+	run(rotated, 1, VERTEX_CLIP_IMPL_C);
+	run(rotated, 1, VERTEX_CLIP_IMPL_SIMD);
+
+	return 0;
+}
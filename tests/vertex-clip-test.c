@@ -26,6 +26,8 @@
 #include "config.h"
 
 #include <assert.h>
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "weston-test-runner.h"
@@ -221,3 +223,66 @@ TEST(float_difference_same)
 	assert(float_difference(1.0f, 1.0f) == 0.0f);
 }
 
+/* A rectangle rotated and scaled around a random point, like
+ * calculate_edges() in gl-renderer produces for a transformed view. */
+static void
+random_quad(struct polygon8 *p)
+{
+	float cx = rand() % 200 - 50, cy = rand() % 200 - 50;
+	float w = rand() % 100 + 1, h = rand() % 100 + 1;
+	float a = (rand() % 3600) * M_PI / 1800.0;
+	float s = sinf(a), c = cosf(a);
+	const float ux[4] = { -w, w, w, -w };
+	const float uy[4] = { -h, -h, h, h };
+	int i;
+
+	memset(p, 0, sizeof *p);
+	p->n = 4;
+	for (i = 0; i < 4; i++) {
+		p->x[i] = cx + ux[i] * c - uy[i] * s;
+		p->y[i] = cy + ux[i] * s + uy[i] * c;
+	}
+}
+
+static int
+clip_with(enum vertex_clip_impl impl, int transformed,
+	  const struct polygon8 *src, float *ex, float *ey)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon;
+
+	assert(vertex_clip_set_impl(impl) == 0);
+	deep_copy_polygon8(src, &polygon);
+	populate_clip_context(&ctx);
+
+	if (transformed)
+		return clip_transformed(&ctx, &polygon, ex, ey);
+	else
+		return clip_simple(&ctx, &polygon, ex, ey);
+}
+
+TEST(clip_simd_matches_c)
+{
+	struct polygon8 src;
+	float cx[8], cy[8], sx[8], sy[8];
+	int i, t, n;
+
+	if (vertex_clip_set_impl(VERTEX_CLIP_IMPL_SIMD) < 0)
+		return;
+
+	srand(0);
+
+	for (i = 0; i < 100000; i++) {
+		random_quad(&src);
+
+		for (t = 0; t < 2; t++) {
+			n = clip_with(VERTEX_CLIP_IMPL_C, t, &src, cx, cy);
+			assert(clip_with(VERTEX_CLIP_IMPL_SIMD, t, &src,
+					 sx, sy) == n);
+			assert(memcmp(cx, sx, n * sizeof cx[0]) == 0);
+			assert(memcmp(cy, sy, n * sizeof cy[0]) == 0);
+		}
+	}
+
+	vertex_clip_set_impl(VERTEX_CLIP_IMPL_AUTO);
+}
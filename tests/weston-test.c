@@ -293,7 +293,12 @@ struct test_screenshot {
 
 struct test_screenshot_frame_listener {
 	struct wl_listener listener;
+	struct wl_listener buffer_destroy_listener;
 	struct weston_buffer *buffer;
+	pixman_format_code_t format;
+	int32_t height;
+	int do_yflip;
+	uint8_t *pixels;
 	weston_test_screenshot_done_func_t done;
 	void *data;
 };
@@ -363,35 +368,23 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-test_screenshot_frame_notify(struct wl_listener *listener, void *data)
+test_screenshot_read_done(void *data, int status)
 {
-	struct test_screenshot_frame_listener *l =
-		container_of(listener,
-			     struct test_screenshot_frame_listener, listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
+	struct test_screenshot_frame_listener *l = data;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
-
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+	uint8_t *pixels = l->pixels, *d, *s;
 
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
-		free(l);
-		return;
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_TEST_SCREENSHOT_BAD_BUFFER);
+		goto out;
 	}
 
-	// FIXME: Needs to handle output transformations
+	wl_list_remove(&l->buffer_destroy_listener.link);
 
-	compositor->renderer->read_pixels(output,
-					  compositor->read_format,
-					  pixels,
-					  0, 0,
-					  output->current_mode->width,
-					  output->current_mode->height);
+	if (status < 0) {
+		l->done(l->data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
+		goto out;
+	}
 
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
@@ -403,20 +396,20 @@ test_screenshot_frame_notify(struct wl_listener *listener, void *data)
 	/* XXX: It would be nice if we used Pixman to do all this rather
 	 *  than our own implementation
 	 */
-	switch (compositor->read_format) {
+	switch (l->format) {
 	case PIXMAN_a8r8g8b8:
 	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
+		if (l->do_yflip)
+			copy_bgra_yflip(d, s, l->height, stride);
 		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
+			copy_bgra(d, pixels, l->height, stride);
 		break;
 	case PIXMAN_x8b8g8r8:
 	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
+		if (l->do_yflip)
+			copy_rgba_yflip(d, s, l->height, stride);
 		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+			copy_rgba(d, pixels, l->height, stride);
 		break;
 	default:
 		break;
@@ -425,10 +418,72 @@ test_screenshot_frame_notify(struct wl_listener *listener, void *data)
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
 
 	l->done(l->data, WESTON_TEST_SCREENSHOT_SUCCESS);
+
+out:
 	free(pixels);
 	free(l);
 }
 
+static void
+test_screenshot_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct test_screenshot_frame_listener *l =
+		container_of(listener, struct test_screenshot_frame_listener,
+			     buffer_destroy_listener);
+
+	wl_list_remove(&listener->link);
+	l->buffer = NULL;
+}
+
+static void
+test_screenshot_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct test_screenshot_frame_listener *l =
+		container_of(listener,
+			     struct test_screenshot_frame_listener, listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	int32_t stride;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+
+	if (l->buffer == NULL) {
+		l->done(l->data, WESTON_TEST_SCREENSHOT_BAD_BUFFER);
+		free(l);
+		return;
+	}
+
+	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	l->pixels = malloc(stride * l->buffer->height);
+
+	if (l->pixels == NULL) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
+		free(l);
+		return;
+	}
+
+	l->format = compositor->read_format;
+	l->height = output->current_mode->height;
+	l->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	// FIXME: Needs to handle output transformations
+
+	if (weston_output_read_pixels_async(output,
+					    compositor->read_format,
+					    l->pixels, 0, 0,
+					    output->current_mode->width,
+					    output->current_mode->height,
+					    test_screenshot_read_done, l) < 0) {
+		wl_list_remove(&l->buffer_destroy_listener.link);
+		l->done(l->data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
+		free(l->pixels);
+		free(l);
+	}
+}
+
 static bool
 weston_test_screenshot_shoot(struct weston_output *output,
 			     struct weston_buffer *buffer,
@@ -455,7 +510,7 @@ weston_test_screenshot_shoot(struct weston_output *output,
 	}
 
 	/* allocate the frame listener */
-	l = malloc(sizeof *l);
+	l = zalloc(sizeof *l);
 	if (l == NULL) {
 		done(data, WESTON_TEST_SCREENSHOT_NO_MEMORY);
 		return false;
@@ -467,6 +522,8 @@ weston_test_screenshot_shoot(struct weston_output *output,
 	l->data = data;
 	l->listener.notify = test_screenshot_frame_notify;
 	wl_signal_add(&output->frame_signal, &l->listener);
+	l->buffer_destroy_listener.notify = test_screenshot_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &l->buffer_destroy_listener);
 
 	/* Fire off a repaint */
 	output->disable_planes++;
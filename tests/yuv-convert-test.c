@@ -0,0 +1,172 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "src/yuv-convert.h"
+
+#define MAX_WIDTH 41
+#define HEIGHT 4
+
+struct frame {
+	uint8_t y[HEIGHT][MAX_WIDTH];
+	uint8_t u[HEIGHT / 2][MAX_WIDTH];
+	uint8_t v[HEIGHT / 2][MAX_WIDTH];
+	uint8_t uv[HEIGHT / 2][MAX_WIDTH + 1];	/* interleaved copy */
+};
+
+static void
+random_frame(struct frame *f)
+{
+	int i, j;
+
+	for (j = 0; j < HEIGHT; j++)
+		for (i = 0; i < MAX_WIDTH; i++)
+			f->y[j][i] = rand();
+
+	for (j = 0; j < HEIGHT / 2; j++) {
+		for (i = 0; i < (MAX_WIDTH + 1) / 2; i++) {
+			f->u[j][i] = rand();
+			f->v[j][i] = rand();
+			f->uv[j][2 * i] = f->u[j][i];
+			f->uv[j][2 * i + 1] = f->v[j][i];
+		}
+	}
+}
+
+static void
+convert(const struct frame *f, int width, int interleaved, uint32_t *dst)
+{
+	struct yuv420_image src;
+
+	src.width = width;
+	src.height = HEIGHT;
+	src.y = &f->y[0][0];
+	src.y_stride = MAX_WIDTH;
+	if (interleaved) {
+		src.u = &f->uv[0][0];
+		src.v = &f->uv[0][1];
+		src.uv_stride = MAX_WIDTH + 1;
+		src.uv_step = 2;
+	} else {
+		src.u = &f->u[0][0];
+		src.v = &f->v[0][0];
+		src.uv_stride = MAX_WIDTH;
+		src.uv_step = 1;
+	}
+
+	yuv420_to_xrgb8888(dst, MAX_WIDTH * sizeof *dst, &src, 0, HEIGHT);
+}
+
+static uint32_t
+convert_pixel(uint8_t y, uint8_t u, uint8_t v)
+{
+	struct yuv420_image src = { 1, 1, &y, 1, &u, &v, 1, 1 };
+	uint32_t pixel;
+
+	yuv420_to_xrgb8888(&pixel, sizeof pixel, &src, 0, 1);
+
+	return pixel;
+}
+
+/* The BT.601 primaries are only exact to within a step. */
+static int
+color_near(uint32_t a, uint32_t b)
+{
+	int shift, d;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		d = (int) ((a >> shift) & 0xff) - (int) ((b >> shift) & 0xff);
+		if (d < -1 || d > 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+TEST(yuv_known_colors)
+{
+	assert(yuv_convert_set_impl(YUV_CONVERT_IMPL_C) == 0);
+
+	assert(convert_pixel(16, 128, 128) == 0xff000000);
+	assert(convert_pixel(235, 128, 128) == 0xffffffff);
+	assert(color_near(convert_pixel(81, 90, 240), 0xffff0000));
+	assert(color_near(convert_pixel(145, 54, 34), 0xff00ff00));
+	assert(color_near(convert_pixel(41, 240, 110), 0xff0000ff));
+
+	/* out of range values are clamped */
+	assert(convert_pixel(0, 128, 128) == 0xff000000);
+	assert(convert_pixel(255, 128, 128) == 0xffffffff);
+}
+
+TEST(yuv_interleaved_matches_planar)
+{
+	uint32_t planar[HEIGHT * MAX_WIDTH], interleaved[HEIGHT * MAX_WIDTH];
+	struct frame f;
+
+	srand(1);
+	random_frame(&f);
+
+	assert(yuv_convert_set_impl(YUV_CONVERT_IMPL_C) == 0);
+	convert(&f, MAX_WIDTH, 0, planar);
+	convert(&f, MAX_WIDTH, 1, interleaved);
+	assert(memcmp(planar, interleaved, sizeof planar) == 0);
+}
+
+TEST(yuv_simd_matches_c)
+{
+	uint32_t expected[HEIGHT * MAX_WIDTH], result[HEIGHT * MAX_WIDTH];
+	struct frame f;
+	int width, interleaved, i;
+
+	if (yuv_convert_set_impl(YUV_CONVERT_IMPL_SIMD) < 0)
+		return;
+
+	srand(2);
+
+	for (i = 0; i < 200; i++) {
+		random_frame(&f);
+
+		for (width = 1; width <= MAX_WIDTH; width++) {
+			for (interleaved = 0; interleaved < 2; interleaved++) {
+				memset(expected, 0, sizeof expected);
+				memset(result, 0, sizeof result);
+
+				yuv_convert_set_impl(YUV_CONVERT_IMPL_C);
+				convert(&f, width, interleaved, expected);
+				yuv_convert_set_impl(YUV_CONVERT_IMPL_SIMD);
+				convert(&f, width, interleaved, result);
+
+				assert(memcmp(expected, result,
+					      sizeof expected) == 0);
+			}
+		}
+	}
+}